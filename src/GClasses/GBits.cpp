@@ -18,6 +18,11 @@
 
 #include "GBits.h"
 #include "GRand.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <string>
 
 using namespace GClasses;
 
@@ -74,6 +79,88 @@ bool GBits::isValidFloat(const char* pString, size_t len)
 	return true;
 }
 
+bool GBits::parseFloat(const char* pString, size_t len, double* pOutValue)
+{
+	// Every power of ten up to 1e22 is exactly representable as a double, and so is any
+	// integer below 2^53. When both the mantissa and the power are exact, one multiply or
+	// divide rounds correctly, so this gives the same result as atof.
+	static const double powersOfTen[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	const char* p = pString;
+	const char* pEnd = pString + len;
+	bool neg = false;
+	if(p < pEnd && (*p == '-' || *p == '+'))
+	{
+		neg = (*p == '-');
+		p++;
+	}
+	uint64_t mantissa = 0;
+	int significant = 0;
+	int digits = 0;
+	int exp10 = 0;
+	bool decimal = false;
+	for( ; p < pEnd; p++)
+	{
+		if(*p >= '0' && *p <= '9')
+		{
+			digits++;
+			if(significant > 0 || *p != '0')
+			{
+				if(++significant > 15)
+					break;
+				mantissa = mantissa * 10 + (*p - '0');
+			}
+			if(decimal)
+				exp10--;
+		}
+		else if(*p == '.' && !decimal)
+			decimal = true;
+		else
+			break;
+	}
+	if(digits > 0 && significant <= 15)
+	{
+		if(p < pEnd && (*p == 'e' || *p == 'E') && p + 1 < pEnd)
+		{
+			const char* q = p + 1;
+			bool negExp = false;
+			if(*q == '-' || *q == '+')
+			{
+				negExp = (*q == '-');
+				q++;
+			}
+			int e = 0;
+			const char* pDigits = q;
+			while(q < pEnd && *q >= '0' && *q <= '9' && e < 10000)
+				e = e * 10 + (*q++ - '0');
+			if(q > pDigits)
+			{
+				exp10 += (negExp ? -e : e);
+				p = q;
+			}
+		}
+		if(p == pEnd && exp10 >= -22 && exp10 <= 22)
+		{
+			double d = (double)mantissa;
+			if(exp10 < 0)
+				d /= powersOfTen[-exp10];
+			else
+				d *= powersOfTen[exp10];
+			*pOutValue = (neg ? -d : d);
+			return true;
+		}
+	}
+
+	// Fall back to the general case
+	if(!isValidFloat(pString, len))
+		return false;
+	std::string s(pString, len);
+	*pOutValue = atof(s.c_str());
+	return true;
+}
+
 unsigned char GBits::reverse_bits(unsigned char n)
 {
 	static const unsigned char bit_reverse_table[256] =
@@ -183,8 +270,45 @@ void test_countTrailingZeros()
 	}
 }
 
+void test_parseFloat()
+{
+	GRand rand(0);
+	char buf[64];
+	const char* formats[] = { "%.0f", "%.3f", "%.8f", "%.15g", "%.17g", "%.6e", "%.16e" };
+	for(size_t i = 0; i < 10000; i++)
+	{
+		double d = rand.normal() * pow(10.0, (double)rand.next(40) - 20.0);
+		snprintf(buf, 64, formats[i % 7], d);
+		double val;
+		if(!GBits::parseFloat(buf, strlen(buf), &val))
+			throw Ex("failed to parse ", buf);
+		if(val != atof(buf))
+			throw Ex("different from atof for ", buf);
+	}
+	const char* valid[] = { "0", "-0", "+7", ".5", "5.", "-.25e+2", "0001.1000", "1E-5", "123456789012345678901234", "4e300" };
+	for(size_t i = 0; i < sizeof(valid) / sizeof(const char*); i++)
+	{
+		double val;
+		if(!GBits::parseFloat(valid[i], strlen(valid[i]), &val))
+			throw Ex("failed to parse ", valid[i]);
+		if(val != atof(valid[i]) || std::signbit(val) != std::signbit(atof(valid[i])))
+			throw Ex("different from atof for ", valid[i]);
+	}
+	const char* invalid[] = { "", "-", ".", "e5", "2e", "2e+", "1.2.3", "3-2", "2e3.5", "--1", "1x", "nan" };
+	for(size_t i = 0; i < sizeof(invalid) / sizeof(const char*); i++)
+	{
+		double val;
+		if(GBits::parseFloat(invalid[i], strlen(invalid[i]), &val))
+			throw Ex("should not have parsed ", invalid[i]);
+	}
+	double val;
+	if(!GBits::parseFloat("12,34", 2, &val) || val != 12.0)
+		throw Ex("failed to respect the length");
+}
+
 void GBits::test()
 {
 	test_boundingShift();
 	test_countTrailingZeros();
+	test_parseFloat();
 }
@@ -36,6 +36,14 @@ public:
 	/// return false for these: "e2", "2e", "-.", "2..3", "3-2", "2e3.5", "--1", etc.
 	static bool isValidFloat(const char* pString, size_t len);
 
+	/// If the first len characters of pString are a valid floating point number (as
+	/// determined by isValidFloat), sets *pOutValue to its value and returns true.
+	/// Otherwise, returns false. Numbers with at most 15 significant digits and
+	/// small exponents (which covers most numbers in data files) are converted
+	/// directly, and with exactly the same result that atof would give. Others
+	/// are passed on to atof.
+	static bool parseFloat(const char* pString, size_t len, double* pOutValue);
+
 	/// Returns -1 if a < b, 0 if a = b, and 1 if a > b.
 	static inline int compareInts(int a, int b)
 	{
@@ -31,12 +31,15 @@
 #include "GSparseMatrix.h"
 #include "GKNN.h"
 #include "GHolders.h"
+#include "GThread.h"
 #include "GTime.h"
 #include "GGraph.h"
 #include "GDom.h"
 #include <iostream>
 #include <map>
 #include <memory>
+#include <vector>
+#include <algorithm>
 
 using namespace GClasses;
 using std::cout;
@@ -453,7 +456,7 @@ std::unique_ptr<GMatrix> GAgglomerativeTransducer::transduceInner(const GMatrix&
 // -----------------------------------------------------------------------------------------
 
 GKMeans::GKMeans(size_t clusters, GRand* pRand)
-: GClusterer(clusters), m_pCentroids(NULL), m_pClusters(NULL), m_reps(1), m_pRand(pRand)
+: GClusterer(clusters), m_pCentroids(NULL), m_pClusters(NULL), m_reps(1), m_pRand(pRand), m_usePruning(true), m_batchSize(0), m_batchIters(0), m_maxIters(300), m_pPool(NULL)
 {
 }
 
@@ -463,88 +466,237 @@ GKMeans::~GKMeans()
 	delete[] m_pClusters;
 }
 
+// Returns the number of chunks to split n rows into for parallel passes. This does not depend on
+// the number of threads, so the floating-point sums come out the same with any thread pool.
+size_t GKMeans_chunkCount(size_t n)
+{
+	return std::max((size_t)1, std::min((size_t)16, n / 2048));
+}
+
 void GKMeans::init(const GMatrix* pData)
 {
 	if(!m_pMetric)
 		setMetric(new GRowDistance(), true);
 	m_pMetric->init(&pData->relation(), false);
-	if(pData->rows() < (size_t)m_clusterCount)
+	size_t n = pData->rows();
+	if(n < (size_t)m_clusterCount)
 		throw Ex("Fewer data point than clusters");
 
-	// Initialize the centroids with random rows. (Note that it is okay if two centroids happen to be initialized with the same row here, because the assignClusters method randomly picks among the best centroids in the event of a tie.)
+	// Seed from all of the rows, or from a random sample of them in mini-batch mode
+	std::vector<size_t> candidates;
+	size_t sampleSize = n;
+	if(m_batchSize > 0)
+		sampleSize = std::min(n, std::max(m_batchSize, 16 * m_clusterCount));
+	candidates.reserve(sampleSize);
+	if(sampleSize < n)
+	{
+		for(size_t i = 0; i < sampleSize; i++)
+			candidates.push_back((size_t)m_pRand->next(n));
+	}
+	else
+	{
+		for(size_t i = 0; i < n; i++)
+			candidates.push_back(i);
+	}
+
+	// Pick the centroids with k-means++. Each centroid after the first is drawn with probability
+	// proportional to the squared distance from the nearest centroid that was already chosen.
 	delete(m_pCentroids);
 	m_pCentroids = new GMatrix(pData->relation().clone());
 	m_pCentroids->newRows(m_clusterCount);
-	for(size_t i = 0; i < m_clusterCount; i++)
+	size_t m = candidates.size();
+	size_t chunks = GKMeans_chunkCount(m);
+	GVec dist(m);
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	m_pCentroids->row(0).copy(pData->row(candidates[(size_t)m_pRand->next(m)]));
+	for(size_t c = 0; true; )
 	{
-		size_t index = (size_t)m_pRand->next(m_clusterCount);
-		m_pCentroids->row(i).copy(pData->row(index));
+		const GVec& centroid = m_pCentroids->row(c);
+		pool.parallelFor(0, chunks, [&](size_t ch)
+		{
+			size_t start = m * ch / chunks;
+			size_t count = m * (ch + 1) / chunks - start;
+			GVec d(count);
+			m_pMetric->squaredDistances(centroid, *pData, candidates.data() + start, count, d.data());
+			for(size_t i = 0; i < count; i++)
+			{
+				if(c == 0 || d[i] < dist[start + i])
+					dist[start + i] = d[i];
+			}
+		});
+		if(++c >= m_clusterCount)
+			break;
+		double total = dist.sum();
+		size_t pick = INVALID_INDEX;
+		if(total > 0.0)
+		{
+			double r = m_pRand->uniform() * total;
+			for(size_t i = 0; i < m; i++)
+			{
+				if(dist[i] <= 0.0)
+					continue;
+				pick = i;
+				r -= dist[i];
+				if(r < 0.0)
+					break;
+			}
+		}
+		else
+			pick = (size_t)m_pRand->next(m); // Every candidate is already a centroid
+		m_pCentroids->row(c).copy(pData->row(candidates[pick]));
 	}
 
 	// Initialize the clusters
 	delete[] m_pClusters;
-	m_pClusters = new size_t[pData->rows()];
+	m_pClusters = new size_t[n];
+	for(size_t i = 0; i < n; i++)
+		m_pClusters[i] = INVALID_INDEX;
 }
 
-double GKMeans::assignClusters(const GMatrix* pData)
+size_t GKMeans::nearestCentroid(const GVec& row, size_t current, double* pSquaredDist, double* pSecond)
 {
-	// Assign each row to a cluster
-	double sse = 0.0;
-	for(size_t i = 0; i < pData->rows(); i++)
+	// Measure the distances to blocks of centroids with one batch call per block
+	const size_t blockSize = 64;
+	double dists[blockSize];
+	size_t indexes[blockSize];
+	double best = 1e308;
+	double second = 1e308;
+	size_t clust = 0;
+	for(size_t start = 0; start < m_clusterCount; start += blockSize)
 	{
-		double best = 1e308;
-		size_t clust = 0;
-		size_t ties = 1;
-		for(size_t j = 0; j < m_clusterCount; j++)
+		size_t count = std::min(blockSize, m_clusterCount - start);
+		for(size_t j = 0; j < count; j++)
+			indexes[j] = start + j;
+		m_pMetric->squaredDistances(row, *m_pCentroids, indexes, count, dists);
+		for(size_t j = 0; j < count; j++)
 		{
-			double d = m_pMetric->squaredDistance(pData->row(i), m_pCentroids->row(j));
-			if(d < best)
+			double d = dists[j];
+			if(d < best || (d == best && start + j == current))
 			{
-				clust = j;
+				second = best;
 				best = d;
-				ties = 1;
+				clust = start + j;
 			}
-			else if(d == best)
+			else if(d < second)
+				second = d;
+		}
+	}
+	*pSquaredDist = best;
+	if(pSecond)
+		*pSecond = second;
+	return clust;
+}
+
+double GKMeans::assignClusters(const GMatrix* pData)
+{
+	return assignClusters(pData, NULL);
+}
+
+double GKMeans::assignClusters(const GMatrix* pData, size_t* pChanges)
+{
+	size_t n = pData->rows();
+	size_t chunks = GKMeans_chunkCount(n);
+	GVec sse(chunks);
+	std::vector<size_t> changes(chunks);
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	pool.parallelFor(0, chunks, [&](size_t c)
+	{
+		double sum = 0.0;
+		size_t changed = 0;
+		for(size_t i = n * c / chunks; i < n * (c + 1) / chunks; i++)
+		{
+			double d;
+			size_t clust = nearestCentroid(pData->row(i), m_pClusters[i], &d, NULL);
+			if(clust != m_pClusters[i])
 			{
-				// Pick randomly among the centroids that tie for the closest
-				ties++;
-				if(m_pRand->next(ties) == 0)
-					clust = j;
+				m_pClusters[i] = clust;
+				changed++;
 			}
+			sum += d;
 		}
-		sse += best;
-		m_pClusters[i] = clust;
+		sse[c] = sum;
+		changes[c] = changed;
+	});
+	if(pChanges)
+	{
+		*pChanges = 0;
+		for(size_t c = 0; c < chunks; c++)
+			*pChanges += changes[c];
 	}
-	return sse;
+	return sse.sum();
 }
 
 void GKMeans::recomputeCentroids(const GMatrix* pData)
 {
-	for(size_t i = 0; i < m_clusterCount; i++)
+	// Lay out one slot per continuous attribute and one slot per value of each nominal attribute
+	const GRelation& rel = pData->relation();
+	size_t dims = pData->cols();
+	std::vector<size_t> offsets(dims);
+	size_t width = 0;
+	for(size_t j = 0; j < dims; j++)
 	{
-		GVec& centroid = m_pCentroids->row(i);
-		size_t unknownCount = 0;
-		for(size_t j = 0; j < pData->cols(); j++)
+		offsets[j] = width;
+		size_t vals = rel.valueCount(j);
+		width += (vals == 0 ? 1 : vals);
+	}
+
+	// Accumulate the sums and counts for every cluster in a single pass, a chunk of rows at a time
+	size_t n = pData->rows();
+	size_t chunks = GKMeans_chunkCount(n);
+	std::vector<GVec> sums(chunks);
+	std::vector< std::vector<size_t> > counts(chunks);
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	pool.parallelFor(0, chunks, [&](size_t c)
+	{
+		GVec& sum = sums[c];
+		sum.resize(m_clusterCount * width);
+		sum.fill(0.0);
+		std::vector<size_t>& count = counts[c];
+		count.assign(m_clusterCount * width, 0);
+		for(size_t i = n * c / chunks; i < n * (c + 1) / chunks; i++)
 		{
-			size_t vals = pData->relation().valueCount(j);
-			if(vals == 0)
+			const GVec& row = pData->row(i);
+			size_t base = m_pClusters[i] * width;
+			for(size_t j = 0; j < dims; j++)
 			{
-				double sum = 0.0;
-				size_t count = 0;
-				for(size_t k = 0; k < pData->rows(); k++)
+				size_t vals = rel.valueCount(j);
+				if(vals == 0)
 				{
-					if(m_pClusters[k] == i)
+					if(row[j] != UNKNOWN_REAL_VALUE)
 					{
-						double d = pData->row(k)[j];
-						if(d != UNKNOWN_REAL_VALUE)
-						{
-							sum += d;
-							count++;
-						}
+						sum[base + offsets[j]] += row[j];
+						count[base + offsets[j]]++;
 					}
 				}
-				if(count > 0)
-					centroid[j] = sum / count;
+				else
+				{
+					int v = (int)row[j];
+					if(v != UNKNOWN_DISCRETE_VALUE && (size_t)v < vals)
+						count[base + offsets[j] + v]++;
+				}
+			}
+		}
+	});
+	for(size_t c = 1; c < chunks; c++)
+	{
+		sums[0] += sums[c];
+		for(size_t i = 0; i < counts[0].size(); i++)
+			counts[0][i] += counts[c][i];
+	}
+
+	// Compute the centroids
+	for(size_t i = 0; i < m_clusterCount; i++)
+	{
+		GVec& centroid = m_pCentroids->row(i);
+		size_t unknownCount = 0;
+		for(size_t j = 0; j < dims; j++)
+		{
+			size_t vals = rel.valueCount(j);
+			size_t slot = i * width + offsets[j];
+			if(vals == 0)
+			{
+				if(counts[0][slot] > 0)
+					centroid[j] = sums[0][slot] / counts[0][slot];
 				else
 				{
 					centroid[j] = UNKNOWN_REAL_VALUE;
@@ -553,20 +705,8 @@ void GKMeans::recomputeCentroids(const GMatrix* pData)
 			}
 			else
 			{
-				size_t* pFreq = new size_t[vals];
-				std::unique_ptr<size_t[]> hFreq(pFreq);
-				memset(pFreq, 0, sizeof(size_t) * vals);
-				for(size_t k = 0; k < pData->rows(); k++)
-				{
-					if(m_pClusters[k] == i)
-					{
-						int v = (int)pData->row(k)[j];
-						if(v != UNKNOWN_DISCRETE_VALUE && (size_t)v < vals)
-							pFreq[v]++;
-					}
-				}
-				size_t index = GIndexVec::indexOfMax(pFreq, vals);
-				if(pFreq[index] == 0)
+				size_t index = GIndexVec::indexOfMax(&counts[0][slot], vals);
+				if(counts[0][slot + index] == 0)
 				{
 					centroid[j] = UNKNOWN_DISCRETE_VALUE;
 					unknownCount++;
@@ -578,9 +718,9 @@ void GKMeans::recomputeCentroids(const GMatrix* pData)
 		if(unknownCount > 0)
 		{
 			const GVec& row = pData->row((size_t)m_pRand->next(pData->rows()));
-			for(size_t j = 0; j < pData->cols(); j++)
+			for(size_t j = 0; j < dims; j++)
 			{
-				size_t vals = pData->relation().valueCount(j);
+				size_t vals = rel.valueCount(j);
 				if(vals == 0)
 				{
 					if(centroid[j] == UNKNOWN_REAL_VALUE)
@@ -596,23 +736,209 @@ void GKMeans::recomputeCentroids(const GMatrix* pData)
 	}
 }
 
+bool GKMeans::canPrune(const GMatrix* pData)
+{
+	// The bounds rely on the triangle inequality, which GRowDistance only obeys when no values are missing
+	if(!m_usePruning || !dynamic_cast<GRowDistance*>(m_pMetric))
+		return false;
+	const GRelation& rel = pData->relation();
+	for(size_t i = 0; i < pData->rows(); i++)
+	{
+		const GVec& row = pData->row(i);
+		for(size_t j = 0; j < pData->cols(); j++)
+		{
+			if(rel.valueCount(j) == 0 ? row[j] == UNKNOWN_REAL_VALUE : (int)row[j] == UNKNOWN_DISCRETE_VALUE)
+				return false;
+		}
+	}
+	return true;
+}
+
+void GKMeans::lloyd(const GMatrix* pData)
+{
+	double prevErr = 1e308;
+	for(size_t iter = 0; iter < m_maxIters; iter++)
+	{
+		size_t changes;
+		double err = assignClusters(pData, &changes);
+		if(changes == 0 || err >= prevErr)
+			break;
+		prevErr = err;
+		recomputeCentroids(pData);
+	}
+}
+
+void GKMeans::hamerly(const GMatrix* pData)
+{
+	// Start with a full assignment that records an upper bound on the distance to the assigned
+	// centroid and a lower bound on the distance to every other centroid
+	size_t n = pData->rows();
+	size_t k = m_clusterCount;
+	size_t chunks = GKMeans_chunkCount(n);
+	GVec upper(n);
+	GVec lower(n);
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	pool.parallelFor(0, chunks, [&](size_t c)
+	{
+		for(size_t i = n * c / chunks; i < n * (c + 1) / chunks; i++)
+		{
+			double d, second;
+			m_pClusters[i] = nearestCentroid(pData->row(i), m_pClusters[i], &d, &second);
+			upper[i] = sqrt(d);
+			lower[i] = sqrt(second);
+		}
+	});
+	GMatrix prev(k, pData->cols());
+	GVec move(k);
+	GVec half(k);
+	std::vector<size_t> changes(chunks);
+	for(size_t iter = 0; iter < m_maxIters; iter++)
+	{
+		for(size_t j = 0; j < k; j++)
+			prev[j].copy(m_pCentroids->row(j));
+		recomputeCentroids(pData);
+
+		// Measure how far each centroid moved
+		size_t farthest = 0;
+		double maxMove = 0.0;
+		double secondMove = 0.0;
+		for(size_t j = 0; j < k; j++)
+		{
+			move[j] = sqrt(m_pMetric->squaredDistance(prev[j], m_pCentroids->row(j)));
+			if(move[j] > maxMove)
+			{
+				secondMove = maxMove;
+				maxMove = move[j];
+				farthest = j;
+			}
+			else if(move[j] > secondMove)
+				secondMove = move[j];
+		}
+
+		// Find half the distance from each centroid to its nearest other centroid
+		pool.parallelFor(0, k, [&](size_t j)
+		{
+			double best = 1e308;
+			for(size_t jj = 0; jj < k; jj++)
+			{
+				if(jj != j)
+					best = std::min(best, m_pMetric->squaredDistance(m_pCentroids->row(j), m_pCentroids->row(jj)));
+			}
+			half[j] = 0.5 * sqrt(best);
+		}, 16);
+
+		// Loosen the bounds by the centroid movements, and only examine the rows they cannot settle
+		pool.parallelFor(0, chunks, [&](size_t c)
+		{
+			size_t changed = 0;
+			for(size_t i = n * c / chunks; i < n * (c + 1) / chunks; i++)
+			{
+				size_t a = m_pClusters[i];
+				upper[i] += move[a];
+				lower[i] -= (a == farthest ? secondMove : maxMove);
+				double m = std::max(half[a], lower[i]);
+				if(upper[i] <= m)
+					continue;
+				const GVec& row = pData->row(i);
+				upper[i] = sqrt(m_pMetric->squaredDistance(row, m_pCentroids->row(a)));
+				if(upper[i] <= m)
+					continue;
+				double d, second;
+				size_t clust = nearestCentroid(row, a, &d, &second);
+				upper[i] = sqrt(d);
+				lower[i] = sqrt(second);
+				if(clust != a)
+				{
+					m_pClusters[i] = clust;
+					changed++;
+				}
+			}
+			changes[c] = changed;
+		});
+		size_t total = 0;
+		for(size_t c = 0; c < chunks; c++)
+			total += changes[c];
+		if(total == 0)
+			break;
+	}
+}
+
+void GKMeans::miniBatch(const GMatrix* pData)
+{
+	if(!pData->relation().areContinuous())
+		throw Ex("Mini-batch k-means only supports continuous attributes");
+	size_t n = pData->rows();
+	size_t dims = pData->cols();
+	std::vector<size_t> counts(m_clusterCount, 0);
+	std::vector<size_t> batch(m_batchSize);
+	std::vector<size_t> nearest(m_batchSize);
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	for(size_t iter = 0; iter < m_batchIters; iter++)
+	{
+		// Find the nearest centroid for each row in a random batch
+		for(size_t b = 0; b < m_batchSize; b++)
+			batch[b] = (size_t)m_pRand->next(n);
+		pool.parallelFor(0, m_batchSize, [&](size_t b)
+		{
+			double d;
+			nearest[b] = nearestCentroid(pData->row(batch[b]), INVALID_INDEX, &d, NULL);
+		}, 64);
+
+		// Move each centroid toward its rows with a per-centroid learning rate of 1/count
+		for(size_t b = 0; b < m_batchSize; b++)
+		{
+			size_t c = nearest[b];
+			double eta = 1.0 / (double)(++counts[c]);
+			GVec& centroid = m_pCentroids->row(c);
+			const GVec& row = pData->row(batch[b]);
+			for(size_t j = 0; j < dims; j++)
+			{
+				if(row[j] == UNKNOWN_REAL_VALUE)
+					continue;
+				if(centroid[j] == UNKNOWN_REAL_VALUE)
+					centroid[j] = row[j];
+				else
+					centroid[j] += eta * (row[j] - centroid[j]);
+			}
+		}
+	}
+}
+
 // virtual
 void GKMeans::cluster(const GMatrix* pData)
 {
 	size_t* pBest = NULL;
+	GMatrix* pBestCentroids = NULL;
 	double bestErr = 1e308;
+	size_t n = pData->rows();
+	size_t chunks = GKMeans_chunkCount(n);
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
 	for(size_t i = 0; i < m_reps; i++)
 	{
 		init(pData);
-		double d = 1e308;
-		double sse = 1e308;
-		for(size_t iters = 0; true; iters++)
+		double d;
+		if(m_batchSize > 0)
 		{
+			miniBatch(pData);
 			d = assignClusters(pData);
-			if(d >= sse && iters > 2)
-				break;
-			recomputeCentroids(pData);
-			sse = d;
+		}
+		else
+		{
+			if(canPrune(pData))
+				hamerly(pData);
+			else
+				lloyd(pData);
+
+			// Measure the sum-squared-distance of the final clustering
+			GVec sse(chunks);
+			pool.parallelFor(0, chunks, [&](size_t c)
+			{
+				double sum = 0.0;
+				for(size_t j = n * c / chunks; j < n * (c + 1) / chunks; j++)
+					sum += m_pMetric->squaredDistance(pData->row(j), m_pCentroids->row(m_pClusters[j]));
+				sse[c] = sum;
+			});
+			d = sse.sum();
 		}
 		if(d < bestErr)
 		{
@@ -620,12 +946,17 @@ void GKMeans::cluster(const GMatrix* pData)
 			delete[] pBest;
 			pBest = m_pClusters;
 			m_pClusters = NULL;
+			delete(pBestCentroids);
+			pBestCentroids = m_pCentroids;
+			m_pCentroids = NULL;
 		}
 	}
 	if(pBest)
 	{
 		delete[] m_pClusters;
 		m_pClusters = pBest;
+		delete(m_pCentroids);
+		m_pCentroids = pBestCentroids;
 	}
 }
 
@@ -635,6 +966,101 @@ size_t GKMeans::whichCluster(size_t index)
 	return m_pClusters[index];
 }
 
+void GKMeans_makeBlobs(GRand& rand, size_t blobs, size_t perBlob, GMatrix& data)
+{
+	GMatrix centers(blobs, 3);
+	for(size_t i = 0; i < blobs; i++)
+		centers[i].fillUniform(rand, -50.0, 50.0);
+	data.resize(blobs * perBlob, 3);
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		data[i].fillNormal(rand);
+		data[i] += centers[i / perBlob];
+	}
+}
+
+// static
+void GKMeans::test()
+{
+	// Every mode should recover well-separated blobs
+	GRand rand(0);
+	GMatrix blobs;
+	GKMeans_makeBlobs(rand, 5, 200, blobs);
+	for(size_t mode = 0; mode < 3; mode++)
+	{
+		GRand r(1);
+		GKMeans km(5, &r);
+		if(mode == 0)
+			km.usePruning(false);
+		else if(mode == 2)
+			km.setMiniBatch(100, 50);
+		km.cluster(&blobs);
+		std::vector<size_t> used;
+		for(size_t i = 0; i < blobs.rows(); i++)
+		{
+			if(i % 200 == 0)
+			{
+				size_t c = km.whichCluster(i);
+				if(std::find(used.begin(), used.end(), c) != used.end())
+					throw Ex("Two blobs share a cluster");
+				used.push_back(c);
+			}
+			else if(km.whichCluster(i) != used.back())
+				throw Ex("A blob was split");
+		}
+	}
+
+	// Metrics for which the mean is not the minimizing centroid should still terminate
+	for(size_t m = 0; m < 2; m++)
+	{
+		GRand r(3);
+		GKMeans km(5, &r);
+		if(m == 0)
+			km.setMetric(new GLNormDistance(1.0), true);
+		else
+			km.setMetric(new GDenseCosineDistance(), true);
+		km.cluster(&blobs);
+		for(size_t i = 0; i < blobs.rows(); i++)
+		{
+			if(km.whichCluster(i) >= 5)
+				throw Ex("Invalid cluster");
+		}
+	}
+
+	// Neither the bounds nor the number of threads should change the results, even with a nominal attribute
+	GMixedRelation* pRel = new GMixedRelation();
+	pRel->addAttrs(4, 0);
+	pRel->addAttrs(1, 3);
+	GMatrix data(pRel);
+	data.newRows(3000);
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		data[i].fillUniform(rand);
+		data[i][4] = (double)rand.next(3);
+	}
+	GThreadPool serial(0);
+	GThreadPool pool(3);
+	GRand r1(2);
+	GKMeans slow(25, &r1);
+	slow.usePruning(false);
+	slow.setThreadPool(&serial);
+	slow.cluster(&data);
+	GRand r2(2);
+	GKMeans fast(25, &r2);
+	fast.setThreadPool(&pool);
+	fast.cluster(&data);
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		if(slow.whichCluster(i) != fast.whichCluster(i))
+			throw Ex("Pruning changed the clustering");
+	}
+	for(size_t i = 0; i < 25; i++)
+	{
+		if(slow.centroids()->row(i).squaredDistance(fast.centroids()->row(i)) > 1e-20)
+			throw Ex("Pruning changed the centroids");
+	}
+}
+
 
 // -----------------------------------------------------------------------------------------
 
@@ -901,14 +1327,15 @@ void GKMedoids::cluster(const GMatrix* pData)
 size_t GKMedoids::whichCluster(size_t nVector)
 {
 	const GVec& vec = m_pData->row(nVector);
+	m_dists.resize(m_clusterCount);
+	m_pMetric->squaredDistances(vec, *m_pData, m_pMedoids, m_clusterCount, m_dists.data());
 	size_t clust = 0;
-	m_d = m_pMetric->squaredDistance(vec, m_pData->row(m_pMedoids[0]));
+	m_d = m_dists[0];
 	for(size_t i = 1; i < m_clusterCount; i++)
 	{
-		double d = m_pMetric->squaredDistance(vec, m_pData->row(m_pMedoids[i]));
-		if(d < m_d)
+		if(m_dists[i] < m_d)
 		{
-			m_d = d;
+			m_d = m_dists[i];
 			clust = i;
 		}
 	}
@@ -1023,43 +1450,99 @@ GKMeansSparse::~GKMeansSparse()
 	delete[] m_pClusters;
 }
 
+// Presents the rows of a GCompressedSparseMatrix to GKMeansSparse::clusterRows
+class GKMeansSparse_compressedRows
+{
+protected:
+	const GCompressedSparseMatrix& m_data;
+
+public:
+	GKMeansSparse_compressedRows(const GCompressedSparseMatrix& data) : m_data(data) {}
+	size_t rows() const { return m_data.rows(); }
+	size_t cols() const { return m_data.cols(); }
+
+	template<class F>
+	void visit(size_t i, F f) const
+	{
+		const uint32_t* pIndexes = m_data.rowIndexes(i);
+		const double* pValues = m_data.rowValues(i);
+		for(size_t l = 0; l < m_data.rowNonDefValues(i); l++)
+			f((size_t)pIndexes[l], pValues[l]);
+	}
+
+	double similarity(GSparseSimilarity* pMetric, size_t i, const GVec& mean) const
+	{
+		return pMetric->similarity(m_data.rowIndexes(i), m_data.rowValues(i), m_data.rowNonDefValues(i), mean);
+	}
+};
+
+// Presents the rows of a GSparseMatrix to GKMeansSparse::clusterRows without copying them
+class GKMeansSparse_mapRows
+{
+protected:
+	GSparseMatrix& m_data;
+
+public:
+	GKMeansSparse_mapRows(GSparseMatrix& data) : m_data(data) {}
+	size_t rows() const { return m_data.rows(); }
+	size_t cols() const { return m_data.cols(); }
+
+	template<class F>
+	void visit(size_t i, F f) const
+	{
+		GSparseMatrix::Iter end = m_data.rowEnd(i);
+		for(GSparseMatrix::Iter it = m_data.rowBegin(i); it != end; it++)
+			f(it->first, it->second);
+	}
+
+	double similarity(GSparseSimilarity* pMetric, size_t i, const GVec& mean) const
+	{
+		return pMetric->similarity(m_data.row(i), mean);
+	}
+};
+
 // virtual
 void GKMeansSparse::cluster(GSparseMatrix* pData)
+{
+	clusterRows(GKMeansSparse_mapRows(*pData));
+}
+
+void GKMeansSparse::cluster(const GCompressedSparseMatrix& data)
+{
+	clusterRows(GKMeansSparse_compressedRows(data));
+}
+
+template<class Rows>
+void GKMeansSparse::clusterRows(const Rows& data)
 {
 	if(!m_pMetric)
 		setMetric(new GCosineSimilarity(), true);
+	size_t cols = data.cols();
 
 	// Pick the seeds (by randomly picking a known value for each element independently)
-	size_t* pCounts = new size_t[pData->cols()];
-	std::unique_ptr<size_t[]> hCounts(pCounts);
-	GMatrix means(0, pData->cols());
-	means.newRows(m_nClusters);
+	std::vector<size_t> counts(m_nClusters * cols);
+	GMatrix means(m_nClusters, cols);
+	means.fill(0.0);
+	for(size_t i = 0; i < m_nClusters; i++)
 	{
-		for(size_t i = 0; i < m_nClusters; i++)
+		size_t* pCounts = counts.data() + i * cols;
+		GVec& mean = means.row(i);
+		for(size_t k = 0; k < data.rows(); k++)
 		{
-			size_t* pC = pCounts;
-			for(size_t j = 0; j < pData->cols(); j++)
-				*(pC++) = 0;
-			GVec& mean = means.row(i);
-			for(size_t k = 0; k < pData->rows(); k++)
-			{
-				GSparseMatrix::Iter it;
-				for(it = pData->rowBegin(k); it != pData->rowEnd(k); it++)
+			data.visit(k, [&](size_t c, double v) {
+				if(m_pRand->next(pCounts[c] + 1) == 0)
 				{
-					if(m_pRand->next(pCounts[it->first] + 1) == 0)
-					{
-						pCounts[it->first]++;
-						mean[it->first] = it->second;
-					}
+					pCounts[c]++;
+					mean[c] = v;
 				}
-			}
+			});
 		}
 	}
 
 	// Do the clustering
 	delete[] m_pClusters;
-	m_pClusters = new size_t[pData->rows()];
-	memset(m_pClusters, 0xff, sizeof(size_t) * pData->rows());
+	m_pClusters = new size_t[data.rows()];
+	memset(m_pClusters, 0xff, sizeof(size_t) * data.rows());
 	double bestSim = -1e300;
 	size_t patience = 16;
 	while(true)
@@ -1068,15 +1551,14 @@ void GKMeansSparse::cluster(GSparseMatrix* pData)
 		bool somethingChanged = false;
 		double sumSim = 0.0;
 		size_t* pClust = m_pClusters;
-		for(size_t i = 0; i < pData->rows(); i++)
+		for(size_t i = 0; i < data.rows(); i++)
 		{
 			size_t oldClust = *pClust;
 			*pClust = 0;
 			double maxSimilarity = -1e300;
-			map<size_t,double>& sparseRow = pData->row(i);
 			for(size_t j = 0; j < m_nClusters; j++)
 			{
-				double sim = m_pMetric->similarity(sparseRow, means.row(j));
+				double sim = data.similarity(m_pMetric, i, means.row(j));
 				if(sim > maxSimilarity)
 				{
 					maxSimilarity = sim;
@@ -1101,27 +1583,19 @@ void GKMeansSparse::cluster(GSparseMatrix* pData)
 				break;
 		}
 
-		// Update the means
-		for(size_t j = 0; j < m_nClusters; j++)
+		// Update the means in a single pass over the data. Only the elements
+		// that a row specifies contribute to the mean of its cluster.
+		std::fill(counts.begin(), counts.end(), 0);
+		for(size_t i = 0; i < data.rows(); i++)
 		{
-			memset(pCounts, '\0', sizeof(size_t) * pData->cols());
-			size_t* pClusts = m_pClusters;
+			size_t j = m_pClusters[i];
+			size_t* pCounts = counts.data() + j * cols;
 			GVec& mean = means.row(j);
-			for(size_t i = 0; i < pData->rows(); i++)
-			{
-				if(*pClusts != j)
-					continue;
-
-				// Update only the mean of the elements that this row specifies
-				GSparseMatrix::Iter it;
-				for(it = pData->rowBegin(i); it != pData->rowEnd(i); it++)
-				{
-					mean[it->first] *= (pCounts[it->first] / (pCounts[it->first] + 1));
-					mean[it->first] += (1.0 / (pCounts[it->first] + 1) * it->second);
-					pCounts[it->first]++;
-				}
-				pClusts++;
-			}
+			data.visit(i, [&](size_t c, double v) {
+				double n = (double)pCounts[c];
+				mean[c] = (mean[c] * n + v) / (n + 1.0);
+				pCounts[c]++;
+			});
 		}
 	}
 }
@@ -28,6 +28,8 @@ namespace GClasses {
 
 class GDistanceMetric;
 class GSparseSimilarity;
+class GCompressedSparseMatrix;
+class GThreadPool;
 
 /// The base class for clustering algorithms. Classes that inherit from this
 /// class must implement a method named "cluster" which performs clustering, and
@@ -155,6 +157,11 @@ protected:
 
 
 /// An implementation of the K-means clustering algorithm.
+/// The centroids are seeded with k-means++. When the metric is a GRowDistance and the
+/// data has no missing values, Hamerly's triangle-inequality bounds are used to skip most of
+/// the point-to-centroid distance computations. Assignment and centroid accumulation are
+/// spread across a thread pool. For very large datasets, setMiniBatch trains the centroids
+/// with mini-batch k-means (Sculley, 2010) instead of full Lloyd iterations.
 class GKMeans : public GClusterer
 {
 protected:
@@ -162,22 +169,31 @@ protected:
 	size_t* m_pClusters;
 	size_t m_reps;
 	GRand* m_pRand;
+	bool m_usePruning;
+	size_t m_batchSize;
+	size_t m_batchIters;
+	size_t m_maxIters;
+	GThreadPool* m_pPool;
 
 public:
 	GKMeans(size_t nClusters, GRand* pRand);
 	~GKMeans();
 
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
 	/// Performs clustering
 	virtual void cluster(const GMatrix* pData);
 
 	/// Identifies the cluster of the specified row
 	virtual size_t whichCluster(size_t nVector);
 
-	/// Selects random centroids and initializes internal data structures
+	/// Selects the initial centroids with k-means++ and initializes internal data structures.
 	void init(const GMatrix* pData);
 
-	/// Assigns each row to the cluster of the nearest centroid as measured
-	/// with the dissimilarity metric. Returns the sum-squared-distance of each row with its centroid.
+	/// Assigns each row to the cluster of the nearest centroid as measured with the
+	/// dissimilarity metric. (Ties go to the current cluster, and then to the lowest index.)
+	/// Returns the sum-squared-distance of each row with its centroid.
 	double assignClusters(const GMatrix* pData);
 
 	/// Computes new centroids for each cluster.
@@ -190,9 +206,45 @@ public:
 	/// by the sum-squared-difference between each point and its cluster-centroid) will be kept.
 	void setReps(size_t r) { m_reps = r; }
 
+	/// Specifies whether to use Hamerly's bounds to avoid distance computations when it is
+	/// safe to do so. (The default is true. The results are the same either way.)
+	void usePruning(bool b) { m_usePruning = b; }
+
+	/// Specifies to train the centroids with iters mini-batches of batchSize randomly drawn
+	/// rows instead of with full passes over the data. Seeding then uses a random sample of
+	/// the rows, and one full pass assigns every row to its cluster at the end. All of the
+	/// attributes must be continuous. If batchSize is 0 (the default), full Lloyd iterations are used.
+	void setMiniBatch(size_t batchSize, size_t iters) { m_batchSize = batchSize; m_batchIters = iters; }
+
+	/// Specifies the maximum number of full iterations to perform. (The default is 300.) Lloyd
+	/// iterations also stop when the sum-squared-distance fails to decrease, which can happen
+	/// with metrics for which the mean is not the minimizing centroid.
+	void setMaxIters(size_t iters) { m_maxIters = iters; }
+
+	/// Specifies a thread pool to use. If pPool is NULL (the default), GThreadPool::global() is used.
+	void setThreadPool(GThreadPool* pPool) { m_pPool = pPool; }
+
 protected:
-	bool clusterAttempt(size_t nMaxIterations);
-	bool selectSeeds(const GMatrix* pSeeds);
+	/// Returns true if Hamerly's bounds are valid with the current metric and data
+	bool canPrune(const GMatrix* pData);
+
+	/// Runs Lloyd iterations until no assignments change, the sum-squared-distance stops
+	/// decreasing, or m_maxIters iterations have been performed
+	void lloyd(const GMatrix* pData);
+
+	/// Runs Lloyd iterations until no assignments change or m_maxIters iterations have been
+	/// performed, using Hamerly's bounds
+	void hamerly(const GMatrix* pData);
+
+	/// Trains the centroids with mini-batches
+	void miniBatch(const GMatrix* pData);
+
+	/// Assigns each row to its nearest centroid, and counts the rows that changed clusters
+	double assignClusters(const GMatrix* pData, size_t* pChanges);
+
+	/// Returns the index of the centroid nearest to row, and its squared distance in *pSquaredDist.
+	/// If pSecond is non-NULL, it receives the squared distance to the second-nearest centroid.
+	size_t nearestCentroid(const GVec& row, size_t current, double* pSquaredDist, double* pSecond);
 };
 
 
@@ -253,6 +305,7 @@ protected:
 	size_t* m_pMedoids;
 	double m_d;
 	const GMatrix* m_pData;
+	GVec m_dists; // distances from one row to each medoid
 
 public:
 	GKMedoids(size_t clusters);
@@ -307,11 +360,20 @@ public:
 	GKMeansSparse(size_t nClusters, GRand* pRand);
 	~GKMeansSparse();
 
-	/// Performs clustering
+	/// Performs clustering. The rows are read in place, so no second copy of the data is made.
 	virtual void cluster(GSparseMatrix* pData);
 
+	/// Performs clustering directly on compressed data
+	void cluster(const GCompressedSparseMatrix& data);
+
 	/// Identifies the cluster of the specified row
 	virtual size_t whichCluster(size_t nVector);
+
+protected:
+	/// Performs clustering on any sparse storage that provides the row operations
+	/// used by the GKMeansSparse_*Rows adapters in GCluster.cpp
+	template<class Rows>
+	void clusterRows(const Rows& data);
 };
 
 
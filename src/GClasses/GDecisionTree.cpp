@@ -29,9 +29,13 @@
 #include "GTransform.h"
 #include "GEnsemble.h"
 #include "GHolders.h"
+#include "GMath.h"
+#include "GThread.h"
 #include <string>
 #include <iostream>
 #include <memory>
+#include <algorithm>
+#include <deque>
 
 using namespace GClasses;
 using std::string;
@@ -65,6 +69,8 @@ public:
 class GDecisionTreeInteriorNode : public GDecisionTreeNode
 {
 friend class GDecisionTree;
+friend class GCompiledTrees;
+friend class GDecisionTreeHistogramBuilder;
 protected:
 	size_t m_nAttribute;
 	double m_dPivot;
@@ -353,14 +359,14 @@ GDecisionTreeNode* GDecisionTreeNode::deserialize(const GDomNode* pNode)
 // -----------------------------------------------------------------
 
 GDecisionTree::GDecisionTree()
-: GSupervisedLearner(), m_leafThresh(1), m_maxLevels(0), m_binaryDivisions(false)
+: GSupervisedLearner(), m_leafThresh(1), m_maxLevels(0), m_binaryDivisions(false), m_histBins(0), m_pHistEdges(NULL), m_pPool(NULL)
 {
 	m_pRoot = NULL;
 	m_eAlg = GDecisionTree::MINIMIZE_ENTROPY;
 }
 
 GDecisionTree::GDecisionTree(const GDomNode* pNode)
-: GSupervisedLearner(pNode), m_leafThresh(1), m_maxLevels(0)
+: GSupervisedLearner(pNode), m_leafThresh(1), m_maxLevels(0), m_histBins(0), m_pHistEdges(NULL), m_pPool(NULL)
 {
 	m_eAlg = (DivisionAlgorithm)pNode->getInt("alg");
 	m_pRoot = GDecisionTreeNode::deserialize(pNode->get("root"));
@@ -419,10 +425,616 @@ void GDecisionTree::print(ostream& stream, GArffRelation* pFeatureRel, GArffRela
 	m_pRoot->print(this, stream, prefix, NULL);
 }
 
+void GDecisionTree::useHistogramSplits(size_t maxBins, const vector< vector<double> >* pSharedEdges)
+{
+	if(maxBins == 1 || maxBins > 256)
+		throw Ex("Expected maxBins to be 0, or from 2 to 256");
+	m_histBins = maxBins;
+	m_pHistEdges = pSharedEdges;
+	if(maxBins > 0 && !m_binaryDivisions)
+		useBinaryDivisions();
+}
+
+// static
+void GDecisionTree::computeHistogramEdges(const GMatrix& features, size_t maxBins, vector< vector<double> >& edges)
+{
+	if(maxBins < 2 || maxBins > 256)
+		throw Ex("Expected maxBins to be from 2 to 256");
+	size_t stride = std::max((size_t)1, features.rows() / 200000); // Quantiles do not need more than a couple hundred thousand samples
+	edges.resize(features.cols());
+	vector<double> vals;
+	vector<double> distinct;
+	for(size_t i = 0; i < features.cols(); i++)
+	{
+		vector<double>& e = edges[i];
+		e.clear();
+		if(features.relation().valueCount(i) > 0)
+		{
+			if(features.relation().valueCount(i) > 256)
+				throw Ex("Histogram splits support at most 256 values per nominal attribute");
+			continue;
+		}
+
+		// Sort the known values
+		vals.clear();
+		for(size_t j = 0; j < features.rows(); j += stride)
+		{
+			double d = features[j][i];
+			if(d != UNKNOWN_REAL_VALUE)
+				vals.push_back(d);
+		}
+		std::sort(vals.begin(), vals.end());
+		distinct.resize(vals.size());
+		distinct.erase(std::unique_copy(vals.begin(), vals.end(), distinct.begin()), distinct.end());
+
+		// Put boundaries between consecutive distinct values, or at the quantiles if there are too many
+		if(distinct.size() <= maxBins)
+		{
+			for(size_t j = 1; j < distinct.size(); j++)
+				e.push_back(0.5 * (distinct[j - 1] + distinct[j]));
+		}
+		else
+		{
+			for(size_t b = 1; b < maxBins; b++)
+			{
+				double q = vals[b * vals.size() / maxBins];
+				size_t index = std::lower_bound(distinct.begin(), distinct.end(), q) - distinct.begin();
+				if(index == 0)
+					continue;
+				double edge = 0.5 * (distinct[index - 1] + distinct[index]);
+				if(e.size() == 0 || edge > e.back())
+					e.push_back(edge);
+			}
+		}
+	}
+}
+
+namespace GClasses {
+
+/// Grows a GDecisionTree from per-node histograms of label statistics over quantized features.
+/// Each bin holds the row count, then for each continuous label the known count, sum, and
+/// sum of squares, and for each nominal label the count of each value.
+/// Large nodes build their histograms and evaluate attributes in parallel, and their two
+/// subtrees grow concurrently. Each node draws from its own GRand, seeded by its parent,
+/// so the tree does not depend on how the work was scheduled.
+class GDecisionTreeHistogramBuilder
+{
+protected:
+	GDecisionTree& m_tree;
+	GThreadPool& m_pool;
+	const GMatrix& m_labels;
+	const vector< vector<double> >& m_edges;
+	size_t m_featureDims;
+	vector<unsigned char> m_bins; // row-major bin index of every feature
+	vector<size_t> m_binCounts;
+	vector<bool> m_nominal;
+	vector<size_t> m_histPos; // where the histogram of each feature starts
+	size_t m_histSize;
+	size_t m_width; // the number of statistics in each bin
+	vector<size_t> m_labelVals;
+	vector<size_t> m_labelPos;
+	vector<size_t> m_rows; // partitioned so that each node owns a contiguous range
+
+	// Nodes with fewer rows than these are handled serially
+	static const size_t PARALLEL_HISTOGRAM_ROWS = 4096;
+	static const size_t PARALLEL_ATTRIBUTE_ROWS = 4096;
+	static const size_t PARALLEL_SUBTREE_ROWS = 8192;
+
+public:
+	GDecisionTreeHistogramBuilder(GDecisionTree& tree, GThreadPool& pool, const GMatrix& features, const GMatrix& labels, const vector< vector<double> >& edges)
+	: m_tree(tree), m_pool(pool), m_labels(labels), m_edges(edges), m_featureDims(features.cols())
+	{
+		if(edges.size() != m_featureDims)
+			throw Ex("Expected histogram edges for ", to_str(m_featureDims), " features. Got ", to_str(edges.size()));
+
+		// Lay out the statistics in each bin
+		m_width = 1;
+		m_labelVals.resize(labels.cols());
+		m_labelPos.resize(labels.cols());
+		for(size_t j = 0; j < labels.cols(); j++)
+		{
+			m_labelVals[j] = labels.relation().valueCount(j);
+			m_labelPos[j] = m_width;
+			m_width += (m_labelVals[j] == 0 ? 3 : m_labelVals[j]);
+		}
+
+		// Lay out the histograms
+		m_binCounts.resize(m_featureDims);
+		m_nominal.resize(m_featureDims);
+		m_histPos.resize(m_featureDims);
+		m_histSize = 0;
+		for(size_t i = 0; i < m_featureDims; i++)
+		{
+			size_t vals = features.relation().valueCount(i);
+			m_nominal[i] = (vals > 0);
+			if(vals > 0 && edges[i].size() > 0)
+				throw Ex("Did not expect histogram edges for nominal attribute ", to_str(i));
+			m_binCounts[i] = (vals > 0 ? vals : edges[i].size() + 1);
+			if(m_binCounts[i] > 256)
+				throw Ex("Histogram splits support at most 256 bins per attribute");
+			m_histPos[i] = m_histSize;
+			m_histSize += m_binCounts[i] * m_width;
+		}
+
+		// Quantize the features. Missing values go in the bin of the baseline value.
+		size_t n = features.rows();
+		m_bins.resize(n * m_featureDims);
+		m_pool.parallelFor(0, m_featureDims, [this, &features, &edges, n](size_t i) {
+			const vector<double>& e = edges[i];
+			unsigned char* pBins = m_bins.data() + i;
+			if(m_nominal[i])
+			{
+				int missing = std::max(0, (int)features.baselineValue(i));
+				for(size_t j = 0; j < n; j++)
+				{
+					int v = (int)features[j][i];
+					pBins[j * m_featureDims] = (unsigned char)(v < 0 ? missing : v);
+				}
+			}
+			else
+			{
+				double mean = features.columnMean(i, NULL, false);
+				unsigned char missing = (unsigned char)(std::upper_bound(e.begin(), e.end(), mean) - e.begin());
+				for(size_t j = 0; j < n; j++)
+				{
+					double d = features[j][i];
+					pBins[j * m_featureDims] = (d == UNKNOWN_REAL_VALUE ? missing : (unsigned char)(std::upper_bound(e.begin(), e.end(), d) - e.begin()));
+				}
+			}
+		});
+		m_rows.resize(n);
+		for(size_t j = 0; j < n; j++)
+			m_rows[j] = j;
+	}
+
+	/// Builds the whole tree
+	GDecisionTreeNode* build(uint64_t seed)
+	{
+		vector<double> hist;
+		buildHistogram(0, m_rows.size(), hist);
+		std::deque< vector<double> > scratch;
+		return buildBranch(0, m_rows.size(), hist, 0, seed, scratch);
+	}
+
+protected:
+	void addRow(double* pStats, size_t row)
+	{
+		pStats[0] += 1.0;
+		const GVec& lab = m_labels[row];
+		for(size_t j = 0; j < m_labelVals.size(); j++)
+		{
+			double* p = pStats + m_labelPos[j];
+			if(m_labelVals[j] == 0)
+			{
+				double d = lab[j];
+				if(d != UNKNOWN_REAL_VALUE)
+				{
+					p[0] += 1.0;
+					p[1] += d;
+					p[2] += d * d;
+				}
+			}
+			else
+			{
+				int v = (int)lab[j];
+				if(v >= 0)
+					p[v] += 1.0;
+			}
+		}
+	}
+
+	/// Adds the rows in [begin, end) to the histograms of the features in [firstAttr, lastAttr)
+	void addRows(size_t begin, size_t end, size_t firstAttr, size_t lastAttr, double* pHist)
+	{
+		for(size_t k = begin; k < end; k++)
+		{
+			size_t r = m_rows[k];
+			const unsigned char* pBins = m_bins.data() + r * m_featureDims;
+			for(size_t i = firstAttr; i < lastAttr; i++)
+				addRow(pHist + m_histPos[i] + pBins[i] * m_width, r);
+		}
+	}
+
+	void buildHistogram(size_t begin, size_t end, vector<double>& hist)
+	{
+		hist.assign(m_histSize, 0.0);
+		double* pHist = hist.data();
+		if(end - begin < PARALLEL_HISTOGRAM_ROWS || m_pool.workers() == 0)
+		{
+			addRows(begin, end, 0, m_featureDims, pHist);
+			return;
+		}
+
+		// Each task fills the histograms of a block of features, so no two tasks touch the same bins
+		size_t blockSize = 8;
+		size_t blocks = (m_featureDims + blockSize - 1) / blockSize;
+		m_pool.parallelFor(0, blocks, [this, begin, end, blockSize, pHist](size_t b) {
+			addRows(begin, end, b * blockSize, std::min(m_featureDims, (b + 1) * blockSize), pHist);
+		});
+	}
+
+	/// Computes the statistics of all the rows in a node
+	void computeTotals(size_t begin, size_t end, const vector<double>& hist, vector<double>& totals)
+	{
+		totals.assign(m_width, 0.0);
+		if(m_featureDims == 0)
+		{
+			for(size_t k = begin; k < end; k++)
+				addRow(totals.data(), m_rows[k]);
+			return;
+		}
+		const double* pBin = hist.data();
+		for(size_t b = 0; b < m_binCounts[0]; b++)
+		{
+			for(size_t w = 0; w < m_width; w++)
+				totals[w] += pBin[w];
+			pBin += m_width;
+		}
+	}
+
+	/// Computes the same measure as GMatrix::measureInfo from a set of statistics
+	double measureInfo(const double* pStats)
+	{
+		double info = 0.0;
+		for(size_t j = 0; j < m_labelVals.size(); j++)
+		{
+			const double* p = pStats + m_labelPos[j];
+			if(m_labelVals[j] == 0)
+			{
+				if(p[0] > 1.0)
+					info += std::max(0.0, (p[2] - p[1] * p[1] / p[0]) / (p[0] - 1.0));
+			}
+			else
+			{
+				double total = 0.0;
+				for(size_t v = 0; v < m_labelVals[j]; v++)
+					total += p[v];
+				double entropy = 0.0;
+				for(size_t v = 0; v < m_labelVals[j]; v++)
+				{
+					if(p[v] > 0.0)
+					{
+						double ratio = p[v] / total;
+						entropy -= ratio * log(ratio);
+					}
+				}
+				info += M_LOG2E * entropy;
+			}
+		}
+		return info;
+	}
+
+	/// Returns the weighted info of dividing totals into left and the remainder. (right is scratch space.)
+	double measureSplitInfo(const vector<double>& totals, const vector<double>& left, vector<double>& right)
+	{
+		for(size_t w = 0; w < m_width; w++)
+			right[w] = totals[w] - left[w];
+		return (left[0] * measureInfo(left.data()) + right[0] * measureInfo(right.data())) / totals[0];
+	}
+
+	bool isHomogenous(const vector<double>& totals)
+	{
+		for(size_t j = 0; j < m_labelVals.size(); j++)
+		{
+			const double* p = totals.data() + m_labelPos[j];
+			if(m_labelVals[j] == 0)
+			{
+				if(p[0] > 1.0)
+				{
+					double mean = p[1] / p[0];
+					double var = (p[2] - p[1] * p[1] / p[0]) / (p[0] - 1.0);
+					if(var > 1e-10 * mean * mean)
+						return false;
+				}
+			}
+			else
+			{
+				double total = 0.0;
+				double most = 0.0;
+				for(size_t v = 0; v < m_labelVals[j]; v++)
+				{
+					total += p[v];
+					most = std::max(most, p[v]);
+				}
+				if(most < total)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	double* labelVec(const vector<double>& totals)
+	{
+		double* pVec = new double[m_labelVals.size()];
+		for(size_t j = 0; j < m_labelVals.size(); j++)
+		{
+			const double* p = totals.data() + m_labelPos[j];
+			if(m_labelVals[j] == 0)
+				pVec[j] = (p[0] > 0.0 ? p[1] / p[0] : 0.0);
+			else
+			{
+				size_t best = 0;
+				for(size_t v = 1; v < m_labelVals[j]; v++)
+				{
+					if(p[v] > p[best])
+						best = v;
+				}
+				pVec[j] = (double)best;
+			}
+		}
+		return pVec;
+	}
+
+	/// Puts the statistics of the rows that a division of attr at bin would send to the first child in left
+	void accumulateLeft(const vector<double>& hist, size_t attr, size_t bin, vector<double>& left)
+	{
+		const double* pHist = hist.data() + m_histPos[attr];
+		if(m_nominal[attr])
+		{
+			memcpy(left.data(), pHist + bin * m_width, sizeof(double) * m_width);
+			return;
+		}
+		left.assign(m_width, 0.0);
+		for(size_t b = 0; b <= bin; b++)
+		{
+			for(size_t w = 0; w < m_width; w++)
+				left[w] += pHist[w];
+			pHist += m_width;
+		}
+	}
+
+	/// Finds the best division of attr. Returns false if it cannot divide the rows.
+	bool bestDivisionOfAttr(const vector<double>& hist, const vector<double>& totals, size_t attr, size_t* pOutBin, double* pOutInfo)
+	{
+		const double* pHist = hist.data() + m_histPos[attr];
+		double n = totals[0];
+		vector<double> left(m_width);
+		vector<double> right(m_width);
+		double bestInfo = 1e308;
+		size_t bestBin = INVALID_INDEX;
+		if(m_nominal[attr])
+		{
+			for(size_t b = 0; b < m_binCounts[attr]; b++)
+			{
+				const double* pBin = pHist + b * m_width;
+				if(pBin[0] == 0.0 || pBin[0] == n)
+					continue;
+				memcpy(left.data(), pBin, sizeof(double) * m_width);
+				double info = measureSplitInfo(totals, left, right);
+				if(info + 1e-14 < bestInfo) // the small value makes it deterministic across hardware
+				{
+					bestInfo = info;
+					bestBin = b;
+				}
+			}
+		}
+		else
+		{
+			for(size_t b = 0; b + 1 < m_binCounts[attr]; b++)
+			{
+				const double* pBin = pHist + b * m_width;
+				for(size_t w = 0; w < m_width; w++)
+					left[w] += pBin[w];
+				if(left[0] == n)
+					break;
+				if(pBin[0] == 0.0 || left[0] == 0.0)
+					continue; // Same division as the previous bin, or nothing on the left
+				double info = measureSplitInfo(totals, left, right);
+				if(info + 1e-14 < bestInfo) // the small value makes it deterministic across hardware
+				{
+					bestInfo = info;
+					bestBin = b;
+				}
+			}
+		}
+		*pOutBin = bestBin;
+		*pOutInfo = bestInfo;
+		return bestBin != INVALID_INDEX;
+	}
+
+	/// Picks a random division of attr in the manner of GDecisionTree::pickDivision. Returns false if it failed.
+	bool randomDivisionOfAttr(size_t begin, size_t end, const vector<double>& hist, const vector<double>& totals, size_t attr, GRand& rand, size_t* pBin)
+	{
+		size_t a = m_bins[m_rows[begin + (size_t)rand.next(end - begin)] * m_featureDims + attr];
+		if(m_nominal[attr])
+		{
+			*pBin = a;
+			return hist[m_histPos[attr] + a * m_width] < totals[0];
+		}
+		size_t b = m_bins[m_rows[begin + (size_t)rand.next(end - begin)] * m_featureDims + attr];
+		if(a == b)
+			return false;
+		*pBin = (std::min(a, b) + std::max(a, b) - 1) / 2;
+		return true;
+	}
+
+	/// Picks the attribute and bin to divide on. Returns false if no division is possible.
+	bool pickDivision(size_t begin, size_t end, const vector<double>& hist, const vector<double>& totals, GRand& rand, size_t* pAttr, size_t* pBin)
+	{
+		if(m_tree.m_eAlg == GDecisionTree::MINIMIZE_ENTROPY)
+		{
+			// Evaluate every attribute, then reduce in attribute order so the choice does not depend on scheduling
+			vector<double> infos(m_featureDims);
+			vector<size_t> bins(m_featureDims);
+			auto evalAttr = [this, &hist, &totals, &infos, &bins](size_t i) {
+				if(!bestDivisionOfAttr(hist, totals, i, &bins[i], &infos[i]))
+					infos[i] = 1e308;
+			};
+			if(end - begin < PARALLEL_ATTRIBUTE_ROWS)
+			{
+				for(size_t i = 0; i < m_featureDims; i++)
+					evalAttr(i);
+			}
+			else
+				m_pool.parallelFor(0, m_featureDims, evalAttr);
+			double bestInfo = 1e308;
+			size_t bestAttr = INVALID_INDEX;
+			for(size_t i = 0; i < m_featureDims; i++)
+			{
+				if(bins[i] != INVALID_INDEX && infos[i] + 1e-14 < bestInfo)
+				{
+					bestInfo = infos[i];
+					bestAttr = i;
+				}
+			}
+			if(bestAttr == INVALID_INDEX)
+				return false;
+			*pAttr = bestAttr;
+			*pBin = bins[bestAttr];
+			return true;
+		}
+
+		// Pick the best of m_randomDraws random divisions
+		vector<double> left(m_width);
+		vector<double> right(m_width);
+		double bestInfo = 1e308;
+		size_t bestAttr = INVALID_INDEX;
+		size_t bestBin = 0;
+		for(size_t i = 0; i < m_tree.m_randomDraws; i++)
+		{
+			size_t attr = (size_t)rand.next(m_featureDims);
+			size_t bin;
+			if(!randomDivisionOfAttr(begin, end, hist, totals, attr, rand, &bin))
+				continue;
+			double info = 0.0;
+			if(m_tree.m_randomDraws > 1)
+			{
+				accumulateLeft(hist, attr, bin, left);
+				info = measureSplitInfo(totals, left, right);
+			}
+			if(info + 1e-14 < bestInfo) // the small value makes it deterministic across hardware
+			{
+				bestInfo = info;
+				bestAttr = attr;
+				bestBin = bin;
+			}
+		}
+		if(bestAttr != INVALID_INDEX)
+		{
+			*pAttr = bestAttr;
+			*pBin = bestBin;
+			return true;
+		}
+
+		// The random draws failed, so systematically look for an attribute that divides the rows
+		size_t k = (size_t)rand.next(m_featureDims);
+		for(size_t i = 0; i < m_featureDims; i++)
+		{
+			size_t attr = (i + k) % m_featureDims;
+			const double* pHist = hist.data() + m_histPos[attr];
+			size_t candidates = 0;
+			size_t first = INVALID_INDEX;
+			for(size_t b = 0; b < m_binCounts[attr]; b++)
+			{
+				double count = pHist[b * m_width];
+				if(count == 0.0 || count == totals[0])
+					continue;
+				if(m_nominal[attr])
+				{
+					if(rand.next(++candidates) == 0)
+						*pBin = b;
+				}
+				else if(first == INVALID_INDEX)
+					first = b;
+				else if(rand.next(++candidates) == 0)
+					*pBin = b - 1; // Divide just below a random non-min bin
+			}
+			if(candidates > 0)
+			{
+				*pAttr = attr;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/// Grows the subtree for the rows in [begin, end), whose histogram is hist. (hist is used up.)
+	/// scratch holds one histogram buffer per depth, which is reused by every node at that depth,
+	/// since only one node per depth is in progress at a time. (It is a deque so that growing it
+	/// does not move the buffers that shallower nodes are still using.)
+	GDecisionTreeNode* buildBranch(size_t begin, size_t end, vector<double>& hist, size_t nDepth, uint64_t seed, std::deque< vector<double> >& scratch)
+	{
+		GRand rand(seed);
+		vector<double> totals;
+		computeTotals(begin, end, hist, totals);
+		size_t count = end - begin;
+		size_t attr, bin;
+		if(count <= m_tree.m_leafThresh || m_featureDims == 0 || nDepth + 1 == m_tree.m_maxLevels
+			|| isHomogenous(totals) || !pickDivision(begin, end, hist, totals, rand, &attr, &bin))
+			return new GDecisionTreeLeafNode(labelVec(totals), count);
+
+		// Divide the rows
+		bool nominal = m_nominal[attr];
+		const unsigned char* pBins = m_bins.data() + attr;
+		size_t featureDims = m_featureDims;
+		size_t* pRows = m_rows.data();
+		size_t mid = std::partition(pRows + begin, pRows + end, [pBins, featureDims, nominal, bin](size_t r) {
+				size_t b = pBins[r * featureDims];
+				return nominal ? b == bin : b <= bin;
+			}) - pRows;
+		GAssert(mid > begin && mid < end);
+
+		// Scan the smaller child, and subtract it from this histogram to obtain the larger one
+		if(scratch.size() <= nDepth)
+			scratch.resize(nDepth + 1);
+		vector<double>& other = scratch[nDepth];
+		bool leftIsSmaller = (mid - begin <= end - mid);
+		if(leftIsSmaller)
+			buildHistogram(begin, mid, other);
+		else
+			buildHistogram(mid, end, other);
+		for(size_t i = 0; i < m_histSize; i++)
+			hist[i] -= other[i];
+		vector<double>& leftHist = leftIsSmaller ? other : hist;
+		vector<double>& rightHist = leftIsSmaller ? hist : other;
+
+		// Make an interior node
+		double pivot = nominal ? (double)bin : m_edges[attr][bin];
+		GDecisionTreeInteriorNode* pNode = new GDecisionTreeInteriorNode(attr, pivot, 2, end - mid > mid - begin ? 1 : 0);
+		std::unique_ptr<GDecisionTreeInteriorNode> hNode(pNode);
+		uint64_t leftSeed = rand.next();
+		uint64_t rightSeed = rand.next();
+		if(std::min(mid - begin, end - mid) < PARALLEL_SUBTREE_ROWS || m_pool.workers() == 0)
+		{
+			pNode->m_ppChildren[0] = buildBranch(begin, mid, leftHist, nDepth + 1, leftSeed, scratch);
+			pNode->m_ppChildren[1] = buildBranch(mid, end, rightHist, nDepth + 1, rightSeed, scratch);
+			return hNode.release();
+		}
+
+		// Grow the two subtrees concurrently. (The other task needs its own scratch buffers.)
+		std::future<GDecisionTreeNode*> left = m_pool.submit([this, begin, mid, &leftHist, nDepth, leftSeed]() {
+				std::deque< vector<double> > leftScratch;
+				return buildBranch(begin, mid, leftHist, nDepth + 1, leftSeed, leftScratch);
+			});
+		try
+		{
+			pNode->m_ppChildren[1] = buildBranch(mid, end, rightHist, nDepth + 1, rightSeed, scratch);
+		}
+		catch(...)
+		{
+			try { delete(m_pool.get(left)); } catch(...) {}
+			throw;
+		}
+		pNode->m_ppChildren[0] = m_pool.get(left);
+		return hNode.release();
+	}
+};
+
+} // namespace GClasses
+
 // virtual
 void GDecisionTree::trainInner(const GMatrix& features, const GMatrix& labels)
 {
 	clear();
+	if(m_histBins > 0)
+	{
+		vector< vector<double> > edges;
+		if(!m_pHistEdges)
+			computeHistogramEdges(features, m_histBins, edges);
+		GDecisionTreeHistogramBuilder builder(*this, m_pPool ? *m_pPool : GThreadPool::global(), features, labels, m_pHistEdges ? *m_pHistEdges : edges);
+		m_pRoot = builder.build(m_rand.next());
+		return;
+	}
 
 	// Make a list of available features
 	vector<size_t> attrPool;
@@ -982,6 +1594,94 @@ void GDecisionTree::clear()
 	m_pRoot = NULL;
 }
 
+void GDecisionTree_testHistogram()
+{
+	// A step in a discrete-valued feature should be found exactly, regardless of a noise feature
+	GRand rand(0);
+	GMatrix features(2000, 2);
+	GMatrix labels(2000, 1);
+	for(size_t i = 0; i < features.rows(); i++)
+	{
+		features[i][0] = (double)rand.next(10);
+		features[i][1] = rand.uniform();
+		labels[i][0] = (features[i][0] < 3.0 ? 1.0 : 5.0);
+	}
+	GDecisionTree tree;
+	tree.useHistogramSplits(16);
+	tree.train(features, labels);
+	if(tree.treeSize() != 3)
+		throw Ex("Expected a single division. Got ", to_str(tree.treeSize()), " nodes");
+	GVec in(2);
+	GVec out(1);
+	in[0] = 2.4;
+	in[1] = 0.5;
+	tree.predict(in, out);
+	if(std::abs(out[0] - 1.0) > 1e-12)
+		throw Ex("wrong prediction");
+	in[0] = 2.6;
+	tree.predict(in, out);
+	if(std::abs(out[0] - 5.0) > 1e-12)
+		throw Ex("wrong prediction");
+
+	// Boosted histogram trees share one quantization
+	for(size_t i = 0; i < features.rows(); i++)
+		labels[i][0] = features[i][0] * features[i][0] + 4.0 * features[i][1];
+	GDecisionTree* pTree = new GDecisionTree();
+	pTree->useHistogramSplits(32);
+	pTree->setMaxLevels(3);
+	GGradBoost boost(pTree, true, new GLearnerLoader());
+	boost.setSize(20);
+	boost.train(features, labels);
+	double sse = boost.sumSquaredError(features, labels);
+	if(sse / features.rows() > 0.5)
+		throw Ex("Gradient boosting with histogram trees did not fit the data. mse=", to_str(sse / features.rows()));
+}
+
+std::string GDecisionTree_serializeToString(const GSupervisedLearner& learner)
+{
+	GDom doc;
+	doc.setRoot(learner.serialize(&doc));
+	std::ostringstream oss;
+	doc.writeJson(oss);
+	return oss.str();
+}
+
+void GDecisionTree_testParallel()
+{
+	// Enough rows that the nodes near the root grow in parallel
+	GRand rand(0);
+	GMatrix features(30000, 6);
+	GMatrix labels(30000, 1);
+	for(size_t i = 0; i < features.rows(); i++)
+	{
+		for(size_t j = 0; j < features.cols(); j++)
+			features[i][j] = rand.normal();
+		labels[i][0] = features[i][0] * features[i][1] + std::sin(features[i][2]) + 0.1 * rand.normal();
+	}
+	GThreadPool serial(0);
+	GThreadPool pool(3);
+	for(size_t alg = 0; alg < 2; alg++)
+	{
+		GDecisionTree a;
+		GDecisionTree b;
+		a.useHistogramSplits(64);
+		b.useHistogramSplits(64);
+		if(alg == 1)
+		{
+			a.useRandomDivisions(2);
+			b.useRandomDivisions(2);
+		}
+		a.setLeafThresh(8);
+		b.setLeafThresh(8);
+		a.setThreadPool(&serial);
+		b.setThreadPool(&pool);
+		a.train(features, labels);
+		b.train(features, labels);
+		if(GDecisionTree_serializeToString(a) != GDecisionTree_serializeToString(b))
+			throw Ex("Growing a tree in parallel changed the tree");
+	}
+}
+
 // static
 void GDecisionTree::test()
 {
@@ -999,6 +1699,13 @@ void GDecisionTree::test()
 		ml1Tree.setMaxLevels(1);
 		ml1Tree.basicTest(0.33, 0.33);
 	}
+	{
+		GDecisionTree histTree;
+		histTree.useHistogramSplits(64);
+		histTree.basicTest(0.70, 0.83);
+	}
+	GDecisionTree_testHistogram();
+	GDecisionTree_testParallel();
 }
 
 // ----------------------------------------------------------------------
@@ -1354,7 +2061,7 @@ void GMeanMarginsTree::test()
 
 
 GRandomForest::GRandomForest(size_t trees, size_t samples)
-: GSupervisedLearner()
+: GSupervisedLearner(), m_histBins(0), m_pPool(NULL)
 {
 	m_pEnsemble = new GBag();
 	for(size_t i = 0; i < trees; i++)
@@ -1367,7 +2074,7 @@ GRandomForest::GRandomForest(size_t trees, size_t samples)
 }
 
 GRandomForest::GRandomForest(const GDomNode* pNode, GLearnerLoader& ll)
-: GSupervisedLearner(pNode)
+: GSupervisedLearner(pNode), m_histBins(0), m_pPool(NULL)
 {
 	m_pEnsemble = new GBag(pNode->get("bag"), ll);
 }
@@ -1403,10 +2110,38 @@ void GRandomForest::print(std::ostream& stream, GArffRelation* pFeatureRel, GArf
 	}
 }
 
+void GRandomForest::useHistogramSplits(size_t maxBins)
+{
+	m_histBins = maxBins;
+	std::vector<GWeightedModel*>& models = m_pEnsemble->models();
+	for(size_t i = 0; i < models.size(); i++)
+		((GDecisionTree*)models[i]->m_pModel)->useHistogramSplits(maxBins);
+}
+
+void GRandomForest::setThreadPool(GThreadPool* pPool)
+{
+	m_pPool = pPool;
+	m_pEnsemble->setThreadPool(pPool);
+	std::vector<GWeightedModel*>& models = m_pEnsemble->models();
+	for(size_t i = 0; i < models.size(); i++)
+		((GDecisionTree*)models[i]->m_pModel)->setThreadPool(pPool);
+}
+
 // virtual
 void GRandomForest::trainInner(const GMatrix& features, const GMatrix& labels)
 {
+	if(m_histBins > 0)
+	{
+		// Quantize once for the whole forest
+		GDecisionTree::computeHistogramEdges(features, m_histBins, m_histEdges);
+		std::vector<GWeightedModel*>& models = m_pEnsemble->models();
+		for(size_t i = 0; i < models.size(); i++)
+			((GDecisionTree*)models[i]->m_pModel)->useHistogramSplits(m_histBins, &m_histEdges);
+	}
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	m_pEnsemble->setWorkerThreads(std::max((size_t)1, std::min(pool.workers() + 1, m_pEnsemble->models().size())));
 	m_pEnsemble->train(features, labels);
+	m_pEnsemble->setWorkerThreads(1); // Each tree is too quick to be worth predicting in parallel
 }
 
 // virtual
@@ -1421,9 +2156,401 @@ void GRandomForest::predictDistribution(const GVec& in, GPrediction* out)
 	m_pEnsemble->predictDistribution(in, out);
 }
 
+// virtual
+void GRandomForest::predictBatch(const GMatrix& features, GMatrix& labels)
+{
+	m_pEnsemble->predictBatch(features, labels);
+}
+
+void GRandomForest::useEarlyExit(bool b)
+{
+	m_pEnsemble->useEarlyExit(b);
+}
+
 // static
 void GRandomForest::test()
 {
-	GRandomForest rf(30);
-	rf.basicTest(0.762, 0.925, 0.01);
+	{
+		GRandomForest rf(30);
+		rf.basicTest(0.762, 0.925, 0.01);
+	}
+	{
+		GRandomForest rf(30);
+		rf.useHistogramSplits(64);
+		rf.basicTest(0.75, 0.93, 0.01);
+	}
+	{
+		// Training the trees concurrently should not change the forest
+		GRand rand(0);
+		GMatrix features(500, 4);
+		GMatrix labels(500, 1);
+		for(size_t i = 0; i < features.rows(); i++)
+		{
+			for(size_t j = 0; j < features.cols(); j++)
+				features[i][j] = rand.uniform();
+			labels[i][0] = features[i][0] + features[i][1] * features[i][2];
+		}
+		GThreadPool serial(0);
+		GThreadPool pool(3);
+		GRandomForest a(12);
+		GRandomForest b(12);
+		a.setThreadPool(&serial);
+		b.setThreadPool(&pool);
+		a.train(features, labels);
+		b.train(features, labels);
+		if(GDecisionTree_serializeToString(a) != GDecisionTree_serializeToString(b))
+			throw Ex("Training the trees in parallel changed the forest");
+
+		// Batch predictions should be identical to one-at-a-time predictions
+		GMatrix batch;
+		b.predictBatch(features, batch);
+		GVec pred(1);
+		for(size_t i = 0; i < features.rows(); i++)
+		{
+			b.predict(features[i], pred);
+			if(batch[i][0] != pred[0])
+				throw Ex("predictBatch disagrees with predict");
+		}
+	}
+}
+
+// ----------------------------------------------------------------------
+
+GCompiledTrees::GCompiledTrees(GDecisionTree& tree)
+: m_pLabelRel(tree.relLabels().clone()), m_featureDims(tree.relFeatures().size()), m_accumulatorDims(0), m_pPool(NULL)
+{
+	addTree(tree, 1.0);
+}
+
+GCompiledTrees::GCompiledTrees(GRandomForest& forest)
+: m_pLabelRel(forest.relLabels().clone()), m_featureDims(forest.relFeatures().size()), m_accumulatorDims(0), m_pPool(NULL)
+{
+	std::vector<GWeightedModel*>& models = forest.m_pEnsemble->models();
+	for(size_t i = 0; i < models.size(); i++)
+		addTree(*(GDecisionTree*)models[i]->m_pModel, models[i]->m_weight);
+
+	// The ballot box has a slot for each nominal value, and one for each continuous label
+	for(size_t i = 0; i < m_pLabelRel->size(); i++)
+		m_accumulatorDims += std::max((size_t)1, m_pLabelRel->valueCount(i));
+}
+
+GCompiledTrees::~GCompiledTrees()
+{
+	delete(m_pLabelRel);
+}
+
+void GCompiledTrees::addTree(GDecisionTree& tree, double weight)
+{
+	if(!tree.m_pRoot)
+		throw Ex("Not trained yet");
+	if(m_featureDims == 0)
+		throw Ex("Expected at least one feature");
+	const GRelation& featureRel = tree.relFeatures();
+	size_t labelDims = m_pLabelRel->size();
+
+	// Each queued item becomes one flat node. Link j of a multi-way division
+	// tests for value j, and falls through to link j + 1 if that fails.
+	struct Item
+	{
+		GDecisionTreeNode* m_pNode;
+		size_t m_link;
+		size_t m_depth;
+	};
+	std::deque<Item> queue;
+	size_t root = m_attrs.size();
+	size_t queued = root;
+	size_t depth = 0;
+	auto enqueue = [&](GDecisionTreeNode* pNode, size_t link, size_t d) {
+		Item item = { pNode, link, d };
+		queue.push_back(item);
+		if(queued >= 0xffffffff)
+			throw Ex("Too many nodes to compile");
+		return (uint32_t)(queued++);
+	};
+	enqueue(tree.m_pRoot, 0, 0);
+	while(queue.size() > 0)
+	{
+		Item item = queue.front();
+		queue.pop_front();
+		uint32_t index = (uint32_t)m_attrs.size();
+		if(item.m_pNode->IsLeaf())
+		{
+			GDecisionTreeLeafNode* pLeaf = (GDecisionTreeLeafNode*)item.m_pNode;
+			m_attrs.push_back(0);
+			m_pivots.push_back(0.0);
+			m_flags.push_back(0);
+			m_children.push_back(index);
+			m_children.push_back(index);
+			m_leafValues.push_back((uint32_t)m_values.size());
+			for(size_t i = 0; i < labelDims; i++)
+				m_values.push_back(pLeaf->m_pOutputValues[i]);
+			depth = std::max(depth, item.m_depth);
+			continue;
+		}
+		GDecisionTreeInteriorNode* pInterior = (GDecisionTreeInteriorNode*)item.m_pNode;
+		size_t attr = pInterior->m_nAttribute;
+		size_t def = pInterior->m_defaultChild;
+		size_t k = pInterior->m_nChildren;
+		GDecisionTreeNode** ppChildren = pInterior->m_ppChildren;
+		double pivot;
+		uint8_t flags;
+		GDecisionTreeNode* pPass;
+		GDecisionTreeNode* pFail;
+		size_t failLink = 0;
+		if(featureRel.valueCount(attr) == 0)
+		{
+			pivot = pInterior->m_dPivot;
+			flags = (def == 0 ? 2 : 0);
+			pPass = ppChildren[0];
+			pFail = ppChildren[1];
+		}
+		else if(tree.m_binaryDivisions)
+		{
+			// (Unknown values are compared as if they were the default child index.)
+			pivot = (double)(int)pInterior->m_dPivot;
+			flags = 1 | ((int)def == (int)pInterior->m_dPivot ? 2 : 0);
+			pPass = ppChildren[0];
+			pFail = ppChildren[1];
+		}
+		else
+		{
+			size_t j = item.m_link;
+			pivot = (double)j;
+			flags = 1 | (def == j ? 2 : 0);
+			pPass = ppChildren[std::min(j, k - 1)];
+			if(j + 2 < k)
+			{
+				pFail = item.m_pNode;
+				failLink = j + 1;
+			}
+			else
+				pFail = ppChildren[k - 1];
+		}
+		m_attrs.push_back((uint32_t)attr);
+		m_pivots.push_back(pivot);
+		m_flags.push_back(flags);
+		m_leafValues.push_back(0);
+		uint32_t pass = enqueue(pPass, 0, item.m_depth + 1);
+		m_children.push_back(pass);
+		m_children.push_back(pPass == pFail ? pass : enqueue(pFail, failLink, item.m_depth + 1));
+	}
+	m_roots.push_back((uint32_t)root);
+	m_depths.push_back(depth);
+	m_weights.push_back(weight);
+}
+
+void GCompiledTrees::predictBlock(const double* const* ppRows, size_t count, double* pOut, uint32_t* pNodes, double* pBallots) const
+{
+	size_t labelDims = m_pLabelRel->size();
+	const uint32_t* pAttrs = m_attrs.data();
+	const double* pPivots = m_pivots.data();
+	const uint8_t* pFlags = m_flags.data();
+	const uint32_t* pChildren = m_children.data();
+	size_t accumDims = m_accumulatorDims;
+	if(m_roots.size() > 1)
+	{
+		for(size_t i = 0; i < count * accumDims; i++)
+			pBallots[i] = 0.0;
+	}
+	for(size_t t = 0; t < m_roots.size(); t++)
+	{
+		// Step all of the rows down one level at a time. (Rows that reach a leaf stay there.)
+		for(size_t r = 0; r < count; r++)
+			pNodes[r] = m_roots[t];
+		for(size_t level = 0; level < m_depths[t]; level++)
+		{
+			for(size_t r = 0; r < count; r++)
+			{
+				uint32_t node = pNodes[r];
+				double x = ppRows[r][pAttrs[node]];
+				double pivot = pPivots[node];
+				unsigned int flags = pFlags[node];
+				unsigned int equality = flags & 1;
+				unsigned int pass = equality ? (x == pivot) : (x < pivot);
+				unsigned int unknown = (x == UNKNOWN_REAL_VALUE) | (equality & (x < 0.0));
+				pass = unknown ? (flags >> 1) : pass;
+				pNodes[r] = pChildren[2 * node + 1 - pass];
+			}
+		}
+
+		// Collect the outputs
+		if(m_roots.size() == 1)
+		{
+			for(size_t r = 0; r < count; r++)
+			{
+				const double* pLeaf = m_values.data() + m_leafValues[pNodes[r]];
+				for(size_t i = 0; i < labelDims; i++)
+					pOut[r * labelDims + i] = pLeaf[i];
+			}
+			return;
+		}
+		double w = m_weights[t];
+		for(size_t r = 0; r < count; r++)
+		{
+			const double* pLeaf = m_values.data() + m_leafValues[pNodes[r]];
+			double* pBallot = pBallots + r * accumDims;
+			for(size_t i = 0; i < labelDims; i++)
+			{
+				size_t nValues = m_pLabelRel->valueCount(i);
+				if(nValues > 0)
+				{
+					int nVal = (int)pLeaf[i];
+					if(nVal >= 0 && nVal < (int)nValues)
+						pBallot[nVal] += w;
+					pBallot += nValues;
+				}
+				else
+					*(pBallot++) += w * pLeaf[i];
+			}
+		}
+	}
+
+	// Tally the votes the same way GEnsemble does
+	for(size_t r = 0; r < count; r++)
+	{
+		const double* pBallot = pBallots + r * accumDims;
+		for(size_t i = 0; i < labelDims; i++)
+		{
+			size_t nValues = m_pLabelRel->valueCount(i);
+			if(nValues > 0)
+			{
+				size_t best = 0;
+				for(size_t j = 1; j < nValues; j++)
+				{
+					if(pBallot[j] > pBallot[best])
+						best = j;
+				}
+				pOut[r * labelDims + i] = (double)best;
+				pBallot += nValues;
+			}
+			else
+				pOut[r * labelDims + i] = *(pBallot++);
+		}
+	}
+}
+
+void GCompiledTrees::predict(const GVec& in, GVec& out) const
+{
+	if(in.size() != m_featureDims)
+		throw Ex("Expected ", to_str(m_featureDims), " features, got ", to_str(in.size()));
+	out.resize(m_pLabelRel->size());
+	const double* pRow = in.data();
+	uint32_t node;
+	GVec ballot(m_accumulatorDims);
+	predictBlock(&pRow, 1, out.data(), &node, ballot.data());
+}
+
+void GCompiledTrees::predictBatch(const GMatrix& features, GMatrix& labels) const
+{
+	if(features.cols() != m_featureDims)
+		throw Ex("Expected ", to_str(m_featureDims), " features, got ", to_str(features.cols()));
+	size_t n = features.rows();
+	size_t labelDims = m_pLabelRel->size();
+	if(labels.rows() != n || labels.cols() != labelDims)
+		labels.resize(n, labelDims);
+	const size_t blockSize = 64;
+	size_t blocks = (n + blockSize - 1) / blockSize;
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	pool.parallelFor(0, blocks, [&](size_t b)
+	{
+		const double* rows[blockSize] = {};
+		uint32_t nodes[blockSize];
+		std::vector<double> out(blockSize * labelDims);
+		std::vector<double> ballots(blockSize * m_accumulatorDims);
+		size_t start = b * blockSize;
+		size_t count = std::min(blockSize, n - start);
+		for(size_t r = 0; r < count; r++)
+			rows[r] = features[start + r].data();
+		predictBlock(rows, count, out.data(), nodes, ballots.data());
+		for(size_t r = 0; r < count; r++)
+		{
+			GVec& lab = labels[start + r];
+			for(size_t i = 0; i < labelDims; i++)
+				lab[i] = out[r * labelDims + i];
+		}
+	});
+}
+
+// Throws if the compiled model disagrees with the original one on any row
+void GCompiledTrees_check(GSupervisedLearner& model, GCompiledTrees& compiled, const GMatrix& features)
+{
+	GMatrix batch;
+	compiled.predictBatch(features, batch);
+	GVec expected(model.relLabels().size());
+	GVec actual;
+	for(size_t i = 0; i < features.rows(); i++)
+	{
+		model.predict(features[i], expected);
+		compiled.predict(features[i], actual);
+		for(size_t j = 0; j < expected.size(); j++)
+		{
+			if(actual[j] != expected[j] || batch[i][j] != expected[j])
+				throw Ex("The compiled trees disagree with the original model");
+		}
+	}
+}
+
+// static
+void GCompiledTrees::test()
+{
+	// Make data with continuous and nominal features, and a nominal and a continuous label
+	GRand rand(0);
+	GMixedRelation* pFeatureRel = new GMixedRelation();
+	pFeatureRel->addAttrs(2, 0);
+	pFeatureRel->addAttrs(1, 4);
+	pFeatureRel->addAttrs(1, 3);
+	GMixedRelation* pLabelRel = new GMixedRelation();
+	pLabelRel->addAttrs(1, 3);
+	pLabelRel->addAttrs(1, 0);
+	GMatrix features(pFeatureRel);
+	GMatrix labels(pLabelRel);
+	GMatrix testFeatures(pFeatureRel->clone());
+	for(size_t i = 0; i < 1200; i++)
+	{
+		GMatrix& f = (i < 400 ? features : testFeatures);
+		GVec& row = f.newRow();
+		row[0] = rand.normal();
+		row[1] = rand.uniform();
+		row[2] = (double)rand.next(4);
+		row[3] = (double)rand.next(3);
+		if(i < 400)
+		{
+			GVec& lab = labels.newRow();
+			lab[0] = (row[0] + row[2] > 1.5 ? 2.0 : (row[3] == 1.0 ? 1.0 : 0.0));
+			lab[1] = row[0] * row[1] + row[2] - row[3] + 0.1 * rand.normal();
+		}
+		else
+		{
+			// Sprinkle unknown values into the test set
+			for(size_t j = 0; j < 4; j++)
+			{
+				if(rand.next(6) == 0)
+					row[j] = (j < 2 ? UNKNOWN_REAL_VALUE : UNKNOWN_DISCRETE_VALUE);
+			}
+		}
+	}
+
+	// Multi-way and binary divisions
+	for(size_t binary = 0; binary < 2; binary++)
+	{
+		GDecisionTree tree;
+		if(binary)
+			tree.useBinaryDivisions();
+		tree.train(features, labels);
+		GCompiledTrees compiled(tree);
+		GCompiledTrees_check(tree, compiled, testFeatures);
+	}
+
+	// A forest, evaluated serially and in parallel
+	GRandomForest forest(25);
+	forest.train(features, labels);
+	GCompiledTrees compiled(forest);
+	if(compiled.treeCount() != 25)
+		throw Ex("wrong number of trees");
+	GThreadPool serial(0);
+	GThreadPool pool(3);
+	compiled.setThreadPool(&serial);
+	GCompiledTrees_check(forest, compiled, testFeatures);
+	compiled.setThreadPool(&pool);
+	GCompiledTrees_check(forest, compiled, testFeatures);
 }
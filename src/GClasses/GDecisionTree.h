@@ -22,6 +22,7 @@
 
 #include "GLearner.h"
 #include <vector>
+#include <cstdint>
 
 namespace GClasses {
 
@@ -31,6 +32,9 @@ class GRand;
 class GMeanMarginsTreeNode;
 class GDecisionTreeLeafNode;
 class GBag;
+class GDecisionTreeHistogramBuilder;
+class GThreadPool;
+class GCompiledTrees;
 
 
 /// This is an efficient learning algorithm. It divides
@@ -38,6 +42,8 @@ class GBag;
 /// can make random divisions.
 class GDecisionTree : public GSupervisedLearner
 {
+friend class GDecisionTreeHistogramBuilder;
+friend class GCompiledTrees;
 public:
 	enum DivisionAlgorithm
 	{
@@ -52,6 +58,9 @@ protected:
 	size_t m_randomDraws;
 	size_t m_maxLevels;
 	bool m_binaryDivisions;
+	size_t m_histBins;
+	const std::vector< std::vector<double> >* m_pHistEdges;
+	GThreadPool* m_pPool;
 
 public:
 	/// General-purpose constructor. See also the comment for GSupervisedLearner::GSupervisedLearner.
@@ -88,6 +97,33 @@ public:
 	/// Returns true iff useBinaryDivisions was called.
 	bool isBinary() { return m_binaryDivisions; }
 
+	/// Specifies to find divisions with histograms instead of by splitting
+	/// copies of the data. Each continuous feature is quantized into at most
+	/// maxBins (<= 256) bins once, before training. Each node then accumulates
+	/// a histogram of label statistics per bin, and the histogram of the larger
+	/// child is obtained by subtracting that of the smaller child from its parent's.
+	/// The candidate pivots are the bin boundaries. This also implies useBinaryDivisions.
+	/// pSharedEdges optionally supplies bin boundaries computed with computeHistogramEdges,
+	/// so that ensembles only need to quantize once. The caller retains ownership of
+	/// pSharedEdges, and it must remain valid while this tree trains. Pass maxBins=0
+	/// to go back to the regular division finding.
+	void useHistogramSplits(size_t maxBins = 256, const std::vector< std::vector<double> >* pSharedEdges = NULL);
+
+	/// Returns the maximum number of bins used by histogram splits, or 0 if they are not used.
+	size_t histogramBins() { return m_histBins; }
+
+	/// Specifies the pool used to grow trees with histogram splits. Large nodes
+	/// build their histograms and evaluate attributes in parallel, and their
+	/// subtrees grow concurrently. The resulting tree is the same regardless of the
+	/// number of threads. If pPool is NULL (the default), GThreadPool::global() is used.
+	void setThreadPool(GThreadPool* pPool) { m_pPool = pPool; }
+
+	/// Computes the bin boundaries used by useHistogramSplits for each column in features.
+	/// Nominal columns receive no boundaries (each value is its own bin). Continuous
+	/// columns receive at most maxBins - 1 ascending boundaries, picked at quantiles
+	/// of the known values. A value x falls into bin b, where b is the number of boundaries <= x.
+	static void computeHistogramEdges(const GMatrix& features, size_t maxBins, std::vector< std::vector<double> >& edges);
+
 	/// Sets the leaf threshold. When the number of samples is <= this value,
 	/// it will no longer try to divide the data, but will create a leaf node.
 	/// The default value is 1. For noisy data, a larger value may be advantageous.
@@ -207,8 +243,12 @@ protected:
 
 class GRandomForest : public GSupervisedLearner
 {
+friend class GCompiledTrees;
 protected:
 	GBag* m_pEnsemble;
+	size_t m_histBins;
+	std::vector< std::vector<double> > m_histEdges;
+	GThreadPool* m_pPool;
 
 public:
 	GRandomForest(size_t trees, size_t samples = 1);
@@ -228,17 +268,106 @@ public:
 	/// better meta-data to make the print-out richer.
 	void print(std::ostream& stream, GArffRelation* pFeatureRel = NULL, GArffRelation* pLabelRel = NULL);
 
+	/// Specifies for all of the trees to find divisions with histograms. (See
+	/// GDecisionTree::useHistogramSplits.) The features are quantized once per
+	/// call to train, and the bin boundaries are shared by all of the trees.
+	void useHistogramSplits(size_t maxBins = 256);
+
+	/// Specifies the pool on which to train the trees. The trees train concurrently,
+	/// one per thread in the pool (plus the calling thread), and trees with histogram
+	/// splits also parallelize internally. The trained forest is the same regardless
+	/// of the number of threads. If pPool is NULL (the default), GThreadPool::global() is used.
+	void setThreadPool(GThreadPool* pPool);
+
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& pIn, GVec& pOut);
 
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& pIn, GPrediction* pOut);
 
+	/// Evaluates the trees in parallel on the pool given to setThreadPool.
+	/// (See GEnsemble::predictBatch.)
+	virtual void predictBatch(const GMatrix& features, GMatrix& labels);
+
+	/// Specifies whether predictBatch may stop evaluating trees for a row once its
+	/// predicted class is certain. (See GEnsemble::useEarlyExit.)
+	void useEarlyExit(bool b = true);
+
 protected:
 	/// See the comment for GSupervisedLearner::trainInner
 	virtual void trainInner(const GMatrix& features, const GMatrix& labels);
 };
 
+
+
+/// A read-only copy of a trained GDecisionTree or GRandomForest that is laid out
+/// for fast inference. The nodes of all the trees are stored breadth-first in flat
+/// arrays (the attribute, pivot, and flags of each node, and the indexes of its two
+/// children), so the levels near the roots share cache lines. Every node is a binary
+/// test: "x < pivot" for continuous attributes and "x == pivot" for nominal ones.
+/// Multi-way nominal divisions are compiled into chains of equality tests. Leaves
+/// point back to themselves, so a block of rows can descend a tree in lock-step
+/// without branching on the data, which lets the memory loads of many rows overlap.
+/// The predictions are identical to those of the model it was compiled from. The
+/// compiled copy does not depend on the model, which may be deleted or retrained.
+class GCompiledTrees
+{
+protected:
+	std::vector<uint32_t> m_attrs; // the attribute tested by each node (0 for leaves)
+	std::vector<double> m_pivots; // the value each node compares against
+	std::vector<uint8_t> m_flags; // bit 0: equality test, bit 1: unknown values pass the test
+	std::vector<uint32_t> m_children; // two per node: where to go if the test passes, and if it fails
+	std::vector<uint32_t> m_leafValues; // for each leaf, the offset of its outputs in m_values
+	std::vector<double> m_values; // the output values of all the leaves
+	std::vector<uint32_t> m_roots; // the index of the root node of each tree
+	std::vector<size_t> m_depths; // the number of tests on the longest path in each tree
+	std::vector<double> m_weights; // the voting weight of each tree
+	GRelation* m_pLabelRel;
+	size_t m_featureDims;
+	size_t m_accumulatorDims;
+	GThreadPool* m_pPool;
+
+public:
+	/// Compiles a trained decision tree.
+	GCompiledTrees(GDecisionTree& tree);
+
+	/// Compiles a trained random forest. The trees vote the same way GBag does.
+	GCompiledTrees(GRandomForest& forest);
+
+	~GCompiledTrees();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Returns the number of trees.
+	size_t treeCount() const { return m_roots.size(); }
+
+	/// Returns the total number of nodes in all of the trees, including the extra nodes
+	/// used to represent multi-way divisions.
+	size_t nodeCount() const { return m_attrs.size(); }
+
+	/// Specifies the pool on which predictBatch evaluates blocks of rows. If pPool is
+	/// NULL (the default), GThreadPool::global() is used.
+	void setThreadPool(GThreadPool* pPool) { m_pPool = pPool; }
+
+	/// Predicts the labels for one feature vector.
+	void predict(const GVec& in, GVec& out) const;
+
+	/// Predicts the labels for every row in features. If labels does not already have one
+	/// row per row of features and the right number of columns, it is resized. Blocks of
+	/// rows are evaluated in parallel.
+	void predictBatch(const GMatrix& features, GMatrix& labels) const;
+
+protected:
+	/// Appends the nodes of one tree.
+	void addTree(GDecisionTree& tree, double weight);
+
+	/// Predicts the labels for count rows. ppRows points to the rows, and pOut to
+	/// count consecutive output vectors. pNodes and pBallots are scratch buffers of
+	/// count and count * m_accumulatorDims elements.
+	void predictBlock(const double* const* ppRows, size_t count, double* pOut, uint32_t* pNodes, double* pBallots) const;
+};
+
 } // namespace GClasses
 
 #endif // __GDECISIONTREE_H__
@@ -21,9 +21,22 @@
 #include "GDistance.h"
 #include "GDom.h"
 #include "GVec.h"
+#include "GThread.h"
+#include "GRand.h"
 #include <math.h>
 #include <cassert>
 #include <memory>
+#if defined(__AVX2__) && defined(__FMA__)
+#	include <immintrin.h>
+#	define GDISTANCE_AVX2
+#	define GDISTANCE_AVX2_TARGET
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// Build the AVX2 kernel anyway, and pick it at runtime when the CPU supports it
+#	include <immintrin.h>
+#	define GDISTANCE_AVX2
+#	define GDISTANCE_AVX2_TARGET __attribute__((target("avx2,fma")))
+#	define GDISTANCE_DISPATCH
+#endif
 
 using std::map;
 
@@ -84,6 +97,23 @@ GDistanceMetric* GDistanceMetric::deserialize(GDomNode* pNode)
 	return NULL;
 }
 
+// virtual
+void GDistanceMetric::squaredDistances(const GVec& a, const GMatrix& b, const size_t* pRows, size_t count, double* pOut) const
+{
+	for(size_t i = 0; i < count; i++)
+		pOut[i] = squaredDistance(a, b.row(pRows ? pRows[i] : i));
+}
+
+void GDistanceMetric::squaredDistanceMatrix(const GMatrix& a, const GMatrix& b, GMatrix& out, GThreadPool* pPool) const
+{
+	out.resize(a.rows(), b.rows());
+	GThreadPool& pool = pPool ? *pPool : GThreadPool::global();
+	pool.parallelFor(0, a.rows(), [&](size_t i)
+	{
+		squaredDistances(a.row(i), b, NULL, b.rows(), out.row(i).data());
+	}, 8);
+}
+
 void GDistanceMetric_exerciseMetric(GDistanceMetric& metric)
 {
 	// Make two vectors
@@ -109,6 +139,132 @@ void GDistanceMetric_exerciseMetric(GDistanceMetric& metric)
 		throw Ex("failed");
 }
 
+// Checks the batch methods of a metric against a reference function of one pair
+template<class F>
+void GDistanceMetric_checkBatch(GDistanceMetric& metric, const GMatrix& data, F reference)
+{
+	std::vector<size_t> rows;
+	for(size_t i = data.rows(); i > 0; i -= 2)
+		rows.push_back(i - 1);
+	GVec out(data.rows());
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		const GVec& a = data[i];
+		metric.squaredDistances(a, data, out.data());
+		for(size_t j = 0; j < data.rows(); j++)
+		{
+			double expected = reference(a, data[j]);
+			if(std::abs(out[j] - expected) > 1e-9 * std::max(1.0, expected))
+				throw Ex("Batch distance mismatch for ", metric.name());
+			if(std::abs(metric.squaredDistance(a, data[j]) - expected) > 1e-9 * std::max(1.0, expected))
+				throw Ex("Distance mismatch for ", metric.name());
+		}
+		metric.squaredDistances(a, data, rows.data(), rows.size(), out.data());
+		for(size_t j = 0; j < rows.size(); j++)
+		{
+			if(std::abs(out[j] - metric.squaredDistance(a, data[rows[j]])) > 1e-9 * std::max(1.0, out[j]))
+				throw Ex("Indexed batch distance mismatch for ", metric.name());
+		}
+	}
+	GMatrix dists;
+	GThreadPool pool(2);
+	metric.squaredDistanceMatrix(data, data, dists, &pool);
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		for(size_t j = 0; j < data.rows(); j++)
+		{
+			if(std::abs(dists[i][j] - metric.squaredDistance(data[i], data[j])) > 1e-9 * std::max(1.0, dists[i][j]))
+				throw Ex("Distance matrix mismatch for ", metric.name());
+		}
+	}
+}
+
+void GDistanceMetric_testBatch()
+{
+	// Make continuous data with some unknown values, and a copy that also has nominal attributes
+	GRand rand(0);
+	GMatrix cont(40, 7);
+	for(size_t i = 0; i < cont.rows(); i++)
+	{
+		cont[i].fillNormal(rand);
+		if(rand.next(4) == 0)
+			cont[i][rand.next(7)] = UNKNOWN_REAL_VALUE;
+	}
+	GMixedRelation* pRel = new GMixedRelation();
+	pRel->addAttrs(7, 0);
+	pRel->addAttrs(2, 3);
+	GMatrix mixed(pRel);
+	mixed.newRows(cont.rows());
+	for(size_t i = 0; i < cont.rows(); i++)
+	{
+		mixed[i].copy(0, cont[i]);
+		mixed[i][7] = (double)rand.next(3);
+		mixed[i][8] = rand.next(5) == 0 ? UNKNOWN_DISCRETE_VALUE : (double)rand.next(3);
+	}
+
+	// A straightforward implementation of the formulas to compare against
+	double dwu = 0.7;
+	auto diff = [&](const GVec& a, const GVec& b, size_t i, const GVec& scale, double unk) {
+		if(i >= 7)
+			return ((int)a[i] == UNKNOWN_DISCRETE_VALUE || (int)b[i] == UNKNOWN_DISCRETE_VALUE) ? unk : ((int)a[i] == (int)b[i] ? 0.0 : 1.0);
+		if(a[i] == UNKNOWN_REAL_VALUE || b[i] == UNKNOWN_REAL_VALUE)
+			return unk;
+		return (b[i] - a[i]) * scale[i];
+	};
+	GVec scale(9);
+	scale.fillUniform(rand, 0.5, 2.0);
+	GVec ones(9);
+	ones.fill(1.0);
+	for(size_t m = 0; m < 2; m++)
+	{
+		const GMatrix& data = (m == 0 ? cont : mixed);
+		GRowDistance row;
+		row.setDiffWithUnknown(dwu);
+		row.init(&data.relation(), false);
+		for(size_t i = 0; i < data.cols(); i++)
+			row.scaleFactors()[i] = scale[i];
+		GDistanceMetric_checkBatch(row, data, [&](const GVec& a, const GVec& b) {
+			double sum = 0.0;
+			for(size_t i = 0; i < a.size(); i++)
+				sum += diff(a, b, i, scale, dwu) * diff(a, b, i, scale, dwu);
+			return sum;
+		});
+
+		// GLNormDistance always treats unknown nominal values as a difference of 1
+		double unk = (m == 0 ? dwu : 1.0);
+		double norms[] = { 1.0, 1.4, 2.0 };
+		for(size_t k = 0; k < 3; k++)
+		{
+			double norm = norms[k];
+			GLNormDistance lnorm(norm);
+			lnorm.setDiffWithUnknown(unk);
+			lnorm.init(&data.relation(), false);
+			GDistanceMetric_checkBatch(lnorm, data, [&](const GVec& a, const GVec& b) {
+				double sum = 0.0;
+				for(size_t i = 0; i < a.size(); i++)
+					sum += pow(std::abs(diff(a, b, i, ones, unk)), norm);
+				double d = pow(sum, 1.0 / norm);
+				return d * d;
+			});
+		}
+	}
+	GMatrix dense(30, 5);
+	for(size_t i = 0; i < dense.rows(); i++)
+		dense[i].fillNormal(rand);
+	dense[3].fill(0.0);
+	GDenseCosineDistance cosine;
+	cosine.init(&dense.relation(), false);
+	GDistanceMetric_checkBatch(cosine, dense, [](const GVec& a, const GVec& b) {
+		double denom = sqrt(a.squaredMagnitude() * b.squaredMagnitude());
+		return denom > 0.0 ? 1.0 - a.dotProduct(b) / denom : 1.0;
+	});
+	GKernelDistance kernel(new GKernelGaussianRBF(1.0), true);
+	kernel.init(&dense.relation(), false);
+	GDistanceMetric_checkBatch(kernel, dense, [](const GVec& a, const GVec& b) {
+		return 1.0 - exp(-0.5 * a.squaredDistance(b));
+	});
+}
+
 // static
 void GDistanceMetric::test()
 {
@@ -116,12 +272,13 @@ void GDistanceMetric::test()
 	GLNormDistance d2(1.4); GDistanceMetric_exerciseMetric(d2);
 	GDenseCosineDistance d3; GDistanceMetric_exerciseMetric(d3);
 	GKernelDistance d4(GKernel::kernelComplex1(), true); GDistanceMetric_exerciseMetric(d4);
+	GDistanceMetric_testBatch();
 }
 
 // --------------------------------------------------------------------
 
 GRowDistance::GRowDistance()
-: GDistanceMetric(), m_diffWithUnknown(1.0)
+: GDistanceMetric(), m_diffWithUnknown(1.0), m_continuous(false)
 {
 }
 
@@ -129,6 +286,7 @@ GRowDistance::GRowDistance(GDomNode* pNode)
 : GDistanceMetric(pNode)
 {
 	m_diffWithUnknown = pNode->getDouble("dwu");
+	m_continuous = m_pRelation->areContinuous();
 }
 
 // virtual
@@ -143,6 +301,72 @@ GDomNode* GRowDistance::serialize(GDom* pDoc) const
 void GRowDistance::init(const GRelation* pRelation, bool own)
 {
 	setRelation(pRelation, own);
+	m_continuous = pRelation && pRelation->areContinuous();
+}
+
+// Returns the sum of the squared, scaled differences between elements i through n-1 of two vectors,
+// added to sum. Each pair with an unknown value contributes dwu squared instead.
+inline double GRowDistance_tail(const double* pA, const double* pB, const double* pScale, size_t i, size_t n, double dwu, double sum)
+{
+	for( ; i < n; i++)
+	{
+		// Unknown values are zeroed before the subtraction so it cannot overflow
+		bool unk = (pA[i] == UNKNOWN_REAL_VALUE) | (pB[i] == UNKNOWN_REAL_VALUE);
+		double x = unk ? 0.0 : pA[i];
+		double y = unk ? 0.0 : pB[i];
+		double d = unk ? dwu : (y - x) * pScale[i];
+		sum += d * d;
+	}
+	return sum;
+}
+
+#ifdef GDISTANCE_AVX2
+// An AVX2/FMA version of GRowDistance_continuous
+GDISTANCE_AVX2_TARGET double GRowDistance_continuousAvx2(const double* pA, const double* pB, const double* pScale, size_t n, double dwu)
+{
+	size_t i = 0;
+	__m256d acc = _mm256_setzero_pd();
+	__m256d zero = _mm256_setzero_pd();
+	__m256d unknown = _mm256_set1_pd(UNKNOWN_REAL_VALUE);
+	__m256d diffWithUnknown = _mm256_set1_pd(dwu);
+	for( ; i + 4 <= n; i += 4)
+	{
+		__m256d x = _mm256_loadu_pd(pA + i);
+		__m256d y = _mm256_loadu_pd(pB + i);
+		__m256d unk = _mm256_or_pd(_mm256_cmp_pd(x, unknown, _CMP_EQ_OQ), _mm256_cmp_pd(y, unknown, _CMP_EQ_OQ));
+		x = _mm256_blendv_pd(x, zero, unk);
+		y = _mm256_blendv_pd(y, zero, unk);
+		__m256d d = _mm256_mul_pd(_mm256_sub_pd(y, x), _mm256_loadu_pd(pScale + i));
+		d = _mm256_blendv_pd(d, diffWithUnknown, unk);
+		acc = _mm256_fmadd_pd(d, d, acc);
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, acc);
+	return GRowDistance_tail(pA, pB, pScale, i, n, dwu, (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]));
+}
+#endif
+
+#ifdef GDISTANCE_DISPATCH
+bool GRowDistance_checkAvx2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+static const bool GRowDistance_hasAvx2 = GRowDistance_checkAvx2();
+#endif
+
+// Returns the sum of the squared, scaled differences between two vectors of n continuous values.
+// Each pair with an unknown value contributes dwu squared instead.
+inline double GRowDistance_continuous(const double* pA, const double* pB, const double* pScale, size_t n, double dwu)
+{
+#if defined(GDISTANCE_DISPATCH)
+	if(GRowDistance_hasAvx2)
+		return GRowDistance_continuousAvx2(pA, pB, pScale, n, dwu);
+#elif defined(GDISTANCE_AVX2)
+	return GRowDistance_continuousAvx2(pA, pB, pScale, n, dwu);
+#endif
+	return GRowDistance_tail(pA, pB, pScale, 0, n, dwu, 0.0);
 }
 
 // virtual
@@ -150,6 +374,8 @@ double GRowDistance::squaredDistance(const GVec& a, const GVec& b) const
 {
 	if(a.size() != m_pRelation->size() || b.size() != m_pRelation->size())
 		throw Ex("unexpected size");
+	if(m_continuous)
+		return GRowDistance_continuous(a.data(), b.data(), m_scaleFactors.data(), a.size(), m_diffWithUnknown);
 	double sum = 0;
 	size_t count = m_pRelation->size();
 	double d;
@@ -174,16 +400,34 @@ double GRowDistance::squaredDistance(const GVec& a, const GVec& b) const
 	return sum;
 }
 
+// virtual
+void GRowDistance::squaredDistances(const GVec& a, const GMatrix& b, const size_t* pRows, size_t count, double* pOut) const
+{
+	if(!m_continuous)
+	{
+		GDistanceMetric::squaredDistances(a, b, pRows, count, pOut);
+		return;
+	}
+	size_t n = m_pRelation->size();
+	if(a.size() != n || b.cols() != n)
+		throw Ex("unexpected size");
+	const double* pA = a.data();
+	const double* pScale = m_scaleFactors.data();
+	for(size_t i = 0; i < count; i++)
+		pOut[i] = GRowDistance_continuous(pA, b.row(pRows ? pRows[i] : i).data(), pScale, n, m_diffWithUnknown);
+}
+
 // --------------------------------------------------------------------
 
 GLNormDistance::GLNormDistance(double norm)
-: GDistanceMetric(), m_norm(norm), m_diffWithUnknown(1.0)
+: GDistanceMetric(), m_norm(norm), m_diffWithUnknown(1.0), m_continuous(false)
 {
 }
 
 GLNormDistance::GLNormDistance(GDomNode* pNode)
 : GDistanceMetric(pNode), m_norm(pNode->getDouble("norm")), m_diffWithUnknown(pNode->getDouble("dwu"))
 {
+	m_continuous = m_pRelation->areContinuous();
 }
 
 // virtual
@@ -199,6 +443,27 @@ GDomNode* GLNormDistance::serialize(GDom* pDoc) const
 void GLNormDistance::init(const GRelation* pRelation, bool own)
 {
 	setRelation(pRelation, own);
+	m_continuous = pRelation && pRelation->areContinuous();
+}
+
+// Returns the squared L-norm distance between two vectors of n continuous values
+inline double GLNormDistance_continuous(const double* pA, const double* pB, const double* pScale, size_t n, double dwu, double norm)
+{
+	if(norm == 2.0)
+		return GRowDistance_continuous(pA, pB, pScale, n, dwu);
+	double sum = 0.0;
+	for(size_t i = 0; i < n; i++)
+	{
+		bool unk = (pA[i] == UNKNOWN_REAL_VALUE) | (pB[i] == UNKNOWN_REAL_VALUE);
+		double x = unk ? 0.0 : pA[i];
+		double y = unk ? 0.0 : pB[i];
+		double d = std::abs(unk ? dwu : (y - x) * pScale[i]);
+		sum += (norm == 1.0 ? d : pow(d, norm));
+	}
+	if(norm == 1.0)
+		return sum * sum;
+	double d = pow(sum, 1.0 / norm);
+	return d * d;
 }
 
 // virtual
@@ -206,6 +471,8 @@ double GLNormDistance::squaredDistance(const GVec& a, const GVec& b) const
 {
 	if(a.size() != m_pRelation->size() || b.size() != m_pRelation->size())
 		throw Ex("unexpected size");
+	if(m_continuous)
+		return GLNormDistance_continuous(a.data(), b.data(), m_scaleFactors.data(), a.size(), m_diffWithUnknown, m_norm);
 	double sum = 0;
 	size_t count = m_pRelation->size();
 	double d;
@@ -231,6 +498,23 @@ double GLNormDistance::squaredDistance(const GVec& a, const GVec& b) const
 	return (d * d);
 }
 
+// virtual
+void GLNormDistance::squaredDistances(const GVec& a, const GMatrix& b, const size_t* pRows, size_t count, double* pOut) const
+{
+	if(!m_continuous)
+	{
+		GDistanceMetric::squaredDistances(a, b, pRows, count, pOut);
+		return;
+	}
+	size_t n = m_pRelation->size();
+	if(a.size() != n || b.cols() != n)
+		throw Ex("unexpected size");
+	const double* pA = a.data();
+	const double* pScale = m_scaleFactors.data();
+	for(size_t i = 0; i < count; i++)
+		pOut[i] = GLNormDistance_continuous(pA, b.row(pRows ? pRows[i] : i).data(), pScale, n, m_diffWithUnknown, m_norm);
+}
+
 // --------------------------------------------------------------------
 
 GDenseCosineDistance::GDenseCosineDistance()
@@ -278,6 +562,31 @@ double GDenseCosineDistance::squaredDistance(const GVec& a, const GVec& b) const
 
 }
 
+// virtual
+void GDenseCosineDistance::squaredDistances(const GVec& a, const GMatrix& b, const size_t* pRows, size_t count, double* pOut) const
+{
+	size_t n = m_pRelation->size();
+	if(a.size() != n || b.cols() != n)
+		throw Ex("unexpected size");
+
+	// The magnitude of a only needs to be computed once
+	const double* pA = a.data();
+	double sum_sq_a = a.squaredMagnitude();
+	for(size_t i = 0; i < count; i++)
+	{
+		const double* pB = b.row(pRows ? pRows[i] : i).data();
+		double sum_sq_b = 0.0;
+		double sum_co_prod = 0.0;
+		for(size_t j = 0; j < n; j++)
+		{
+			sum_sq_b += (pB[j] * pB[j]);
+			sum_co_prod += (pA[j] * pB[j]);
+		}
+		double denom = sqrt(sum_sq_a * sum_sq_b);
+		pOut[i] = (denom > 0.0 ? 1.0 - sum_co_prod / denom : 1.0);
+	}
+}
+
 // --------------------------------------------------------------------
 
 GKernelDistance::GKernelDistance(GKernel* pKernel, bool own)
@@ -345,6 +654,30 @@ GDomNode* GSparseSimilarity::baseDomNode(GDom* pDoc, const char* szClassName) co
 	return pNode;
 }
 
+void GSparseSimilarity_toMap(const uint32_t* pIndexes, const double* pValues, size_t n, map<size_t,double>& out)
+{
+	for(size_t i = 0; i < n; i++)
+		out.insert(out.end(), std::make_pair((size_t)pIndexes[i], pValues[i]));
+}
+
+// virtual
+double GSparseSimilarity::similarity(const uint32_t* pIndexes, const double* pValues, size_t n, const GVec& b)
+{
+	map<size_t,double> a;
+	GSparseSimilarity_toMap(pIndexes, pValues, n, a);
+	return similarity(a, b);
+}
+
+// virtual
+double GSparseSimilarity::similarity(const uint32_t* pIndexesA, const double* pValuesA, size_t nA, const uint32_t* pIndexesB, const double* pValuesB, size_t nB)
+{
+	map<size_t,double> a;
+	map<size_t,double> b;
+	GSparseSimilarity_toMap(pIndexesA, pValuesA, nA, a);
+	GSparseSimilarity_toMap(pIndexesB, pValuesB, nB, b);
+	return similarity(a, b);
+}
+
 // --------------------------------------------------------------------
 
 // virtual
@@ -440,6 +773,59 @@ double GCosineSimilarity::similarity(const GVec& a, const GVec& b)
 		return 0.0;
 }
 
+// virtual
+double GCosineSimilarity::similarity(const uint32_t* pIndexes, const double* pValues, size_t n, const GVec& b)
+{
+	if(n == 0)
+		return 0.0;
+	double sum_sq_a = 0.0;
+	double sum_sq_b = 0.0;
+	double sum_co_prod = 0.0;
+	for(size_t i = 0; i < n; i++)
+	{
+		double vb = b[pIndexes[i]];
+		sum_sq_a += (pValues[i] * pValues[i]);
+		sum_sq_b += (vb * vb);
+		sum_co_prod += (pValues[i] * vb);
+	}
+	double denom = sqrt(sum_sq_a * sum_sq_b) + m_regularizer;
+	if(denom > 0.0)
+		return sum_co_prod / denom;
+	else
+		return 0.0;
+}
+
+// virtual
+double GCosineSimilarity::similarity(const uint32_t* pIndexesA, const double* pValuesA, size_t nA, const uint32_t* pIndexesB, const double* pValuesB, size_t nB)
+{
+	// Like the map version, only the overlapping elements contribute
+	double sum_sq_a = 0.0;
+	double sum_sq_b = 0.0;
+	double sum_co_prod = 0.0;
+	size_t i = 0;
+	size_t j = 0;
+	while(i < nA && j < nB)
+	{
+		if(pIndexesA[i] < pIndexesB[j])
+			i++;
+		else if(pIndexesB[j] < pIndexesA[i])
+			j++;
+		else
+		{
+			double va = pValuesA[i++];
+			double vb = pValuesB[j++];
+			sum_sq_a += (va * va);
+			sum_sq_b += (vb * vb);
+			sum_co_prod += (va * vb);
+		}
+	}
+	double denom = sqrt(sum_sq_a * sum_sq_b) + m_regularizer;
+	if(denom > 0.0)
+		return sum_co_prod / denom;
+	else
+		return 0.0;
+}
+
 // --------------------------------------------------------------------
 
 // virtual
@@ -24,11 +24,13 @@
 #include "GMatrix.h"
 #include <map>
 #include <vector>
+#include <cstdint>
 #include "GKernelTrick.h"
 
 namespace GClasses {
 
 class GKernel;
+class GThreadPool;
 
 
 /// This class enables you to define a distance (or dissimilarity) metric between two vectors.
@@ -63,6 +65,23 @@ public:
 	/// Computes the squared distance (or squared dissimilarity) between the two specified vectors
 	virtual double squaredDistance(const GVec& a, const GVec& b) const = 0;
 
+	/// Computes the squared distances from a to count rows of b, and puts them in pOut.
+	/// If pRows is NULL, the rows are 0 through count-1. Otherwise, they are pRows[0] through pRows[count-1].
+	/// The default implementation calls squaredDistance for each row. Metrics override it with
+	/// kernels that avoid the per-pair virtual call and per-element attribute checks.
+	virtual void squaredDistances(const GVec& a, const GMatrix& b, const size_t* pRows, size_t count, double* pOut) const;
+
+	/// Computes the squared distances from a to every row of b, and puts them in pOut.
+	void squaredDistances(const GVec& a, const GMatrix& b, double* pOut) const
+	{
+		squaredDistances(a, b, NULL, b.rows(), pOut);
+	}
+
+	/// Computes the squared distance between every row of a and every row of b.
+	/// out is resized to a.rows() x b.rows(). The rows of a are spread across pPool, or across
+	/// GThreadPool::global() if pPool is NULL.
+	void squaredDistanceMatrix(const GMatrix& a, const GMatrix& b, GMatrix& out, GThreadPool* pPool = NULL) const;
+
 	/// Return squaredDistance(pA, pB).  Allows dissimilarity metrics to
 	/// be used as function objects.  Do not override.  Override
 	/// squaredDistance(pA,pB) instead.  See GDistanceMetric::squaredDistance(const GVec&, const GVec&)
@@ -99,6 +118,7 @@ class GRowDistance : public GDistanceMetric
 {
 protected:
 	double m_diffWithUnknown;
+	bool m_continuous; // true iff every attribute is continuous
 
 public:
 	GRowDistance();
@@ -117,6 +137,11 @@ public:
 	/// Returns the distance between a and b
 	virtual double squaredDistance(const GVec& a, const GVec& b) const;
 
+	using GDistanceMetric::squaredDistances;
+
+	/// See the comment for GDistanceMetric::squaredDistances
+	virtual void squaredDistances(const GVec& a, const GMatrix& b, const size_t* pRows, size_t count, double* pOut) const;
+
 	/// Specify the difference to use when one or more of the values is unknown.
 	/// (If your data contains unknown values, you may want to normalize the
 	/// known values to fall within some pre-determined range, so that it will
@@ -135,6 +160,7 @@ class GLNormDistance : public GDistanceMetric
 protected:
 	double m_norm;
 	double m_diffWithUnknown;
+	bool m_continuous; // true iff every attribute is continuous
 
 public:
 	GLNormDistance(double norm);
@@ -153,6 +179,11 @@ public:
 	/// Returns the distance (using the norm passed to the constructor) between pA and pB
 	virtual double squaredDistance(const GVec& a, const GVec& b) const;
 
+	using GDistanceMetric::squaredDistances;
+
+	/// See the comment for GDistanceMetric::squaredDistances
+	virtual void squaredDistances(const GVec& a, const GMatrix& b, const size_t* pRows, size_t count, double* pOut) const;
+
 	/// Specify the difference to use when one or more of the values is unknown.
 	/// (If your data contains unknown values, you may want to normalize the
 	/// known values to fall within some pre-determined range, so that it will
@@ -182,6 +213,11 @@ public:
 
 	/// Returns the distance (using the norm passed to the constructor) between pA and pB
 	virtual double squaredDistance(const GVec& a, const GVec& b) const;
+
+	using GDistanceMetric::squaredDistances;
+
+	/// See the comment for GDistanceMetric::squaredDistances
+	virtual void squaredDistances(const GVec& a, const GMatrix& b, const size_t* pRows, size_t count, double* pOut) const;
 };
 
 
@@ -240,6 +276,15 @@ public:
 	/// Computes the similarity between two dense vectors
 	virtual double similarity(const GVec& a, const GVec& b) = 0;
 
+	/// Computes the similarity between a compressed sparse vector (sorted column
+	/// indexes and their values, as stored by GCompressedSparseMatrix) and a dense vector.
+	/// The default implementation converts to a map, so subclasses should override it.
+	virtual double similarity(const uint32_t* pIndexes, const double* pValues, size_t n, const GVec& b);
+
+	/// Computes the similarity between two compressed sparse vectors.
+	/// The default implementation converts to maps, so subclasses should override it.
+	virtual double similarity(const uint32_t* pIndexesA, const double* pValuesA, size_t nA, const uint32_t* pIndexesB, const double* pValuesB, size_t nB);
+
 	/// Load from a DOM.
 	static GSparseSimilarity* deserialize(GDomNode* pNode);
 
@@ -268,6 +313,12 @@ public:
 
 	/// Computes the similarity between two dense vectors
 	virtual double similarity(const GVec& a, const GVec& b);
+
+	/// Computes the similarity between a compressed sparse vector and a dense vector
+	virtual double similarity(const uint32_t* pIndexes, const double* pValues, size_t n, const GVec& b);
+
+	/// Computes the similarity between two compressed sparse vectors
+	virtual double similarity(const uint32_t* pIndexesA, const double* pValuesA, size_t nA, const uint32_t* pIndexesB, const double* pValuesB, size_t nB);
 };
 
 
@@ -290,6 +341,8 @@ public:
 
 	/// Computes the similarity between two dense vectors
 	virtual double similarity(const GVec& a, const GVec& b);
+
+	using GSparseSimilarity::similarity;
 };
 
 
@@ -315,6 +368,8 @@ public:
 
 	/// Computes the similarity between two dense vectors
 	virtual double similarity(const GVec& a, const GVec& b);
+
+	using GSparseSimilarity::similarity;
 };
 
 
@@ -31,6 +31,14 @@
 #include <errno.h>
 #include "GTokenizer.h"
 #include "GString.h"
+#include <memory>
+#include <stdint.h>
+#ifndef WINDOWS
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
 
 
 namespace GClasses {
@@ -60,6 +68,39 @@ public:
 	GDomListItem* m_pPrev;
 };
 
+#define GDOM_BINARY_SIGNATURE "GDomBin1"
+#define GDOM_BINARY_ALIGN 64
+#define GDOM_BINARY_SMALL_ALIGN 8
+#define GDOM_BINARY_SMALL_ARRAY 32 // Arrays with fewer items than this are only aligned to 8 bytes, so that short rows don't waste space on padding
+
+// Returns the alignment of a raw array with the specified number of items
+size_t GDom_arrayAlignment(size_t count)
+{
+	return count < GDOM_BINARY_SMALL_ARRAY ? GDOM_BINARY_SMALL_ALIGN : GDOM_BINARY_ALIGN;
+}
+
+// Converts between native and little-endian byte order. (The conversion is its own inverse.)
+uint64_t GDom_littleEndian(uint64_t n)
+{
+	uint16_t probe = 1;
+	if(*(unsigned char*)&probe == 1)
+		return n;
+	uint64_t swapped = 0;
+	for(size_t i = 0; i < 8; i++)
+	{
+		swapped = (swapped << 8) | (n & 0xff);
+		n >>= 8;
+	}
+	return swapped;
+}
+
+/// The size of a node that carries the specified number of payload bytes
+#define GDOMNODE_SIZE(payload) (offsetof(GDomNode, m_value) + (payload))
+
+/// The storage behind a list node. Lists loaded from the raw arrays of a binary
+/// document keep pointing at the array (which the GDom keeps alive) until something
+/// asks for the item nodes, so reading numbers straight through a GDomListIterator
+/// costs no allocation. Unpacking is not thread-safe.
 class GDomArrayList
 {
 public:
@@ -67,8 +108,66 @@ public:
 	size_t m_size;
 	size_t m_capacity;
 
-	/// The items in the list
-	GDomNode* m_items[2]; // 2 is a bogus value
+	/// The items in the list. NULL until a packed list is unpacked.
+	GDomNode** m_items;
+
+	/// A raw little-endian array of 64-bit values, or NULL if this list was not loaded from one
+	const char* m_pPacked;
+
+	/// The document that owns this list, used to allocate nodes when a packed list is unpacked
+	GDom* m_pDoc;
+
+	/// GDomNode::type_double or GDomNode::type_int, the type of the values in m_pPacked
+	char m_packedType;
+
+	/// Returns true iff the values are still only in the raw array
+	bool isPacked() const
+	{
+		return !m_items;
+	}
+
+	/// Returns the raw bits of the specified value in the packed array
+	uint64_t packedBits(size_t index) const
+	{
+		uint64_t n;
+		memcpy(&n, m_pPacked + sizeof(uint64_t) * index, sizeof(uint64_t));
+		return GDom_littleEndian(n);
+	}
+
+	/// Returns the specified value in the packed array as a double
+	double packedDouble(size_t index) const
+	{
+		uint64_t n = packedBits(index);
+		if(m_packedType == GDomNode::type_int)
+			return (double)(long long)n;
+		double d;
+		memcpy(&d, &n, sizeof(double));
+		return d;
+	}
+
+	/// Returns the item nodes, making them first if this list is still packed
+	GDomNode** items()
+	{
+		if(m_items)
+			return m_items;
+		size_t nodeSize = GDOMNODE_SIZE(sizeof(uint64_t));
+		GHeap* pHeap = m_pDoc->heap();
+		GDomNode** pItems = (GDomNode**)pHeap->allocAligned(sizeof(GDomNode*) * m_size);
+		char* pNodes = pHeap->allocAligned(nodeSize * m_size);
+		for(size_t i = 0; i < m_size; i++)
+		{
+			GDomNode* pItem = (GDomNode*)(pNodes + nodeSize * i);
+			uint64_t n = packedBits(i);
+			pItem->m_type = m_packedType;
+			if(m_packedType == GDomNode::type_double)
+				memcpy(&pItem->m_value.m_double, &n, sizeof(double));
+			else
+				pItem->m_value.m_int = (long long)n;
+			pItems[i] = pItem;
+		}
+		m_items = pItems;
+		return m_items;
+	}
 };
 
 
@@ -90,7 +189,7 @@ GDomNode* GDomListIterator::current()
 	if(!m_pList->m_value.m_pArrayList)
 		return nullptr;
 	if(m_index < m_pList->m_value.m_pArrayList->m_size)
-		return m_pList->m_value.m_pArrayList->m_items[m_index];
+		return m_pList->m_value.m_pArrayList->items()[m_index];
 	else
 		return nullptr;
 }
@@ -102,11 +201,17 @@ bool GDomListIterator::currentBool()
 
 long long GDomListIterator::currentInt()
 {
+	GDomArrayList* pList = m_pList->m_value.m_pArrayList;
+	if(pList && pList->isPacked() && pList->m_packedType == GDomNode::type_int && m_index < pList->m_size)
+		return (long long)pList->packedBits(m_index);
 	return current()->asInt();
 }
 
 double GDomListIterator::currentDouble()
 {
+	GDomArrayList* pList = m_pList->m_value.m_pArrayList;
+	if(pList && pList->isPacked() && m_index < pList->m_size)
+		return pList->packedDouble(m_index);
 	return current()->asDouble();
 }
 
@@ -170,7 +275,7 @@ GDomNode* GDomNode::get(size_t index) const
 {
 	GAssert(m_type == type_list);
 	GAssert(index < m_value.m_pArrayList->m_size);
-	return m_value.m_pArrayList->m_items[index];
+	return m_value.m_pArrayList->items()[index];
 }
 
 GDomNode* GDomNode::set(GDom* pDoc, const char* szName, GDomNode* pNode)
@@ -203,7 +308,7 @@ GDomNode* GDomNode::set(GDom* pDoc, size_t index, GDomNode* pNode)
 		return add(pDoc, pNode);
 	else if(index < m_value.m_pArrayList->m_size)
 	{
-		m_value.m_pArrayList->m_items[index] = pNode;
+		m_value.m_pArrayList->items()[index] = pNode;
 		return pNode;
 	}
 	else
@@ -256,19 +361,17 @@ GDomNode* GDomNode::add(GDom* pDoc, GDomNode* pNode)
 	{
 		// Reallocate the array of node pointers
 		size_t newCapacity = std::max((size_t)4, (m_value.m_pArrayList ? m_value.m_pArrayList->m_size * 2 : 0));
-		GDomArrayList* pArrayList = (GDomArrayList*)pDoc->m_heap.allocAligned(sizeof(size_t) + sizeof(size_t) + sizeof(GDomNode*) * newCapacity);
+		GDomArrayList* pArrayList = pDoc->newArrayList(newCapacity);
 		if(m_value.m_pArrayList)
 		{
+			GDomNode** pOldItems = m_value.m_pArrayList->items();
 			for(size_t i = 0; i < m_value.m_pArrayList->m_size; i++)
-				pArrayList->m_items[i] = m_value.m_pArrayList->m_items[i];
+				pArrayList->m_items[i] = pOldItems[i];
 			pArrayList->m_size = m_value.m_pArrayList->m_size;
 		}
-		else
-			pArrayList->m_size = 0;
-		pArrayList->m_capacity = newCapacity;
 		m_value.m_pArrayList = pArrayList;
 	}
-	m_value.m_pArrayList->m_items[m_value.m_pArrayList->m_size] = pNode;
+	m_value.m_pArrayList->items()[m_value.m_pArrayList->m_size] = pNode;
 	m_value.m_pArrayList->m_size++;
 	return pNode;
 }
@@ -327,8 +430,9 @@ void GDomNode::del(size_t index)
 		throw Ex(to_str_brief(*this), " is not a list");
 	if(index >= m_value.m_pArrayList->m_size)
 		throw Ex("Index out of range. Index ", to_str(index), ". Size ", to_str(m_value.m_pArrayList->m_size));
+	GDomNode** pItems = m_value.m_pArrayList->items();
 	for(size_t i = index; i + 1 < m_value.m_pArrayList->m_size; i++)
-		m_value.m_pArrayList->m_items[i] = m_value.m_pArrayList->m_items[i + 1];
+		pItems[i] = pItems[i + 1];
 	m_value.m_pArrayList->m_size--;
 }
 
@@ -435,11 +539,11 @@ void GDomNode::writeJson(std::ostream& stream) const
 			if(m_value.m_pArrayList)
 			{
 				if(m_value.m_pArrayList->m_size > 0)
-					m_value.m_pArrayList->m_items[0]->writeJson(stream);
+					m_value.m_pArrayList->items()[0]->writeJson(stream);
 				for(size_t i = 1; i < m_value.m_pArrayList->m_size; i++)
 				{
 					stream << ",";
-					m_value.m_pArrayList->m_items[i]->writeJson(stream);
+					m_value.m_pArrayList->items()[i]->writeJson(stream);
 				}
 			}
 			stream << "]";
@@ -502,7 +606,7 @@ void GDomNode::writeJsonPretty(std::ostream& stream, size_t indents) const
 						allAtomic = false;
 					for(size_t i = 0; i < m_value.m_pArrayList->m_size && allAtomic; i++)
 					{
-						GDomNode* pNode = m_value.m_pArrayList->m_items[i];
+						GDomNode* pNode = m_value.m_pArrayList->items()[i];
 						if(pNode->type() == GDomNode::type_obj || pNode->type() == GDomNode::type_list)
 							allAtomic = false;
 					}
@@ -523,7 +627,7 @@ void GDomNode::writeJsonPretty(std::ostream& stream, size_t indents) const
 								if(i % 100 == 0)
 									newLineAndIndent(stream, indents);
 							}
-							GDomNode* pNode = m_value.m_pArrayList->m_items[i];
+							GDomNode* pNode = m_value.m_pArrayList->items()[i];
 							pNode->writeJson(stream);
 						}
 					}
@@ -536,7 +640,7 @@ void GDomNode::writeJsonPretty(std::ostream& stream, size_t indents) const
 					stream << "[";
 					for(size_t i = 0; i < m_value.m_pArrayList->m_size; i++)
 					{
-						GDomNode* pNode = m_value.m_pArrayList->m_items[i];
+						GDomNode* pNode = m_value.m_pArrayList->items()[i];
 						newLineAndIndent(stream, indents + 1);
 						pNode->writeJsonPretty(stream, indents + 1);
 						if(i + 1 < m_value.m_pArrayList->m_size)
@@ -616,7 +720,7 @@ size_t GDomNode::writeJsonCpp(std::ostream& stream, size_t col) const
 						stream << "\"\n\"";
 						col = 0;
 					}
-					col = m_value.m_pArrayList->m_items[i]->writeJsonCpp(stream, col);
+					col = m_value.m_pArrayList->items()[i]->writeJsonCpp(stream, col);
 				}
 			}
 			stream << "]";
@@ -730,7 +834,7 @@ void GDomNode::writeXml(std::ostream& stream, const char* szLabel) const
 			{
 				for(size_t i = 0; i < m_value.m_pArrayList->m_size; i++)
 				{
-					GDomNode* pNode = m_value.m_pArrayList->m_items[i];
+					GDomNode* pNode = m_value.m_pArrayList->items()[i];
 					pNode->writeXml(stream, "i");
 				}
 			}
@@ -766,6 +870,121 @@ void GDomNode::writeXml(std::ostream& stream, const char* szLabel) const
 	}
 }
 
+void GDom_writeBytes(std::ostream& stream, size_t& pos, const void* pBytes, size_t len)
+{
+	stream.write((const char*)pBytes, len);
+	pos += len;
+}
+
+void GDom_writeUint64(std::ostream& stream, size_t& pos, uint64_t n)
+{
+	n = GDom_littleEndian(n);
+	GDom_writeBytes(stream, pos, &n, sizeof(uint64_t));
+}
+
+void GDom_writeDouble(std::ostream& stream, size_t& pos, double d)
+{
+	uint64_t n;
+	memcpy(&n, &d, sizeof(double));
+	GDom_writeUint64(stream, pos, n);
+}
+
+void GDomNode::writeBinary(std::ostream& stream, size_t& pos) const
+{
+	switch(m_type)
+	{
+		case type_obj:
+			{
+				vector<GDomObjField*> fields;
+				for(GDomObjField* pField = m_value.m_pLastField; pField; pField = pField->m_pPrev)
+					fields.push_back(pField);
+				GDom_writeBytes(stream, pos, "o", 1);
+				GDom_writeUint64(stream, pos, fields.size());
+				for(size_t i = fields.size(); i > 0; i--)
+				{
+					GDomObjField* pField = fields[i - 1];
+					size_t len = strlen(pField->m_pName);
+					GDom_writeUint64(stream, pos, len);
+					GDom_writeBytes(stream, pos, pField->m_pName, len);
+					pField->m_pValue->writeBinary(stream, pos);
+				}
+			}
+			break;
+		case type_list:
+			{
+				// Lists of uniformly-typed numbers are stored as raw arrays
+				size_t count = size();
+				GDomArrayList* pArrayList = m_value.m_pArrayList;
+				bool stillPacked = (count > 0 && pArrayList->isPacked());
+				char itemType = (stillPacked ? pArrayList->m_packedType : (count > 0 ? get((size_t)0)->m_type : (char)type_null));
+				bool packed = (itemType == type_double || itemType == type_int);
+				for(size_t i = 1; i < count && packed && !stillPacked; i++)
+				{
+					if(get(i)->m_type != itemType)
+						packed = false;
+				}
+				if(packed)
+				{
+					GDom_writeBytes(stream, pos, itemType == type_double ? "D" : "I", 1);
+					GDom_writeUint64(stream, pos, count);
+					char zeros[GDOM_BINARY_ALIGN];
+					memset(zeros, 0, GDOM_BINARY_ALIGN);
+					size_t align = GDom_arrayAlignment(count);
+					GDom_writeBytes(stream, pos, zeros, (align - pos % align) % align);
+					if(stillPacked)
+					{
+						// The array is already in the binary layout
+						GDom_writeBytes(stream, pos, pArrayList->m_pPacked, sizeof(uint64_t) * count);
+						break;
+					}
+					vector<uint64_t> buf(count);
+					for(size_t i = 0; i < count; i++)
+					{
+						const GDomNode* pItem = get(i);
+						if(itemType == type_double)
+							memcpy(&buf[i], &pItem->m_value.m_double, sizeof(double));
+						else
+							buf[i] = (uint64_t)pItem->m_value.m_int;
+						buf[i] = GDom_littleEndian(buf[i]);
+					}
+					GDom_writeBytes(stream, pos, buf.data(), sizeof(uint64_t) * count);
+				}
+				else
+				{
+					GDom_writeBytes(stream, pos, "l", 1);
+					GDom_writeUint64(stream, pos, count);
+					for(size_t i = 0; i < count; i++)
+						get(i)->writeBinary(stream, pos);
+				}
+			}
+			break;
+		case type_bool:
+			GDom_writeBytes(stream, pos, m_value.m_bool ? "t" : "f", 1);
+			break;
+		case type_int:
+			GDom_writeBytes(stream, pos, "i", 1);
+			GDom_writeUint64(stream, pos, (uint64_t)m_value.m_int);
+			break;
+		case type_double:
+			GDom_writeBytes(stream, pos, "d", 1);
+			GDom_writeDouble(stream, pos, m_value.m_double);
+			break;
+		case type_string:
+			{
+				size_t len = strlen(m_value.m_string);
+				GDom_writeBytes(stream, pos, "s", 1);
+				GDom_writeUint64(stream, pos, len);
+				GDom_writeBytes(stream, pos, m_value.m_string, len);
+			}
+			break;
+		case type_null:
+			GDom_writeBytes(stream, pos, "n", 1);
+			break;
+		default:
+			throw Ex("Unrecognized node type");
+	}
+}
+
 bool GDomNode::isEqual(const GDomNode* pOther) const
 {
 	switch(m_type)
@@ -845,7 +1064,7 @@ bool GDomNode::isEqual(const GDomNode* pOther) const
 				return false;
 
 		case type_null:
-			if(pOther->m_type != type_bool)
+			if(pOther->m_type != type_null)
 				return false;
 			else
 				return true;
@@ -870,13 +1089,6 @@ public:
 	virtual ~GJsonTokenizer() {}
 };
 
-class Bogus1
-{
-public:
-	char m_type;
-	double m_double;
-};
-
 GDom::GDom()
 : m_heap(2000), m_pRoot(NULL), m_line(0), m_len(0), m_pDoc(NULL)
 {
@@ -884,17 +1096,28 @@ GDom::GDom()
 
 GDom::~GDom()
 {
+	releaseMaps();
 }
 
 void GDom::clear()
 {
 	m_pRoot = nullptr;
 	m_heap.clear();
+	releaseMaps();
+}
+
+void GDom::releaseMaps()
+{
+#ifndef WINDOWS
+	for(size_t i = 0; i < m_maps.size(); i++)
+		munmap(m_maps[i].first, m_maps[i].second);
+#endif
+	m_maps.clear();
 }
 
 GDomNode* GDom::newObj()
 {
-	GDomNode* pNewObj = (GDomNode*)m_heap.allocAligned(offsetof(Bogus1, m_double) + sizeof(GDomObjField*));
+	GDomNode* pNewObj = (GDomNode*)m_heap.allocAligned(GDOMNODE_SIZE(sizeof(GDomObjField*)));
 	pNewObj->m_type = GDomNode::type_obj;
 	pNewObj->m_value.m_pLastField = nullptr;
 	return pNewObj;
@@ -902,7 +1125,7 @@ GDomNode* GDom::newObj()
 
 GDomNode* GDom::newList()
 {
-	GDomNode* pNewList = (GDomNode*)m_heap.allocAligned(offsetof(Bogus1, m_double) + sizeof(GDomListItem*));
+	GDomNode* pNewList = (GDomNode*)m_heap.allocAligned(GDOMNODE_SIZE(sizeof(GDomListItem*)));
 	pNewList->m_type = GDomNode::type_list;
 	pNewList->m_value.m_pArrayList = nullptr;
 	return pNewList;
@@ -910,14 +1133,14 @@ GDomNode* GDom::newList()
 
 GDomNode* GDom::newNull()
 {
-	GDomNode* pNewNull = (GDomNode*)m_heap.allocAligned(offsetof(Bogus1, m_double));
+	GDomNode* pNewNull = (GDomNode*)m_heap.allocAligned(GDOMNODE_SIZE(0));
 	pNewNull->m_type = GDomNode::type_null;
 	return pNewNull;
 }
 
 GDomNode* GDom::newBool(bool b)
 {
-	GDomNode* pNewBool = (GDomNode*)m_heap.allocAligned(offsetof(Bogus1, m_double) + sizeof(bool));
+	GDomNode* pNewBool = (GDomNode*)m_heap.allocAligned(GDOMNODE_SIZE(sizeof(bool)));
 	pNewBool->m_type = GDomNode::type_bool;
 	pNewBool->m_value.m_bool = b;
 	return pNewBool;
@@ -925,7 +1148,7 @@ GDomNode* GDom::newBool(bool b)
 
 GDomNode* GDom::newInt(long long n)
 {
-	GDomNode* pNewInt = (GDomNode*)m_heap.allocAligned(offsetof(Bogus1, m_double) + sizeof(long long));
+	GDomNode* pNewInt = (GDomNode*)m_heap.allocAligned(GDOMNODE_SIZE(sizeof(long long)));
 	pNewInt->m_type = GDomNode::type_int;
 	pNewInt->m_value.m_int = n;
 	return pNewInt;
@@ -935,7 +1158,7 @@ GDomNode* GDom::newDouble(double d)
 {
 	if(d >= -1.5e308 && d <= 1.5e308)
 	{
-		GDomNode* pNewDouble = (GDomNode*)m_heap.allocAligned(offsetof(Bogus1, m_double) + sizeof(double));
+		GDomNode* pNewDouble = (GDomNode*)m_heap.allocAligned(GDOMNODE_SIZE(sizeof(double)));
 		pNewDouble->m_type = GDomNode::type_double;
 		pNewDouble->m_value.m_double = d;
 		return pNewDouble;
@@ -949,7 +1172,7 @@ GDomNode* GDom::newDouble(double d)
 
 GDomNode* GDom::newString(const char* pString, size_t len)
 {
-	GDomNode* pNewString = (GDomNode*)m_heap.allocAligned(offsetof(Bogus1, m_double) + len + 1);
+	GDomNode* pNewString = (GDomNode*)m_heap.allocAligned(GDOMNODE_SIZE(len + 1));
 	pNewString->m_type = GDomNode::type_string;
 	memcpy(pNewString->m_value.m_string, pString, len);
 	pNewString->m_value.m_string[len] = '\0';
@@ -961,6 +1184,18 @@ GDomNode* GDom::newString(const char* szString)
 	return newString(szString, strlen(szString));
 }
 
+GDomArrayList* GDom::newArrayList(size_t capacity)
+{
+	GDomArrayList* pArrayList = (GDomArrayList*)m_heap.allocAligned(sizeof(GDomArrayList) + sizeof(GDomNode*) * capacity);
+	pArrayList->m_size = 0;
+	pArrayList->m_capacity = capacity;
+	pArrayList->m_items = (GDomNode**)(pArrayList + 1);
+	pArrayList->m_pPacked = NULL;
+	pArrayList->m_pDoc = this;
+	pArrayList->m_packedType = GDomNode::type_null;
+	return pArrayList;
+}
+
 GDomObjField* GDom::newField()
 {
 	return (GDomObjField*)m_heap.allocAligned(sizeof(GDomObjField));
@@ -1268,6 +1503,345 @@ std::string to_str(const GDom& doc)
 	return os.str();
 }
 
+/// Reads the values in a document in the binary format, with bounds checking
+class GDomBinaryReader
+{
+public:
+	const char* m_pStart;
+	const char* m_pPos;
+	const char* m_pEnd;
+
+	GDomBinaryReader(const char* pData, size_t len)
+	: m_pStart(pData), m_pPos(pData), m_pEnd(pData + len)
+	{
+	}
+
+	const char* take(size_t len)
+	{
+		if((size_t)(m_pEnd - m_pPos) < len)
+			throw Ex("Unexpected end of binary document at offset ", to_str(m_pPos - m_pStart));
+		const char* p = m_pPos;
+		m_pPos += len;
+		return p;
+	}
+
+	char readTag()
+	{
+		return *take(1);
+	}
+
+	uint64_t readUint64()
+	{
+		uint64_t n;
+		memcpy(&n, take(sizeof(uint64_t)), sizeof(uint64_t));
+		return GDom_littleEndian(n);
+	}
+
+	// Reads a count of items that each occupy at least minBytes, and makes sure they could fit
+	size_t readCount(size_t minBytes)
+	{
+		uint64_t n = readUint64();
+		if(minBytes > 0 && n > (uint64_t)(m_pEnd - m_pPos) / minBytes)
+			throw Ex("Invalid count at offset ", to_str(m_pPos - m_pStart));
+		return (size_t)n;
+	}
+
+	void skipPadding(size_t align)
+	{
+		take((align - (m_pPos - m_pStart) % align) % align);
+	}
+};
+
+GDomNode* GDom::loadBinaryValue(GDomBinaryReader& reader)
+{
+	char tag = reader.readTag();
+	switch(tag)
+	{
+		case 'o':
+			{
+				GDomNode* pObj = newObj();
+				size_t count = reader.readCount(9);
+				for(size_t i = 0; i < count; i++)
+				{
+					size_t len = reader.readCount(1);
+					const char* pName = reader.take(len);
+					GDomObjField* pField = newField();
+					pField->m_pName = m_heap.add(pName, len);
+					pField->m_pPrev = pObj->m_value.m_pLastField;
+					pObj->m_value.m_pLastField = pField;
+					pField->m_pValue = loadBinaryValue(reader);
+				}
+				return pObj;
+			}
+		case 'l':
+			{
+				GDomNode* pList = newList();
+				size_t count = reader.readCount(1);
+				for(size_t i = 0; i < count; i++)
+					pList->add(this, loadBinaryValue(reader));
+				return pList;
+			}
+		case 'D':
+		case 'I':
+			{
+				// Keep pointing at the array. Item nodes are only made if something asks for them.
+				size_t count = reader.readCount(sizeof(uint64_t));
+				reader.skipPadding(GDom_arrayAlignment(count));
+				const char* pArray = reader.take(sizeof(uint64_t) * count);
+				GDomNode* pList = newList();
+				if(count == 0)
+					return pList;
+				GDomArrayList* pArrayList = newArrayList(0);
+				pArrayList->m_size = count;
+				pArrayList->m_capacity = count;
+				pArrayList->m_items = NULL;
+				pArrayList->m_pPacked = pArray;
+				pArrayList->m_packedType = (tag == 'D' ? GDomNode::type_double : GDomNode::type_int);
+				pList->m_value.m_pArrayList = pArrayList;
+				return pList;
+			}
+		case 't': return newBool(true);
+		case 'f': return newBool(false);
+		case 'i': return newInt((long long)reader.readUint64());
+		case 'd':
+			{
+				uint64_t n = reader.readUint64();
+				double d;
+				memcpy(&d, &n, sizeof(double));
+				GDomNode* pDouble = (GDomNode*)m_heap.allocAligned(GDOMNODE_SIZE(sizeof(double)));
+				pDouble->m_type = GDomNode::type_double;
+				pDouble->m_value.m_double = d;
+				return pDouble;
+			}
+		case 's':
+			{
+				size_t len = reader.readCount(1);
+				return newString(reader.take(len), len);
+			}
+		case 'n': return newNull();
+		default:
+			throw Ex("Unexpected tag in binary document at offset ", to_str(reader.m_pPos - reader.m_pStart - 1));
+	}
+}
+
+// static
+bool GDom::isBinary(const char* pData, size_t len)
+{
+	size_t sigLen = strlen(GDOM_BINARY_SIGNATURE);
+	return len >= sigLen && memcmp(pData, GDOM_BINARY_SIGNATURE, sigLen) == 0;
+}
+
+void GDom::parseBinary(const char* pData, size_t len)
+{
+	if(!isBinary(pData, len))
+		throw Ex("This is not a binary GDom document");
+	char* pCopy = m_heap.allocAligned(len);
+	memcpy(pCopy, pData, len);
+	parseBinaryInPlace(pCopy, len);
+}
+
+void GDom::parseBinaryInPlace(const char* pData, size_t len)
+{
+	if(!isBinary(pData, len))
+		throw Ex("This is not a binary GDom document");
+	GDomBinaryReader reader(pData, len);
+	reader.take(strlen(GDOM_BINARY_SIGNATURE));
+	GDomNode* pRoot = loadBinaryValue(reader);
+	if(reader.m_pPos != reader.m_pEnd)
+		throw Ex("Unexpected data after the end of the binary document");
+	setRoot(pRoot);
+}
+
+void GDom::writeBinary(std::ostream& stream) const
+{
+	if(!m_pRoot)
+		throw Ex("No root node has been set");
+	size_t pos = 0;
+	GDom_writeBytes(stream, pos, GDOM_BINARY_SIGNATURE, strlen(GDOM_BINARY_SIGNATURE));
+	m_pRoot->writeBinary(stream, pos);
+}
+
+void GDom::saveBinary(const char* szFilename) const
+{
+	std::ofstream os;
+	os.exceptions(std::ios::badbit | std::ios::failbit);
+	try
+	{
+		os.open(szFilename, std::ios::binary);
+	}
+	catch(const std::exception&)
+	{
+		throw Ex("Error while trying to create the file, ", szFilename, ". ", strerror(errno));
+	}
+	writeBinary(os);
+}
+
+void GDom::loadBinary(const char* szFilename)
+{
+#ifdef WINDOWS
+	size_t len;
+	char* pData = GFile::loadFile(szFilename, &len);
+	std::unique_ptr<char[]> hData(pData);
+	parseBinary(pData, len);
+#else
+	int fd = open(szFilename, O_RDONLY);
+	if(fd < 0)
+		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		close(fd);
+		throw Ex("Error while trying to read the file, ", szFilename, ". ", strerror(errno));
+	}
+	size_t len = (size_t)st.st_size;
+	if(len == 0)
+	{
+		close(fd);
+		throw Ex("The file, ", szFilename, ", is empty");
+	}
+	void* pMap = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(pMap == MAP_FAILED)
+		throw Ex("Error while trying to map the file, ", szFilename, ". ", strerror(errno));
+	try
+	{
+		parseBinaryInPlace((const char*)pMap, len);
+	}
+	catch(...)
+	{
+		munmap(pMap, len);
+		throw;
+	}
+	m_maps.push_back(std::make_pair(pMap, len)); // The packed lists still point into the mapping
+#endif
+}
+
+void GDom::load(const char* szFilename)
+{
+	char sig[16];
+	std::ifstream is;
+	is.open(szFilename, std::ios::binary);
+	if(!is)
+		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
+	is.read(sig, strlen(GDOM_BINARY_SIGNATURE));
+	size_t got = (size_t)is.gcount();
+	is.close();
+	if(isBinary(sig, got))
+		loadBinary(szFilename);
+	else
+		loadJson(szFilename);
+}
+
+void GDom_testBinary(GDom& jsonDoc)
+{
+	// Add some lists that exercise the raw arrays
+	GDomNode* pRoot = jsonDoc.root();
+	GDomNode* pDoubles = pRoot->add(&jsonDoc, "weights", jsonDoc.newList());
+	for(size_t i = 0; i < 100; i++)
+		pDoubles->add(&jsonDoc, 1.0 / (i + 3.0));
+	pDoubles->add(&jsonDoc, -1e308);
+	GDomNode* pInts = pRoot->add(&jsonDoc, "indexes", jsonDoc.newList());
+	for(long long i = 0; i < 10; i++)
+		pInts->add(&jsonDoc, i * 1000000007LL - 3);
+	GDomNode* pMixed = pRoot->add(&jsonDoc, "mixed", jsonDoc.newList());
+	pMixed->add(&jsonDoc, 3.5);
+	pMixed->add(&jsonDoc, (long long)4);
+	pMixed->add(&jsonDoc, jsonDoc.newNull());
+	pRoot->add(&jsonDoc, "empty", jsonDoc.newList());
+
+	// Round-trip through memory
+	std::ostringstream os;
+	jsonDoc.writeBinary(os);
+	string bin = os.str();
+	if(!GDom::isBinary(bin.data(), bin.size()))
+		throw Ex("missing signature");
+	GDom binDoc;
+	binDoc.parseBinary(bin.data(), bin.size());
+	if(!binDoc.root()->isEqual(jsonDoc.root()) || !jsonDoc.root()->isEqual(binDoc.root()))
+		throw Ex("binary round trip failed");
+	GDomNode* pWeights = binDoc.root()->get("weights");
+	if(pWeights->size() != 101 || pWeights->get(7)->asDouble() != 1.0 / 10.0 || pWeights->get(100)->asDouble() != -1e308)
+		throw Ex("doubles lost precision");
+	if(binDoc.root()->get("indexes")->get(9)->asInt() != 9 * 1000000007LL - 3)
+		throw Ex("wrong int");
+	if(strcmp(binDoc.root()->getString("name"), "Bob\nis\\cool") != 0)
+		throw Ex("wrong string");
+	binDoc.root()->get("weights")->add(&binDoc, 2.0); // lists loaded from arrays must still grow
+	if(binDoc.root()->get("weights")->size() != 102)
+		throw Ex("failed to grow");
+
+	// Numbers are read straight from the raw arrays, which write back out unchanged
+	GDom packedDoc;
+	packedDoc.parseBinary(bin.data(), bin.size());
+	GDomListIterator itWeights(packedDoc.root()->get("weights"));
+	for(size_t i = 0; i < 100; i++)
+	{
+		if(itWeights.currentDouble() != 1.0 / (i + 3.0))
+			throw Ex("wrong packed double");
+		itWeights.advance();
+	}
+	GDomListIterator itIndexes(packedDoc.root()->get("indexes"));
+	if(itIndexes.currentInt() != -3 || itIndexes.currentDouble() != -3.0)
+		throw Ex("wrong packed int");
+	std::ostringstream os2;
+	packedDoc.writeBinary(os2);
+	if(os2.str() != bin)
+		throw Ex("packed lists changed");
+
+	// The raw array of weights is aligned
+	char header[9] = { 'D', 101, 0, 0, 0, 0, 0, 0, 0 };
+	size_t arrayPos = bin.find(string(header, 9));
+	if(arrayPos == string::npos)
+		throw Ex("could not find the array");
+	size_t payload = arrayPos + 9;
+	payload += (GDOM_BINARY_ALIGN - payload % GDOM_BINARY_ALIGN) % GDOM_BINARY_ALIGN;
+	uint64_t n;
+	memcpy(&n, bin.data() + payload, sizeof(uint64_t));
+	n = GDom_littleEndian(n);
+	double first;
+	memcpy(&first, &n, sizeof(double));
+	if(first != 1.0 / 3.0)
+		throw Ex("array is not where it should be");
+
+	// Corrupt documents are rejected
+	for(size_t len = 0; len < bin.size(); len += 7)
+	{
+		bool threw = false;
+		try
+		{
+			GDom bad;
+			bad.parseBinary(bin.data(), len);
+		}
+		catch(const std::exception&)
+		{
+			threw = true;
+		}
+		if(!threw)
+			throw Ex("failed to reject a truncated document");
+	}
+
+	// Round-trip through a file
+	char szFilename[256];
+	GFile::tempFilename(szFilename);
+	jsonDoc.saveBinary(szFilename);
+	GDom fileDoc;
+	try
+	{
+		fileDoc.load(szFilename);
+	}
+	catch(...)
+	{
+		GFile::deleteFile(szFilename);
+		throw;
+	}
+	GFile::deleteFile(szFilename);
+	GDomListIterator itFile(fileDoc.root()->get("weights"));
+	if(itFile.remaining() != 101 || itFile.currentDouble() != 1.0 / 3.0)
+		throw Ex("wrong mapped double");
+	if(!fileDoc.root()->isEqual(jsonDoc.root()))
+		throw Ex("file round trip failed");
+}
+
 // static
 void GDom::test()
 {
@@ -1302,6 +1876,7 @@ void GDom::test()
 		"}\n";
 	GDom doc;
 	doc.parseJson(szTestFile, strlen(szTestFile));
+	GDom_testBinary(doc);
 }
 
 
@@ -55,12 +55,12 @@ GDomNode* GWeightedModel::serialize(GDom* pDoc) const
 
 
 GEnsemble::GEnsemble()
-: GSupervisedLearner(), m_pLabelRel(NULL), m_workerThreads(1), m_pPredictMaster(NULL)
+: GSupervisedLearner(), m_pLabelRel(NULL), m_workerThreads(1), m_pPredictMaster(NULL), m_pPool(NULL), m_earlyExit(true)
 {
 }
 
 GEnsemble::GEnsemble(const GDomNode* pNode, GLearnerLoader& ll)
-: GSupervisedLearner(pNode), m_pPredictMaster(NULL)
+: GSupervisedLearner(pNode), m_pPredictMaster(NULL), m_pPool(NULL), m_earlyExit(true)
 {
 	m_pLabelRel = GRelation::deserialize(pNode->get("labelrel"));
 	size_t accumulatorDims = (size_t)pNode->getInt("accum");
@@ -140,6 +140,11 @@ void GEnsemble::normalizeWeights()
 }
 
 void GEnsemble::castVote(double weight, const GVec& out)
+{
+	castVote(weight, out, m_accumulator.data());
+}
+
+void GEnsemble::castVote(double weight, const GVec& out, double* pAccumulator) const
 {
 	size_t labelDims = m_pLabelRel->size();
 	size_t pos = 0;
@@ -150,15 +155,15 @@ void GEnsemble::castVote(double weight, const GVec& out)
 		{
 			int nVal = (int)out[i];
 			if(nVal >= 0 && nVal < (int)nValues)
-				m_accumulator[pos + nVal] += weight;
+				pAccumulator[pos + nVal] += weight;
 			pos += nValues;
 		}
 		else
 		{
 			double dVal = out[i];
-			m_accumulator[pos] += (weight * dVal);
+			pAccumulator[pos] += (weight * dVal);
 			pos++;
-			m_accumulator[pos] += (weight * (dVal * dVal));
+			pAccumulator[pos] += (weight * (dVal * dVal));
 			pos++;
 		}
 	}
@@ -188,6 +193,11 @@ void GEnsemble::tally(GPrediction* out)
 }
 
 void GEnsemble::tally(GVec& out)
+{
+	tally(m_accumulator.data(), out);
+}
+
+void GEnsemble::tally(const double* pAccumulator, GVec& out) const
 {
 	size_t labelDims = m_pLabelRel->size();
 	size_t nDims = 0;
@@ -196,18 +206,54 @@ void GEnsemble::tally(GVec& out)
 		size_t nValues = m_pLabelRel->valueCount(i);
 		if(nValues > 0)
 		{
-			out[i] = (double)m_accumulator.indexOfMax(nDims, nDims + nValues) - nDims;
+			// Ties go to the first value, like GVec::indexOfMax
+			size_t best = 0;
+			for(size_t j = 1; j < nValues; j++)
+			{
+				if(pAccumulator[nDims + j] > pAccumulator[nDims + best])
+					best = j;
+			}
+			out[i] = (double)best;
 			nDims += nValues;
 		}
 		else
 		{
-			out[i] = m_accumulator[nDims];
+			out[i] = pAccumulator[nDims];
 			nDims += 2;
 		}
 	}
 	GAssert(nDims == m_accumulator.size()); // invalid dim count
 }
 
+bool GEnsemble::isDecided(const double* pAccumulator, double remainingWeight) const
+{
+	// Leave some slack for rounding, so an early exit can never change the winner
+	double margin = remainingWeight * (1.0 + 1e-9) + 1e-12;
+	size_t labelDims = m_pLabelRel->size();
+	size_t nDims = 0;
+	for(size_t i = 0; i < labelDims; i++)
+	{
+		size_t nValues = m_pLabelRel->valueCount(i);
+		double first = -1e308;
+		double second = -1e308;
+		for(size_t j = 0; j < nValues; j++)
+		{
+			double v = pAccumulator[nDims + j];
+			if(v > first)
+			{
+				second = first;
+				first = v;
+			}
+			else if(v > second)
+				second = v;
+		}
+		if(nValues > 1 && first - second <= margin)
+			return false;
+		nDims += nValues;
+	}
+	return true;
+}
+
 class GEnsemblePredictWorker : public GWorkerThread
 {
 protected:
@@ -264,6 +310,98 @@ void GEnsemble::predictDistribution(const GVec& in, GPrediction* out)
 	tally(out);
 }
 
+void GEnsemble::predictBlock(const GMatrix& features, size_t start, const vector<size_t>& rows, size_t firstModel, size_t lastModel, GVec& predictions)
+{
+	size_t labelDims = m_pLabelRel->size();
+	size_t count = rows.size();
+	predictions.resize((lastModel - firstModel) * count * labelDims);
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	pool.parallelFor(firstModel, lastModel, [&](size_t m)
+	{
+		GSupervisedLearner* pModel = m_models[m]->m_pModel;
+		GVec pred(labelDims);
+		double* pOut = predictions.data() + (m - firstModel) * count * labelDims;
+		for(size_t j = 0; j < count; j++)
+		{
+			pModel->predict(features[start + rows[j]], pred);
+			for(size_t k = 0; k < labelDims; k++)
+				*(pOut++) = pred[k];
+		}
+	});
+}
+
+// virtual
+void GEnsemble::predictBatch(const GMatrix& features, GMatrix& labels)
+{
+	size_t n = features.rows();
+	size_t labelDims = m_pLabelRel->size();
+	if(labels.rows() != n || labels.cols() != labelDims)
+		labels.resize(n, labelDims);
+	size_t modelCount = m_models.size();
+	size_t accumDims = m_accumulator.size();
+
+	// Find the total weight of the models that come after each one, to decide when
+	// the remaining votes can no longer change the winner
+	bool earlyExit = m_earlyExit && m_pLabelRel->areNominal();
+	GVec remaining(modelCount + 1);
+	remaining[modelCount] = 0.0;
+	for(size_t m = modelCount; m > 0; m--)
+	{
+		if(m_models[m - 1]->m_weight < 0.0)
+			earlyExit = false;
+		remaining[m - 1] = remaining[m] + m_models[m - 1]->m_weight;
+	}
+
+	// With early exit, the models vote in rounds, and decided rows drop out after each round
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	size_t roundSize = earlyExit ? std::max((size_t)8, 2 * (pool.workers() + 1)) : modelCount;
+	const size_t blockSize = 1024;
+	vector<size_t> rows;
+	vector<size_t> undecided;
+	GVec ballots;
+	GVec predictions;
+	GVec pred(labelDims);
+	for(size_t start = 0; start < n; start += blockSize)
+	{
+		size_t count = std::min(blockSize, n - start);
+		rows.resize(count);
+		for(size_t j = 0; j < count; j++)
+			rows[j] = j;
+		ballots.resize(count * accumDims);
+		ballots.fill(0.0);
+		for(size_t first = 0; first < modelCount && rows.size() > 0; first += roundSize)
+		{
+			size_t last = std::min(modelCount, first + roundSize);
+			predictBlock(features, start, rows, first, last, predictions);
+
+			// Cast the votes in model order, just like predict does
+			for(size_t j = 0; j < rows.size(); j++)
+			{
+				double* pBallot = ballots.data() + rows[j] * accumDims;
+				for(size_t m = first; m < last; m++)
+				{
+					const double* pPred = predictions.data() + ((m - first) * rows.size() + j) * labelDims;
+					for(size_t k = 0; k < labelDims; k++)
+						pred[k] = pPred[k];
+					castVote(m_models[m]->m_weight, pred, pBallot);
+				}
+			}
+			if(earlyExit && last < modelCount)
+			{
+				undecided.clear();
+				for(size_t j = 0; j < rows.size(); j++)
+				{
+					if(!isDecided(ballots.data() + rows[j] * accumDims, remaining[last]))
+						undecided.push_back(rows[j]);
+				}
+				rows.swap(undecided);
+			}
+		}
+		for(size_t j = 0; j < count; j++)
+			tally(ballots.data() + j * accumDims, labels[start + j]);
+	}
+}
+
 
 
 
@@ -323,17 +461,19 @@ protected:
 	GMatrix m_drawnFeatures;
 	GMatrix m_drawnLabels;
 	size_t m_drawSize;
+	const vector<std::unique_ptr<GRand> >& m_starts;
 	GRand m_rand;
 
 public:
-	GBagTrainWorker(GMasterThread& master, GBag* pBag, const GMatrix& features, const GMatrix& labels, double trainSize, size_t seed)
+	GBagTrainWorker(GMasterThread& master, GBag* pBag, const GMatrix& features, const GMatrix& labels, double trainSize, const vector<std::unique_ptr<GRand> >& starts)
 	: GWorkerThread(master),
 	m_pBag(pBag),
 	m_features(features),
 	m_labels(labels),
 	m_drawnFeatures(features.relation().clone()),
 	m_drawnLabels(labels.relation().clone()),
-	m_rand(seed)
+	m_starts(starts),
+	m_rand(0)
 	{
 		GAssert(m_features.rows() > 0);
 		m_drawSize = size_t(trainSize * features.rows());
@@ -348,6 +488,7 @@ public:
 	virtual void doJob(size_t jobId)
 	{
 		// Randomly draw some data (with replacement)
+		m_rand.copyState(*m_starts[jobId]); // so the draw does not depend on which worker does this job
 		GReleaseDataHolder hDrawnFeatures(&m_drawnFeatures);
 		GReleaseDataHolder hDrawnLabels(&m_drawnLabels);
 		for(size_t j = 0; j < m_drawSize; j++)
@@ -401,9 +542,22 @@ void GBag::trainInnerInner(const GMatrix& features, const GMatrix& labels)
 	normalizeWeights();
 */
 
-	GMasterThread trainMaster;
+	// Replay one random stream through all of the draws, recording where each
+	// model's draw begins. This gives the same bootstrap samples as drawing them
+	// all serially, no matter how the jobs are spread across threads.
+	GRand stream(m_rand.next());
+	size_t drawSize = size_t(m_trainSize * features.rows());
+	vector<std::unique_ptr<GRand> > starts(m_models.size());
+	for(size_t i = 0; i < starts.size(); i++)
+	{
+		starts[i].reset(new GRand(0));
+		starts[i]->copyState(stream);
+		for(size_t j = 0; j < drawSize; j++)
+			stream.next(features.rows());
+	}
+	GMasterThread trainMaster(m_pPool);
 	for(size_t i = 0; i < m_workerThreads; i++)
-		trainMaster.addWorker(new GBagTrainWorker(trainMaster, this, features, labels, m_trainSize, (size_t)m_rand.next()));
+		trainMaster.addWorker(new GBagTrainWorker(trainMaster, this, features, labels, m_trainSize, starts));
 	trainMaster.doJobs(m_models.size());
 	determineWeights(features, labels);
 	normalizeWeights();
@@ -417,6 +571,37 @@ void GBag::determineWeights(const GMatrix& features, const GMatrix& labels)
 }
 
 #include "GDecisionTree.h"
+// Makes a noisy three-class problem with two continuous features
+void GEnsemble_makeClasses(GRand& rand, size_t n, GMatrix& features, GMatrix& labels)
+{
+	features.resize(n, 2);
+	labels.setRelation(new GUniformRelation(1, 3));
+	labels.newRows(n);
+	for(size_t i = 0; i < n; i++)
+	{
+		features[i].fillUniform(rand);
+		double x = features[i][0] + features[i][1] + 0.3 * rand.normal();
+		labels[i][0] = (x < 0.7 ? 0.0 : (x < 1.3 ? 1.0 : 2.0));
+	}
+}
+
+// Throws if predictBatch disagrees with predict for any row
+void GEnsemble_checkBatch(GSupervisedLearner& learner, const GMatrix& features)
+{
+	GMatrix batch;
+	learner.predictBatch(features, batch);
+	GVec pred(learner.relLabels().size());
+	for(size_t i = 0; i < features.rows(); i++)
+	{
+		learner.predict(features[i], pred);
+		for(size_t j = 0; j < pred.size(); j++)
+		{
+			if(batch[i][j] != pred[j])
+				throw Ex("predictBatch disagrees with predict");
+		}
+	}
+}
+
 // static
 void GBag::test()
 {
@@ -428,6 +613,28 @@ void GBag::test()
 		bag.addLearner(pTree);
 	}
 	bag.basicTest(0.764, 0.93, 0.01);
+
+	// Batch predictions should match one-at-a-time predictions, with or without early exit
+	GRand rand(0);
+	GMatrix features, labels, testFeatures, testLabels;
+	GEnsemble_makeClasses(rand, 300, features, labels);
+	GEnsemble_makeClasses(rand, 2500, testFeatures, testLabels);
+	GBag bag2;
+	for(size_t i = 0; i < 40; i++)
+	{
+		GDecisionTree* pTree = new GDecisionTree();
+		pTree->useRandomDivisions();
+		bag2.addLearner(pTree);
+	}
+	bag2.train(features, labels);
+	GThreadPool serial(0);
+	GThreadPool pool(3);
+	bag2.setThreadPool(&serial);
+	GEnsemble_checkBatch(bag2, testFeatures);
+	bag2.setThreadPool(&pool);
+	GEnsemble_checkBatch(bag2, testFeatures);
+	bag2.useEarlyExit(false);
+	GEnsemble_checkBatch(bag2, testFeatures);
 }
 
 
@@ -753,42 +960,144 @@ void GGradBoost::trainInnerInner(const GMatrix& features, const GMatrix& labels)
 	for(size_t i = 0; i < m_labelCentroid.size(); i++)
 		m_labelCentroid[i] = labels.columnMean(i);
 
-	// Train the ensemble
+	// If boosting histogram-splitting trees, quantize the features once for all of them
+	GDecisionTree* pTree = dynamic_cast<GDecisionTree*>(m_pLearner);
+	bool shareEdges = (pTree && pTree->histogramBins() > 0);
+	vector< vector<double> > histEdges;
+	if(shareEdges)
+		GDecisionTree::computeHistogramEdges(features, pTree->histogramBins(), histEdges);
+
+	// Keep a running prediction for every training row, so each round only has
+	// to evaluate the newest model. (The sums are accumulated in the same order
+	// as in predict, so they are identical to what it would return.)
+	GMatrix current(features.rows(), m_labelCentroid.size());
+	for(size_t i = 0; i < current.rows(); i++)
+		current[i].copy(m_labelCentroid);
+
+	// Train the ensemble. (The learner must not be left pointing at histEdges, even if training fails.)
 	size_t drawRows = (size_t)(m_trainSize * features.rows());
 	GVec prediction(m_labelCentroid.size());
-	for(size_t es = 0; es < m_ensembleSize; es++)
+	if(shareEdges)
+		pTree->useHistogramSplits(pTree->histogramBins(), &histEdges);
+	try
 	{
-		// Draw a training set from the distribution
-		GMatrix drawnFeatures(features.relation().clone());
-		GReleaseDataHolder hDrawnFeatures(&drawnFeatures);
-		GMatrix residualLabels(labels.relation().clone());
-		for(size_t i = 0; i < drawRows; i++)
+		for(size_t es = 0; es < m_ensembleSize; es++)
 		{
-			size_t index = m_rand.next(features.rows());
-			drawnFeatures.takeRow((GVec*)&features[index]);
-			GVec& lab = residualLabels.newRow();
-			lab.copy(labels[index]);
-			predict(features[index], prediction);
-			lab -= prediction;
-		}
+			// Draw a training set from the distribution
+			GMatrix drawnFeatures(features.relation().clone());
+			GReleaseDataHolder hDrawnFeatures(&drawnFeatures);
+			GMatrix residualLabels(labels.relation().clone());
+			for(size_t i = 0; i < drawRows; i++)
+			{
+				size_t index = m_rand.next(features.rows());
+				drawnFeatures.takeRow((GVec*)&features[index]);
+				GVec& lab = residualLabels.newRow();
+				lab.copy(labels[index]);
+				lab -= current[index];
+			}
 
-		// Train an instance of the model and store a clone of it
-		m_pLearner->train(drawnFeatures, residualLabels);
-		GDom doc;
-		GSupervisedLearner* pClone = m_pLoader->loadLearner(m_pLearner->serialize(&doc));
-		m_models.push_back(new GWeightedModel(1.0, pClone));
+			// Train an instance of the model and store a clone of it
+			m_pLearner->train(drawnFeatures, residualLabels);
+			GDom doc;
+			GSupervisedLearner* pClone = m_pLoader->loadLearner(m_pLearner->serialize(&doc));
+			m_models.push_back(new GWeightedModel(1.0, pClone));
+			if(es + 1 < m_ensembleSize)
+			{
+				for(size_t i = 0; i < features.rows(); i++)
+				{
+					pClone->predict(features[i], prediction);
+					current[i] += prediction;
+				}
+			}
+		}
 	}
+	catch(...)
+	{
+		if(shareEdges)
+			pTree->useHistogramSplits(pTree->histogramBins());
+		throw;
+	}
+	if(shareEdges)
+		pTree->useHistogramSplits(pTree->histogramBins());
 }
 
 // virtual
 void GGradBoost::predict(const GVec& in, GVec& out)
 {
 	out.copy(m_labelCentroid);
+	m_modelOut.resize(m_labelCentroid.size());
 	for(size_t i = 0; i < m_models.size(); i++)
 	{
-		m_models[i]->m_pModel->predict(in, m_accumulator);
-		out += m_accumulator;
+		m_models[i]->m_pModel->predict(in, m_modelOut);
+		out += m_modelOut;
+	}
+}
+
+// virtual
+void GGradBoost::predictBatch(const GMatrix& features, GMatrix& labels)
+{
+	size_t n = features.rows();
+	size_t labelDims = m_labelCentroid.size();
+	if(labels.rows() != n || labels.cols() != labelDims)
+		labels.resize(n, labelDims);
+	const size_t blockSize = 1024;
+	vector<size_t> rows;
+	GVec predictions;
+	for(size_t start = 0; start < n; start += blockSize)
+	{
+		size_t count = std::min(blockSize, n - start);
+		rows.resize(count);
+		for(size_t j = 0; j < count; j++)
+			rows[j] = j;
+		predictBlock(features, start, rows, 0, m_models.size(), predictions);
+
+		// Sum the predictions in model order, just like predict does
+		for(size_t j = 0; j < count; j++)
+		{
+			GVec& out = labels[start + j];
+			out.copy(m_labelCentroid);
+			for(size_t m = 0; m < m_models.size(); m++)
+			{
+				const double* pPred = predictions.data() + (m * count + j) * labelDims;
+				for(size_t k = 0; k < labelDims; k++)
+					out[k] += pPred[k];
+			}
+		}
+	}
+}
+
+// static
+void GGradBoost::test()
+{
+	// Fit a smooth function with boosted shallow trees
+	GRand rand(0);
+	GMatrix features(600, 2);
+	GMatrix labels(600, 2);
+	for(size_t i = 0; i < features.rows(); i++)
+	{
+		features[i].fillUniform(rand);
+		labels[i][0] = sin(3.0 * features[i][0]) + features[i][1];
+		labels[i][1] = features[i][0] * features[i][1];
 	}
+	GDecisionTree* pTree = new GDecisionTree();
+	pTree->setLeafThresh(40);
+	GGradBoost boost(pTree, true, new GLearnerLoader());
+	boost.setSize(20);
+	boost.train(features, labels);
+	double sse = boost.sumSquaredError(features, labels);
+	double baseline = 0.0;
+	for(size_t j = 0; j < 2; j++)
+		baseline += labels.columnVariance(j, labels.columnMean(j)) * (labels.rows() - 1);
+	if(sse > 0.1 * baseline)
+		throw Ex("Boosting did not fit the training data very well");
+
+	// Batch predictions should be identical to one-at-a-time predictions
+	GMatrix testFeatures(1500, 2);
+	for(size_t i = 0; i < testFeatures.rows(); i++)
+		testFeatures[i].fillUniform(rand);
+	GThreadPool pool(3);
+	boost.setThreadPool(&pool);
+	GEnsemble_checkBatch(boost, testFeatures);
 }
 
 
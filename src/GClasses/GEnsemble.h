@@ -28,6 +28,7 @@ namespace GClasses {
 class GRelation;
 class GRand;
 class GMasterThread;
+class GThreadPool;
 class GNeuralNetLearner;
 
 
@@ -69,6 +70,8 @@ protected:
 
 	size_t m_workerThreads;
 	GMasterThread* m_pPredictMaster;
+	GThreadPool* m_pPool;
+	bool m_earlyExit;
 public:
 	volatile const GVec* m_pPredictInput;
 
@@ -87,6 +90,10 @@ public:
 	/// do not need to call it.)
 	void castVote(double weight, const GVec& label);
 
+	/// Adds the vote from one of the models to the ballot box pAccumulator, which
+	/// must have as many elements as the accumulator buffer of this ensemble.
+	void castVote(double weight, const GVec& label, double* pAccumulator) const;
+
 	/// Specify the number of worker threads to use. If count is 1,
 	/// then no additional threads will be spawned, but the work will
 	/// all be done by the same thread. If count is 2 or more, that
@@ -102,12 +109,32 @@ public:
 	/// and GBayesianModelCombination all implement multi-threaded training.
 	void setWorkerThreads(size_t count) { m_workerThreads = count; }
 
+	/// Specifies the pool on which predictBatch evaluates the models. GBag also trains
+	/// the models on this pool with the number of threads given by setWorkerThreads.
+	/// (Each model draws its training data with its own seed, so the trained models do
+	/// not depend on the number of threads.) If pPool is NULL (the default),
+	/// GThreadPool::global() is used.
+	void setThreadPool(GThreadPool* pPool) { m_pPool = pPool; }
+
+	/// Specifies whether predictBatch may stop evaluating models for a row once the
+	/// winning value of every nominal label is certain, because the leading value is
+	/// ahead of the runner-up by more than the total weight of the models that have
+	/// not voted yet. The predicted labels are the same either way. This only applies
+	/// when every label is nominal and no model has a negative weight. The default is true.
+	void useEarlyExit(bool b = true) { m_earlyExit = b; }
+
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
+	/// Evaluates the models in parallel (each model handles blocks of rows in one thread,
+	/// so the models do not need to be reentrant), then tallies the votes for each row
+	/// in the same order as predict, so the results are identical to calling predict
+	/// for each row. See also useEarlyExit.
+	virtual void predictBatch(const GMatrix& features, GMatrix& labels);
+
 protected:
 	/// Base classes should call this method to serialize the base object
 	/// as part of their implementation of the serialize method.
@@ -132,6 +159,18 @@ protected:
 	/// Counts all the votes from the models in the bag, assuming you only
 	/// care to know the winner, and do not care about the distribution.
 	void tally(GVec& label);
+
+	/// Like tally, except it counts the votes in the ballot box pAccumulator.
+	void tally(const double* pAccumulator, GVec& label) const;
+
+	/// Returns true iff the winning value of every label in the ballot box pAccumulator
+	/// leads the runner-up by more than remainingWeight. (Assumes all labels are nominal.)
+	bool isDecided(const double* pAccumulator, double remainingWeight) const;
+
+	/// Evaluates models [firstModel, lastModel) for the rows features[start + rows[j]] in
+	/// parallel, one model per task. The prediction of model m for the j'th row is stored
+	/// at element ((m - firstModel) * rows.size() + j) * labelDims of predictions.
+	void predictBlock(const GMatrix& features, size_t start, const std::vector<size_t>& rows, size_t firstModel, size_t lastModel, GVec& predictions);
 };
 
 
@@ -325,6 +364,7 @@ protected:
 	double m_trainSize;
 	size_t m_ensembleSize;
 	GVec m_labelCentroid;
+	GVec m_modelOut;
 
 public:
 	/// General purpose constructor. pLearner is the learning algorithm
@@ -341,9 +381,17 @@ public:
 
 	virtual ~GGradBoost();
 
-	// todo: this method does not yet benefit from multiple threads
+	static void test();
+
+	/// See the comment for GSupervisedLearner::predict. (Use predictBatch to
+	/// evaluate the models in parallel.)
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// Evaluates the models in parallel, then sums their predictions for each row
+	/// in the same order as predict, so the results are identical to calling predict
+	/// for each row.
+	virtual void predictBatch(const GMatrix& features, GMatrix& labels);
+
 	/// Marshal this object into a DOM, which can then be converted to a variety of serial formats.
 	virtual GDomNode* serialize(GDom* pDoc) const;
 
@@ -24,6 +24,7 @@
 #include "GImage.h"
 #include "GBits.h"
 #include "GVec.h"
+#include "GThread.h"
 #include <cmath>
 #include <memory>
 
@@ -165,41 +166,36 @@ void GFourier::fft(size_t arraySize, struct ComplexNumber* pComplexNumberArray,
 void GFourier::fft2d(size_t arrayWidth, size_t arrayHeight, struct ComplexNumber* p2DComplexNumberArray, bool bForward)
 {
 	double* pData = (double*)p2DComplexNumberArray;
+	GThreadPool& pool = GThreadPool::global();
 
-	double* pTmpArray = new double[std::max(arrayWidth, arrayHeight) << 1];
-	std::unique_ptr<double[]> hTmpArray(pTmpArray);
-
-	// Horizontal transforms
-	for(size_t y = 0; y < arrayHeight; y++)
+	// Horizontal transforms (The rows are contiguous, so they are transformed in place.)
+	pool.parallelFor(0, arrayHeight, [&](size_t y)
 	{
-		for(size_t x = 0; x < arrayWidth; x++)
-		{
-			pTmpArray[x << 1] = pData[(arrayWidth * y + x) << 1];
-			pTmpArray[(x << 1) + 1] = pData[((arrayWidth * y + x) << 1) + 1];
-		}
-		fft(arrayWidth, (struct ComplexNumber*)pTmpArray, bForward);
-		for(size_t x = 0; x < arrayWidth; x++)
-		{
-			pData[(arrayWidth * y + x) << 1] = pTmpArray[x << 1];
-			pData[((arrayWidth * y + x) << 1) + 1] = pTmpArray[(x << 1) + 1];
-		}
-	}
+		fft(arrayWidth, p2DComplexNumberArray + arrayWidth * y, bForward);
+	}, std::max((size_t)1, (size_t)4096 / arrayWidth));
 
 	// Vertical transforms
-	for(size_t x = 0; x < arrayWidth; x++)
+	const size_t blockSize = 16;
+	size_t blocks = (arrayWidth + blockSize - 1) / blockSize;
+	pool.parallelFor(0, blocks, [&](size_t block)
 	{
-		for(size_t y = 0; y < arrayHeight; y++)
+		double* pTmpArray = new double[arrayHeight << 1];
+		std::unique_ptr<double[]> hTmpArray(pTmpArray);
+		for(size_t x = block * blockSize; x < std::min(arrayWidth, (block + 1) * blockSize); x++)
 		{
-			pTmpArray[y << 1] = pData[(arrayWidth * y + x) << 1];
-			pTmpArray[(y << 1) + 1] = pData[((arrayWidth * y + x) << 1) + 1];
-		}
-		fft(arrayHeight, (struct ComplexNumber*)pTmpArray, bForward);
-		for(size_t y = 0; y < arrayHeight; y++)
-		{
-			pData[(arrayWidth * y + x) << 1] = pTmpArray[y << 1];
-			pData[((arrayWidth * y + x) << 1) + 1] = pTmpArray[(y << 1) + 1];
+			for(size_t y = 0; y < arrayHeight; y++)
+			{
+				pTmpArray[y << 1] = pData[(arrayWidth * y + x) << 1];
+				pTmpArray[(y << 1) + 1] = pData[((arrayWidth * y + x) << 1) + 1];
+			}
+			fft(arrayHeight, (struct ComplexNumber*)pTmpArray, bForward);
+			for(size_t y = 0; y < arrayHeight; y++)
+			{
+				pData[(arrayWidth * y + x) << 1] = pTmpArray[y << 1];
+				pData[((arrayWidth * y + x) << 1) + 1] = pTmpArray[(y << 1) + 1];
+			}
 		}
-	}
+	});
 }
 
 // static
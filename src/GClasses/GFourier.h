@@ -59,7 +59,8 @@ public:
 	static void fft(size_t arraySize, struct ComplexNumber* pComplexNumberArray, bool bForward);
 
 	/// 2D Fast Forier Transform.  nArrayWidth must be a power of 2. nArrayHeight must be a power of 2. If bForward
-	/// is false, it will perform the reverse transform.
+	/// is false, it will perform the reverse transform. The rows, and then the columns, are transformed in
+	/// parallel on GThreadPool::global().
 	static void fft2d(size_t arrayWidth, size_t arrayHeight, struct ComplexNumber* p2DComplexNumberArray, bool bForward);
 
 	/// pArrayWidth returns the width of the array and pOneThirdHeight returns one third the height of the array
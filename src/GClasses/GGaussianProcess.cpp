@@ -24,8 +24,11 @@
 #include "GDistribution.h"
 #include "GKernelTrick.h"
 #include "GHolders.h"
+#include "GThread.h"
 #include <cmath>
 #include <memory>
+#include <vector>
+#include <algorithm>
 
 namespace GClasses {
 
@@ -106,18 +109,31 @@ void GRunningCovariance::test()
 
 
 GGaussianProcess::GGaussianProcess()
-: GSupervisedLearner(), m_noiseVar(1.0), m_weightsPriorVar(1024.0), m_maxSamples(350), m_pLInv(NULL), m_pAlpha(NULL), m_pStoredFeatures(NULL), m_pBuf(NULL)
+: GSupervisedLearner(), m_noiseVar(1.0), m_weightsPriorVar(1024.0), m_maxSamples(350), m_inducingPoints(0), m_pL(NULL), m_pLB(NULL), m_pAlpha(NULL), m_pStoredFeatures(NULL), m_pBuf(NULL), m_pPool(NULL)
 {
 	m_pKernel = new GKernelIdentity();
 }
 
 GGaussianProcess::GGaussianProcess(const GDomNode* pNode)
-: GSupervisedLearner(pNode), m_pBuf(NULL)
+: GSupervisedLearner(pNode), m_pLB(NULL), m_pBuf(NULL), m_pPool(NULL)
 {
 	m_weightsPriorVar = pNode->getDouble("wv");
 	m_noiseVar = pNode->getDouble("nv");
 	m_maxSamples = (size_t)pNode->getInt("ms");
-	m_pLInv = new GMatrix(pNode->get("l"));
+	GDomNode* pIP = pNode->getIfExists("ip");
+	m_inducingPoints = pIP ? (size_t)pIP->asInt() : 0;
+	GDomNode* pLInv = pNode->getIfExists("l");
+	if(pLInv)
+	{
+		// Older models stored the inverse of the Cholesky factor
+		GMatrix lInv(pLInv);
+		m_pL = lInv.pseudoInverse();
+	}
+	else
+		m_pL = new GMatrix(pNode->get("L"));
+	GDomNode* pLB = pNode->getIfExists("LB");
+	if(pLB)
+		m_pLB = new GMatrix(pLB);
 	m_pAlpha = new GMatrix(pNode->get("a"));
 	m_pStoredFeatures = new GMatrix(pNode->get("feat"));
 	m_pKernel = GKernel::deserialize(pNode->get("kernel"));
@@ -130,6 +146,91 @@ GGaussianProcess::~GGaussianProcess()
 	delete(m_pKernel);
 }
 
+void GGaussianProcess_makeData(GRand& rand, size_t n, GMatrix& features, GMatrix& labels)
+{
+	features.resize(n, 2);
+	labels.resize(n, 1);
+	for(size_t i = 0; i < n; i++)
+	{
+		GVec& f = features[i];
+		f.fillUniform(rand, -1.0, 1.0);
+		labels[i][0] = std::sin(3.0 * f[0]) + f[1] * f[1] + 0.05 * rand.normal();
+	}
+}
+
+void GGaussianProcess_testSparse()
+{
+	GRand rand(0);
+	GMatrix features, labels, testFeatures, testLabels;
+	GGaussianProcess_makeData(rand, 300, features, labels);
+	GGaussianProcess_makeData(rand, 100, testFeatures, testLabels);
+
+	// Train an exact model
+	GGaussianProcess exact;
+	exact.setKernel(new GKernelGaussianRBF(0.3));
+	exact.setWeightsPriorVariance(1.0);
+	exact.setNoiseVariance(0.01);
+	exact.train(features, labels);
+
+	// With every training point as an inducing point, the sparse model is the exact model
+	GGaussianProcess full;
+	full.setKernel(new GKernelGaussianRBF(0.3));
+	full.setWeightsPriorVariance(1.0);
+	full.setNoiseVariance(0.01);
+	full.setInducingPoints(features.rows());
+	full.train(features, labels);
+
+	// A few inducing points should approximate it closely
+	GGaussianProcess sparse;
+	sparse.setKernel(new GKernelGaussianRBF(0.3));
+	sparse.setWeightsPriorVariance(1.0);
+	sparse.setNoiseVariance(0.01);
+	sparse.setInducingPoints(40);
+	sparse.train(features, labels);
+
+	GSupervisedLearner& e0 = exact;
+	GSupervisedLearner& f0 = full;
+	GSupervisedLearner& s0 = sparse;
+	GVec e(1), f(1), s(1);
+	GPrediction pe, pf;
+	double sseExact = 0.0;
+	double sseSparse = 0.0;
+	double sseDiff = 0.0;
+	for(size_t i = 0; i < testFeatures.rows(); i++)
+	{
+		e0.predict(testFeatures[i], e);
+		f0.predict(testFeatures[i], f);
+		s0.predict(testFeatures[i], s);
+		if(std::abs(e[0] - f[0]) > 1e-5)
+			throw Ex("The sparse model with all points as inducing points differs from the exact model");
+		sseExact += (e[0] - testLabels[i][0]) * (e[0] - testLabels[i][0]);
+		sseSparse += (s[0] - testLabels[i][0]) * (s[0] - testLabels[i][0]);
+		sseDiff += (s[0] - e[0]) * (s[0] - e[0]);
+		e0.predictDistribution(testFeatures[i], &pe);
+		f0.predictDistribution(testFeatures[i], &pf);
+		double ve = pe.asNormal()->variance();
+		if(ve < 0.0 || ve > 1.0 || std::abs(ve - pf.asNormal()->variance()) > 1e-5)
+			throw Ex("bad variance");
+	}
+	if(sseExact / testFeatures.rows() > 0.005)
+		throw Ex("The exact model is not accurate enough: ", to_str(sseExact / testFeatures.rows()));
+	if(sseSparse / testFeatures.rows() > 0.005 || sseDiff / testFeatures.rows() > 0.0005)
+		throw Ex("The sparse model does not approximate the exact model closely enough");
+
+	// A round-trip through serialization should preserve the sparse model
+	GDom doc;
+	doc.setRoot(sparse.serialize(&doc));
+	GGaussianProcess loaded(doc.root());
+	GSupervisedLearner& l0 = loaded;
+	for(size_t i = 0; i < 10; i++)
+	{
+		s0.predict(testFeatures[i], s);
+		l0.predict(testFeatures[i], e);
+		if(std::abs(s[0] - e[0]) > 1e-9)
+			throw Ex("serialization failed");
+	}
+}
+
 // static
 void GGaussianProcess::test()
 {
@@ -140,6 +241,7 @@ void GGaussianProcess::test()
 	pGP->setKernel(new GKernelGaussianRBF(0.2));
 	GAutoFilter af2(pGP);
 	af2.basicTest(0.67, 0.92);
+	GGaussianProcess_testSparse();
 }
 
 // virtual
@@ -149,7 +251,10 @@ GDomNode* GGaussianProcess::serialize(GDom* pDoc) const
 	pNode->add(pDoc, "wv", m_weightsPriorVar);
 	pNode->add(pDoc, "nv", m_noiseVar);
 	pNode->add(pDoc, "ms", m_maxSamples);
-	pNode->add(pDoc, "l", m_pLInv->serialize(pDoc));
+	pNode->add(pDoc, "ip", m_inducingPoints);
+	pNode->add(pDoc, "L", m_pL->serialize(pDoc));
+	if(m_pLB)
+		pNode->add(pDoc, "LB", m_pLB->serialize(pDoc));
 	pNode->add(pDoc, "a", m_pAlpha->serialize(pDoc));
 	pNode->add(pDoc, "feat", m_pStoredFeatures->serialize(pDoc));
 	pNode->add(pDoc, "kernel", m_pKernel->serialize(pDoc));
@@ -159,8 +264,10 @@ GDomNode* GGaussianProcess::serialize(GDom* pDoc) const
 // virtual
 void GGaussianProcess::clear()
 {
-	delete(m_pLInv);
-	m_pLInv = NULL;
+	delete(m_pL);
+	m_pL = NULL;
+	delete(m_pLB);
+	m_pLB = NULL;
 	delete(m_pAlpha);
 	m_pAlpha = NULL;
 	delete(m_pStoredFeatures);
@@ -169,6 +276,50 @@ void GGaussianProcess::clear()
 	m_pBuf = NULL;
 }
 
+// Solves L*x=b for x, where L is lower-triangular. x may be the same vector as b,
+// and must already have as many elements as L has rows. Components with a zero pivot are set to zero.
+void GGaussianProcess_forwardSubstitute(const GMatrix& L, const GVec& b, GVec& x)
+{
+	size_t n = L.rows();
+	GAssert(x.size() == n);
+	for(size_t i = 0; i < n; i++)
+	{
+		const GVec& row = L[i];
+		if(std::abs(row[i]) < 1e-12)
+		{
+			x[i] = 0.0;
+			continue;
+		}
+		double d = b[i];
+		for(size_t k = 0; k < i; k++)
+			d -= row[k] * x[k];
+		x[i] = d / row[i];
+	}
+}
+
+// Solves L^T*x=b for x, where L is lower-triangular. x may be the same vector as b,
+// and must already have as many elements as L has rows. Components with a zero pivot are set to zero.
+void GGaussianProcess_backSubstituteTransposed(const GMatrix& L, const GVec& b, GVec& x)
+{
+	size_t n = L.rows();
+	GAssert(x.size() == n);
+	if(&x != &b)
+		x.copy(b);
+	for(size_t i = n - 1; i < n; i--)
+	{
+		const GVec& row = L[i];
+		if(std::abs(row[i]) < 1e-12)
+		{
+			x[i] = 0.0;
+			continue;
+		}
+		double d = x[i] / row[i];
+		x[i] = d;
+		for(size_t k = 0; k < i; k++)
+			x[k] -= row[k] * d;
+	}
+}
+
 // virtual
 void GGaussianProcess::trainInner(const GMatrix& features, const GMatrix& labels)
 {
@@ -176,6 +327,11 @@ void GGaussianProcess::trainInner(const GMatrix& features, const GMatrix& labels
 		throw Ex("GGaussianProcess only supports continuous features. Perhaps you should wrap it in a GAutoFilter.");
 	if(!labels.relation().areContinuous())
 		throw Ex("GGaussianProcess only supports continuous labels. Perhaps you should wrap it in a GAutoFilter.");
+	if(m_inducingPoints > 0)
+	{
+		trainSparse(features, labels);
+		return;
+	}
 	if(features.rows() <= m_maxSamples)
 	{
 		trainInnerInner(features, labels);
@@ -202,67 +358,147 @@ void GGaussianProcess::trainInner(const GMatrix& features, const GMatrix& labels
 void GGaussianProcess::trainInnerInner(const GMatrix& features, const GMatrix& labels)
 {
 	clear();
-	GMatrix* pL;
 	{
 		// Compute the kernel matrix
-		GMatrix k(features.rows(), features.rows());
-		for(size_t i = 0; i < features.rows(); i++)
+		size_t n = features.rows();
+		GMatrix k(n, n);
+		for(size_t i = 0; i < n; i++)
 		{
-			GVec& row = k[i];
 			const GVec& a = features[i];
-			for(size_t j = 0; j < features.rows(); j++)
+			for(size_t j = 0; j <= i; j++)
 			{
-				const GVec& b = features[j];
-				row[j] = m_weightsPriorVar * m_pKernel->apply(a, b);
+				double d = m_weightsPriorVar * m_pKernel->apply(a, features[j]);
+				k[i][j] = d;
+				k[j][i] = d;
 			}
 		}
 
 		// Add the noise variance to the diagonal of the kernel matrix
-		for(size_t i = 0; i < features.rows(); i++)
+		for(size_t i = 0; i < n; i++)
 			k[i][i] += m_noiseVar;
 
 		// Compute L
-		pL = k.cholesky(true);
+		m_pL = k.cholesky(true);
+	}
+
+	// Compute alpha = L^T \ (L \ y), one label column at a time
+	m_pAlpha = new GMatrix(features.rows(), labels.cols());
+	GVec y(features.rows());
+	for(size_t c = 0; c < labels.cols(); c++)
+	{
+		for(size_t i = 0; i < labels.rows(); i++)
+			y[i] = labels[i][c];
+		GGaussianProcess_forwardSubstitute(*m_pL, y, y);
+		GGaussianProcess_backSubstituteTransposed(*m_pL, y, y);
+		for(size_t i = 0; i < labels.rows(); i++)
+			(*m_pAlpha)[i][c] = y[i];
 	}
-	std::unique_ptr<GMatrix> hL(pL);
-
-	// Compute the model
-	m_pLInv = pL->pseudoInverse();
-	GMatrix* pTmp = GMatrix::multiply(*m_pLInv, labels, false, false);
-	std::unique_ptr<GMatrix> hTmp(pTmp);
-	GMatrix* pLTrans = pL->transpose();
-	std::unique_ptr<GMatrix> hLTrans(pLTrans);
-	GMatrix* pLTransInv = pLTrans->pseudoInverse();
-	std::unique_ptr<GMatrix> hLTransInv(pLTransInv);
-	m_pAlpha = GMatrix::multiply(*pLTransInv, *pTmp, false, false);
-	GAssert(m_pAlpha->rows() == features.rows());
-	GAssert(m_pAlpha->cols() == labels.cols());
 	m_pStoredFeatures = new GMatrix();
 	m_pStoredFeatures->copy(features);
 }
 
-// virtual
-void GGaussianProcess::predict(const GVec& in, GVec& out)
+void GGaussianProcess::trainSparse(const GMatrix& features, const GMatrix& labels)
 {
-	if(!m_pBuf)
-		m_pBuf = new GMatrix(1, m_pStoredFeatures->rows());
+	if(m_noiseVar <= 0.0)
+		throw Ex("The noise variance must be positive to use inducing points");
+	clear();
+	size_t n = features.rows();
+	size_t m = std::min(m_inducingPoints, n);
+
+	// Pick the inducing points at random from the training data
+	std::vector<size_t> indexes;
+	indexes.reserve(n);
+	for(size_t i = 0; i < n; i++)
+		indexes.push_back(i);
+	m_pStoredFeatures = new GMatrix(features.relation().clone());
+	m_pStoredFeatures->newRows(m);
+	for(size_t i = 0; i < m; i++)
+	{
+		std::swap(indexes[i], indexes[i + (size_t)m_rand.next(n - i)]);
+		m_pStoredFeatures->row(i).copy(features[indexes[i]]);
+	}
+	const GMatrix& z = *m_pStoredFeatures;
 
-	// Compute k*
-	GVec& k = m_pBuf->row(0);
-	for(size_t i = 0; i < m_pStoredFeatures->rows(); i++)
-		k[i] = m_weightsPriorVar * m_pKernel->apply(m_pStoredFeatures->row(i), in);
+	// Factor the kernel matrix of the inducing points. A little jitter keeps it positive definite.
+	{
+		GMatrix kmm(m, m);
+		for(size_t i = 0; i < m; i++)
+		{
+			for(size_t j = 0; j <= i; j++)
+			{
+				double d = m_weightsPriorVar * m_pKernel->apply(z[i], z[j]);
+				kmm[i][j] = d;
+				kmm[j][i] = d;
+			}
+		}
+		double jitter = 0.0;
+		for(size_t i = 0; i < m; i++)
+			jitter = std::max(jitter, kmm[i][i]);
+		jitter *= 1e-8;
+		for(size_t i = 0; i < m; i++)
+			kmm[i][i] += jitter;
+		m_pL = kmm.cholesky(true);
+	}
 
-	// Compute the prediction
-	m_pAlpha->multiply(m_pBuf->row(0), out, true);
+	// Accumulate B = I + A*A^T and A*y/sigma, where the columns of A are L \ k(z, x_j) / sigma.
+	// The rows of A are computed a block at a time so memory stays O(m^2).
+	double scale = 1.0 / std::sqrt(m_noiseVar);
+	GMatrix b(m, m);
+	b.fill(0.0);
+	GMatrix ay(m, labels.cols());
+	ay.fill(0.0);
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	const size_t blockSize = 1024;
+	for(size_t start = 0; start < n; start += blockSize)
+	{
+		size_t count = std::min(blockSize, n - start);
+		GMatrix aBlock(count, m);
+		pool.parallelFor(0, count, [&](size_t i)
+		{
+			const GVec& x = features[start + i];
+			GVec& a = aBlock[i];
+			for(size_t j = 0; j < m; j++)
+				a[j] = m_weightsPriorVar * m_pKernel->apply(z[j], x) * scale;
+			GGaussianProcess_forwardSubstitute(*m_pL, a, a);
+		}, 16);
+		GMatrix* pAAT = GMatrix::multiply(aBlock, aBlock, true, false);
+		std::unique_ptr<GMatrix> hAAT(pAAT);
+		b.add(pAAT);
+		for(size_t i = 0; i < count; i++)
+		{
+			const GVec& a = aBlock[i];
+			const GVec& y = labels[start + i];
+			for(size_t c = 0; c < labels.cols(); c++)
+			{
+				double d = y[c] * scale;
+				for(size_t j = 0; j < m; j++)
+					ay[j][c] += a[j] * d;
+			}
+		}
+	}
+	for(size_t i = 0; i < m; i++)
+		b[i][i] += 1.0;
+	m_pLB = b.cholesky(true);
+
+	// Compute the weights w = L^T \ (LB^T \ (LB \ (A*y/sigma)))
+	m_pAlpha = new GMatrix(m, labels.cols());
+	GVec w(m);
+	for(size_t c = 0; c < labels.cols(); c++)
+	{
+		for(size_t j = 0; j < m; j++)
+			w[j] = ay[j][c];
+		GGaussianProcess_forwardSubstitute(*m_pLB, w, w);
+		GGaussianProcess_backSubstituteTransposed(*m_pLB, w, w);
+		GGaussianProcess_backSubstituteTransposed(*m_pL, w, w);
+		for(size_t j = 0; j < m; j++)
+			(*m_pAlpha)[j][c] = w[j];
+	}
 }
 
-// virtual
-void GGaussianProcess::predictDistribution(const GVec& in, GPrediction* out)
+void GGaussianProcess::predictMean(const GVec& in, GVec& out)
 {
 	if(!m_pBuf)
 		m_pBuf = new GMatrix(2, m_pStoredFeatures->rows());
-	else if(m_pBuf->rows() < 2)
-		m_pBuf->newRow();
 
 	// Compute k*
 	GVec& k = m_pBuf->row(0);
@@ -270,18 +506,37 @@ void GGaussianProcess::predictDistribution(const GVec& in, GPrediction* out)
 		k[i] = m_weightsPriorVar * m_pKernel->apply(m_pStoredFeatures->row(i), in);
 
 	// Compute the prediction
-	GVec pred;
-	m_pAlpha->multiply(m_pBuf->row(0), pred, true);
+	m_pAlpha->multiply(k, out, true);
+}
+
+// virtual
+void GGaussianProcess::predict(const GVec& in, GVec& out)
+{
+	predictMean(in, out);
+}
 
-	// Compute the variance
+// virtual
+void GGaussianProcess::predictDistribution(const GVec& in, GPrediction* out)
+{
+	GVec pred(m_pAlpha->cols());
+	predictMean(in, pred);
+
+	// Compute the variance. In exact mode, this is k** - |L \ k*|^2. In sparse mode, the
+	// approximation of k*^T K^-1 k* is |L \ k*|^2 - |LB \ (L \ k*)|^2.
 	GVec& v = m_pBuf->row(1);
-	m_pLInv->multiply(k, v);
-	double variance = m_pKernel->apply(k, k) - v.squaredMagnitude();
+	GGaussianProcess_forwardSubstitute(*m_pL, m_pBuf->row(0), v);
+	double variance = m_weightsPriorVar * m_pKernel->apply(in, in) - v.squaredMagnitude();
+	if(m_pLB)
+	{
+		GGaussianProcess_forwardSubstitute(*m_pLB, v, v);
+		variance += v.squaredMagnitude();
+	}
+	variance = std::max(0.0, variance);
 
 	// Store the results
 	for(size_t i = 0; i < m_pAlpha->cols(); i++)
 	{
-		GNormalDistribution* pNorm = out->makeNormal();
+		GNormalDistribution* pNorm = out[i].makeNormal();
 		pNorm->setMeanAndVariance(pred[i], variance);
 	}
 }
@@ -26,6 +26,7 @@
 namespace GClasses {
 
 class GKernel;
+class GThreadPool;
 
 /// Computes a running covariance matrix about the origin.
 class GRunningCovariance
@@ -61,17 +62,25 @@ public:
 /// A Gaussian Process model. This class was implemented according to the specification
 /// in Algorithm 2.1 on page 19 of chapter 2 of http://www.gaussianprocesses.org/gpml/chapters/
 /// by Carl Edward Rasmussen and Christopher K. I. Williams.
+/// The exact model is solved with a Cholesky factorization and triangular solves.
+/// If setInducingPoints is called with a non-zero value, it instead trains a sparse
+/// (Nystrom, or "subset of regressors") approximation that uses a random subset of the
+/// training points as inducing points. That mode costs O(n*m^2) time and O(m^2) memory,
+/// so it can use all of the training data even when there are hundreds of thousands of rows.
 class GGaussianProcess : public GSupervisedLearner
 {
 protected:
 	double m_noiseVar;
 	double m_weightsPriorVar;
 	size_t m_maxSamples;
-	GMatrix* m_pLInv;
+	size_t m_inducingPoints;
+	GMatrix* m_pL; // Cholesky factor of the kernel matrix (or of the inducing-point kernel matrix in sparse mode)
+	GMatrix* m_pLB; // Cholesky factor of I + A*A^T in sparse mode. NULL in exact mode.
 	GMatrix* m_pAlpha;
 	GMatrix* m_pStoredFeatures;
 	GMatrix* m_pBuf;
 	GKernel* m_pKernel;
+	GThreadPool* m_pPool;
 
 public:
 	/// General-purpose constructor
@@ -96,7 +105,7 @@ public:
 	/// will want to change the kernel before using this model.)
 	void setKernel(GKernel* pKernel);
 
-	/// Sets the noise variance term. (The default is 0.0.)
+	/// Sets the noise variance term. (The default is 1.0.)
 	void setNoiseVariance(double v) { m_noiseVar = v; }
 
 	/// Sets the weight prior variance term. (The default is 1024.0.)
@@ -107,6 +116,16 @@ public:
 	/// in order to train efficiently. The default is 350.
 	void setMaxSamples(size_t m) { m_maxSamples = m; }
 
+	/// Sets the number of inducing points. If m is 0 (the default), the exact model is
+	/// trained with at most maxSamples rows. Otherwise, m randomly chosen training rows are
+	/// used as inducing points for a sparse approximation that trains with all of the rows,
+	/// and maxSamples is ignored. The sparse mode requires a positive noise variance.
+	void setInducingPoints(size_t m) { m_inducingPoints = m; }
+
+	/// Specifies a thread pool for computing the kernel rows in sparse mode.
+	/// If pPool is NULL (the default), GThreadPool::global() is used.
+	void setThreadPool(GThreadPool* pPool) { m_pPool = pPool; }
+
 protected:
 	/// See the comment for GSupervisedLearner::trainInner
 	virtual void trainInner(const GMatrix& features, const GMatrix& labels);
@@ -126,8 +145,14 @@ protected:
 	/// See the comment for GTransducer::canImplicitlyHandleNominalLabels
 	virtual bool canImplicitlyHandleNominalLabels() { return false; }
 
-	/// Called by trainInner
+	/// Called by trainInner to train the exact model
 	void trainInnerInner(const GMatrix& features, const GMatrix& labels);
+
+	/// Called by trainInner to train the sparse model with inducing points
+	void trainSparse(const GMatrix& features, const GMatrix& labels);
+
+	/// Computes the mean prediction. Leaves k* in row 0 of m_pBuf.
+	void predictMean(const GVec& in, GVec& out);
 };
 
 } // namespace GClasses
@@ -29,6 +29,7 @@
 #include "GRand.h"
 #include "GVec.h"
 #include "GHolders.h"
+#include "GThread.h"
 #include <vector>
 #include <deque>
 #include <cmath>
@@ -674,11 +675,18 @@ void GDijkstra::addDirectedEdge(size_t from, size_t to, double edgecost)
 }
 
 void GDijkstra::compute(size_t origin)
+{
+	compute(origin, m_pCosts, m_pPrevious);
+}
+
+void GDijkstra::compute(size_t origin, double* pCosts, size_t* pPrevious) const
 {
 	for(size_t i = 0; i < m_nodes; i++)
+		pCosts[i] = 1e300;
+	if(pPrevious)
 	{
-		m_pPrevious[i] = INVALID_INDEX;
-		m_pCosts[i] = 1e300;
+		for(size_t i = 0; i < m_nodes; i++)
+			pPrevious[i] = INVALID_INDEX;
 	}
 	size_t* q = new size_t[2 * m_nodes];
 	std::unique_ptr<size_t[]> hQ(q);
@@ -688,7 +696,7 @@ void GDijkstra::compute(size_t origin)
 		q[i] = i;
 		map[i] = i + 1;
 	}
-	m_pCosts[origin] = 0;
+	pCosts[origin] = 0;
 	std::swap(q[0], q[origin]);
 	std::swap(map[0], map[origin]);
 	q--;
@@ -696,14 +704,14 @@ void GDijkstra::compute(size_t origin)
 	while(qSize > 0)
 	{
 		size_t u = q[1];
-		if(m_pCosts[u] >= 1e300)
+		if(pCosts[u] >= 1e300)
 			break;
 
 		// Pop from the front of the heap
 		size_t index = 1;
 		while(2 * index <= qSize)
 		{
-			if(2 * index == qSize || m_pCosts[q[2 * index]] < m_pCosts[q[2 * index + 1]])
+			if(2 * index == qSize || pCosts[q[2 * index]] < pCosts[q[2 * index + 1]])
 			{
 				map[q[2 * index]] = index;
 				q[index] = q[2 * index];
@@ -720,7 +728,7 @@ void GDijkstra::compute(size_t origin)
 		{
 			map[q[qSize]] = index;
 			q[index] = q[qSize];
-			while(index > 1 && m_pCosts[q[index / 2]] > m_pCosts[q[index]])
+			while(index > 1 && pCosts[q[index / 2]] > pCosts[q[index]])
 			{
 				std::swap(map[q[index / 2]], map[q[index]]);
 				std::swap(q[index / 2], q[index]);
@@ -730,17 +738,18 @@ void GDijkstra::compute(size_t origin)
 		qSize--;
 
 		// Test alternate routes
-		vector<size_t>::iterator itNeigh = m_pNeighbors[u].begin();
-		vector<double>::iterator itEdgeCost = m_pEdgeCosts[u].begin();
+		vector<size_t>::const_iterator itNeigh = m_pNeighbors[u].begin();
+		vector<double>::const_iterator itEdgeCost = m_pEdgeCosts[u].begin();
 		while(itNeigh != m_pNeighbors[u].end())
 		{
 			size_t v = *itNeigh;
-			double alt = m_pCosts[u] + *itEdgeCost;
-			if(alt < m_pCosts[v])
+			double alt = pCosts[u] + *itEdgeCost;
+			if(alt < pCosts[v])
 			{
-				m_pPrevious[v] = u;
-				m_pCosts[v] = alt;
-				while(map[v] > 1 && m_pCosts[q[map[v] / 2]] > alt)
+				if(pPrevious)
+					pPrevious[v] = u;
+				pCosts[v] = alt;
+				while(map[v] > 1 && pCosts[q[map[v] / 2]] > alt)
 				{
 					size_t a = map[v];
 					size_t b = a / 2;
@@ -754,6 +763,16 @@ void GDijkstra::compute(size_t origin)
 	}
 }
 
+void GDijkstra::computeFrom(const std::vector<size_t>& origins, GMatrix& costs, GThreadPool* pPool) const
+{
+	costs.resize(origins.size(), m_nodes);
+	GThreadPool& pool = pPool ? *pPool : GThreadPool::global();
+	pool.parallelFor(0, origins.size(), [&](size_t i)
+	{
+		compute(origins[i], costs[i].data(), NULL);
+	});
+}
+
 double GDijkstra::cost(size_t target)
 {
 	return m_pCosts[target];
@@ -798,6 +817,37 @@ void GDijkstra::test()
 	if(g.cost(5) != 0.0) throw Ex("failed");
 	if(g.cost(2) != 0.9) throw Ex("failed");
 	if(g.cost(3) != 0.8) throw Ex("failed");
+
+	// Compare the parallel all-sources costs with Floyd-Warshall on a random sparse graph
+	GRand rand(0);
+	size_t n = 60;
+	GDijkstra sparse(n);
+	GFloydWarshall dense(n);
+	for(size_t i = 0; i < n; i++)
+	{
+		for(size_t j = 0; j < 3; j++)
+		{
+			size_t to = (size_t)rand.next(n);
+			double cost = rand.uniform();
+			sparse.addDirectedEdge(i, to, cost);
+			dense.addDirectedEdge(i, to, cost);
+		}
+	}
+	dense.compute();
+	std::vector<size_t> origins;
+	for(size_t i = 0; i < n; i++)
+		origins.push_back(i);
+	GThreadPool pool(3);
+	GMatrix costs;
+	sparse.computeFrom(origins, costs, &pool);
+	for(size_t i = 0; i < n; i++)
+	{
+		for(size_t j = 0; j < n; j++)
+		{
+			if(std::abs(costs[i][j] - dense.costMatrix()->row(i)[j]) > 1e-9)
+				throw Ex("failed");
+		}
+	}
 }
 
 
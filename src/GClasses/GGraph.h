@@ -31,6 +31,8 @@ class GHeap;
 class GRegionAjacencyGraph;
 class GGraphEdgeIterator;
 class GRand;
+class GMatrix;
+class GThreadPool;
 
 
 /// This implements an optimized max-flow/min-cut algorithm described in
@@ -196,6 +198,18 @@ public:
 	/// other point in the graph
 	void compute(size_t origin);
 
+	/// Finds the shortest-cost path from the specified origin to every other
+	/// point in the graph, and stores the results in the caller's buffers instead
+	/// of in this object. pCosts must have room for nodeCount() values. pPrevious
+	/// may be NULL if the paths are not needed. Because this method does not modify
+	/// the object, it may be called from many threads at once.
+	void compute(size_t origin, double* pCosts, size_t* pPrevious) const;
+
+	/// Computes the costs from each of the specified origins to every node, in parallel.
+	/// Row i of costs will contain the costs from origins[i]. Unreachable nodes get a cost
+	/// of 1e300. If pPool is NULL, GThreadPool::global() is used.
+	void computeFrom(const std::vector<size_t>& origins, GMatrix& costs, GThreadPool* pPool = NULL) const;
+
 	/// Returns the total cost to travel from the origin to the specified target node
 	double cost(size_t target);
 
@@ -38,3 +38,25 @@ void GHeap::clear()
 	}
 	m_nCurrentPos = m_nMinBlockSize;
 }
+
+void GHeap::takeBlocks(GHeap& that)
+{
+	if(!that.m_pCurrentBlock)
+		return;
+	char* pTail = that.m_pCurrentBlock;
+	while(*(char**)pTail)
+		pTail = *(char**)pTail;
+	if(m_pCurrentBlock)
+	{
+		// Link them in behind the current block, so it can keep filling up
+		*(char**)pTail = *(char**)m_pCurrentBlock;
+		*(char**)m_pCurrentBlock = that.m_pCurrentBlock;
+	}
+	else
+	{
+		m_pCurrentBlock = that.m_pCurrentBlock;
+		m_nCurrentPos = m_nMinBlockSize; // The blocks may be smaller than ours, so start a new one next time
+	}
+	that.m_pCurrentBlock = NULL;
+	that.m_nCurrentPos = that.m_nMinBlockSize;
+}
@@ -63,6 +63,10 @@ public:
 	/// Deletes all the blocks and frees up memory
 	void clear();
 
+	/// Moves all of the blocks in that heap into this one, so everything that was
+	/// allocated from that heap will now live as long as this one. that is left empty.
+	void takeBlocks(GHeap& that);
+
 	/// Allocate space in the heap and copy a string to it.  Returns
 	/// a pointer to the string
 	char* add(const char* szString)
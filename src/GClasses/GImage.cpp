@@ -30,12 +30,25 @@
 #include "GHillClimber.h"
 #include "GMath.h"
 #include "GHolders.h"
+#include "GThread.h"
+#include "GRand.h"
 #include <vector>
 #include <algorithm>
 #include <string.h>
 #include <sstream>
 #include <cmath>
 #include <memory>
+#if defined(__AVX2__) && defined(__FMA__)
+#	include <immintrin.h>
+#	define GIMAGE_AVX2
+#	define GIMAGE_AVX2_TARGET
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// Build the AVX2 kernels anyway, and pick them at runtime when the CPU supports them
+#	include <immintrin.h>
+#	define GIMAGE_AVX2
+#	define GIMAGE_AVX2_TARGET __attribute__((target("avx2,fma")))
+#	define GIMAGE_DISPATCH
+#endif
 
 namespace GClasses {
 using std::vector;
@@ -1545,93 +1558,396 @@ void GImage::swapData(GImage* pSwapImage)
 	pSwapImage->m_height = nTmpHeight;
 }
 
-void GImage::convolve(GImage* pKernel)
+#ifdef GIMAGE_AVX2
+// An AVX2/FMA version of GImage_axpy. Returns the number of elements it processed.
+GIMAGE_AVX2_TARGET static size_t GImage_axpyAvx2(double* pOut, const double* pIn, double a, size_t n)
 {
-	GImage NewImage;
-	NewImage.setSize(m_width, m_height);
-	unsigned int c1;
-	unsigned int c2;
-	int nHalfKWidth = (int)pKernel->m_width >> 1;
-	int nHalfKHeight = (int)pKernel->m_height >> 1;
-	int nRSum, nGSum, nBSum;
-	int nRTot, nGTot, nBTot;
-	nRTot = 0;
-	nGTot = 0;
-	nBTot = 0;
-	int x, y, kx, ky;
-	for(ky = 0; ky < (int)pKernel->m_height; ky++)
+	size_t i = 0;
+	__m256d va = _mm256_set1_pd(a);
+	for(; i + 4 <= n; i += 4)
+		_mm256_storeu_pd(pOut + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(pIn + i), _mm256_loadu_pd(pOut + i)));
+	return i;
+}
+
+// An AVX2/FMA version of GImage_axpy. Returns the number of elements it processed.
+GIMAGE_AVX2_TARGET static size_t GImage_axpyAvx2(float* pOut, const float* pIn, float a, size_t n)
+{
+	size_t i = 0;
+	__m256 va = _mm256_set1_ps(a);
+	for(; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(pOut + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(pIn + i), _mm256_loadu_ps(pOut + i)));
+	return i;
+}
+#endif
+
+#ifdef GIMAGE_DISPATCH
+static bool GImage_checkAvx2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+static const bool GImage_hasAvx2 = GImage_checkAvx2();
+#endif
+
+// Adds a * pIn[i] to pOut[i] for every i in [0, n)
+template<typename T>
+static void GImage_axpy(T* pOut, const T* pIn, T a, size_t n)
+{
+	size_t i = 0;
+#if defined(GIMAGE_DISPATCH)
+	if(GImage_hasAvx2)
+		i = GImage_axpyAvx2(pOut, pIn, a, n);
+#elif defined(GIMAGE_AVX2)
+	i = GImage_axpyAvx2(pOut, pIn, a, n);
+#endif
+	for(; i < n; i++)
+		pOut[i] += a * pIn[i];
+}
+
+// Returns a parallelFor grain that gives each task roughly 64k operations, given the cost of one row
+static size_t GImage_rowGrain(size_t rowCost)
+{
+	return std::max((size_t)1, (size_t)65536 / std::max((size_t)1, rowCost));
+}
+
+// Clamps y to a valid row index of an image with h rows
+static size_t GImage_clampRow(ptrdiff_t y, size_t h)
+{
+	return (size_t)std::max((ptrdiff_t)0, std::min((ptrdiff_t)h - 1, y));
+}
+
+// Makes a copy of a w-by-h plane in which each row is extended horizontally by repeating
+// its edge pixels, kw / 2 to the left and the rest of kw - 1 to the right. (This matches
+// pixelNearest, and it lets every tap of a kernel be applied as one pass over a contiguous row.)
+template<typename T>
+static void GImage_padPlane(const T* pIn, size_t w, size_t h, size_t kw, std::vector<T>& padded)
+{
+	size_t hw = kw >> 1;
+	size_t pw = w + kw - 1;
+	padded.resize(pw * h);
+	GThreadPool::global().parallelFor(0, h, [&](size_t y)
+	{
+		const T* pSrc = pIn + w * y;
+		T* pRow = padded.data() + pw * y;
+		std::fill(pRow, pRow + hw, pSrc[0]);
+		std::copy(pSrc, pSrc + w, pRow + hw);
+		std::fill(pRow + hw + w, pRow + pw, pSrc[w - 1]);
+	}, GImage_rowGrain(pw));
+}
+
+// Correlates a w-by-h plane with a kw-by-kh kernel (stored row-major), clamping at the edges
+template<typename T>
+static void GImage_correlateDirect(const T* pIn, size_t w, size_t h, const T* pKernel, size_t kw, size_t kh, T* pOut)
+{
+	std::vector<T> padded;
+	GImage_padPlane(pIn, w, h, kw, padded);
+	size_t pw = w + kw - 1;
+	ptrdiff_t hh = kh >> 1;
+	GThreadPool::global().parallelFor(0, h, [&](size_t y)
+	{
+		T* pRow = pOut + w * y;
+		std::fill(pRow, pRow + w, (T)0);
+		for(size_t ky = 0; ky < kh; ky++)
+		{
+			const T* pSrc = padded.data() + pw * GImage_clampRow((ptrdiff_t)(y + ky) - hh, h);
+			const T* pK = pKernel + kw * ky;
+			for(size_t kx = 0; kx < kw; kx++)
+			{
+				if(pK[kx] != 0)
+					GImage_axpy(pRow, pSrc + kx, pK[kx], w);
+			}
+		}
+	}, GImage_rowGrain(w * kw * kh));
+}
+
+// Correlates a w-by-h plane with the outer product of pColKernel (kh values) and pRowKernel
+// (kw values), clamping at the edges. This takes kw + kh operations per pixel instead of kw * kh.
+template<typename T>
+static void GImage_correlateSeparable(const T* pIn, size_t w, size_t h, const T* pRowKernel, size_t kw, const T* pColKernel, size_t kh, T* pOut)
+{
+	GThreadPool& pool = GThreadPool::global();
+
+	// Horizontal pass
+	std::vector<T> padded;
+	GImage_padPlane(pIn, w, h, kw, padded);
+	size_t pw = w + kw - 1;
+	std::vector<T> tmp(w * h);
+	pool.parallelFor(0, h, [&](size_t y)
+	{
+		T* pRow = tmp.data() + w * y;
+		std::fill(pRow, pRow + w, (T)0);
+		const T* pSrc = padded.data() + pw * y;
+		for(size_t kx = 0; kx < kw; kx++)
+		{
+			if(pRowKernel[kx] != 0)
+				GImage_axpy(pRow, pSrc + kx, pRowKernel[kx], w);
+		}
+	}, GImage_rowGrain(w * kw));
+
+	// Vertical pass
+	ptrdiff_t hh = kh >> 1;
+	pool.parallelFor(0, h, [&](size_t y)
 	{
-		for(kx = 0; kx < (int)pKernel->m_width; kx++)
+		T* pRow = pOut + w * y;
+		std::fill(pRow, pRow + w, (T)0);
+		for(size_t ky = 0; ky < kh; ky++)
 		{
-			c1 = pKernel->pixel(kx, ky);
-			nRTot += gRed(c1);
-			nGTot += gGreen(c1);
-			nBTot += gBlue(c1);
+			if(pColKernel[ky] != 0)
+				GImage_axpy(pRow, tmp.data() + w * GImage_clampRow((ptrdiff_t)(y + ky) - hh, h), pColKernel[ky], w);
 		}
+	}, GImage_rowGrain(w * kh));
+}
+
+// Tries to factor a kw-by-kh kernel into the outer product of a column and a row. If successful,
+// returns true, and pKernel[kw * y + x] == pCol[y] * pRow[x] / *pPivot. Integer kernels are
+// factored exactly, so the divide by the pivot leaves integer results unchanged.
+static bool GImage_factorKernel(const double* pKernel, size_t kw, size_t kh, double* pRow, double* pCol, double* pPivot)
+{
+	size_t p = 0;
+	for(size_t i = 1; i < kw * kh; i++)
+	{
+		if(std::abs(pKernel[i]) > std::abs(pKernel[p]))
+			p = i;
 	}
-	nRTot = std::max(1, nRTot);
-	nGTot = std::max(1, nGTot);
-	nBTot = std::max(1, nBTot);
-	for(y = 0; y < (int)m_height; y++)
+	if(pKernel[p] == 0)
 	{
-		for(x = 0; x < (int)m_width; x++)
+		std::fill(pRow, pRow + kw, 0.0);
+		std::fill(pCol, pCol + kh, 0.0);
+		*pPivot = 1.0;
+		return true;
+	}
+	size_t px = p % kw;
+	size_t py = p / kw;
+	double pivot = pKernel[p];
+	for(size_t x = 0; x < kw; x++)
+		pRow[x] = pKernel[kw * py + x];
+	for(size_t y = 0; y < kh; y++)
+		pCol[y] = pKernel[kw * y + px];
+	for(size_t y = 0; y < kh; y++)
+	{
+		for(size_t x = 0; x < kw; x++)
 		{
-			nRSum = 0;
-			nGSum = 0;
-			nBSum = 0;
-			for(ky = 0; ky < (int)pKernel->m_height; ky++)
+			if(pKernel[kw * y + x] * pivot != pCol[y] * pRow[x])
+				return false;
+		}
+	}
+	*pPivot = pivot;
+	return true;
+}
+
+// Computes the forward Fourier transform of a kernel, zero-padded to P-by-Q
+static void GImage_kernelFft(const double* pKernel, size_t kw, size_t kh, size_t P, size_t Q, std::vector<struct ComplexNumber>& fftKernel)
+{
+	fftKernel.assign(P * Q, ComplexNumber());
+	for(size_t y = 0; y < kh; y++)
+	{
+		for(size_t x = 0; x < kw; x++)
+		{
+			fftKernel[P * y + x].real = pKernel[kw * y + x];
+			fftKernel[P * y + x].imag = 0.0;
+		}
+	}
+	GFourier::fft2d(P, Q, fftKernel.data(), true);
+}
+
+// Correlates one or two w-by-h planes with the same kernel in the frequency domain. fftKernel is
+// the kernel's transform at size P-by-Q, where P >= w + kw - 1 and Q >= h + kh - 1, so the
+// circular correlation never wraps into the pixels that are kept. When pInB is non-null, it rides
+// along in the imaginary part, which costs nothing extra because the kernel is real.
+static void GImage_correlateFft(const double* pInA, const double* pInB, size_t w, size_t h, const std::vector<struct ComplexNumber>& fftKernel, size_t P, size_t Q, size_t kw, size_t kh, double* pOutA, double* pOutB)
+{
+	GThreadPool& pool = GThreadPool::global();
+	size_t hw = kw >> 1;
+	size_t hh = kh >> 1;
+	std::vector<struct ComplexNumber> buf(P * Q);
+	pool.parallelFor(0, Q, [&](size_t j)
+	{
+		struct ComplexNumber* pRow = buf.data() + P * j;
+		if(j >= h + kh - 1)
+		{
+			std::fill(pRow, pRow + P, ComplexNumber());
+			return;
+		}
+		size_t y = GImage_clampRow((ptrdiff_t)j - (ptrdiff_t)hh, h);
+		const double* pA = pInA + w * y;
+		const double* pB = pInB ? pInB + w * y : NULL;
+		for(size_t i = 0; i < P; i++)
+		{
+			if(i < w + kw - 1)
 			{
-				for(kx = 0; kx < (int)pKernel->m_width; kx++)
-				{
-					c1 = pKernel->pixel(pKernel->m_width - kx - 1, pKernel->m_height - ky - 1);
-					c2 = pixelNearest(x + kx - nHalfKWidth, y + ky - nHalfKHeight);
-					nRSum += gRed(c1) * gRed(c2);
-					nGSum += gGreen(c1) * gGreen(c2);
-					nBSum += gBlue(c1) * gBlue(c2);
-				}
+				size_t x = GImage_clampRow((ptrdiff_t)i - (ptrdiff_t)hw, w);
+				pRow[i].real = pA[x];
+				pRow[i].imag = pB ? pB[x] : 0.0;
+			}
+			else
+			{
+				pRow[i].real = 0.0;
+				pRow[i].imag = 0.0;
 			}
-			NewImage.setPixel(x, y, gRGB(ClipChan(nRSum / nRTot), ClipChan(nGSum / nGTot), ClipChan(nBSum / nBTot)));
+		}
+	}, GImage_rowGrain(P));
+	GFourier::fft2d(P, Q, buf.data(), true);
+	pool.parallelFor(0, Q, [&](size_t j)
+	{
+		for(size_t i = P * j; i < P * (j + 1); i++)
+		{
+			// Multiply by the conjugate of the kernel to correlate instead of convolving
+			double re = buf[i].real * fftKernel[i].real + buf[i].imag * fftKernel[i].imag;
+			double im = buf[i].imag * fftKernel[i].real - buf[i].real * fftKernel[i].imag;
+			buf[i].real = re;
+			buf[i].imag = im;
+		}
+	}, GImage_rowGrain(P));
+	GFourier::fft2d(P, Q, buf.data(), false);
+	for(size_t y = 0; y < h; y++)
+	{
+		for(size_t x = 0; x < w; x++)
+		{
+			pOutA[w * y + x] = buf[P * y + x].real;
+			if(pOutB)
+				pOutB[w * y + x] = buf[P * y + x].imag;
 		}
 	}
-	swapData(&NewImage);
 }
 
-void GImage::convolveKernel(GImage* pKernel)
+enum GImage_ConvolutionMethod
 {
-	GImage NewImage;
-	NewImage.setSize(m_width, m_height);
-	unsigned int c1;
-	unsigned int c2;
-	int nHalfKWidth = (int)pKernel->m_width >> 1;
-	int nHalfKHeight = (int)pKernel->m_height >> 1;
-	int nRSum, nGSum, nBSum;
-	int x, y;
-	int kx, ky;
-	for(y = 0; y < (int)m_height; y++)
+	GImage_autoConvolution,
+	GImage_directConvolution,
+	GImage_separableConvolution,
+	GImage_fftConvolution,
+};
+
+// Convolves the image with the kernel one channel at a time. The channels are converted to
+// double-precision planes, so the integer sums of the original per-pixel loop are reproduced
+// exactly by every method (the FFT method is rounded back to the nearest integer). If normalize
+// is true, each channel is divided by the sum of its kernel values. Otherwise it is just clipped.
+static void GImage_convolve(GImage* pImage, const GImage* pKernel, bool normalize, GImage_ConvolutionMethod method)
+{
+	size_t w = pImage->width();
+	size_t h = pImage->height();
+	size_t kw = pKernel->width();
+	size_t kh = pKernel->height();
+	if(w == 0 || h == 0 || kw == 0 || kh == 0)
+		return;
+	GThreadPool& pool = GThreadPool::global();
+
+	// Split the image into planes, and flip the kernel so it can be applied as a correlation
+	std::vector<double> planes(3 * w * h);
+	pool.parallelFor(0, h, [&](size_t y)
 	{
-		for(x = 0; x < (int)m_width; x++)
+		for(size_t x = 0; x < w; x++)
+		{
+			unsigned int c = pImage->pixel((int)x, (int)y);
+			planes[w * y + x] = gRed(c);
+			planes[w * h + w * y + x] = gGreen(c);
+			planes[2 * w * h + w * y + x] = gBlue(c);
+		}
+	}, GImage_rowGrain(w));
+	std::vector<double> kernels(3 * kw * kh);
+	double tot[3] = { 0.0, 0.0, 0.0 };
+	for(size_t ky = 0; ky < kh; ky++)
+	{
+		for(size_t kx = 0; kx < kw; kx++)
+		{
+			unsigned int c = pKernel->pixel((int)(kw - 1 - kx), (int)(kh - 1 - ky));
+			kernels[kw * ky + kx] = gRed(c);
+			kernels[kw * kh + kw * ky + kx] = gGreen(c);
+			kernels[2 * kw * kh + kw * ky + kx] = gBlue(c);
+			tot[0] += gRed(c);
+			tot[1] += gGreen(c);
+			tot[2] += gBlue(c);
+		}
+	}
+
+	// Pick a method
+	std::vector<double> rowKernels(3 * kw);
+	std::vector<double> colKernels(3 * kh);
+	double scale[3] = { 1.0, 1.0, 1.0 };
+	bool separable = true;
+	for(size_t c = 0; c < 3 && separable; c++)
+		separable = GImage_factorKernel(kernels.data() + c * kw * kh, kw, kh, rowKernels.data() + c * kw, colKernels.data() + c * kh, &scale[c]);
+	size_t P = GBits::boundingPowerOfTwo((unsigned int)(w + kw - 1));
+	size_t Q = GBits::boundingPowerOfTwo((unsigned int)(h + kh - 1));
+	bool sameRG = std::equal(kernels.begin(), kernels.begin() + kw * kh, kernels.begin() + kw * kh);
+	bool sameGB = std::equal(kernels.begin() + kw * kh, kernels.begin() + 2 * kw * kh, kernels.begin() + 2 * kw * kh);
+	if(method == GImage_autoConvolution)
+	{
+		if(separable)
+			method = GImage_separableConvolution;
+		else
+		{
+			// The FFT path does not depend on the kernel size. Each 2D transform was measured to
+			// cost about 20 times as much per butterfly as one multiply-add of the direct path.
+			size_t transforms = (sameRG ? 4 : 6) + 1 + (sameRG ? 0 : 1) + (sameGB ? 0 : 1);
+			double directCost = 3.0 * kw * kh * w * h;
+			double fftCost = 20.0 * transforms * P * Q * std::log2((double)P * Q);
+			method = (directCost > fftCost ? GImage_fftConvolution : GImage_directConvolution);
+		}
+	}
+	if(method == GImage_separableConvolution && !separable)
+		throw Ex("This kernel is not separable");
+	if(method != GImage_separableConvolution)
+		scale[0] = scale[1] = scale[2] = 1.0;
+
+	// Convolve
+	std::vector<double> out(3 * w * h);
+	if(method == GImage_fftConvolution)
+	{
+		// Channels that share a kernel are transformed two at a time
+		std::vector<struct ComplexNumber> fftKernel;
+		GImage_kernelFft(kernels.data(), kw, kh, P, Q, fftKernel);
+		if(sameRG)
+			GImage_correlateFft(planes.data(), planes.data() + w * h, w, h, fftKernel, P, Q, kw, kh, out.data(), out.data() + w * h);
+		else
+		{
+			GImage_correlateFft(planes.data(), NULL, w, h, fftKernel, P, Q, kw, kh, out.data(), NULL);
+			GImage_kernelFft(kernels.data() + kw * kh, kw, kh, P, Q, fftKernel);
+			GImage_correlateFft(planes.data() + w * h, NULL, w, h, fftKernel, P, Q, kw, kh, out.data() + w * h, NULL);
+		}
+		if(!sameGB)
+			GImage_kernelFft(kernels.data() + 2 * kw * kh, kw, kh, P, Q, fftKernel);
+		GImage_correlateFft(planes.data() + 2 * w * h, NULL, w, h, fftKernel, P, Q, kw, kh, out.data() + 2 * w * h, NULL);
+	}
+	else
+	{
+		for(size_t c = 0; c < 3; c++)
+		{
+			if(method == GImage_separableConvolution)
+				GImage_correlateSeparable(planes.data() + c * w * h, w, h, rowKernels.data() + c * kw, kw, colKernels.data() + c * kh, kh, out.data() + c * w * h);
+			else
+				GImage_correlateDirect(planes.data() + c * w * h, w, h, kernels.data() + c * kw * kh, kw, kh, out.data() + c * w * h);
+		}
+	}
+
+	// Convert back to pixels
+	long long divisor[3];
+	for(size_t c = 0; c < 3; c++)
+		divisor[c] = normalize ? std::max(1LL, (long long)tot[c]) : 1LL;
+	pool.parallelFor(0, h, [&](size_t y)
+	{
+		for(size_t x = 0; x < w; x++)
 		{
-			nRSum = 0;
-			nGSum = 0;
-			nBSum = 0;
-			for(ky = 0; ky < (int)pKernel->m_height; ky++)
+			int chan[3];
+			for(size_t c = 0; c < 3; c++)
 			{
-				for(kx = 0; kx < (int)pKernel->m_width; kx++)
-				{
-					c1 = pKernel->pixel(pKernel->m_width - kx - 1, pKernel->m_height - ky - 1);
-					c2 = pixelNearest(x + kx - nHalfKWidth, y + ky - nHalfKHeight);
-					nRSum += gRed(c1) * gRed(c2);
-					nGSum += gGreen(c1) * gGreen(c2);
-					nBSum += gBlue(c1) * gBlue(c2);
-				}
+				long long sum = std::llround(out[c * w * h + w * y + x] / scale[c]) / divisor[c];
+				chan[c] = (int)std::max(0LL, std::min(255LL, sum));
 			}
-			nRSum = ClipChan(nRSum);
-			nGSum = ClipChan(nGSum);
-			nBSum = ClipChan(nBSum);
-			NewImage.setPixel(x, y, gRGB(nRSum, nGSum, nBSum));
+			pImage->setPixel((int)x, (int)y, gRGB(chan[0], chan[1], chan[2]));
 		}
-	}
-	swapData(&NewImage);
+	}, GImage_rowGrain(w));
+}
+
+void GImage::convolve(GImage* pKernel)
+{
+	GImage_convolve(this, pKernel, true, GImage_autoConvolution);
+}
+
+void GImage::convolveKernel(GImage* pKernel)
+{
+	GImage_convolve(this, pKernel, false, GImage_autoConvolution);
 }
 
 void GImage::blur(double dRadius)
@@ -1661,6 +1977,55 @@ void GImage::blur(double dRadius)
 	convolve(&imgKernel);
 }
 
+void GImage::blurGaussian(double sigma)
+{
+	size_t w = m_width;
+	size_t h = m_height;
+	if(sigma <= 0.0 || w == 0 || h == 0)
+		return;
+
+	// Make a normalized 1D Gaussian that reaches out to three standard deviations
+	size_t radius = (size_t)std::ceil(3.0 * sigma);
+	size_t kw = 2 * radius + 1;
+	std::vector<float> kernel(kw);
+	double sum = 0.0;
+	for(size_t i = 0; i < kw; i++)
+	{
+		double d = ((double)i - (double)radius) / sigma;
+		kernel[i] = (float)std::exp(-0.5 * d * d);
+		sum += kernel[i];
+	}
+	for(size_t i = 0; i < kw; i++)
+		kernel[i] = (float)(kernel[i] / sum);
+
+	// Blur each channel with a horizontal pass and a vertical pass
+	GThreadPool& pool = GThreadPool::global();
+	std::vector<float> planes(3 * w * h);
+	pool.parallelFor(0, h, [&](size_t y)
+	{
+		for(size_t x = 0; x < w; x++)
+		{
+			unsigned int c = pixel((int)x, (int)y);
+			planes[w * y + x] = (float)gRed(c);
+			planes[w * h + w * y + x] = (float)gGreen(c);
+			planes[2 * w * h + w * y + x] = (float)gBlue(c);
+		}
+	}, GImage_rowGrain(w));
+	std::vector<float> out(3 * w * h);
+	for(size_t c = 0; c < 3; c++)
+		GImage_correlateSeparable(planes.data() + c * w * h, w, h, kernel.data(), kw, kernel.data(), kw, out.data() + c * w * h);
+	pool.parallelFor(0, h, [&](size_t y)
+	{
+		for(size_t x = 0; x < w; x++)
+		{
+			setPixel((int)x, (int)y, gRGB(
+				ClipChan((int)std::lround(out[w * y + x])),
+				ClipChan((int)std::lround(out[w * h + w * y + x])),
+				ClipChan((int)std::lround(out[2 * w * h + w * y + x]))));
+		}
+	}, GImage_rowGrain(w));
+}
+
 void GImage::blurQuick(int iters, int nRadius)
 {
 	GImage tmp;
@@ -3572,4 +3937,163 @@ void GImage::replaceColor(unsigned int before, unsigned int after)
 	}
 }
 
+// This is the original per-pixel convolution loop, kept to check the faster methods against
+static void GImage_convolveReference(const GImage& image, const GImage& kernel, bool normalize, GImage& result)
+{
+	result.setSize(image.width(), image.height());
+	int kw = (int)kernel.width();
+	int kh = (int)kernel.height();
+	int nRTot = 0;
+	int nGTot = 0;
+	int nBTot = 0;
+	for(int ky = 0; ky < kh; ky++)
+	{
+		for(int kx = 0; kx < kw; kx++)
+		{
+			unsigned int c = kernel.pixel(kx, ky);
+			nRTot += gRed(c);
+			nGTot += gGreen(c);
+			nBTot += gBlue(c);
+		}
+	}
+	if(!normalize)
+		nRTot = nGTot = nBTot = 1;
+	nRTot = std::max(1, nRTot);
+	nGTot = std::max(1, nGTot);
+	nBTot = std::max(1, nBTot);
+	for(int y = 0; y < (int)image.height(); y++)
+	{
+		for(int x = 0; x < (int)image.width(); x++)
+		{
+			int nRSum = 0;
+			int nGSum = 0;
+			int nBSum = 0;
+			for(int ky = 0; ky < kh; ky++)
+			{
+				for(int kx = 0; kx < kw; kx++)
+				{
+					unsigned int c1 = kernel.pixel(kw - kx - 1, kh - ky - 1);
+					unsigned int c2 = image.pixelNearest(x + kx - (kw >> 1), y + ky - (kh >> 1));
+					nRSum += gRed(c1) * gRed(c2);
+					nGSum += gGreen(c1) * gGreen(c2);
+					nBSum += gBlue(c1) * gBlue(c2);
+				}
+			}
+			result.setPixel(x, y, gRGB(ClipChan(nRSum / nRTot), ClipChan(nGSum / nGTot), ClipChan(nBSum / nBTot)));
+		}
+	}
+}
+
+// Checks that every applicable convolution method matches the reference loop exactly
+static void GImage_checkConvolution(GImage& image, const GImage& kernel, bool separable)
+{
+	GImage_ConvolutionMethod methods[] = { GImage_autoConvolution, GImage_directConvolution, GImage_separableConvolution, GImage_fftConvolution };
+	for(size_t n = 0; n < 2; n++)
+	{
+		GImage expected;
+		GImage_convolveReference(image, kernel, n == 0, expected);
+		for(size_t m = 0; m < 4; m++)
+		{
+			if(methods[m] == GImage_separableConvolution && !separable)
+				continue;
+			GImage actual;
+			actual.copy(&image);
+			GImage_convolve(&actual, &kernel, n == 0, methods[m]);
+			for(int y = 0; y < (int)image.height(); y++)
+			{
+				for(int x = 0; x < (int)image.width(); x++)
+				{
+					if(actual.pixel(x, y) != expected.pixel(x, y))
+						throw Ex("Convolution method ", to_str(m), " disagrees with the reference at (", to_str(x), ", ", to_str(y), ")");
+				}
+			}
+		}
+	}
+}
+
+// static
+void GImage::test()
+{
+	GRand rand(0);
+	GImage image;
+	image.setSize(37, 23);
+	for(int y = 0; y < 23; y++)
+	{
+		for(int x = 0; x < 37; x++)
+			image.setPixel(x, y, gRGB((int)rand.next(256), (int)rand.next(256), (int)rand.next(256)));
+	}
+
+	// A gray kernel that is not separable
+	GImage kernel;
+	kernel.setSize(5, 3);
+	for(int y = 0; y < 3; y++)
+	{
+		for(int x = 0; x < 5; x++)
+		{
+			int v = (int)rand.next(16);
+			kernel.setPixel(x, y, gRGB(v, v, v));
+		}
+	}
+	kernel.setPixel(0, 0, gRGB(15, 15, 15));
+	kernel.setPixel(1, 0, gRGB(0, 0, 0));
+	kernel.setPixel(0, 1, gRGB(0, 0, 0));
+	kernel.setPixel(1, 1, gRGB(15, 15, 15));
+	GImage_checkConvolution(image, kernel, false);
+
+	// A kernel with a different pattern in each channel
+	kernel.setSize(4, 6);
+	for(int y = 0; y < 6; y++)
+	{
+		for(int x = 0; x < 4; x++)
+			kernel.setPixel(x, y, gRGB((int)rand.next(16), (int)rand.next(16), (int)rand.next(16)));
+	}
+	GImage_checkConvolution(image, kernel, false);
+
+	// A separable kernel that is larger than the image
+	kernel.setSize(9, 31);
+	int row[9];
+	int col[31];
+	for(int x = 0; x < 9; x++)
+		row[x] = (int)rand.next(16);
+	for(int y = 0; y < 31; y++)
+		col[y] = (int)rand.next(16);
+	for(int y = 0; y < 31; y++)
+	{
+		for(int x = 0; x < 9; x++)
+			kernel.setPixel(x, y, gRGB(row[x] * col[y], row[x] * col[y], col[y]));
+	}
+	GImage_checkConvolution(image, kernel, true);
+
+	// Gaussian blurring should preserve a constant image, and spread a point symmetrically
+	GImage flat;
+	flat.setSize(20, 10);
+	flat.clear(gRGB(200, 100, 50));
+	flat.blurGaussian(2.5);
+	for(int y = 0; y < 10; y++)
+	{
+		for(int x = 0; x < 20; x++)
+		{
+			if(flat.pixel(x, y) != gRGB(200, 100, 50))
+				throw Ex("Blurring changed a constant image");
+		}
+	}
+	GImage point;
+	point.setSize(21, 21);
+	point.clear(gRGB(0, 0, 0));
+	point.setPixel(10, 10, gRGB(255, 255, 255));
+	point.blurGaussian(1.0);
+	if(gRed(point.pixel(10, 10)) >= 255 || gRed(point.pixel(10, 10)) < 30)
+		throw Ex("Unexpected peak after blurring");
+	for(int i = 0; i < 21; i++)
+	{
+		for(int j = 0; j < 21; j++)
+		{
+			if(point.pixel(i, j) != point.pixel(20 - i, j) || point.pixel(i, j) != point.pixel(j, i))
+				throw Ex("Blurring was not symmetric");
+		}
+		if(i > 0 && i <= 10 && gRed(point.pixel(i, 10)) < gRed(point.pixel(i - 1, 10)))
+			throw Ex("Blurring was not monotonic");
+	}
+}
+
 } // namespace GClasses
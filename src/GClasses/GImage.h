@@ -294,6 +294,11 @@ public:
 	/// Blur the image by convolving with a Gaussian kernel
 	void blur(double dRadius);
 
+	/// Blurs the image with a Gaussian kernel that has a standard deviation of sigma pixels,
+	/// and reaches out to 3 * sigma pixels. The kernel is separable, so this costs
+	/// O(sigma) per pixel instead of O(sigma^2).
+	void blurGaussian(double sigma);
+
 	/// Blurs by averaging uniformly over a square, plus some optimizations
 	void blurQuick(int iters, int nRadius);
 
@@ -312,8 +317,13 @@ public:
 	/// Draws a border around anything that touches the background color
 	void addBorder(const GImage* pSourceImage, unsigned int cBackground, unsigned int cBorder);
 
+	/// Convolves the image with pKernel (clamping at the edges), and divides each channel
+	/// by the sum of the kernel values in that channel. Separable kernels are applied with a
+	/// horizontal and a vertical pass, and big kernels that are not separable are applied in
+	/// the frequency domain. The results are the same as a direct integer convolution.
 	void convolve(GImage* pKernel);
 
+	/// Like convolve, except the results are just clipped instead of normalized.
 	void convolveKernel(GImage* pKernel);
 
 	void horizDifferenceize();
@@ -455,6 +465,9 @@ public:
 	/// Replaces every occurrence of the exact color "before" with "after"
 	void replaceColor(unsigned int before, unsigned int after);
 
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
 protected:
 	void loadPixMap(FILE* pFile, bool bTextData, bool bGrayScale);
 	void savePixMap(FILE* pFile, bool bTextData, bool bGrayScale);
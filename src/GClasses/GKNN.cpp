@@ -30,6 +30,7 @@
 #include "GBitTable.h"
 #include "GDistance.h"
 #include "GSparseMatrix.h"
+#include "GRand.h"
 #include "GHolders.h"
 #include "GBitTable.h"
 #include <map>
@@ -102,6 +103,9 @@ GKNN::GKNN()
 	m_pSparseFeatures = NULL;
 	m_pLabels = NULL;
 	m_pNeighborFinder = NULL;
+	m_hnswM = 0;
+	m_hnswEfConstruction = 200;
+	m_hnswEfSearch = 64;
 	m_normalizeScaleFactors = true;
 	m_optimizeScaleFactors = false;
 	m_pDistanceMetric = NULL;
@@ -125,6 +129,10 @@ GKNN::GKNN(const GDomNode* pNode)
 	m_trainParam = pNode->getDouble("trainParam");
 	m_normalizeScaleFactors = pNode->getBool("normalize");
 	m_optimizeScaleFactors = pNode->getBool("optimize");
+	GDomNode* pHnswMNode = pNode->getIfExists("hnswM");
+	m_hnswM = pHnswMNode ? (size_t)pHnswMNode->asInt() : 0;
+	m_hnswEfConstruction = m_hnswM > 0 ? (size_t)pNode->getInt("hnswEfc") : 200;
+	m_hnswEfSearch = m_hnswM > 0 ? (size_t)pNode->getInt("hnswEfs") : 64;
 	GMatrix* pFeatures = NULL;
 	GSparseMatrix* pSparseFeatures = NULL;
 	GDomNode* pFeaturesNode = pNode->getIfExists("features");
@@ -157,6 +165,13 @@ GKNN::GKNN(const GDomNode* pNode)
 	m_pFeatures = pFeatures;
 	m_pSparseFeatures = pSparseFeatures;
 	m_pLabels = pLabels;
+	GDomNode* pHnswNode = pNode->getIfExists("hnsw");
+	if(pHnswNode && m_pFeatures)
+	{
+		GHnswNeighborFinder* pHnsw = new GHnswNeighborFinder(pHnswNode, m_pFeatures, m_pDistanceMetric, false);
+		pHnsw->setEfSearch(m_hnswEfSearch);
+		m_pNeighborFinder = pHnsw;
+	}
 }
 
 GKNN::~GKNN()
@@ -195,6 +210,14 @@ GDomNode* GKNN::serialize(GDom* pDoc) const
 		pNode->add(pDoc, "metric", m_pDistanceMetric->serialize(pDoc));
 	else
 		pNode->add(pDoc, "sparseMetric", m_pSparseMetric->serialize(pDoc));
+	if(m_hnswM > 0)
+	{
+		pNode->add(pDoc, "hnswM", m_hnswM);
+		pNode->add(pDoc, "hnswEfc", m_hnswEfConstruction);
+		pNode->add(pDoc, "hnswEfs", m_hnswEfSearch);
+		if(m_pNeighborFinder && m_pFeatures)
+			pNode->add(pDoc, "hnsw", ((GHnswNeighborFinder*)m_pNeighborFinder)->serialize(pDoc));
+	}
 	return pNode;
 }
 
@@ -252,19 +275,43 @@ size_t GKNN::addVector(const GVec& feat, const GVec& lab)
 {
 	// Store the features
 	size_t index;
-	if(m_pNeighborFinder)
+	if(m_pNeighborFinder && m_hnswM == 0)
 	{
 		delete(m_pNeighborFinder);
 		m_pNeighborFinder = NULL;
 	}
 	index = m_pFeatures->rows();
 	m_pFeatures->newRow().copy(feat);
+	if(m_pNeighborFinder)
+		((GHnswNeighborFinder*)m_pNeighborFinder)->insert(index); // The graph supports incremental inserts, so there is no need to rebuild it
 
 	// Store the labels
 	m_pLabels->newRow().copy(lab);
 	return index;
 }
 
+void GKNN::useHnsw(size_t M, size_t efConstruction, size_t efSearch)
+{
+	delete(m_pNeighborFinder);
+	m_pNeighborFinder = NULL;
+	m_hnswM = M;
+	m_hnswEfConstruction = efConstruction;
+	m_hnswEfSearch = efSearch;
+}
+
+void GKNN::makeNeighborFinder()
+{
+	GAssert(!m_pNeighborFinder && m_pDistanceMetric);
+	if(m_hnswM > 0)
+	{
+		GHnswNeighborFinder* pHnsw = new GHnswNeighborFinder(m_pFeatures, m_hnswM, m_hnswEfConstruction, m_pDistanceMetric, false);
+		pHnsw->setEfSearch(m_hnswEfSearch);
+		m_pNeighborFinder = pHnsw;
+	}
+	else
+		m_pNeighborFinder = new GKdTree(m_pFeatures, m_pDistanceMetric, false);
+}
+
 void GKNN::setNormalizeScaleFactors(bool b)
 {
 	m_normalizeScaleFactors = b;
@@ -347,6 +394,8 @@ void GKNN::trainIncremental(const GVec& in, const GVec& out)
 	{
 		m_pScaleFactorOptimizer->iterate();
 		m_pDistanceMetric->scaleFactors().copy(m_pScaleFactorOptimizer->currentVector());
+		delete(m_pNeighborFinder); // The graph was built with the old scale factors
+		m_pNeighborFinder = NULL;
 	}
 }
 
@@ -405,16 +454,20 @@ void GKNN::trainInner(const GMatrix& feats, const GMatrix& labs)
 	if(m_pScaleFactorOptimizer)
 	{
 		if(!m_pNeighborFinder)
-		{
-			m_pNeighborFinder = new GKdTree(m_pFeatures, m_pDistanceMetric, false);
-		}
+			makeNeighborFinder();
 		for(size_t j = 0; j < 50; j++)
 		{
 			m_pScaleFactorOptimizer->iterate();
 			m_pNeighborFinder->reoptimize();
 		}
 		scaleFactors.copy(m_pScaleFactorOptimizer->currentVector());
+		if(m_hnswM > 0)
+			m_pNeighborFinder->reoptimize();
 	}
+
+	// Building a graph takes much longer than a kd-tree, so do it now rather than at the first prediction
+	if(m_hnswM > 0 && !m_pNeighborFinder)
+		makeNeighborFinder();
 }
 
 // virtual
@@ -442,7 +495,7 @@ size_t GKNN::findNeighbors(const GVec& vec)
 		if(m_pDistanceMetric)
 		{
 			//m_pNeighborFinder = new GBruteForceNeighborFinder(m_pFeatures, m_pDistanceMetric, false);
-			m_pNeighborFinder = new GKdTree(m_pFeatures, m_pDistanceMetric, false);
+			makeNeighborFinder();
 		}
 		else
 		{
@@ -452,7 +505,15 @@ size_t GKNN::findNeighbors(const GVec& vec)
 			m_pNeighborFinder = new GSparseNeighborFinder(m_pSparseFeatures, &bogus, m_pSparseMetric, false);
 		}
 	}
-	return m_pNeighborFinder->findNearest(m_nNeighbors, vec);
+	size_t nc = m_pNeighborFinder->findNearest(m_nNeighbors, vec);
+	m_neighbors.resize(nc);
+	m_squaredDists.resize(nc);
+	for(size_t i = 0; i < nc; i++)
+	{
+		m_neighbors[i] = m_pNeighborFinder->neighbor(i);
+		m_squaredDists[i] = m_pNeighborFinder->distance(i);
+	}
+	return nc;
 }
 
 void GKNN::interpolateMean(size_t nc, const GVec& in, GPrediction* out, GVec* pOut2)
@@ -467,7 +528,7 @@ void GKNN::interpolateMean(size_t nc, const GVec& in, GPrediction* out, GVec* pO
 			size_t count = 0;
 			for(size_t j = 0; j < nc; j++)
 			{
-				size_t k = m_pNeighborFinder->neighbor(j);
+				size_t k = m_neighbors[j];
 				GVec& neighbor = m_pLabels->row(k);
 				dSum += neighbor[i];
 				dSumOfSquares += (neighbor[i] * neighbor[i]);
@@ -498,7 +559,7 @@ void GKNN::interpolateMean(size_t nc, const GVec& in, GPrediction* out, GVec* pO
 			m_valueCounts.fill(0.0, 0, nValueCount);
 			for(size_t j = 0; j < nc; j++)
 			{
-				size_t k = m_pNeighborFinder->neighbor(j);
+				size_t k = m_neighbors[j];
 				GVec& neighbor = m_pLabels->row(k);
 				int val = (int)neighbor[i];
 				if(val < 0 || val >= (int)nValueCount)
@@ -525,11 +586,11 @@ void GKNN::interpolateLinear(size_t nc, const GVec& in, GPrediction* out, GVec*
 			double dTot = 0;
 			for(size_t j = 0; j < nc; j++)
 			{
-				size_t k = m_pNeighborFinder->neighbor(j);
+				size_t k = m_neighbors[j];
 				GVec& neighbor = m_pLabels->row(k);
 				if(neighbor[i] == UNKNOWN_REAL_VALUE)
 					throw Ex("GKNN doesn't support unknown label values");
-				double d = 1.0 / std::max(sqrt(m_pNeighborFinder->distance(j)), 1e-9); // the weight
+				double d = 1.0 / std::max(sqrt(m_squaredDists[j]), 1e-9); // the weight
 				dTot += d;
 				d *= neighbor[i]; // weighted sum
 				dSum += d;
@@ -562,11 +623,11 @@ void GKNN::interpolateLinear(size_t nc, const GVec& in, GPrediction* out, GVec*
 			double dSumWeight = 0;
 			for(size_t j = 0; j < nc; j++)
 			{
-				size_t k = m_pNeighborFinder->neighbor(j);
+				size_t k = m_neighbors[j];
 				if(k < m_pLabels->rows())
 				{
 					GVec& neighbor = m_pLabels->row(k);
-					double d = 1.0 / std::max(m_pNeighborFinder->distance(j), 1e-9); // to be truly "linear", we should use sqrt(d) instead of d, but this is faster to compute and arguably better for nominal values anyway
+					double d = 1.0 / std::max(m_squaredDists[j], 1e-9); // to be truly "linear", we should use sqrt(d) instead of d, but this is faster to compute and arguably better for nominal values anyway
 					int val = (int)neighbor[i];
 					if(val < 0 || val >= nValueCount)
 						throw Ex("GKNN doesn't support unknown label values");
@@ -593,7 +654,7 @@ void GKNN::interpolateLearner(size_t nc, const GVec& in, GPrediction* out, GVec*
 	dataLabels.reserve(nc);
 	for(size_t i = 0; i < nc; i++)
 	{
-		size_t nNeighbor = m_pNeighborFinder->neighbor(i);
+		size_t nNeighbor = m_neighbors[i];
 		dataFeatures.takeRow(&m_pFeatures->row(nNeighbor));
 		dataLabels.takeRow(&m_pLabels->row(nNeighbor));
 	}
@@ -634,6 +695,49 @@ void GKNN::predict(const GVec& in, GVec& out)
 	}
 }
 
+// virtual
+void GKNN::predictBatch(const GMatrix& features, GMatrix& labels)
+{
+	if(m_eInterpolationMethod == Learner || !m_pDistanceMetric)
+	{
+		GSupervisedLearner::predictBatch(features, labels);
+		return;
+	}
+	if(!m_pNeighborFinder)
+		makeNeighborFinder();
+	size_t labelDims = relLabels().size();
+	if(labels.rows() != features.rows() || labels.cols() != labelDims)
+		labels.resize(features.rows(), labelDims);
+
+	// Search a block of rows at a time, so the result matrices stay small
+	const size_t blockSize = 1024;
+	GMatrix queries;
+	GMatrix neighbors;
+	GMatrix squaredDists;
+	for(size_t start = 0; start < features.rows(); start += blockSize)
+	{
+		size_t count = std::min(blockSize, features.rows() - start);
+		queries.resize(count, features.cols());
+		for(size_t i = 0; i < count; i++)
+			queries[i].copy(features[start + i]);
+		m_pNeighborFinder->findNearest(m_nNeighbors, queries, neighbors, squaredDists);
+		for(size_t i = 0; i < count; i++)
+		{
+			m_neighbors.clear();
+			m_squaredDists.clear();
+			for(size_t j = 0; j < m_nNeighbors && neighbors[i][j] != UNKNOWN_REAL_VALUE; j++)
+			{
+				m_neighbors.push_back((size_t)neighbors[i][j]);
+				m_squaredDists.push_back(squaredDists[i][j]);
+			}
+			if(m_eInterpolationMethod == Linear)
+				interpolateLinear(m_neighbors.size(), features[start + i], NULL, &labels[start + i]);
+			else
+				interpolateMean(m_neighbors.size(), features[start + i], NULL, &labels[start + i]);
+		}
+	}
+}
+
 // virtual
 void GKNN::clear()
 {
@@ -647,11 +751,58 @@ void GKNN::clear()
 }
 
 //static
+// Checks that predictBatch agrees with predict for every row
+void GKNN_checkBatch(GKNN& knn)
+{
+	GRand rand(0);
+	GMatrix features(300, 4);
+	GMatrix labels(300, 2);
+	for(size_t i = 0; i < features.rows(); i++)
+	{
+		features[i].fillUniform(rand);
+		labels[i][0] = features[i][0] + features[i][1] * features[i][2];
+		labels[i][1] = features[i][3] - features[i][0];
+	}
+	knn.train(features, labels);
+	GMatrix queries(150, 4);
+	for(size_t i = 0; i < queries.rows(); i++)
+		queries[i].fillUniform(rand);
+	GMatrix batch;
+	knn.predictBatch(queries, batch);
+	GVec pred(2);
+	for(size_t i = 0; i < queries.rows(); i++)
+	{
+		knn.predict(queries[i], pred);
+		for(size_t j = 0; j < 2; j++)
+		{
+			if(std::abs(batch[i][j] - pred[j]) > 1e-9)
+				throw Ex("predictBatch disagrees with predict");
+		}
+	}
+}
+
 void GKNN::test()
 {
 	GKNN knn;
 	knn.setNeighborCount(3);
 	knn.basicTest(0.72, 0.92, 0.1);
+
+	// Test with approximate neighbors
+	GKNN approx;
+	approx.setNeighborCount(3);
+	approx.useHnsw(8, 50, 32);
+	approx.basicTest(0.72, 0.92, 0.1);
+
+	// Batch prediction
+	GKNN mean;
+	mean.setNeighborCount(5);
+	mean.setInterpolationMethod(GKNN::Mean);
+	GKNN_checkBatch(mean);
+	GKNN linear;
+	linear.setNeighborCount(5);
+	linear.setInterpolationMethod(GKNN::Linear);
+	GKNN_checkBatch(linear);
+	GKNN_checkBatch(approx);
 }
 
 
@@ -76,6 +76,11 @@ protected:
 
 	// Neighbor Finding
 	GNeighborFinderGeneralizing* m_pNeighborFinder;
+	std::vector<size_t> m_neighbors; // the neighbors that the interpolation methods use
+	std::vector<double> m_squaredDists; // the squared distances to those neighbors
+	size_t m_hnswM;
+	size_t m_hnswEfConstruction;
+	size_t m_hnswEfSearch;
 
 public:
 	/// General-purpose constructor
@@ -104,6 +109,11 @@ public:
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
+	/// Finds the neighbors of a block of rows at a time with the parallel batch search of
+	/// GNeighborFinderGeneralizing, and then interpolates each row. (Learner interpolation
+	/// and sparse features fall back to predicting one row at a time.)
+	virtual void predictBatch(const GMatrix& features, GMatrix& labels);
+
 	/// See the comment for GIncrementalLearner::trainSparse
 	virtual void trainSparse(GSparseMatrix& features, GMatrix& labels);
 
@@ -139,6 +149,11 @@ public:
 	/// attribute scaling factors. If you set it to false (the default), it won't.
 	void setOptimizeScaleFactors(bool b);
 
+	/// Specify to find neighbors with an approximate GHnswNeighborFinder instead of an exact
+	/// GKdTree. This is much faster when there are many high-dimensional features. The
+	/// parameters are passed to GHnswNeighborFinder. Pass M = 0 to go back to exact neighbors.
+	void useHnsw(size_t M = 16, size_t efConstruction = 200, size_t efSearch = 64);
+
 	/// Returns the internal feature set
 	GMatrix* features() { return m_pFeatures; }
 
@@ -177,9 +192,13 @@ protected:
 	/// Call SetElbowRoom to specify the elbow room distance.
 	virtual void trainIncremental(const GVec& in, const GVec& out);
 
-	/// Finds the nearest neighbors of pVector. Returns the number of neighbors found.
+	/// Finds the nearest neighbors of pVector, and stores them in m_neighbors and
+	/// m_squaredDists. Returns the number of neighbors found.
 	size_t findNeighbors(const GVec& vector);
 
+	/// Makes a neighbor finder for the dense features.
+	void makeNeighborFinder();
+
 	/// Interpolate with each neighbor having equal vote
 	void interpolateMean(size_t nc, const GVec& in, GPrediction* pOut, GVec* pOut2);
 
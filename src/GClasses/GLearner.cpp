@@ -466,6 +466,16 @@ void GSupervisedLearner::train(const GMatrix& features, const GMatrix& labels)
 	trainInner(features, labels);
 }
 
+// virtual
+void GSupervisedLearner::predictBatch(const GMatrix& features, GMatrix& labels)
+{
+	size_t labelDims = relLabels().size();
+	if(labels.rows() != features.rows() || labels.cols() != labelDims)
+		labels.resize(features.rows(), labelDims);
+	for(size_t i = 0; i < features.rows(); i++)
+		predict(features[i], labels[i]);
+}
+
 void GSupervisedLearner::confusion(GMatrix& features, GMatrix& labels, std::vector<GMatrix*>& stats)
 {
 	if(features.rows() != labels.rows())
@@ -919,6 +929,29 @@ void GIncrementalLearner::beginIncrementalLearning(const GMatrix& features, cons
 	beginIncrementalLearningInner(features, labels);
 }
 
+void GIncrementalLearner::trainStream(GBatchReader& reader, size_t labelDims, size_t epochs, size_t batchRows)
+{
+	GMatrix features, labels;
+	for(size_t epoch = 0; epoch < epochs; epoch++)
+	{
+		reader.rewind();
+		bool first = true;
+		while(reader.next(features, labels, labelDims, batchRows) > 0)
+		{
+			if(epoch == 0 && first)
+				beginIncrementalLearning(features, labels);
+			first = false;
+			GRandomIndexIterator ii(features.rows(), rand());
+			ii.reset();
+			size_t i;
+			while(ii.next(i))
+				trainIncremental(features[i], labels[i]);
+		}
+		if(first)
+			throw Ex("Expected at least one row");
+	}
+}
+
 // ---------------------------------------------------------------
 
 // virtual
@@ -1633,6 +1666,12 @@ void GAutoFilter::predictDistribution(const GVec& in, GPrediction* out)
 	m_pLearner->predictDistribution(in, out);
 }
 
+// virtual
+void GAutoFilter::predictBatch(const GMatrix& features, GMatrix& labels)
+{
+	m_pLearner->predictBatch(features, labels);
+}
+
 // virtual
 void GAutoFilter::beginIncrementalLearningInner(const GMatrix& features, const GMatrix& labels)
 {
@@ -38,6 +38,7 @@ class GSparseMatrix;
 class GCollaborativeFilter;
 class GNeuralNetLearner;
 class GLearnerLoader;
+class GBatchReader;
 
 /// This class is used to represent the predicted distribution made by a supervised learning algorithm.
 /// (It is just a shallow wrapper around GDistribution.) It is used in conjunction with calls
@@ -261,6 +262,12 @@ public:
 	/// before the first time that this method is called.
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut) = 0;
 
+	/// Predicts a label vector for every row in features. If labels does not already
+	/// have one row per row of features and relLabels().size() columns, it is resized.
+	/// The default implementation calls predict once per row. Models that can do better
+	/// with many rows at once (such as ensembles) override it.
+	virtual void predictBatch(const GMatrix& features, GMatrix& labels);
+
 	/// Discards all training for the purpose of freeing memory.
 	/// If you call this method, you must train before making any predictions.
 	/// No settings or options are discarded, so you should be able to
@@ -365,6 +372,13 @@ public:
 	/// Pass a single input row and the corresponding label to incrementally train this model.
 	virtual void trainIncremental(const GVec& in, const GVec& out) = 0;
 
+	/// Trains on every row that reader yields, batchRows rows at a time, so the
+	/// data never has to fit in memory. The last labelDims columns are the labels.
+	/// beginIncrementalLearning is called with the first batch (so data-dependent
+	/// filters are fitted to it), and then trainIncremental is called for each
+	/// row in a random order within its batch. The reader is rewound before each epoch.
+	void trainStream(GBatchReader& reader, size_t labelDims, size_t epochs = 1, size_t batchRows = 10000);
+
 	/// Train using a sparse feature matrix. (A Typical implementation of this
 	/// method will first call beginIncrementalLearning, then it will
 	/// iterate over all of the feature rows, and for each row it
@@ -609,6 +623,9 @@ using GFilter::prefilterLabels;
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
+	/// See the comment for GSupervisedLearner::predictBatch
+	virtual void predictBatch(const GMatrix& features, GMatrix& labels);
+
 	/// See the comment for GIncrementalLearner::trainIncremental
 	virtual void trainIncremental(const GVec& in, const GVec& out);
 
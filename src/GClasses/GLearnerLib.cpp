@@ -158,6 +158,10 @@ void GLearnerLib::loadData(GArgReader& args, std::unique_ptr<GMatrix>& hFeatures
 	{
 		data.loadArff(szFilename);
 	}
+	else if(_stricmp(input_type, "gmat") == 0)
+	{
+		data.loadBinary(szFilename);
+	}
 	else if(_stricmp(input_type, "csv") == 0)
 	{
 		GCSVParser parser;
@@ -238,6 +242,108 @@ void GLearnerLib::loadData(GArgReader& args, std::unique_ptr<GMatrix>& hFeatures
 	hLabelsOut.reset(pLabels);
 }
 
+// Yields the rows of another reader with its columns selected and reordered
+class GLearnerLib_columnReader : public GBatchReader
+{
+protected:
+	std::unique_ptr<GBatchReader> m_pReader;
+	vector<size_t> m_cols;
+	std::unique_ptr<GRelation> m_pRelation;
+	GMatrix m_raw;
+
+public:
+	GLearnerLib_columnReader(GBatchReader* pReader, const vector<size_t>& cols)
+	: GBatchReader(), m_pReader(pReader), m_cols(cols)
+	{
+		const GRelation& rel = pReader->relation();
+		GMixedRelation* pRel = rel.type() == GRelation::ARFF ? new GArffRelation() : new GMixedRelation();
+		m_pRelation.reset(pRel);
+		for(size_t i = 0; i < cols.size(); i++)
+			pRel->copyAttr(&rel, cols[i]);
+	}
+
+	virtual ~GLearnerLib_columnReader() {}
+
+	virtual const GRelation& relation() { return *m_pRelation; }
+	virtual void rewind() { m_pReader->rewind(); }
+
+protected:
+	virtual size_t readRows(GMatrix& batch, size_t maxRows)
+	{
+		size_t n = m_pReader->next(m_raw, maxRows);
+		for(size_t i = 0; i < n; i++)
+		{
+			const GVec& src = m_raw[i];
+			GVec& dest = batch.newRow();
+			for(size_t j = 0; j < m_cols.size(); j++)
+				dest[j] = src[m_cols[j]];
+		}
+		return n;
+	}
+};
+
+GBatchReader* GLearnerLib::loadDataStream(GArgReader& args, size_t& labelDims)
+{
+	if(args.size() < 1)
+		throw Ex("Expected the filename of a datset. (Found end of arguments.)");
+	const char* szFilename = args.pop_string();
+	std::unique_ptr<GBatchReader> hReader(GBatchReader::open(szFilename));
+	size_t attrCount = hReader->relation().size();
+	GCSVBatchReader* pCSV = dynamic_cast<GCSVBatchReader*>(hReader.get());
+	if(pCSV)
+	{
+		cerr << "\nParsing Report (from the first " << to_str(pCSV->sample().rows()) << " rows):\n";
+		for(size_t i = 0; i < attrCount; i++)
+			cerr << to_str(i) << ") " << pCSV->parser().report(i) << "\n";
+	}
+
+	// Parse params
+	vector<size_t> ignore;
+	vector<size_t> labels;
+	while(args.next_is_flag())
+	{
+		if(args.if_pop("-labels"))
+			parseAttributeList(labels, args, attrCount);
+		else if(args.if_pop("-ignore"))
+			parseAttributeList(ignore, args, attrCount);
+		else
+			throw Ex("Invalid option: ", args.peek());
+	}
+	if(labels.size() == 0)
+	{
+		size_t last = attrCount - 1;
+		while(last < attrCount && std::find(ignore.begin(), ignore.end(), last) != ignore.end())
+			last--;
+		if(last >= attrCount)
+			throw Ex("Every attribute is ignored");
+		labels.push_back(last);
+	}
+
+	// Put the features first and the labels last
+	vector<size_t> cols;
+	for(size_t i = 0; i < attrCount; i++)
+	{
+		if(std::find(labels.begin(), labels.end(), i) != labels.end())
+			continue;
+		if(std::find(ignore.begin(), ignore.end(), i) != ignore.end())
+			continue;
+		cols.push_back(i);
+	}
+	for(size_t i = 0; i < labels.size(); i++)
+	{
+		if(std::find(ignore.begin(), ignore.end(), labels[i]) != ignore.end())
+			throw Ex("Attribute ", to_str(labels[i]), " is both ignored and used as a label");
+		cols.push_back(labels[i]);
+	}
+	labelDims = labels.size();
+	bool identity = (cols.size() == attrCount);
+	for(size_t i = 0; identity && i < cols.size(); i++)
+		identity = (cols[i] == i);
+	if(identity)
+		return hReader.release();
+	return new GLearnerLib_columnReader(hReader.release(), cols);
+}
+
 GAgglomerativeTransducer* GLearnerLib::InstantiateAgglomerativeTransducer(GArgReader& args, GMatrix* pFeatures, GMatrix* pLabels)
 {
 	GAgglomerativeTransducer* pTransducer = new GAgglomerativeTransducer();
@@ -472,6 +578,8 @@ GDecisionTree* GLearnerLib::InstantiateDecisionTree(GArgReader& args, GMatrix* p
 		}
 		else if(args.if_pop("-random")){
 			pModel->useRandomDivisions(args.pop_uint());
+		}else if(args.if_pop("-histogram")){
+			pModel->useHistogramSplits(args.pop_uint());
 		}else if(args.if_pop("-leafthresh")){
 			pModel->setLeafThresh(args.pop_uint());
 		}else if(args.if_pop("-maxlevels")){
@@ -494,6 +602,8 @@ GGaussianProcess* GLearnerLib::InstantiateGaussianProcess(GArgReader& args, GMat
 			pModel->setWeightsPriorVariance(args.pop_double());
 		}else if(args.if_pop("-maxsamples")){
 			pModel->setMaxSamples(args.pop_uint());
+		}else if(args.if_pop("-inducingpoints")){
+			pModel->setInducingPoints(args.pop_uint());
 		}else if(args.if_pop("-kernel")){
 			if(args.if_pop("identity"))
 				pModel->setKernel(new GKernelIdentity());
@@ -615,6 +725,24 @@ GKNN* GLearnerLib::InstantiateKNN(GArgReader& args, GMatrix* pFeatures, GMatrix*
 			pModel->setMetric(new GCosineSimilarity(), true);
 		else if(args.if_pop("-pearson"))
 			pModel->setMetric(new GPearsonCorrelation(), true);
+		else if(args.if_pop("-hnsw"))
+		{
+			// The arguments are optional, but they must be given in order
+			size_t m = 16;
+			size_t efc = 200;
+			size_t efs = 64;
+			if(args.next_is_uint())
+			{
+				m = args.pop_uint();
+				if(args.next_is_uint())
+				{
+					efc = args.pop_uint();
+					if(args.next_is_uint())
+						efs = args.pop_uint();
+				}
+			}
+			pModel->useHnsw(m, efc, efs);
+		}
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
@@ -777,14 +905,20 @@ GRandomForest* GLearnerLib::InstantiateRandomForest(GArgReader& args)
 {
 	size_t trees = args.pop_uint();
 	size_t samples = 1;
+	size_t histBins = 0;
 	while(args.next_is_flag())
 	{
 		if(args.if_pop("-samples"))
 			samples = args.pop_uint();
+		else if(args.if_pop("-histogram"))
+			histBins = args.pop_uint();
 		else
 			throw Ex("Invalid random forest option: ", args.peek());
 	}
-	return new GRandomForest(trees, samples);
+	GRandomForest* pModel = new GRandomForest(trees, samples);
+	if(histBins > 0)
+		pModel->useHistogramSplits(histBins);
+	return pModel;
 }
 
 void GLearnerLib::showInstantiateAlgorithmError(const char* szMessage, GArgReader& args)
@@ -975,19 +1109,39 @@ void GLearnerLib::Train(GArgReader& args)
 	// Parse options
 	size_t seed = getpid() * (unsigned int)time(NULL);
 	bool embed = false;
+	bool binary = false;
+	size_t streamRows = 0;
+	size_t epochs = 1;
 	while(args.next_is_flag())
 	{
 		if(args.if_pop("-seed"))
 			seed = args.pop_uint();
 		else if(args.if_pop("-embed"))
 			embed = true;
+		else if(args.if_pop("-binary"))
+			binary = true;
+		else if(args.if_pop("-stream"))
+			streamRows = args.pop_uint();
+		else if(args.if_pop("-epochs"))
+			epochs = args.pop_uint();
 		else
 			throw Ex("Invalid train option: ", args.peek());
 	}
 
-	// Load the data
+	// Load the data (or just the first batch of it)
 	std::unique_ptr<GMatrix> hFeatures, hLabels;
-	loadData(args, hFeatures, hLabels);
+	std::unique_ptr<GBatchReader> hReader;
+	size_t labelDims = 0;
+	if(streamRows > 0)
+	{
+		hReader.reset(loadDataStream(args, labelDims));
+		hFeatures.reset(new GMatrix());
+		hLabels.reset(new GMatrix());
+		if(hReader->next(*hFeatures, *hLabels, labelDims, streamRows) == 0)
+			throw Ex("The dataset contains no rows");
+	}
+	else
+		loadData(args, hFeatures, hLabels);
 	GMatrix* pFeatures = hFeatures.get();
 	GMatrix* pLabels = hLabels.get();
 
@@ -1002,7 +1156,14 @@ void GLearnerLib::Train(GArgReader& args)
 	GSupervisedLearner* pModel = (GSupervisedLearner*)pSupLearner;
 
 	// Train the modeler
-	pModel->train(*pFeatures, *pLabels);
+	if(hReader)
+	{
+		if(!pModel->canTrainIncrementally())
+			throw Ex("Only incremental learners (such as naivebayes) can be trained with -stream");
+		((GIncrementalLearner*)pModel)->trainStream(*hReader, labelDims, epochs, streamRows);
+	}
+	else
+		pModel->train(*pFeatures, *pLabels);
 
 	// Output the trained model
 	GDom doc;
@@ -1010,6 +1171,8 @@ void GLearnerLib::Train(GArgReader& args)
 	doc.setRoot(pRoot);
 	if(embed)
 		doc.writeJsonCpp(cout);
+	else if(binary)
+		doc.writeBinary(cout);
 	else
 		doc.writeJson(cout);
 }
@@ -1030,7 +1193,7 @@ void GLearnerLib::predict(GArgReader& args)
 	GDom doc;
 	if(args.size() < 1)
 		throw Ex("Model not specified.");
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	GLearnerLoader ll(true);
 	GSupervisedLearner* pModeler = ll.loadLearner(doc.root());
 	std::unique_ptr<GSupervisedLearner> hModeler(pModeler);
@@ -1048,12 +1211,7 @@ void GLearnerLib::predict(GArgReader& args)
 	pLabels->fill(0.0); // Wipe out the existing labels, just to be absolutely certain that we don't somehow accidentally let them influence the predictions
 
 	// Test
-	for(size_t i = 0; i < pFeatures->rows(); i++)
-	{
-		GVec& featureVec = pFeatures->row(i);
-		GVec& labelVec = pLabels->row(i);
-		pModeler->predict(featureVec, labelVec);
-	}
+	pModeler->predictBatch(*pFeatures, *pLabels);
 
 	// Print results
 	pLabels->print(cout);
@@ -1075,7 +1233,7 @@ void GLearnerLib::predictDistribution(GArgReader& args)
 	GDom doc;
 	if(args.size() < 1)
 		throw Ex("Model not specified.");
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	GLearnerLoader ll(true);
 	GSupervisedLearner* pModeler = ll.loadLearner(doc.root());
 	std::unique_ptr<GSupervisedLearner> hModeler(pModeler);
@@ -1346,7 +1504,7 @@ void GLearnerLib::Test(GArgReader& args)
 	GDom doc;
 	if(args.size() < 1)
 		throw Ex("Model not specified.");
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	GLearnerLoader ll(true);
 	GSupervisedLearner* pModeler = ll.loadLearner(doc.root());
 	std::unique_ptr<GSupervisedLearner> hModeler(pModeler);
@@ -84,6 +84,10 @@ public:
 
 	static void loadData(GArgReader& args, std::unique_ptr<GMatrix>& hFeaturesOut, std::unique_ptr<GMatrix>& hLabelsOut, bool requireMetadata = false);
 
+	/// Like loadData, but instead of loading the data, it opens a reader that yields it in
+	/// batches. The label columns are moved to the end, and the number of them is returned in labelDims.
+	static GBatchReader* loadDataStream(GArgReader& args, size_t& labelDims);
+
 	static GAgglomerativeTransducer* InstantiateAgglomerativeTransducer(GArgReader& args, GMatrix* pFeatures, GMatrix* pLabels);
 
 	static GBaselineLearner* InstantiateBaseline(GArgReader& args, GMatrix* pFeatures, GMatrix* pLabels);
@@ -37,6 +37,7 @@
 #include "GDom.h"
 #include "GVec.h"
 #include "GHolders.h"
+#include "GThread.h"
 #include <deque>
 #include <set>
 #include <map>
@@ -912,14 +913,16 @@ double GManifoldSculpting::squishPass(size_t nSeedDataPoint)
 
 
 
-GIsomap::GIsomap(size_t neighborCount, size_t targetDims, GRand* pRand) : m_neighborCount(neighborCount), m_targetDims(targetDims), m_pNF(NULL), m_pRand(pRand), m_dropDisconnectedPoints(false)
+GIsomap::GIsomap(size_t neighborCount, size_t targetDims, GRand* pRand) : m_neighborCount(neighborCount), m_targetDims(targetDims), m_pNF(NULL), m_pRand(pRand), m_dropDisconnectedPoints(false), m_landmarks(0), m_pPool(NULL)
 {
 }
 
 GIsomap::GIsomap(GDomNode* pNode)
-: GTransform(pNode)
+: GTransform(pNode), m_pPool(NULL)
 {
 	m_targetDims = (size_t)pNode->getInt("targetDims");
+	GDomNode* pLandmarks = pNode->getIfExists("landmarks");
+	m_landmarks = pLandmarks ? (size_t)pLandmarks->asInt() : 0;
 }
 
 // virtual
@@ -931,6 +934,7 @@ GDomNode* GIsomap::serialize(GDom* pDoc) const
 {
 	GDomNode* pNode = baseDomNode(pDoc, "GIsomap");
 	pNode->add(pDoc, "targetDims", m_targetDims);
+	pNode->add(pDoc, "landmarks", m_landmarks);
 	return pNode;
 }
 
@@ -950,26 +954,60 @@ GMatrix* GIsomap::reduce(const GMatrix& in)
 		hNF.reset(pNF);
 	}
 
-	// Compute the distance matrix using the Floyd Warshall algorithm
-	GFloydWarshall graph(in.rows());
-	for(size_t i = 0; i < in.rows(); i++)
+	// Build the neighbor graph. (Edges go both ways, so a point that is nobody's
+	// nearest neighbor can still be reached.)
+	size_t n = in.rows();
+	GDijkstra graph(n);
+	for(size_t i = 0; i < n; i++)
 	{
 		size_t nc = pNF->findNearest(m_neighborCount, i);
 		for(size_t j = 0; j < nc; j++)
 		{
 			double d = sqrt(pNF->distance(j));
 			graph.addDirectedEdge(i, pNF->neighbor(j), d);
+			graph.addDirectedEdge(pNF->neighbor(j), i, d);
+		}
+	}
+
+	// Compute the geodesic distances from every source
+	std::vector<size_t> sources;
+	sources.reserve(n);
+	for(size_t i = 0; i < n; i++)
+		sources.push_back(i);
+	bool useLandmarks = m_landmarks > 0 && m_landmarks < n;
+	if(useLandmarks)
+	{
+		for(size_t i = 0; i < m_landmarks; i++)
+			std::swap(sources[i], sources[i + (size_t)m_pRand->next(n - i)]);
+		sources.resize(m_landmarks);
+	}
+	GMatrix costs;
+	graph.computeFrom(sources, costs, m_pPool);
+	if(useLandmarks)
+		return reduceWithLandmarks(sources, costs);
+
+	// Deal with disconnected points
+	size_t c = costs.cols();
+	bool connected = true;
+	for(size_t i = 0; i < costs.rows() && connected; i++)
+	{
+		for(size_t j = 0; j < c; j++)
+		{
+			if(costs[i][j] >= 1e200)
+			{
+				connected = false;
+				break;
+			}
 		}
 	}
-	graph.compute();
-	if(!graph.isConnected())
+	if(!connected)
 	{
 		if(!m_dropDisconnectedPoints)
 			throw Ex("The local neighborhoods do not form a connected graph. Increasing the neighbor count may be a good solution. Another solution is to specify to dropDisconnectedPoints.");
-		GMatrix* pCM = graph.costMatrix();
-		size_t c = pCM->cols();
+		GMatrix* pCM = &costs;
 		while(true)
 		{
+			c = pCM->cols();
 			size_t worstRow = 0;
 			size_t missing_count = 0;
 			for(size_t i = 0; i < pCM->rows(); i++)
@@ -998,7 +1036,177 @@ GMatrix* GIsomap::reduce(const GMatrix& in)
 	}
 
 	// Do classic MDS on the distance matrix
-	return GManifold::multiDimensionalScaling(graph.costMatrix(), m_targetDims, m_pRand, false);
+	return GManifold::multiDimensionalScaling(&costs, m_targetDims, m_pRand, false);
+}
+
+GMatrix* GIsomap::reduceWithLandmarks(const std::vector<size_t>& landmarks, GMatrix& costs)
+{
+	size_t n = costs.cols();
+
+	// Drop the landmarks that are the most disconnected from the others until the rest are mutually connected
+	std::vector<size_t> kept;
+	for(size_t i = 0; i < landmarks.size(); i++)
+		kept.push_back(i);
+	while(true)
+	{
+		size_t worst = 0;
+		size_t missingCount = 0;
+		for(size_t a = 0; a < kept.size(); a++)
+		{
+			size_t count = 0;
+			for(size_t b = 0; b < kept.size(); b++)
+			{
+				if(costs[kept[a]][landmarks[kept[b]]] >= 1e200 || costs[kept[b]][landmarks[kept[a]]] >= 1e200)
+					count++;
+			}
+			if(count > missingCount)
+			{
+				missingCount = count;
+				worst = a;
+			}
+		}
+		if(missingCount == 0)
+			break;
+		if(!m_dropDisconnectedPoints)
+			throw Ex("The local neighborhoods do not form a connected graph. Increasing the neighbor count may be a good solution. Another solution is to specify to dropDisconnectedPoints.");
+		kept.erase(kept.begin() + worst);
+	}
+	size_t k = kept.size();
+	if(k <= m_targetDims)
+		throw Ex("Too few connected landmarks to embed into ", to_str(m_targetDims), " dimensions");
+
+	// Find the points that all of the remaining landmarks can reach
+	std::vector<size_t> points;
+	for(size_t j = 0; j < n; j++)
+	{
+		bool reachable = true;
+		for(size_t a = 0; a < k; a++)
+		{
+			if(costs[kept[a]][j] >= 1e200)
+			{
+				reachable = false;
+				break;
+			}
+		}
+		if(reachable)
+			points.push_back(j);
+		else if(!m_dropDisconnectedPoints)
+			throw Ex("The local neighborhoods do not form a connected graph. Increasing the neighbor count may be a good solution. Another solution is to specify to dropDisconnectedPoints.");
+	}
+
+	// Do classic MDS on the landmarks. (It reads the upper triangle of the distance matrix.)
+	GMatrix dl(k, k);
+	for(size_t a = 0; a < k; a++)
+	{
+		for(size_t b = 0; b < k; b++)
+			dl[a][b] = costs[kept[std::min(a, b)]][landmarks[kept[std::max(a, b)]]];
+	}
+	GMatrix* pLandmarkEmbedding = GManifold::multiDimensionalScaling(&dl, m_targetDims, m_pRand, false);
+	std::unique_ptr<GMatrix> hLandmarkEmbedding(pLandmarkEmbedding);
+
+	// The columns of the landmark embedding are eigenvectors scaled by the square roots of their
+	// eigenvalues, so dividing each by its squared magnitude gives the pseudo-inverse of the embedding.
+	GMatrix pinv(m_targetDims, k);
+	for(size_t c = 0; c < m_targetDims; c++)
+	{
+		double lambda = 0.0;
+		for(size_t a = 0; a < k; a++)
+			lambda += (*pLandmarkEmbedding)[a][c] * (*pLandmarkEmbedding)[a][c];
+		for(size_t a = 0; a < k; a++)
+			pinv[c][a] = lambda > 1e-12 ? (*pLandmarkEmbedding)[a][c] / lambda : 0.0;
+	}
+	GVec meanSquared(k);
+	for(size_t a = 0; a < k; a++)
+		meanSquared[a] = dl[a].squaredMagnitude() / k;
+
+	// Embed every point by triangulating from its distances to the landmarks
+	GMatrix* pOut = new GMatrix(points.size(), m_targetDims);
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	pool.parallelFor(0, points.size(), [&](size_t i)
+	{
+		size_t j = points[i];
+		GVec delta(k);
+		for(size_t a = 0; a < k; a++)
+		{
+			double d = costs[kept[a]][j];
+			delta[a] = d * d - meanSquared[a];
+		}
+		GVec& out = (*pOut)[i];
+		for(size_t c = 0; c < m_targetDims; c++)
+			out[c] = -0.5 * pinv[c].dotProduct(delta);
+	}, 256);
+	return pOut;
+}
+
+void GIsomap_makeSpiral(size_t n, GMatrix& data, GVec& t)
+{
+	data.resize(n, 3);
+	t.resize(n);
+	for(size_t i = 0; i < n; i++)
+	{
+		t[i] = 3.0 * M_PI * i / (n - 1);
+		data[i][0] = cos(t[i]);
+		data[i][1] = sin(t[i]);
+		data[i][2] = 0.3 * t[i];
+	}
+}
+
+// Copies the first column of an embedding into y with its mean subtracted
+void GIsomap_centeredColumn(const GMatrix& embedding, GVec& y)
+{
+	y.resize(embedding.rows());
+	for(size_t i = 0; i < embedding.rows(); i++)
+		y[i] = embedding[i][0];
+	y += -y.sum() / y.size();
+}
+
+double GIsomap_correlation(const GMatrix& embedding, const GVec& t)
+{
+	GVec y;
+	GIsomap_centeredColumn(embedding, y);
+	GVec centered;
+	centered.copy(t);
+	centered += -t.sum() / t.size();
+	return y.correlation(centered);
+}
+
+// static
+void GIsomap::test()
+{
+	// A spiral should be unrolled into a line
+	GMatrix data;
+	GVec t;
+	GIsomap_makeSpiral(300, data, t);
+	GRand rand(0);
+	GThreadPool pool(3);
+	GIsomap full(6, 1, &rand);
+	full.setThreadPool(&pool);
+	GMatrix* pFull = full.reduce(data);
+	std::unique_ptr<GMatrix> hFull(pFull);
+	if(pFull->rows() != data.rows() || std::abs(GIsomap_correlation(*pFull, t)) < 0.999)
+		throw Ex("Isomap failed to unroll the spiral");
+
+	// Landmark Isomap should produce nearly the same embedding
+	GIsomap landmark(6, 1, &rand);
+	landmark.setLandmarks(25);
+	landmark.setThreadPool(&pool);
+	GMatrix* pLandmark = landmark.reduce(data);
+	std::unique_ptr<GMatrix> hLandmark(pLandmark);
+	if(pLandmark->rows() != data.rows() || std::abs(GIsomap_correlation(*pLandmark, t)) < 0.999)
+		throw Ex("Landmark Isomap failed to unroll the spiral");
+
+	// Landmark MDS centers the embedding on the landmarks rather than on all of the points,
+	// so compare the embeddings after removing their means
+	GVec yFull, yLandmark;
+	GIsomap_centeredColumn(*pFull, yFull);
+	GIsomap_centeredColumn(*pLandmark, yLandmark);
+	double sign = yFull.dotProduct(yLandmark) < 0.0 ? -1.0 : 1.0;
+	double range = std::abs(yFull[data.rows() - 1] - yFull[0]);
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		if(std::abs(yFull[i] - sign * yLandmark[i]) > 0.02 * range)
+			throw Ex("Landmark Isomap differs from Isomap");
+	}
 }
 
 
@@ -34,6 +34,7 @@ class GNeighborFinderGeneralizing;
 class GNeuralNetLearner;
 class GNeuralNetLayer;
 class GNeighborGraph;
+class GThreadPool;
 
 
 /// This class stores static methods that are useful for manifold learning
@@ -174,10 +175,16 @@ protected:
 };
 
 
-/// Isomap is a manifold learning algorithm that uses the Floyd-Warshall algorithm
+/// Isomap is a manifold learning algorithm that uses shortest paths in a neighbor graph
 /// to compute an estimate of the geodesic distance between every pair of points
 /// using local neighborhoods, and then uses classic multidimensional scaling to
 /// compute a low-dimensional projection.
+/// The geodesic distances are computed with Dijkstra's algorithm over the sparse
+/// neighbor graph, one source per task on a thread pool. If setLandmarks is used,
+/// geodesics are only computed from a random subset of landmark points, MDS is
+/// applied to the landmarks, and every point is embedded by distance-based
+/// triangulation against the landmarks (Landmark Isomap, de Silva and Tenenbaum).
+/// That needs O(m*n) memory instead of O(n^2), so it scales to much larger datasets.
 class GIsomap : public GTransform
 {
 protected:
@@ -186,12 +193,17 @@ protected:
 	GNeighborFinder* m_pNF;
 	GRand* m_pRand;
 	bool m_dropDisconnectedPoints;
+	size_t m_landmarks;
+	GThreadPool* m_pPool;
 
 public:
 	GIsomap(size_t neighborCount, size_t targetDims, GRand* pRand);
 	GIsomap(GDomNode* pNode);
 	virtual ~GIsomap();
 
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
 	/// Serializes this object
 	GDomNode* serialize(GDom* pDoc) const;
 
@@ -206,8 +218,20 @@ public:
 	/// specified to the constructor, and ignore the data passed to the "transform" method.
 	void setNeighborFinder(GNeighborFinder* pNF);
 
+	/// Specifies to use Landmark Isomap with m randomly chosen landmark points. If m is 0
+	/// (the default), or at least the number of points, geodesics are computed between all pairs of points.
+	void setLandmarks(size_t m) { m_landmarks = m; }
+
+	/// Specifies a thread pool for the shortest-path computations. If pPool is NULL (the
+	/// default), GThreadPool::global() is used.
+	void setThreadPool(GThreadPool* pPool) { m_pPool = pPool; }
+
 	/// Performs NLDR
 	virtual GMatrix* reduce(const GMatrix& in);
+
+protected:
+	/// Embeds the points with Landmark Isomap, given the geodesic costs from each landmark.
+	GMatrix* reduceWithLandmarks(const std::vector<size_t>& landmarks, GMatrix& costs);
 };
 
 
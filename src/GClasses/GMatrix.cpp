@@ -35,6 +35,8 @@
 #include "GRand.h"
 #include "GTokenizer.h"
 #include "GTime.h"
+#include "GThread.h"
+#include "GTruncatedSVD.h"
 #include <algorithm>
 #include <fstream>
 #include <sstream>
@@ -42,6 +44,25 @@
 #include <set>
 #include <errno.h>
 #include <memory>
+#include <thread>
+#include <stdint.h>
+#ifndef WINDOWS
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+#if defined(__AVX2__) && defined(__FMA__)
+#	include <immintrin.h>
+#	define GMATRIX_AVX2
+#	define GMATRIX_AVX2_TARGET
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// Build the AVX2 kernel anyway, and pick it at runtime when the CPU supports it
+#	include <immintrin.h>
+#	define GMATRIX_AVX2
+#	define GMATRIX_AVX2_TARGET __attribute__((target("avx2,fma")))
+#	define GMATRIX_DISPATCH
+#endif
 
 using std::vector;
 using std::string;
@@ -469,6 +490,7 @@ public:
 	m_whitespace("\t\n\r "), m_spaces(" \t"), m_space(" "), m_valEnd(",}\n"), m_valEnder(" ,\t}\n"), m_valHardEnder(",}\t\n"), m_argEnd(" \t\n{\r"), m_newline("\n"), m_commaNewlineTab(",\n\t") {}
 	GArffTokenizer(const char* pFile, size_t len) : GTokenizer(pFile, len),
 	m_whitespace("\t\n\r "), m_spaces(" \t"), m_space(" "), m_valEnd(",}\n"), m_valEnder(" ,\t}\n"), m_valHardEnder(",}\t\n"), m_argEnd(" \t\n{\r"), m_newline("\n"), m_commaNewlineTab(",\n\t") {}
+	GArffTokenizer(const char* pFile, size_t len, size_t firstLine) : GArffTokenizer(pFile, len) { m_line = firstLine; }
 	virtual ~GArffTokenizer() {}
 };
 
@@ -805,6 +827,13 @@ int GArffRelation::findEnumeratedValue(size_t nAttr, const char* szValue) const
 	return UNKNOWN_DISCRETE_VALUE;
 }
 
+const char* GArffRelation::attrValue(size_t nAttr, size_t nValue) const
+{
+	if(nValue >= m_attrs[nAttr].m_values.size())
+		throw Ex("Value ", to_str(nValue), " of attribute ", to_str(nAttr), " has no name");
+	return m_attrs[nAttr].m_values[nValue].c_str();
+}
+
 const char* GArffRelation::attrName(size_t nAttr) const
 {
 	return m_attrs[nAttr].m_name.c_str();
@@ -913,29 +942,134 @@ void GArffRelation::dropValue(size_t attr, int val)
 
 // ------------------------------------------------------------------
 
+/// A row of a GMatrix in contiguous mode. Its values belong to a slab, so it
+/// refuses any operation that would free or replace them.
+class GMatrixSlabRow : public GVecWrapper
+{
+public:
+	virtual void resize(size_t n)
+	{
+		if(n != m_size)
+			throw Ex("Rows in contiguous storage cannot be resized. Use newColumns or deleteColumns on the matrix instead.");
+	}
+
+	virtual void resizePreserve(size_t n)
+	{
+		resize(n);
+	}
+
+	virtual void swapContents(GVec& that)
+	{
+		throw Ex("Rows in contiguous storage cannot swap their buffers. Use GMatrix::swapRows instead.");
+	}
+};
+
+/// A block of row storage for a GMatrix in contiguous mode. The values live
+/// in one aligned buffer, and the row objects that view them live in one array.
+class GMatrixSlab
+{
+public:
+	double* m_pBuf;
+	double* m_pData;
+	GMatrixSlabRow* m_pRows;
+	size_t m_cols;
+	size_t m_stride;
+	size_t m_capacity;
+	size_t m_used;
+
+	void* m_pMap;
+	size_t m_mapLen;
+
+	GMatrixSlab(size_t cols, size_t capacity)
+	: m_cols(cols), m_capacity(capacity), m_used(0), m_pMap(NULL), m_mapLen(0)
+	{
+		m_stride = GMatrixSlab::paddedStride(cols);
+		m_pBuf = new double[m_stride * capacity + 8];
+		m_pData = GMatrixSlab::align(m_pBuf);
+		m_pRows = new GMatrixSlabRow[capacity];
+	}
+
+	/// Makes a slab whose rows are already in pData, which is somewhere in a region
+	/// of memory that was mapped from a file. The slab takes ownership of the mapping.
+	GMatrixSlab(void* pMap, size_t mapLen, double* pData, size_t cols, size_t stride, size_t rows)
+	: m_pBuf(NULL), m_pData(pData), m_cols(cols), m_stride(stride), m_capacity(rows), m_used(0), m_pMap(pMap), m_mapLen(mapLen)
+	{
+		m_pRows = new GMatrixSlabRow[rows];
+	}
+
+	~GMatrixSlab()
+	{
+		delete[] m_pRows;
+		delete[] m_pBuf;
+#ifndef WINDOWS
+		if(m_pMap)
+			munmap(m_pMap, m_mapLen);
+#endif
+	}
+
+	bool isFull() const { return m_used >= m_capacity; }
+
+	GVec* next()
+	{
+		GAssert(m_used < m_capacity);
+		GMatrixSlabRow* pRow = &m_pRows[m_used];
+		pRow->setData(m_pData + m_used * m_stride, m_cols);
+		m_used++;
+		return pRow;
+	}
+
+	bool owns(const GVec* pRow) const
+	{
+		std::less<const GVec*> lt;
+		return !lt(pRow, m_pRows) && lt(pRow, m_pRows + m_capacity);
+	}
+
+	/// Pads rows of 8 or more values to a whole number of cache lines, and
+	/// shorter rows to a power of 2, so that no row straddles a cache line
+	/// unnecessarily.
+	static size_t paddedStride(size_t cols)
+	{
+		if(cols >= 8)
+			return (cols + 7) & ~(size_t)7;
+		size_t stride = 1;
+		while(stride < cols)
+			stride *= 2;
+		return stride;
+	}
+
+	/// Rounds p up to a 64-byte boundary.
+	static double* align(double* p)
+	{
+		size_t misalign = ((size_t)p) & 63;
+		return misalign == 0 ? p : (double*)(((char*)p) + (64 - misalign));
+	}
+};
+
 GMatrix::GMatrix()
-: m_pRelation(&g_emptyRelation)
+: m_pRelation(&g_emptyRelation), m_contiguous(false)
 {
 }
 
 GMatrix::GMatrix(GRelation* pRelation)
-: m_pRelation(pRelation)
+: m_pRelation(pRelation), m_contiguous(false)
 {
 }
 
 GMatrix::GMatrix(size_t rowCount, size_t colCount)
+: m_contiguous(false)
 {
 	m_pRelation = new GUniformRelation(colCount, 0);
 	newRows(rowCount);
 }
 
 GMatrix::GMatrix(vector<size_t>& attrValues)
+: m_contiguous(false)
 {
 	m_pRelation = new GMixedRelation(attrValues);
 }
 
 GMatrix::GMatrix(const GMatrix& orig, size_t rowStart, size_t colStart, size_t rowCount, size_t colCount)
-: m_pRelation(NULL)
+: m_pRelation(NULL), m_contiguous(false)
 {
 	copy(orig, rowStart, colStart, rowCount, colCount);
 }
@@ -947,6 +1081,7 @@ GMatrix& GMatrix::operator=(const GMatrix& orig)
 }
 
 GMatrix::GMatrix(const GDomNode* pNode)
+: m_contiguous(false)
 {
 	m_pRelation = GRelation::deserialize(pNode->get("rel"));
 	GDomNode* pRows = pNode->get("vals");
@@ -960,8 +1095,8 @@ GMatrix::GMatrix(const GDomNode* pNode)
 		if(it2.remaining() != dims)
 			throw Ex("Row ", to_str(i), " has an unexpected number of values");
 		GVec& pat = newRow();
-		for(size_t j = 0 ; it2.current(); it2.advance())
-			pat[j++] = it2.currentDouble();
+		for(size_t j = 0; j < dims; j++, it2.advance())
+			pat[j] = it2.currentDouble();
 		i++;
 	}
 }
@@ -1018,8 +1153,107 @@ void GMatrix::resize(size_t rowCount, size_t colCount)
 void GMatrix::flush()
 {
 	for(size_t i = 0; i < rows(); i++)
-		delete(m_rows[i]);
+	{
+		if(!isSlabRow(m_rows[i]))
+			delete(m_rows[i]);
+	}
 	m_rows.clear();
+	for(size_t i = 0; i < m_slabs.size(); i++)
+		delete(m_slabs[i]);
+	m_slabs.clear();
+}
+
+bool GMatrix::isSlabRow(const GVec* pRow) const
+{
+	for(size_t i = 0; i < m_slabs.size(); i++)
+	{
+		if(m_slabs[i]->owns(pRow))
+			return true;
+	}
+	return false;
+}
+
+GVec* GMatrix::detachRow(GVec* pRow)
+{
+	if(!isSlabRow(pRow))
+		return pRow;
+	GVec* pCopy = new GVec(pRow->size());
+	pCopy->copy(*pRow);
+	return pCopy;
+}
+
+GVec* GMatrix::allocRow()
+{
+	if(!m_contiguous)
+		return new GVec(m_pRelation->size());
+	if(m_slabs.size() == 0 || m_slabs.back()->isFull() || m_slabs.back()->m_cols != m_pRelation->size())
+	{
+		// Grow geometrically, so n rows take O(log n) allocations
+		size_t capacity = std::max((size_t)64, std::max(m_rows.capacity(), m_rows.size() * 2) - m_rows.size());
+		m_slabs.push_back(new GMatrixSlab(m_pRelation->size(), capacity));
+	}
+	return m_slabs.back()->next();
+}
+
+void GMatrix::reserve(size_t n)
+{
+	m_rows.reserve(n);
+	if(m_contiguous && n > m_rows.size())
+	{
+		size_t needed = n - m_rows.size();
+		GMatrixSlab* pSlab = m_slabs.size() > 0 ? m_slabs.back() : nullptr;
+		if(!pSlab || pSlab->m_cols != m_pRelation->size() || pSlab->m_capacity - pSlab->m_used < needed)
+			m_slabs.push_back(new GMatrixSlab(m_pRelation->size(), needed));
+	}
+}
+
+void GMatrix::setContiguous(bool contiguous)
+{
+	if(contiguous)
+	{
+		// Pack all the rows into one new slab
+		size_t colCount = m_pRelation->size();
+		GMatrixSlab* pSlab = new GMatrixSlab(colCount, std::max((size_t)1, m_rows.size()));
+		std::vector<GVec*> newRows;
+		newRows.reserve(m_rows.capacity());
+		for(size_t i = 0; i < m_rows.size(); i++)
+		{
+			GVec* pRow = pSlab->next();
+			pRow->copy(*m_rows[i]);
+			newRows.push_back(pRow);
+		}
+		flush();
+		m_rows.swap(newRows);
+		m_slabs.push_back(pSlab);
+		m_contiguous = true;
+	}
+	else
+	{
+		m_contiguous = false;
+		if(m_slabs.size() == 0)
+			return;
+		for(size_t i = 0; i < m_rows.size(); i++)
+			m_rows[i] = detachRow(m_rows[i]);
+		for(size_t i = 0; i < m_slabs.size(); i++)
+			delete(m_slabs[i]);
+		m_slabs.clear();
+	}
+}
+
+double* GMatrix::contiguousData(size_t& stride)
+{
+	if(m_slabs.size() != 1 || m_rows.size() == 0)
+		return nullptr;
+	GMatrixSlab* pSlab = m_slabs[0];
+	if(pSlab->m_used != m_rows.size())
+		return nullptr;
+	for(size_t i = 0; i < m_rows.size(); i++)
+	{
+		if(m_rows[i] != &pSlab->m_pRows[i])
+			return nullptr;
+	}
+	stride = pSlab->m_stride;
+	return pSlab->m_pData;
 }
 
 inline bool IsRealValue(const char* szValue)
@@ -1045,6 +1279,9 @@ double GMatrix_parseValue(GArffRelation* pRelation, size_t col, const char* szVa
 		{
 			if(!IsRealValue(szVal))
 				throw Ex("Expected a numeric value at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
+			double val;
+			if(GBits::parseFloat(szVal, strlen(szVal), &val))
+				return val;
 			return atof(szVal);
 		}
 	}
@@ -1080,10 +1317,77 @@ double GMatrix_parseValue(GArffRelation* pRelation, size_t col, const char* szVa
 		throw Ex("Unexpected attribute type, ", to_str(vals));
 }
 
-void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
+// Text that is smaller than this is parsed in one piece
+#define GMATRIX_MIN_PARSE_PIECE 65536
+
+// Splits pFile[begin, len) into pieces that hold whole lines, so they can be parsed independently.
+// If firstPiece is non-zero, the first piece is only about that big. The rest are split as evenly as
+// possible into about the specified number of pieces, but no smaller than GMATRIX_MIN_PARSE_PIECE.
+// starts is set to the position where each piece begins, followed by len.
+void GMatrix_splitLines(const char* pFile, size_t begin, size_t len, size_t firstPiece, size_t pieces, vector<size_t>& starts)
+{
+	starts.clear();
+	starts.push_back(begin);
+	size_t pieceSize = std::max((size_t)GMATRIX_MIN_PARSE_PIECE, (len - begin) / std::max((size_t)1, pieces) + 1);
+	while(starts.back() < len)
+	{
+		size_t target = starts.back() + ((starts.size() == 1 && firstPiece > 0) ? firstPiece : pieceSize);
+		if(target >= len)
+		{
+			starts.push_back(len);
+			break;
+		}
+		const char* pNewline = (const char*)memchr(pFile + target - 1, '\n', len - target + 1);
+		starts.push_back(pNewline ? (size_t)(pNewline - pFile) + 1 : len);
+	}
+	if(starts.size() == 1)
+		starts.push_back(len);
+}
+
+// Returns the number of newline characters in p[0, len).
+size_t GMatrix_countLines(const char* p, size_t len)
+{
+	size_t count = 0;
+	const char* pEnd = p + len;
+	while(p < pEnd && (p = (const char*)memchr(p, '\n', pEnd - p)) != NULL)
+	{
+		count++;
+		p++;
+	}
+	return count;
+}
+
+// Calls f(i) for each i in [0, pieces) with the pool. If any of the calls throw, the error from the
+// first such piece is rethrown, so the error that is reported does not depend on the timing of the threads.
+template<typename F>
+void GMatrix_forEachPiece(GThreadPool& pool, size_t pieces, F f)
+{
+	vector<string> errors(pieces);
+	pool.parallelFor(0, pieces, [&](size_t i) {
+		try
+		{
+			f(i);
+		}
+		catch(const std::exception& e)
+		{
+			errors[i] = e.what();
+			if(errors[i].length() == 0)
+				errors[i] = "An error occurred while parsing";
+		}
+	});
+	for(size_t i = 0; i < pieces; i++)
+	{
+		if(errors[i].length() > 0)
+			throw Ex(errors[i]);
+	}
+}
+
+// Parses the meta-data at the start of an ARFF file, and leaves tok at the first row of data
+GArffRelation* GMatrix_parseArffHeader(GArffTokenizer& tok)
 {
 	// Parse the meta data
 	GArffRelation* pRelation = new GArffRelation();
+	std::unique_ptr<GArffRelation> hRelation(pRelation);
 	while(true)
 	{
 		tok.skipWhile(tok.m_whitespace);
@@ -1118,17 +1422,19 @@ void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
 			throw Ex("Expected a '%' or a '@' at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
 	}
 
-	flush();
-	setRelation(pRelation);
+	return hRelation.release();
+}
+
+// Parses the next row of ARFF data into a new row of m. Returns false if there are no more rows.
+bool GMatrix_parseArffRow(GArffTokenizer& tok, GArffRelation* pRelation, GMatrix& m)
+{
 	size_t colCount = pRelation->size();
 	while(true)
 	{
-		if(rows() >= maxRows)
-			break;
 		tok.skipWhile(tok.m_whitespace);
 		char c = tok.peek();
 		if(c == '\0')
-			break;
+			return false;
 		else if(c == '%')
 		{
 			tok.skip(1);
@@ -1138,7 +1444,7 @@ void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
 		{
 			// Parse ARFF sparse data format
 			tok.skip(1);
-			GVec& r = newRow();
+			GVec& r = m.newRow();
 			r.fill(0.0);
 			while(true)
 			{
@@ -1172,11 +1478,12 @@ void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
 				else
 					throw Ex("Unexpected token at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
 			}
+			return true;
 		}
 		else
 		{
 			// Parse ARFF dense data format
-			GVec& r = newRow();
+			GVec& r = m.newRow();
 			size_t column = 0;
 			while(true)
 			{
@@ -1205,17 +1512,49 @@ void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
 			}
 			if(column < colCount)
 				throw Ex("Not enough values on line ", to_str(tok.line()), ", col ", to_str(tok.col()));
+			return true;
 		}
 	}
-	for(size_t i = 0; i < colCount; i++)
+}
+
+// String and date attributes are parsed into continuous values
+void GMatrix_finishArffRelation(GArffRelation* pRelation)
+{
+	for(size_t i = 0; i < pRelation->size(); i++)
 	{
 		if(pRelation->valueCount(i) == INVALID_INDEX)
 			pRelation->setAttrValueCount(i, 0);
 	}
 }
 
-void GMatrix::loadArff(const char* szFilename, size_t maxRows)
+void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
+{
+	GArffRelation* pRelation = GMatrix_parseArffHeader(tok);
+	flush();
+	setRelation(pRelation);
+	setContiguous(true);
+	while(rows() < maxRows)
+	{
+		if(!GMatrix_parseArffRow(tok, pRelation, *this))
+			break;
+	}
+	GMatrix_finishArffRelation(pRelation);
+}
+
+void GMatrix::loadArff(const char* szFilename, size_t maxRows, GThreadPool* pPool)
 {
+	GThreadPool& pool = pPool ? *pPool : GThreadPool::global();
+	if(maxRows == INVALID_INDEX && pool.workers() > 0)
+	{
+		size_t nLen;
+		char* szFile = GFile::loadFile(szFilename, &nLen);
+		std::unique_ptr<char[]> hFile(szFile);
+		if(nLen > 0)
+		{
+			parseArff(szFile, nLen, maxRows, &pool);
+			return;
+		}
+	}
 	GArffTokenizer tok(szFilename);
 	parseArff(tok, maxRows);
 }
@@ -1228,6 +1567,8 @@ void GMatrix::loadRaw(const char* szFilename)
 		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
 	fin.read((char *) &r, sizeof(size_t));
 	fin.read((char *) &c, sizeof(size_t));
+	flush();
+	setContiguous(true);
 	resize(r, c);
 	for(size_t i = 0; i < r; i++)
 		fin.read((char *) m_rows[i]->data(), sizeof(double) * c);
@@ -1246,6 +1587,8 @@ void GMatrix::load(const char* szFilename)
 			loadArff(szFilename);
 		else if(ext == "raw")
 			loadRaw(szFilename);
+		else if(ext == "gmat")
+			loadBinary(szFilename);
 		else
 			throw Ex("File type could not be determined.");
 	}
@@ -1270,11 +1613,228 @@ void GMatrix::saveRaw(const char* szFilename)
 	fout.close();
 }
 
-// static
-void GMatrix::parseArff(const char* szFile, size_t nLen, size_t maxRows)
+#define GMATRIX_BINARY_SIGNATURE "GMATRIX1"
+#define GMATRIX_BINARY_ALIGN 4096
+#define GMATRIX_BINARY_BYTE_ORDER 0x0102030405060708ull
+
+// The header of a file written by saveBinary. It follows the signature.
+struct GMatrixBinaryHeader
 {
-	GArffTokenizer tok(szFile, nLen);
-	parseArff(tok, maxRows);
+	uint64_t byteOrder; // GMATRIX_BINARY_BYTE_ORDER, as written by the machine that saved it
+	uint64_t rows;
+	uint64_t cols;
+	uint64_t stride; // the number of doubles from the start of one row to the start of the next
+	uint64_t relationStart; // where the relation begins, in bytes from the start of the file
+	uint64_t relationBytes;
+	uint64_t dataStart; // where the first row begins, in bytes from the start of the file
+};
+
+void GMatrix::saveBinary(const char* szFilename)
+{
+	// Serialize the relation
+	GDom doc;
+	doc.setRoot(m_pRelation->serialize(&doc));
+	std::ostringstream os;
+	doc.writeBinary(os);
+	string rel = os.str();
+
+	// Make the header
+	GMatrixBinaryHeader header;
+	size_t sigLen = strlen(GMATRIX_BINARY_SIGNATURE);
+	header.byteOrder = GMATRIX_BINARY_BYTE_ORDER;
+	header.rows = rows();
+	header.cols = cols();
+	header.stride = GMatrixSlab::paddedStride(cols());
+	header.relationStart = sigLen + sizeof(GMatrixBinaryHeader);
+	header.relationBytes = rel.length();
+	header.dataStart = (header.relationStart + header.relationBytes + GMATRIX_BINARY_ALIGN - 1) / GMATRIX_BINARY_ALIGN * GMATRIX_BINARY_ALIGN;
+
+	// Write it all
+	std::ofstream fout;
+	fout.exceptions(std::ios::badbit | std::ios::failbit);
+	try
+	{
+		fout.open(szFilename, std::ios::out | std::ios::binary);
+	}
+	catch(const std::exception&)
+	{
+		throw Ex("Error while trying to create the file, ", szFilename, ". ", strerror(errno));
+	}
+	fout.write(GMATRIX_BINARY_SIGNATURE, sigLen);
+	fout.write((const char*)&header, sizeof(GMatrixBinaryHeader));
+	fout.write(rel.data(), rel.length());
+	vector<char> zeros(GMATRIX_BINARY_ALIGN, 0);
+	fout.write(zeros.data(), header.dataStart - header.relationStart - header.relationBytes);
+	size_t c = cols();
+	size_t pad = (size_t)header.stride - c;
+	for(size_t i = 0; i < rows(); i++)
+	{
+		fout.write((const char*)m_rows[i]->data(), sizeof(double) * c);
+		fout.write(zeros.data(), sizeof(double) * pad);
+	}
+	fout.close();
+}
+
+// Checks the header of a file written by saveBinary, and deserializes its relation
+GRelation* GMatrix_parseBinaryHeader(const char* pFile, size_t len, GMatrixBinaryHeader& header)
+{
+	size_t sigLen = strlen(GMATRIX_BINARY_SIGNATURE);
+	if(len < sigLen + sizeof(GMatrixBinaryHeader) || memcmp(pFile, GMATRIX_BINARY_SIGNATURE, sigLen) != 0)
+		throw Ex("This is not a binary matrix file");
+	memcpy(&header, pFile + sigLen, sizeof(GMatrixBinaryHeader));
+	if(header.byteOrder != GMATRIX_BINARY_BYTE_ORDER)
+		throw Ex("This binary matrix file was written on a machine with a different byte order");
+	if(header.stride < header.cols || header.relationStart > len || header.relationBytes > len - header.relationStart || header.dataStart % 64 != 0)
+		throw Ex("Invalid binary matrix header");
+	if(header.dataStart > len || (header.stride > 0 && header.rows > (len - header.dataStart) / sizeof(double) / header.stride))
+		throw Ex("The binary matrix file is truncated");
+	GDom doc;
+	doc.parseBinary(pFile + header.relationStart, (size_t)header.relationBytes);
+	GRelation* pRelation = GRelation::deserialize(doc.root());
+	if(pRelation->size() != header.cols)
+	{
+		delete(pRelation);
+		throw Ex("The relation does not match the number of columns");
+	}
+	return pRelation;
+}
+
+void GMatrix::loadBinary(const char* szFilename)
+{
+	GMatrixBinaryHeader header;
+#ifdef WINDOWS
+	size_t len;
+	char* pFile = GFile::loadFile(szFilename, &len);
+	std::unique_ptr<char[]> hFile(pFile);
+	GRelation* pRelation = GMatrix_parseBinaryHeader(pFile, len, header);
+	flush();
+	setRelation(pRelation);
+	setContiguous(true);
+	newRows((size_t)header.rows);
+	const double* pRows = (const double*)(pFile + header.dataStart);
+	for(size_t i = 0; i < (size_t)header.rows; i++)
+		m_rows[i]->copy(pRows + i * (size_t)header.stride, (size_t)header.cols);
+#else
+	int fd = ::open(szFilename, O_RDONLY);
+	if(fd < 0)
+		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		throw Ex("Error while trying to read the file, ", szFilename, ". ", strerror(errno));
+	}
+	size_t len = (size_t)st.st_size;
+	if(len == 0)
+	{
+		::close(fd);
+		throw Ex("The file, ", szFilename, ", is empty");
+	}
+	void* pMap = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(pMap == MAP_FAILED)
+		throw Ex("Error while trying to map the file, ", szFilename, ". ", strerror(errno));
+	GRelation* pRelation;
+	try
+	{
+		pRelation = GMatrix_parseBinaryHeader((const char*)pMap, len, header);
+	}
+	catch(...)
+	{
+		munmap(pMap, len);
+		throw;
+	}
+	flush();
+	setRelation(pRelation);
+	GMatrixSlab* pSlab = new GMatrixSlab(pMap, len, (double*)((char*)pMap + header.dataStart), (size_t)header.cols, (size_t)header.stride, (size_t)header.rows);
+	m_slabs.push_back(pSlab);
+	m_rows.reserve((size_t)header.rows);
+	for(size_t i = 0; i < (size_t)header.rows; i++)
+		m_rows.push_back(pSlab->next());
+	m_contiguous = true;
+#endif
+}
+
+// Returns the position just after the line in an ARFF file that begins with "@data", or INVALID_INDEX
+size_t GMatrix_findArffData(const char* szFile, size_t nLen)
+{
+	size_t pos = 0;
+	while(pos < nLen)
+	{
+		const char* pEol = (const char*)memchr(szFile + pos, '\n', nLen - pos);
+		size_t lineEnd = pEol ? (size_t)(pEol - szFile) : nLen;
+		while(pos < lineEnd && (szFile[pos] == ' ' || szFile[pos] == '\t' || szFile[pos] == '\r'))
+			pos++;
+		if(lineEnd - pos >= 5 && szFile[pos] == '@' && _strnicmp(szFile + pos + 1, "data", 4) == 0 && (pos + 5 == lineEnd || szFile[pos + 5] <= ' '))
+			return std::min(lineEnd + 1, nLen);
+		pos = lineEnd + 1;
+	}
+	return INVALID_INDEX;
+}
+
+void GMatrix::parseArff(const char* szFile, size_t nLen, size_t maxRows, GThreadPool* pPool)
+{
+	GThreadPool& pool = pPool ? *pPool : GThreadPool::global();
+	size_t dataStart = INVALID_INDEX;
+	if(maxRows == INVALID_INDEX && pool.workers() > 0 && nLen >= 2 * GMATRIX_MIN_PARSE_PIECE)
+		dataStart = GMatrix_findArffData(szFile, nLen);
+	if(dataStart == INVALID_INDEX)
+	{
+		GArffTokenizer tok(szFile, nLen);
+		parseArff(tok, maxRows);
+		return;
+	}
+
+	// Parse the header
+	GArffTokenizer headerTok(szFile, dataStart);
+	GArffRelation* pRelation = GMatrix_parseArffHeader(headerTok);
+	std::unique_ptr<GArffRelation> hRelation(pRelation);
+
+	// Find where each piece of the data begins
+	vector<size_t> starts;
+	GMatrix_splitLines(szFile, dataStart, nLen, 0, 4 * (pool.workers() + 1), starts);
+	size_t pieces = starts.size() - 1;
+	vector<size_t> firstLines(pieces);
+	pool.parallelFor(0, pieces, [&](size_t i) {
+		firstLines[i] = GMatrix_countLines(szFile + starts[i], starts[i + 1] - starts[i]);
+	});
+	size_t line = 1 + GMatrix_countLines(szFile, dataStart);
+	for(size_t i = 0; i < pieces; i++)
+	{
+		size_t n = firstLines[i];
+		firstLines[i] = line;
+		line += n;
+	}
+
+	// Parse the pieces in parallel. (All of the nominal values are declared in the
+	// header, so the pieces do not need to agree on anything else.)
+	vector< std::unique_ptr<GMatrix> > parts(pieces);
+	GMatrix_forEachPiece(pool, pieces, [&](size_t i) {
+		parts[i].reset(new GMatrix(0, pRelation->size()));
+		if(starts[i + 1] > starts[i])
+		{
+			GArffTokenizer tok(szFile + starts[i], starts[i + 1] - starts[i], firstLines[i]);
+			while(GMatrix_parseArffRow(tok, pRelation, *parts[i]))
+			{
+			}
+		}
+	});
+
+	// Put the rows together in order
+	vector<size_t> offsets(pieces + 1, 0);
+	for(size_t i = 0; i < pieces; i++)
+		offsets[i + 1] = offsets[i] + parts[i]->rows();
+	flush();
+	setRelation(hRelation.release());
+	setContiguous(true);
+	newRows(offsets[pieces]);
+	GMatrix_forEachPiece(pool, pieces, [&](size_t i) {
+		GMatrix& part = *parts[i];
+		for(size_t j = 0; j < part.rows(); j++)
+			(*this)[offsets[i] + j].copy(part[j]);
+		parts[i].reset();
+	});
+	GMatrix_finishArffRelation(pRelation);
 }
 
 size_t GMatrix::countUniqueValues(size_t column, size_t maxCount) const
@@ -1405,144 +1965,374 @@ void GMatrix::multiply(double scalar)
 		row(i) *= scalar;
 }
 
-void GMatrix::multiply(const GVec& vectorIn, GVec& vectorOut, bool transposeFirst) const
-{
-	size_t rowCount = rows();
-	if(transposeFirst)
-	{
-		vectorOut.fill(0.0);
-		for(size_t i = 0; i < rowCount; i++)
-			vectorOut.addScaled(vectorIn[i], row(i));
-	}
-	else
-	{
-		for(size_t i = 0; i < rowCount; i++)
-			vectorOut[i] = row(i).dotProduct(vectorIn);
-	}
-}
+// ----------------------------------------------------------------------
+// Matrix-multiply engine. The product is computed a panel at a time: a
+// KC-deep slice of op(A) and op(B) is packed into contiguous buffers (so the
+// inner loops never chase row pointers), and an MR x NR register tile of C
+// is accumulated from the packed slivers. Large products are split into
+// bands of C that are computed in parallel.
+// ----------------------------------------------------------------------
 
-// static
-GMatrix* GMatrix::multiply(const GMatrix& a, const GMatrix& b, bool transposeA, bool transposeB)
+#define GEMM_MR 4
+#define GEMM_NR 8
+#define GEMM_KC 256
+#define GEMM_MC 128
+#define GEMM_NC 2048
+#define GEMM_PARALLEL_FLOPS 8000000
+
+// Packs rows [i0, i0 + mc) and inner indexes [p0, p0 + kc) of op(A) into
+// slivers of GEMM_MR rows. Rows past the end are padded with zeros.
+void GMatrix_gemmPackA(const GMatrix& a, bool transA, size_t i0, size_t mc, size_t p0, size_t kc, double* pBuf)
 {
-	if(transposeA)
+	for(size_t s = 0; s < mc; s += GEMM_MR)
 	{
-		if(transposeB)
+		size_t mr = std::min((size_t)GEMM_MR, mc - s);
+		if(transA)
 		{
-			size_t dims = a.rows();
-			if((size_t)b.cols() != dims)
-				throw Ex("dimension mismatch");
-			size_t w = b.rows();
-			size_t h = a.cols();
-			GMatrix* pOut = new GMatrix(h, w);
-			for(size_t y = 0; y < h; y++)
+			for(size_t p = 0; p < kc; p++)
 			{
-				GVec& r = pOut->row(y);
-				for(size_t x = 0; x < w; x++)
-				{
-					const GVec& pB = b[x];
-					double sum = 0;
-					for(size_t i = 0; i < dims; i++)
-						sum += a[i][y] * pB[i];
-					r[x] = sum;
-				}
+				const double* pSrc = a[p0 + p].data() + i0 + s;
+				size_t ii;
+				for(ii = 0; ii < mr; ii++)
+					pBuf[ii] = pSrc[ii];
+				for( ; ii < GEMM_MR; ii++)
+					pBuf[ii] = 0.0;
+				pBuf += GEMM_MR;
 			}
-			return pOut;
 		}
 		else
 		{
-			size_t dims = a.rows();
-			if(b.rows() != dims)
-				throw Ex("dimension mismatch");
-			size_t w = b.cols();
-			size_t h = a.cols();
-			GMatrix* pOut = new GMatrix(h, w);
-			for(size_t y = 0; y < h; y++)
+			for(size_t ii = 0; ii < GEMM_MR; ii++)
 			{
-				GVec& r = pOut->row(y);
-				for(size_t x = 0; x < w; x++)
+				double* pDest = pBuf + ii;
+				if(ii < mr)
+				{
+					const double* pSrc = a[i0 + s + ii].data() + p0;
+					for(size_t p = 0; p < kc; p++)
+						pDest[p * GEMM_MR] = pSrc[p];
+				}
+				else
 				{
-					double sum = 0;
-					for(size_t i = 0; i < dims; i++)
-						sum += a[i][y] * b[i][x];
-					r[x] = sum;
+					for(size_t p = 0; p < kc; p++)
+						pDest[p * GEMM_MR] = 0.0;
 				}
 			}
-			return pOut;
+			pBuf += kc * GEMM_MR;
 		}
 	}
-	else
+}
+
+// Packs inner indexes [p0, p0 + kc) and columns [j0, j0 + nc) of op(B) into
+// slivers of GEMM_NR columns. Columns past the end are padded with zeros.
+void GMatrix_gemmPackB(const GMatrix& b, bool transB, size_t p0, size_t kc, size_t j0, size_t nc, double* pBuf)
+{
+	for(size_t t = 0; t < nc; t += GEMM_NR)
 	{
-		if(transposeB)
+		size_t nr = std::min((size_t)GEMM_NR, nc - t);
+		if(transB)
 		{
-			size_t dims = (size_t)a.cols();
-			if((size_t)b.cols() != dims)
-				throw Ex("dimension mismatch");
-			size_t w = b.rows();
-			size_t h = a.rows();
-			GMatrix* pOut = new GMatrix(h, w);
-			for(size_t y = 0; y < h; y++)
+			for(size_t jj = 0; jj < GEMM_NR; jj++)
 			{
-				GVec& r = pOut->row(y);
-				const GVec& pA = a[y];
-				for(size_t x = 0; x < w; x++)
-					r[x] = pA.dotProduct(b[x]);
+				double* pDest = pBuf + jj;
+				if(jj < nr)
+				{
+					const double* pSrc = b[j0 + t + jj].data() + p0;
+					for(size_t p = 0; p < kc; p++)
+						pDest[p * GEMM_NR] = pSrc[p];
+				}
+				else
+				{
+					for(size_t p = 0; p < kc; p++)
+						pDest[p * GEMM_NR] = 0.0;
+				}
 			}
-			return pOut;
+			pBuf += kc * GEMM_NR;
 		}
 		else
 		{
-			size_t dims = (size_t)a.cols();
-			if(b.rows() != dims)
-				throw Ex("dimension mismatch");
-			size_t w = b.cols();
-			size_t h = a.rows();
-			GMatrix* pOut = new GMatrix(h, w);
-			for(size_t y = 0; y < h; y++)
+			for(size_t p = 0; p < kc; p++)
 			{
-				GVec& r = pOut->row(y);
-				const GVec& pA = a[y];
-				for(size_t x = 0; x < w; x++)
-				{
-					double sum = 0;
-					for(size_t i = 0; i < dims; i++)
-						sum += pA[i] * b[i][x];
-					r[x] = sum;
-				}
+				const double* pSrc = b[p0 + p].data() + j0 + t;
+				size_t jj;
+				for(jj = 0; jj < nr; jj++)
+					pBuf[jj] = pSrc[jj];
+				for( ; jj < GEMM_NR; jj++)
+					pBuf[jj] = 0.0;
+				pBuf += GEMM_NR;
 			}
-			return pOut;
 		}
 	}
 }
 
-GMatrix* GMatrix::transpose()
+// Computes the GEMM_MR x GEMM_NR product of one packed sliver of A with one
+// packed sliver of B, and stores it in acc. The fixed trip counts let the
+// compiler keep the accumulators in vector registers.
+void GMatrix_gemmProduct(size_t kc, const double* pA, const double* pB, double* acc)
 {
-	size_t r = rows();
-	size_t c = (size_t)cols();
-	GMatrix* pTarget = new GMatrix(c, r);
-	for(size_t i = 0; i < c; i++)
+	for(size_t k = 0; k < GEMM_MR * GEMM_NR; k++)
+		acc[k] = 0.0;
+	for(size_t p = 0; p < kc; p++)
 	{
-		GVec& pRow = pTarget->row(i);
-		for(size_t j = 0; j < r; j++)
-			pRow[j] = row(j)[i];
+		for(size_t ii = 0; ii < GEMM_MR; ii++)
+		{
+			double aa = pA[ii];
+			for(size_t jj = 0; jj < GEMM_NR; jj++)
+				acc[ii * GEMM_NR + jj] += aa * pB[jj];
+		}
+		pA += GEMM_MR;
+		pB += GEMM_NR;
 	}
-	return pTarget;
 }
 
-double GMatrix::trace()
+#ifdef GMATRIX_AVX2
+// An AVX2/FMA version of GMatrix_gemmProduct
+GMATRIX_AVX2_TARGET void GMatrix_gemmProductAvx2(size_t kc, const double* pA, const double* pB, double* acc)
 {
-	size_t min = std::min((size_t)cols(), rows());
-	double sum = 0;
-	for(size_t n = 0; n < min; n++)
-		sum += row(n)[n];
-	return sum;
+	__m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+	__m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+	__m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+	__m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+	for(size_t p = 0; p < kc; p++)
+	{
+		__m256d b0 = _mm256_loadu_pd(pB);
+		__m256d b1 = _mm256_loadu_pd(pB + 4);
+		__m256d a0 = _mm256_broadcast_sd(pA);
+		c00 = _mm256_fmadd_pd(a0, b0, c00); c01 = _mm256_fmadd_pd(a0, b1, c01);
+		a0 = _mm256_broadcast_sd(pA + 1);
+		c10 = _mm256_fmadd_pd(a0, b0, c10); c11 = _mm256_fmadd_pd(a0, b1, c11);
+		a0 = _mm256_broadcast_sd(pA + 2);
+		c20 = _mm256_fmadd_pd(a0, b0, c20); c21 = _mm256_fmadd_pd(a0, b1, c21);
+		a0 = _mm256_broadcast_sd(pA + 3);
+		c30 = _mm256_fmadd_pd(a0, b0, c30); c31 = _mm256_fmadd_pd(a0, b1, c31);
+		pA += GEMM_MR;
+		pB += GEMM_NR;
+	}
+	_mm256_storeu_pd(acc, c00); _mm256_storeu_pd(acc + 4, c01);
+	_mm256_storeu_pd(acc + 8, c10); _mm256_storeu_pd(acc + 12, c11);
+	_mm256_storeu_pd(acc + 16, c20); _mm256_storeu_pd(acc + 20, c21);
+	_mm256_storeu_pd(acc + 24, c30); _mm256_storeu_pd(acc + 28, c31);
 }
+#endif
 
-size_t GMatrix::toReducedRowEchelonForm()
+#ifdef GMATRIX_DISPATCH
+bool GMatrix_checkAvx2()
 {
-	size_t nLead = 0;
-	size_t rowCount = rows();
-	size_t colCount = cols();
-	for(size_t nRow = 0; nRow < rowCount; nRow++)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+static const bool GMatrix_hasAvx2 = GMatrix_checkAvx2();
+#endif
+
+// Computes the GEMM_MR x GEMM_NR product of one packed sliver of A with one
+// packed sliver of B, and adds the top-left mr x nr corner of it into C.
+void GMatrix_gemmMicroKernel(size_t kc, const double* pA, const double* pB, GMatrix& c, size_t i, size_t j, size_t mr, size_t nr)
+{
+	double acc[GEMM_MR * GEMM_NR];
+#if defined(GMATRIX_DISPATCH)
+	if(GMatrix_hasAvx2)
+		GMatrix_gemmProductAvx2(kc, pA, pB, acc);
+	else
+		GMatrix_gemmProduct(kc, pA, pB, acc);
+#elif defined(GMATRIX_AVX2)
+	GMatrix_gemmProductAvx2(kc, pA, pB, acc);
+#else
+	GMatrix_gemmProduct(kc, pA, pB, acc);
+#endif
+	for(size_t ii = 0; ii < mr; ii++)
+	{
+		double* pC = c[i + ii].data() + j;
+		const double* pAcc = acc + ii * GEMM_NR;
+		for(size_t jj = 0; jj < nr; jj++)
+			pC[jj] += pAcc[jj];
+	}
+}
+
+// Adds op(A) * op(B) into rows [iBegin, iEnd) and columns [jBegin, jEnd) of C.
+// pBufA must hold GEMM_MC * GEMM_KC values, and pBufB GEMM_KC * GEMM_NC values.
+void GMatrix_gemmRange(const GMatrix& a, bool transA, const GMatrix& b, bool transB, GMatrix& c, size_t inner, size_t iBegin, size_t iEnd, size_t jBegin, size_t jEnd, double* pBufA, double* pBufB)
+{
+	for(size_t j0 = jBegin; j0 < jEnd; j0 += GEMM_NC)
+	{
+		size_t nc = std::min((size_t)GEMM_NC, jEnd - j0);
+		for(size_t p0 = 0; p0 < inner; p0 += GEMM_KC)
+		{
+			size_t kc = std::min((size_t)GEMM_KC, inner - p0);
+			GMatrix_gemmPackB(b, transB, p0, kc, j0, nc, pBufB);
+			for(size_t i0 = iBegin; i0 < iEnd; i0 += GEMM_MC)
+			{
+				size_t mc = std::min((size_t)GEMM_MC, iEnd - i0);
+				GMatrix_gemmPackA(a, transA, i0, mc, p0, kc, pBufA);
+				for(size_t t = 0; t < nc; t += GEMM_NR)
+				{
+					size_t nr = std::min((size_t)GEMM_NR, nc - t);
+					const double* pB = pBufB + t * kc;
+					for(size_t s = 0; s < mc; s += GEMM_MR)
+					{
+						size_t mr = std::min((size_t)GEMM_MR, mc - s);
+						GMatrix_gemmMicroKernel(kc, pBufA + s * kc, pB, c, i0 + s, j0 + t, mr, nr);
+					}
+				}
+			}
+		}
+	}
+}
+
+class GMatrix_GemmWorker : public GWorkerThread
+{
+protected:
+	const GMatrix& m_a;
+	bool m_transA;
+	const GMatrix& m_b;
+	bool m_transB;
+	GMatrix& m_c;
+	size_t m_inner;
+	size_t m_bandSize;
+	bool m_splitRows;
+	GVec m_bufA;
+	GVec m_bufB;
+
+public:
+	GMatrix_GemmWorker(GMasterThread& master, const GMatrix& a, bool transA, const GMatrix& b, bool transB, GMatrix& c, size_t inner, size_t bandSize, bool splitRows)
+	: GWorkerThread(master), m_a(a), m_transA(transA), m_b(b), m_transB(transB), m_c(c), m_inner(inner), m_bandSize(bandSize), m_splitRows(splitRows),
+	m_bufA(GEMM_MC * GEMM_KC), m_bufB(GEMM_KC * GEMM_NC)
+	{
+	}
+
+	virtual ~GMatrix_GemmWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		size_t start = jobId * m_bandSize;
+		if(m_splitRows)
+			GMatrix_gemmRange(m_a, m_transA, m_b, m_transB, m_c, m_inner, start, std::min(m_c.rows(), start + m_bandSize), 0, m_c.cols(), m_bufA.data(), m_bufB.data());
+		else
+			GMatrix_gemmRange(m_a, m_transA, m_b, m_transB, m_c, m_inner, 0, m_c.rows(), start, std::min(m_c.cols(), start + m_bandSize), m_bufA.data(), m_bufB.data());
+	}
+};
+
+// Computes c = op(a) * op(b), where c already has the right size.
+void GMatrix_gemm(const GMatrix& a, bool transA, const GMatrix& b, bool transB, GMatrix& c)
+{
+	size_t h = c.rows();
+	size_t w = c.cols();
+	size_t inner = transA ? a.rows() : a.cols();
+	c.fill(0.0);
+	if(h == 0 || w == 0 || inner == 0)
+		return;
+	size_t threads = std::thread::hardware_concurrency();
+	if(threads < 2 || (double)h * (double)w * (double)inner < GEMM_PARALLEL_FLOPS)
+	{
+		GVec bufA(GEMM_MC * GEMM_KC);
+		GVec bufB(GEMM_KC * GEMM_NC);
+		GMatrix_gemmRange(a, transA, b, transB, c, inner, 0, h, 0, w, bufA.data(), bufB.data());
+		return;
+	}
+
+	// Split C into bands along its longer side, two bands per thread so
+	// that an unlucky thread does not hold everybody up
+	bool splitRows = (h >= w);
+	size_t len = splitRows ? h : w;
+	size_t align = splitRows ? GEMM_MR : GEMM_NR;
+	size_t bands = std::max((size_t)1, std::min(threads * 2, len / align));
+	size_t bandSize = (len + bands - 1) / bands;
+	bandSize = (bandSize + align - 1) / align * align;
+	bands = (len + bandSize - 1) / bandSize;
+	threads = std::min(threads, bands);
+	GMasterThread master;
+	for(size_t i = 0; i < threads; i++)
+		master.addWorker(new GMatrix_GemmWorker(master, a, transA, b, transB, c, inner, bandSize, splitRows));
+	master.doJobs(bands);
+}
+
+void GMatrix::multiply(const GVec& vectorIn, GVec& vectorOut, bool transposeFirst) const
+{
+	size_t rowCount = rows();
+	if(transposeFirst)
+	{
+		// Accumulate four rows per pass so vectorOut is streamed through
+		// the cache a quarter as many times
+		vectorOut.fill(0.0);
+		double* pOut = vectorOut.data();
+		size_t n = vectorOut.size();
+		size_t i = 0;
+		for( ; i + 4 <= rowCount; i += 4)
+		{
+			const double* p0 = row(i).data();
+			const double* p1 = row(i + 1).data();
+			const double* p2 = row(i + 2).data();
+			const double* p3 = row(i + 3).data();
+			double s0 = vectorIn[i];
+			double s1 = vectorIn[i + 1];
+			double s2 = vectorIn[i + 2];
+			double s3 = vectorIn[i + 3];
+			for(size_t j = 0; j < n; j++)
+				pOut[j] += s0 * p0[j] + s1 * p1[j] + s2 * p2[j] + s3 * p3[j];
+		}
+		for( ; i < rowCount; i++)
+			vectorOut.addScaled(vectorIn[i], row(i));
+	}
+	else
+	{
+		for(size_t i = 0; i < rowCount; i++)
+			vectorOut[i] = row(i).dotProduct(vectorIn);
+	}
+}
+
+// static
+GMatrix* GMatrix::multiply(const GMatrix& a, const GMatrix& b, bool transposeA, bool transposeB)
+{
+	GMatrix* pOut = new GMatrix();
+	std::unique_ptr<GMatrix> hOut(pOut);
+	multiply(a, b, *pOut, transposeA, transposeB);
+	return hOut.release();
+}
+
+// static
+void GMatrix::multiply(const GMatrix& a, const GMatrix& b, GMatrix& out, bool transposeA, bool transposeB)
+{
+	if(&out == &a || &out == &b)
+		throw Ex("The output matrix may not also be an operand");
+	size_t inner = transposeA ? a.rows() : a.cols();
+	if((transposeB ? b.cols() : b.rows()) != inner)
+		throw Ex("dimension mismatch");
+	size_t h = transposeA ? a.cols() : a.rows();
+	size_t w = transposeB ? b.rows() : b.cols();
+	out.resize(h, w);
+	GMatrix_gemm(a, transposeA, b, transposeB, out);
+}
+
+GMatrix* GMatrix::transpose()
+{
+	size_t r = rows();
+	size_t c = (size_t)cols();
+	GMatrix* pTarget = new GMatrix(c, r);
+	for(size_t i = 0; i < c; i++)
+	{
+		GVec& pRow = pTarget->row(i);
+		for(size_t j = 0; j < r; j++)
+			pRow[j] = row(j)[i];
+	}
+	return pTarget;
+}
+
+double GMatrix::trace()
+{
+	size_t min = std::min((size_t)cols(), rows());
+	double sum = 0;
+	for(size_t n = 0; n < min; n++)
+		sum += row(n)[n];
+	return sum;
+}
+
+size_t GMatrix::toReducedRowEchelonForm()
+{
+	size_t nLead = 0;
+	size_t rowCount = rows();
+	size_t colCount = cols();
+	for(size_t nRow = 0; nRow < rowCount; nRow++)
 	{
 		// Find the next pivot (swapping rows as necessary)
 		size_t i = nRow;
@@ -2411,7 +3201,68 @@ void GMatrix::eigenVector(double eigenvalue, GVec& outVector)
 	outVector.normalize();
 }
 
-GMatrix* GMatrix::eigs(size_t nCount, GVec& eigenVals, GRand* pRand, bool mostSignificant)
+bool GMatrix_isSymmetric(const GMatrix& m)
+{
+	for(size_t i = 0; i < m.rows(); i++)
+	{
+		for(size_t j = 0; j < i; j++)
+		{
+			double a = m[i][j];
+			double b = m[j][i];
+			if(std::abs(a - b) > 1e-12 * (std::abs(a) + std::abs(b)))
+				return false;
+		}
+	}
+	return true;
+}
+
+// Finds the eigenvectors of a symmetric matrix with the largest-magnitude eigenvalues
+GMatrix* GMatrix_symmetricEigs(const GMatrix& m, size_t nCount, GVec& eigenVals, GRand* pRand, size_t krylovIters)
+{
+	// The top singular vectors span the top eigenvectors
+	size_t dims = m.cols();
+	GMatrixOperator op(m);
+	GTruncatedSVD svd(*pRand);
+	svd.useBlockKrylov();
+	svd.setPowerIterations(krylovIters);
+	GVec sv;
+	GMatrix v;
+	svd.compute(op, nCount, sv, v);
+
+	// Solve within their span (Rayleigh-Ritz), which separates eigenvalues of equal
+	// magnitude and opposite sign, and gives the signs of the eigenvalues
+	GMatrix av;
+	op.multiply(v, av);
+	GMatrix t(nCount, nCount);
+	for(size_t i = 0; i < nCount; i++)
+	{
+		for(size_t j = 0; j <= i; j++)
+		{
+			double d = 0.5 * (v[i].dotProduct(av[j]) + v[j].dotProduct(av[i]));
+			t[i][j] = d;
+			t[j][i] = d;
+		}
+	}
+	GVec vals;
+	GMatrix w;
+	GTruncatedSVD::symmetricEigs(t, vals, w);
+	vector<size_t> order(nCount);
+	for(size_t i = 0; i < nCount; i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&vals](size_t a, size_t b) { return std::abs(vals[a]) > std::abs(vals[b]); });
+	GMatrix* pOut = new GMatrix(nCount, dims);
+	for(size_t i = 0; i < nCount; i++)
+	{
+		eigenVals[i] = vals[order[i]];
+		GVec& x = pOut->row(i);
+		x.fill(0.0);
+		for(size_t j = 0; j < nCount; j++)
+			x.addScaled(w[order[i]][j], v[j]);
+	}
+	return pOut;
+}
+
+GMatrix* GMatrix::eigs(size_t nCount, GVec& eigenVals, GRand* pRand, bool mostSignificant, size_t krylovIters)
 {
 	eigenVals.resize(nCount);
 	size_t dims = cols();
@@ -2445,7 +3296,12 @@ GMatrix* GMatrix::eigs(size_t nCount, GVec& eigenVals, GRand* pRand, bool mostSi
 	}
 */
 
-	// Use the power method to compute the first few eigenvectors. todo: we really should use the Lanczos method instead
+	// For a symmetric matrix, the singular vectors are eigenvectors, so a block
+	// Krylov truncated SVD finds all of them in a few multiplies
+	if(krylovIters > 0 && mostSignificant && GMatrix_isSymmetric(*this))
+		return GMatrix_symmetricEigs(*this, nCount, eigenVals, pRand, krylovIters);
+
+	// Use the power method to compute the first few eigenvectors
 	GMatrix* pOut = new GMatrix(m_pRelation->cloneMinimal());
 	pOut->newRows(nCount);
 	GMatrix* pA;
@@ -2505,13 +3361,21 @@ GMatrix* GMatrix::leastSignificantEigenVectors(size_t nCount, GRand* pRand)
 */
 GVec& GMatrix::newRow()
 {
-	GVec* pNewVec = new GVec(m_pRelation->size());
+	GVec* pNewVec = allocRow();
 	m_rows.push_back(pNewVec);
 	return *pNewVec;
 }
 
 void GMatrix::newColumns(size_t n)
 {
+	if(m_contiguous)
+	{
+		// Slab rows cannot be resized, so move them to the heap and back
+		setContiguous(false);
+		newColumns(n);
+		setContiguous(true);
+		return;
+	}
 	size_t oldSize = m_pRelation->size();
 	if(m_pRelation->type() == GRelation::UNIFORM)
 	{
@@ -2672,6 +3536,13 @@ void GMatrix::swapColumns(size_t nAttr1, size_t nAttr2)
 
 void GMatrix::deleteColumns(size_t index, size_t count)
 {
+	if(m_contiguous)
+	{
+		setContiguous(false);
+		deleteColumns(index, count);
+		setContiguous(true);
+		return;
+	}
 	m_pRelation->deleteAttributes(index, count);
 	size_t rowCount = rows();
 	for(size_t i = 0; i < rowCount; i++)
@@ -2687,7 +3558,7 @@ GVec* GMatrix::releaseRow(size_t index)
 	GVec* pRow = m_rows[index];
 	m_rows[index] = m_rows[last];
 	m_rows.pop_back();
-	return pRow;
+	return detachRow(pRow);
 }
 
 void GMatrix::deleteRow(size_t index)
@@ -2699,7 +3570,7 @@ GVec* GMatrix::releaseRowPreserveOrder(size_t index)
 {
 	GVec* pRow = m_rows[index];
 	m_rows.erase(m_rows.begin() + index);
-	return pRow;
+	return detachRow(pRow);
 }
 
 void GMatrix::deleteRowPreserveOrder(size_t index)
@@ -2903,6 +3774,9 @@ void GMatrix::splitBySize(GMatrix& other, size_t nOtherRows)
 
 void GMatrix::mergeVert(GMatrix* pData, bool ignoreMismatchingName)
 {
+	// The rows are adopted below, so they must not belong to pData's slabs
+	if(pData->isContiguous())
+		pData->setContiguous(false);
 	if(relation().type() == GRelation::ARFF && pData->relation().type() == GRelation::ARFF)
 	{
 		// Make an value mapping for pData
@@ -3699,28 +4573,22 @@ double GMatrix::covariance(size_t nAttr1, double dMean1, size_t nAttr2, double d
 GMatrix* GMatrix::covarianceMatrix() const
 {
 	size_t colCount = cols();
-	GMatrix* pOut = new GMatrix(colCount, colCount);
 
 	// Compute the deviations
-	GTEMPBUF(double, pMeans, colCount);
-	for(size_t i = 0; i < colCount; i++)
-		pMeans[i] = columnMean(i);
-
-	// Compute the covariances for half the matrix
+	GVec means(colCount);
 	for(size_t i = 0; i < colCount; i++)
+		means[i] = columnMean(i);
+	GMatrix deviations(rows(), colCount);
+	for(size_t i = 0; i < rows(); i++)
 	{
-		GVec& r = pOut->row(i);
-		for(size_t n = i; n < colCount; n++)
-			r[n] = covariance(i, pMeans[i], n, pMeans[n]);
+		GVec& r = deviations[i];
+		r.copy(row(i));
+		r -= means;
 	}
 
-	// Fill out the other half of the matrix
-	for(size_t i = 1; i < colCount; i++)
-	{
-		GVec& r = pOut->row(i);
-		for(size_t n = 0; n < i; n++)
-			r[n] = pOut->row(n)[i];
-	}
+	// The covariance matrix is D^T D / (n - 1)
+	GMatrix* pOut = multiply(deviations, deviations, true, false);
+	pOut->multiply(1.0 / (rows() - 1));
 	return pOut;
 }
 
@@ -4128,7 +4996,7 @@ GVec* GMatrix::swapRow(size_t i, GVec* pNewRow)
 {
 	GVec* pRow = m_rows[i];
 	m_rows[i] = pNewRow;
-	return pRow;
+	return detachRow(pRow);
 }
 
 //static
@@ -4271,6 +5139,169 @@ void GMatrix_testMultiply()
 	delete(pB);
 }
 
+void GMatrix_testMultiplyBlocked()
+{
+	GRand rand(0);
+
+	// Use sizes that straddle the register tile and cache-block edges
+	size_t sizes[] = { 1, 3, 5, 8, 13, 33, 131, 270 };
+	size_t sizeCount = sizeof(sizes) / sizeof(size_t);
+	for(size_t trial = 0; trial < 12; trial++)
+	{
+		size_t h = sizes[rand.next(sizeCount)];
+		size_t w = sizes[rand.next(sizeCount)];
+		size_t inner = sizes[rand.next(sizeCount)];
+		if(trial == 0)
+		{
+			// Big enough to be split across threads
+			h = 301; w = 211; inner = 270;
+		}
+		GMatrix a(h, inner);
+		a.fillNormal(rand);
+		GMatrix b(inner, w);
+		b.fillNormal(rand);
+		GMatrix* pAT = a.transpose();
+		std::unique_ptr<GMatrix> hAT(pAT);
+		GMatrix* pBT = b.transpose();
+		std::unique_ptr<GMatrix> hBT(pBT);
+		for(size_t mode = 0; mode < 4; mode++)
+		{
+			bool tA = (mode & 1) != 0;
+			bool tB = (mode & 2) != 0;
+			GMatrix* pC = GMatrix::multiply(tA ? *pAT : a, tB ? *pBT : b, tA, tB);
+			std::unique_ptr<GMatrix> hC(pC);
+			if(pC->rows() != h || pC->cols() != w)
+				throw Ex("wrong size");
+			for(size_t i = 0; i < h; i++)
+			{
+				for(size_t j = 0; j < w; j++)
+				{
+					double sum = 0.0;
+					for(size_t k = 0; k < inner; k++)
+						sum += a[i][k] * b[k][j];
+					if(std::abs((*pC)[i][j] - sum) > 1e-9 * (1.0 + std::abs(sum)))
+						throw Ex("wrong answer");
+				}
+			}
+		}
+	}
+
+	// Matrix-vector products
+	GMatrix m(37, 29);
+	m.fillNormal(rand);
+	GVec x(29);
+	x.fillNormal(rand);
+	GVec y(37);
+	y.fillNormal(rand);
+	GVec mx(37);
+	m.multiply(x, mx, false);
+	GVec ym(29);
+	m.multiply(y, ym, true);
+	for(size_t i = 0; i < 37; i++)
+	{
+		if(std::abs(mx[i] - m[i].dotProduct(x)) > 1e-9)
+			throw Ex("wrong answer");
+	}
+	for(size_t j = 0; j < 29; j++)
+	{
+		double sum = 0.0;
+		for(size_t i = 0; i < 37; i++)
+			sum += y[i] * m[i][j];
+		if(std::abs(ym[j] - sum) > 1e-9)
+			throw Ex("wrong answer");
+	}
+}
+
+void GMatrix_testContiguous()
+{
+	GRand rand(0);
+	GMatrix m(0, 13);
+	m.setContiguous();
+	for(size_t i = 0; i < 150; i++)
+		m.newRow().fillNormal(rand);
+	GMatrix ref(m);
+	if(ref.isContiguous())
+		throw Ex("copies should use the default storage");
+
+	// Packing should preserve the values and lay the rows out sequentially
+	m.setContiguous();
+	size_t stride;
+	double* pData = m.contiguousData(stride);
+	if(!pData || stride != 16 || ((size_t)pData & 63) != 0)
+		throw Ex("expected aligned sequential rows");
+	for(size_t i = 0; i < m.rows(); i++)
+	{
+		if(m[i].data() != pData + i * stride)
+			throw Ex("rows are not sequential");
+		for(size_t j = 0; j < m.cols(); j++)
+		{
+			if(m[i][j] != ref[i][j])
+				throw Ex("wrong value");
+		}
+	}
+
+	// Column edits and row removal
+	m.newColumns(2);
+	m.deleteColumns(3, 4);
+	ref.newColumns(2);
+	ref.deleteColumns(3, 4);
+	if(m.cols() != 11 || !m.isContiguous())
+		throw Ex("wrong size");
+	for(size_t i = 0; i < m.rows(); i++)
+	{
+		m[i][9] = 0.0; m[i][10] = 0.0;
+		ref[i][9] = 0.0; ref[i][10] = 0.0;
+	}
+	delete(m.releaseRow(17));
+	GVec* pRow = m.releaseRowPreserveOrder(5);
+	delete(ref.releaseRow(17));
+	delete(ref.releaseRowPreserveOrder(5));
+	if(pRow->size() != 11)
+		throw Ex("wrong size");
+	m.takeRow(pRow);
+	ref.newRow().copy(*pRow);
+	m.shuffle(rand);
+	m.setContiguous();
+	m.sort(0);
+	ref.sort(0);
+	for(size_t i = 0; i < m.rows(); i++)
+	{
+		for(size_t j = 0; j < m.cols(); j++)
+		{
+			if(m[i][j] != ref[i][j])
+				throw Ex("wrong value");
+		}
+	}
+
+	// Merging takes ownership of the rows, so they must survive the other matrix
+	{
+		GMatrix other(0, 11);
+		other.setContiguous();
+		other.newRow().fill(3.0);
+		m.mergeVert(&other);
+	}
+	if(m.back()[10] != 3.0)
+		throw Ex("wrong value");
+
+	// Resizing a row in place would free memory that belongs to the slab
+	bool refused = false;
+	try
+	{
+		m[0].resize(20);
+	}
+	catch(const std::exception&)
+	{
+		refused = true;
+	}
+	if(!refused || m[0].size() != 11)
+		throw Ex("expected slab rows to refuse resizing");
+	m.setContiguous(false);
+	if(m.isContiguous() || m.contiguousData(stride))
+		throw Ex("expected heap rows");
+	if(m.rows() != ref.rows() + 1)
+		throw Ex("wrong size");
+}
+
 void GMatrix_testCholesky()
 {
 	GMatrix m1(3, 3);
@@ -4442,6 +5473,14 @@ void GMatrix_testPrincipalComponents(GRand& prng)
 		throw Ex("answer not normalized");
 	if(std::abs(pE2->row(1)[0] * pE2->row(1)[1] + .27735) >= .0001)
 		throw Ex("wrong answer");
+	GVec ev3(2);
+	GMatrix* pE3 = e1.eigs(2, ev3, &prng, true, 4);
+	std::unique_ptr<GMatrix> hE3(pE3);
+	for(size_t i = 0; i < 2; i++)
+	{
+		if(std::abs(ev3[i] - ev2[i]) > .0001 || std::abs(std::abs(pE3->row(i).dotProduct(pE2->row(i))) - 1.0) > .0001)
+			throw Ex("The Krylov path disagrees with the power method");
+	}
 
 	// Test least significant eigenvector computation and gaussian ellimination
 	GMatrix e3(2, 2);
@@ -4747,11 +5786,219 @@ void GMatrix_testImport()
 		throw Ex("failed");
 }
 
+void GMatrix_checkSameParse(const GMatrix& a, const GMatrix& b)
+{
+	std::ostringstream sa, sb;
+	a.print(sa);
+	b.print(sb);
+	if(sa.str().compare(sb.str()) != 0)
+		throw Ex("The relations or values differ");
+	for(size_t i = 0; i < a.rows(); i++)
+	{
+		for(size_t j = 0; j < a.cols(); j++)
+		{
+			if(a[i][j] != b[i][j])
+				throw Ex("Values differ at row ", to_str(i), ", col ", to_str(j));
+		}
+	}
+}
+
+void GMatrix_testParallelImport(GRand& rand)
+{
+	GThreadPool serial(0);
+	GThreadPool pool(3);
+
+	// Make a CSV file big enough to be split into several pieces
+	std::ostringstream csv;
+	csv << "num,color,id,late,\"quoted, name\"\n";
+	csv.precision(17);
+	size_t rowCount = 30000;
+	const char* colors[] = { "red", "green", "\"dark, blue\"", "?", "" };
+	std::set<string> ids;
+	size_t abortRow = INVALID_INDEX;
+	for(size_t i = 0; i < rowCount; i++)
+	{
+		if(rand.next(20) == 0)
+			csv << "?";
+		else
+			csv << (rand.normal() * pow(10.0, (double)rand.next(8) - 4.0));
+		csv << ", " << colors[rand.next(5)]; // extra whitespace
+		string id = string("id") + to_str(rand.next(100) == 0 ? i : rand.next(150));
+		csv << "," << id;
+		ids.insert(id);
+		if(ids.size() == 201 && abortRow == INVALID_INDEX)
+			abortRow = i; // Values after the 201st unique one are discarded
+		if(i == rowCount - 5)
+			csv << ",oops"; // A non-numerical value in the last piece makes the column nominal
+		else
+			csv << "," << rand.next(3);
+		csv << "," << rand.uniform() << "\n";
+	}
+	string s = csv.str();
+	GMatrix a, b;
+	GCSVParser parser;
+	parser.columnNamesInFirstRow();
+	parser.setThreadPool(&serial);
+	parser.parse(a, s.c_str(), s.length());
+	parser.setThreadPool(&pool);
+	parser.parse(b, s.c_str(), s.length());
+	if(a.rows() != rowCount || a.cols() != 5)
+		throw Ex("wrong size");
+	if(a.relation().valueCount(0) != 0 || a.relation().valueCount(1) != 3 || a.relation().valueCount(2) != 201 || a.relation().valueCount(3) != 4)
+		throw Ex("wrong types");
+	if(abortRow == INVALID_INDEX || a[abortRow][2] == UNKNOWN_DISCRETE_VALUE || a[abortRow + 1][2] != UNKNOWN_DISCRETE_VALUE)
+		throw Ex("not aborted in the right place");
+	GMatrix_checkSameParse(a, b);
+
+	// The same error should be reported with any number of threads
+	string bad = s;
+	bad.insert(bad.find('\n', bad.length() * 3 / 4) + 1, "1,2\n");
+	bad.insert(bad.find('\n', bad.length() / 2) + 1, "1,2,3\n");
+	string errSerial, errParallel;
+	try
+	{
+		parser.setThreadPool(&serial);
+		parser.parse(a, bad.c_str(), bad.length());
+	}
+	catch(const std::exception& e)
+	{
+		errSerial = e.what();
+	}
+	try
+	{
+		parser.setThreadPool(&pool);
+		parser.parse(b, bad.c_str(), bad.length());
+	}
+	catch(const std::exception& e)
+	{
+		errParallel = e.what();
+	}
+	size_t badLine = 1 + std::count(bad.begin(), bad.begin() + bad.find("1,2,3\n"), '\n');
+	if(errParallel.find(string("Line ") + to_str(badLine) + " ") != 0)
+		throw Ex("Unexpected error: ", errParallel);
+	if(errSerial.find(string("Line ") + to_str(badLine) + " ") != 0)
+		throw Ex("Unexpected error: ", errSerial);
+
+	// Make an ARFF file with dense rows, sparse rows, and comments
+	std::ostringstream arff;
+	arff.precision(17);
+	arff << "@RELATION test\n% a comment\n@ATTRIBUTE x real\n@ATTRIBUTE 'c' {a,'b c',d}\n@ATTRIBUTE y numeric\n@DATA\n";
+	for(size_t i = 0; i < rowCount; i++)
+	{
+		if(i % 1000 == 0)
+			arff << "% comment " << i << "\n";
+		if(i % 7 == 0)
+			arff << "{0 " << rand.normal() << ", 2 " << (i % 5) << "}\n";
+		else
+			arff << rand.normal() * 1e-3 << ",'b c'," << (rand.next(10) == 0 ? "?" : to_str(rand.uniform())) << "\n";
+	}
+	s = arff.str();
+	a.parseArff(s.c_str(), s.length(), INVALID_INDEX, &serial);
+	b.parseArff(s.c_str(), s.length(), INVALID_INDEX, &pool);
+	if(a.rows() != rowCount || a[7][2] != 2.0 || a[8][1] != 1.0)
+		throw Ex("wrong values");
+	GMatrix_checkSameParse(a, b);
+
+	// Errors should have the right line numbers
+	bad = s;
+	bad.insert(bad.find('\n', bad.length() * 3 / 4) + 1, "1,a,2,3\n");
+	badLine = 1 + std::count(bad.begin(), bad.begin() + bad.find("1,a,2,3\n"), '\n');
+	try
+	{
+		b.parseArff(bad.c_str(), bad.length(), INVALID_INDEX, &pool);
+		throw Ex("Expected an error");
+	}
+	catch(const std::exception& e)
+	{
+		if(string(e.what()).find(string("line ") + to_str(badLine) + ",") == string::npos)
+			throw Ex("Unexpected error: ", e.what());
+	}
+}
+
+void GMatrix_testBinary(GRand& rand)
+{
+	// Make a matrix with some nominal attributes
+	GArffRelation* pRel = new GArffRelation();
+	pRel->setName("stuff");
+	vector<const char*> vals;
+	vals.push_back("a");
+	vals.push_back("b c");
+	pRel->addAttribute("x", 0, NULL);
+	pRel->addAttribute("y", 2, &vals);
+	for(size_t i = 0; i < 9; i++)
+		pRel->addAttribute((string("z") + to_str(i)).c_str(), 0, NULL);
+	GMatrix m(pRel);
+	for(size_t i = 0; i < 1000; i++)
+	{
+		GVec& r = m.newRow();
+		r.fillNormal(rand);
+		r[1] = (i % 3 == 0 ? UNKNOWN_DISCRETE_VALUE : (double)(i % 2));
+	}
+
+	// Round-trip it through a file
+	char szFilename[256];
+	GFile::tempFilename(szFilename);
+	try
+	{
+		m.saveBinary(szFilename);
+		GMatrix m2;
+		m2.loadBinary(szFilename);
+		GMatrix_checkSameParse(m, m2);
+		size_t stride;
+		double* pData = m2.contiguousData(stride);
+		if(!pData || ((size_t)pData) % 64 != 0 || stride != 16)
+			throw Ex("Not aligned and contiguous");
+
+		// Changes should not be written back to the file, and the matrix should still grow
+		m2[5][0] = 3.0;
+		m2.newRow().fill(1.0);
+		m2.deleteRow(2);
+		GMatrix m3;
+		m3.loadBinary(szFilename);
+		GMatrix_checkSameParse(m, m3);
+		if(m2.rows() != 1000 || m2[5][0] != 3.0 || m2[2][0] != 1.0)
+			throw Ex("failed to modify");
+
+		// Empty matrices work too
+		GMatrix empty(0, 3);
+		empty.saveBinary(szFilename);
+		m3.loadBinary(szFilename);
+		if(m3.rows() != 0 || m3.cols() != 3)
+			throw Ex("wrong size");
+
+		// Truncated files are rejected
+		m.saveBinary(szFilename);
+		size_t len;
+		char* pFile = GFile::loadFile(szFilename, &len);
+		std::unique_ptr<char[]> hFile(pFile);
+		GFile::saveFile(pFile, len - 8, szFilename);
+		bool threw = false;
+		try
+		{
+			m3.loadBinary(szFilename);
+		}
+		catch(const std::exception&)
+		{
+			threw = true;
+		}
+		if(!threw)
+			throw Ex("failed to reject a truncated file");
+	}
+	catch(...)
+	{
+		GFile::deleteFile(szFilename);
+		throw;
+	}
+	GFile::deleteFile(szFilename);
+}
+
 // static
 void GMatrix::test()
 {
 	GRand prng(0);
 	GMatrix_testMultiply();
+	GMatrix_testMultiplyBlocked();
+	GMatrix_testContiguous();
 	GMatrix_testCholesky();
 	GMatrix_testInvert();
 	GMatrix_testDeterminant();
@@ -4767,6 +6014,8 @@ void GMatrix::test()
 	GMatrix_testWilcoxon();
 	GMatrix_testBoundingSphere(prng);
 	GMatrix_testImport();
+	GMatrix_testParallelImport(prng);
+	GMatrix_testBinary(prng);
 }
 
 std::string to_str(const GMatrix& m){
@@ -4833,7 +6082,8 @@ m_separator(','),
 m_columnNamesInFirstRow(false),
 m_tolerant(false),
 m_clearlyNumericalThreshold(10),
-m_maxVals(200)
+m_maxVals(200),
+m_pPool(NULL)
 {
 
 }
@@ -4863,12 +6113,6 @@ void GCSVParser::setStripQuotes(size_t attr)
 }
 
 
-class ImportRow
-{
-public:
-	vector<const char*> m_elements;
-};
-
 void GCSVParser::parse(GMatrix& outMatrix, const char* szFilename)
 {
 	size_t nLen;
@@ -4879,14 +6123,66 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* szFilename)
 	parse(outMatrix, szFile, nLen);
 }
 
-void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
+size_t GCSVParser::tokenize(const char* pFile, size_t len, GHeap& heap, vector< vector<const char*> >& rows, bool namesInFirstRow, size_t columnCount)
 {
-	// Extract the elements
-	GHeap heap(2048);
-	vector<ImportRow> rows;
-	size_t columnCount = INVALID_INDEX;
-	size_t nFirstDataLine = 1;
-	size_t nLine = 1;
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	if(pool.workers() == 0 || len < 2 * GMATRIX_MIN_PARSE_PIECE)
+		return tokenizeLines(pFile, len, heap, rows, namesInFirstRow, columnCount, 1);
+
+	// Tokenize the first few lines by themselves, since they determine the column count
+	vector<size_t> starts;
+	GMatrix_splitLines(pFile, 0, len, 4096, 4 * (pool.workers() + 1), starts);
+	size_t rowsBefore = rows.size();
+	columnCount = tokenizeLines(pFile, starts[1], heap, rows, namesInFirstRow, columnCount, 1);
+	if(columnCount == INVALID_INDEX)
+	{
+		// There were no rows of data in the first piece, so just do it all serially
+		rows.resize(rowsBefore);
+		return tokenizeLines(pFile, len, heap, rows, namesInFirstRow, columnCount, 1);
+	}
+
+	// Find the line number where each of the other pieces begins
+	size_t pieces = starts.size() - 2;
+	vector<size_t> firstLines(pieces);
+	pool.parallelFor(0, pieces, [&](size_t i) {
+		firstLines[i] = GMatrix_countLines(pFile + starts[i], starts[i + 1] - starts[i]);
+	});
+	size_t line = 1;
+	for(size_t i = 0; i < pieces; i++)
+	{
+		size_t n = firstLines[i];
+		firstLines[i] = line + n;
+		line += n;
+	}
+
+	// Tokenize the other pieces in parallel
+	vector< vector< vector<const char*> > > pieceRows(pieces);
+	vector< std::unique_ptr<GHeap> > pieceHeaps(pieces);
+	for(size_t i = 0; i < pieces; i++)
+		pieceHeaps[i].reset(new GHeap(2048));
+	GMatrix_forEachPiece(pool, pieces, [&](size_t i) {
+		tokenizeLines(pFile + starts[i + 1], starts[i + 2] - starts[i + 1], *pieceHeaps[i], pieceRows[i], false, columnCount, firstLines[i]);
+	});
+
+	// Append them in order
+	size_t total = rows.size();
+	for(size_t i = 0; i < pieces; i++)
+		total += pieceRows[i].size();
+	rows.reserve(total);
+	for(size_t i = 0; i < pieces; i++)
+	{
+		heap.takeBlocks(*pieceHeaps[i]);
+		for(size_t j = 0; j < pieceRows[i].size(); j++)
+			rows.push_back(std::move(pieceRows[i][j]));
+		vector< vector<const char*> >().swap(pieceRows[i]);
+	}
+	return columnCount;
+}
+
+size_t GCSVParser::tokenizeLines(const char* pFile, size_t len, GHeap& heap, vector< vector<const char*> >& rows, bool namesInFirstRow, size_t columnCount, size_t firstLine)
+{
+	size_t nFirstDataLine = (columnCount == INVALID_INDEX ? 1 : INVALID_INDEX);
+	size_t nLine = firstLine;
 	size_t nPos = 0;
 	while(true)
 	{
@@ -4901,7 +6197,7 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 			break;
 
 		// Count the elements
-		if(columnCount == INVALID_INDEX && (!m_columnNamesInFirstRow || nLine > 1))
+		if(columnCount == INVALID_INDEX && (!namesInFirstRow || nLine > 1))
 		{
 			if(m_separator == '\0')
 			{
@@ -4948,9 +6244,17 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 			}
 		}
 
+		// Lines without quotes (which are most of them) can be split with memchr, which is vectorized
+		const char* pEol = (const char*)memchr(pFile + nPos, '\n', len - nPos);
+		size_t lineEnd = pEol ? (size_t)(pEol - pFile) : len;
+		bool plain = m_separator != '\0' &&
+			!memchr(pFile + nPos, '"', lineEnd - nPos) &&
+			!(m_single_quotes && memchr(pFile + nPos, '\'', lineEnd - nPos)) &&
+			!memchr(pFile + nPos, '\0', lineEnd - nPos);
+
 		// Extract the elements from the row
 		rows.resize(rows.size() + 1);
-		ImportRow& row = rows[rows.size() - 1];
+		vector<const char*>& row = rows[rows.size() - 1];
 		while(true)
 		{
 			// Skip Whitespace
@@ -4972,10 +6276,18 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 				{
 				}
 			}
-			else
+			else if(plain)
 			{
-				bool quo = false;
-				bool quoquo = false;
+				const char* pSep = (const char*)memchr(pFile + nPos, m_separator, lineEnd - nPos);
+				i = pSep ? (size_t)(pSep - (pFile + nPos)) : lineEnd - nPos;
+				for(l = i; l > 0 && pFile[nPos + l - 1] <= ' '; l--)
+				{
+				}
+			}
+			else
+			{
+				bool quo = false;
+				bool quoquo = false;
 				for(i = 0; pFile[nPos + i] != '\n' && pFile[nPos + i] != '\0'; i++)
 				{
 					if(quoquo)
@@ -5007,7 +6319,7 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 			GAssert(pFile[nPos] != m_separator || l == 0);
 			GAssert(pFile[nPos + l - 1] > ' ' || l == 0);
 			GAssert(pFile[nPos + l - 1] != m_separator || l == 0);
-			std::map<size_t, size_t>::iterator itStripQuotes = m_stripQuotes.find(row.m_elements.size());
+			std::map<size_t, size_t>::iterator itStripQuotes = m_stripQuotes.find(row.size());
 			if(itStripQuotes != m_stripQuotes.end())
 			{
 				if(pFile[nPos] == '"' && pFile[nPos + l - 1] == '"')
@@ -5042,7 +6354,7 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 			// Replace any unquoted separator chars with '_'
 			bool quo = false;
 			bool quoquo = false;
-			for(size_t k = 0; el[k] != '\0'; k++)
+			for(size_t k = 0; !plain && el[k] != '\0'; k++)
 			{
 				if(quo)
 				{
@@ -5062,8 +6374,8 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 					el[k] = '_';
 			}
 
-			row.m_elements.push_back(el);
-			if(row.m_elements.size() > columnCount)
+			row.push_back(el);
+			if(row.size() > columnCount)
 				break;
 			nPos += i;
 			if(nPos >= len || pFile[nPos] == '\n')
@@ -5073,16 +6385,20 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 		}
 		if(m_tolerant)
 		{
-			if(!m_columnNamesInFirstRow || nLine > 1)
+			if(!namesInFirstRow || nLine > 1)
 			{
-				while(row.m_elements.size() < columnCount)
-					row.m_elements.push_back("?");
+				while(row.size() < columnCount)
+					row.push_back("?");
 			}
 		}
 		else
 		{
-			if(row.m_elements.size() != (size_t)columnCount && columnCount != INVALID_INDEX)
+			if(row.size() != (size_t)columnCount && columnCount != INVALID_INDEX)
+			{
+				if(nFirstDataLine == INVALID_INDEX)
+					throw Ex("Line ", to_str(nLine), " does not have ", to_str(columnCount), " elements, like the lines before it");
 				throw Ex("Line ", to_str(nLine), " has a different number of elements than line ", to_str(nFirstDataLine));
+			}
 		}
 
 		// Move to next line
@@ -5091,15 +6407,27 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 		}
 		continue;
 	}
-	if(m_columnNamesInFirstRow && m_tolerant)
+	if(namesInFirstRow && m_tolerant && rows.size() > 0)
 	{
-		ImportRow& row = rows[0];
-		while(row.m_elements.size() < columnCount)
-			row.m_elements.push_back("attr");
+		vector<const char*>& row = rows[0];
+		while(row.size() < columnCount)
+			row.push_back("attr");
 	}
+	return columnCount;
+}
+
+void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
+{
+	// Extract the elements
+	GHeap heap(2048);
+	vector< vector<const char*> > rows;
+	size_t columnCount = tokenize(pFile, len, heap, rows, m_columnNamesInFirstRow, INVALID_INDEX);
+	if(columnCount == INVALID_INDEX)
+		columnCount = 0;
 
 	// Parse it all
-	size_t rowCount = rows.size() - (m_columnNamesInFirstRow ? 1 : 0);
+	size_t firstRow = (m_columnNamesInFirstRow ? 1 : 0);
+	size_t rowCount = rows.size() - firstRow;
 	outMatrix.flush();
 	GArffRelation* pRelation = new GArffRelation();
 	outMatrix.setRelation(pRelation);
@@ -5119,12 +6447,12 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 			if(m_columnNamesInFirstRow)
 			{
 				bool quot = false;
-				if(rows[0].m_elements[attr][0] != '"' && rows[0].m_elements[attr][0] != '\'')
+				if(rows[0][attr][0] != '"' && rows[0][attr][0] != '\'')
 					quot = true;
 				string attrName = "";
 				if(quot)
 					attrName += "\"";
-				attrName += rows[0].m_elements[attr];
+				attrName += rows[0][attr];
 				if(quot)
 					attrName += "\"";
 				pRelation->addAttribute(attrName.c_str(), 0, NULL);
@@ -5141,7 +6469,7 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 			string firstErr;
 			for(size_t rowNum = m_columnNamesInFirstRow ? 1 : 0; rowNum < rows.size(); rowNum++)
 			{
-				const char* el = rows[rowNum].m_elements[attr];
+				const char* el = rows[rowNum][attr];
 				double t;
 				if(*el == '\0')
 					outMatrix[i][attr] = UNKNOWN_REAL_VALUE;
@@ -5159,7 +6487,7 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 
 			if(m_columnNamesInFirstRow)
 			{
-				m_report[attr] = rows[0].m_elements[attr];
+				m_report[attr] = rows[0][attr];
 				m_report[attr] += ": ";
 			}
 			else
@@ -5205,19 +6533,8 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 		}
 		else
 		{
-			for(size_t rowNum = m_columnNamesInFirstRow ? 1 : 0; rowNum < rows.size(); rowNum++)
-			{
-				const char* el = rows[rowNum].m_elements[attr];
-				if(el[0] == '\0')
-					continue; // unknown value
-				if(strcmp(el, "?") == 0)
-					continue; // unknown value
-				if(GBits::isValidFloat(el, strlen(el)))
-					continue;
-				firstNonNumericalValue = el;
-				real = false;
-				break;
-			}
+			// Convert it as a real column, and see if that works
+			real = (convertReal(rows, firstRow, attr, outMatrix, true, firstNonNumericalValue) == 0);
 		}
 
 		// Make the attribute
@@ -5228,12 +6545,12 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 			if(m_columnNamesInFirstRow)
 			{
 				bool quot = false;
-				if(rows[0].m_elements[attr][0] != '"' && rows[0].m_elements[attr][0] != '\'')
+				if(rows[0][attr][0] != '"' && rows[0][attr][0] != '\'')
 					quot = true;
 				string attrName = "";
 				if(quot)
 					attrName += "\"";
-				attrName += rows[0].m_elements[attr];
+				attrName += rows[0][attr];
 				if(quot)
 					attrName += "\"";
 				pRelation->addAttribute(attrName.c_str(), 0, NULL);
@@ -5244,32 +6561,13 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 				attrName += to_str(attr);
 				pRelation->addAttribute(attrName.c_str(), 0, NULL);
 			}
-			size_t i = 0;
-			for(size_t rowNum = m_columnNamesInFirstRow ? 1 : 0; rowNum < rows.size(); rowNum++)
-			{
-				const char* el = rows[rowNum].m_elements[attr];
-				double val;
-				if(el[0] == '\0')
-					val = UNKNOWN_REAL_VALUE;
-				else if(strcmp(el, "?") == 0)
-					val = UNKNOWN_REAL_VALUE;
-				else if(!GBits::isValidFloat(el, strlen(el)))
-				{
-					val = UNKNOWN_REAL_VALUE;
-					if(firstRealError.length() < 1)
-						firstRealError = el;
-					realErrs++;
-				}
-				else
-					val = atof(el);
-				outMatrix[i][attr] = val;
-				i++;
-			}
+			if(specified)
+				realErrs = convertReal(rows, firstRow, attr, outMatrix, false, firstRealError);
 
 			// Report this column
 			if(m_columnNamesInFirstRow)
 			{
-				m_report[attr] = rows[0].m_elements[attr];
+				m_report[attr] = rows[0][attr];
 				m_report[attr] += ": ";
 			}
 			else
@@ -5318,46 +6616,12 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 		{
 			// It's categorical
 			vector<const char*> values;
-			GConstStringHashTable ht(31, true);
-			void* pVal;
-			uintptr_t n;
-			size_t i = 0;
-			size_t valueCount = 0;
-			for(size_t rowNum = m_columnNamesInFirstRow ? 1 : 0; rowNum < rows.size(); rowNum++)
-			{
-				const char* el = rows[rowNum].m_elements[attr];
-				if(el[0] == '\0')
-					outMatrix[i][attr] = UNKNOWN_DISCRETE_VALUE;
-				else if(strcmp(el, "?") == 0)
-					outMatrix[i][attr] = UNKNOWN_DISCRETE_VALUE;
-				else
-				{
-					if(specified || valueCount <= m_maxVals)
-					{
-						if(ht.get(el, &pVal))
-							n = (uintptr_t)pVal;
-						else
-						{
-							GAssert(el[0] > ' ');
-							GAssert(el[0] != m_separator);
-							GAssert(el[strlen(el) - 1] > ' ');
-							GAssert(el[strlen(el) - 1] != m_separator);
-							values.push_back(el);
-							n = valueCount++;
-							ht.add(el, (const void*)n);
-						}
-						outMatrix[i][attr] = (double)n;
-					}
-					else
-						outMatrix[i][attr] = UNKNOWN_DISCRETE_VALUE;
-				}
-				i++;
-			}
+			size_t valueCount = convertNominal(rows, firstRow, attr, outMatrix, specified, values);
 
 			// Make the attribute
 			if(m_columnNamesInFirstRow)
 			{
-				m_report[attr] = rows[0].m_elements[attr];
+				m_report[attr] = rows[0][attr];
 				m_report[attr] += ": ";
 			}
 			else
@@ -5402,12 +6666,12 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 			if(m_columnNamesInFirstRow)
 			{
 				bool quot = false;
-				if(rows[0].m_elements[attr][0] != '"' && rows[0].m_elements[attr][0] != '\'')
+				if(rows[0][attr][0] != '"' && rows[0][attr][0] != '\'')
 					quot = true;
 				string attrName = "";
 				if(quot)
 					attrName += "\"";
-				attrName += rows[0].m_elements[attr];
+				attrName += rows[0][attr];
 				if(quot)
 					attrName += "\"";
 				if(!specified && valueCount > m_maxVals)
@@ -5430,6 +6694,556 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 	}
 }
 
+// Returns the number of pieces to split the specified number of rows into for parallel conversion
+size_t GCSVParser_rowPieces(GThreadPool& pool, size_t rows)
+{
+	if(pool.workers() == 0)
+		return 1;
+	return std::max((size_t)1, std::min(4 * (pool.workers() + 1), rows / 4096));
+}
+
+size_t GCSVParser::convertReal(const vector< vector<const char*> >& rows, size_t firstRow, size_t attr, GMatrix& outMatrix, bool stopAtError, string& firstErr)
+{
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	size_t n = rows.size() - firstRow;
+	size_t pieces = GCSVParser_rowPieces(pool, n);
+	vector<size_t> errs(pieces, 0);
+	vector<size_t> firstBad(pieces, INVALID_INDEX);
+	GMatrix_forEachPiece(pool, pieces, [&](size_t p) {
+		size_t end = n * (p + 1) / pieces;
+		for(size_t i = n * p / pieces; i < end; i++)
+		{
+			const char* el = rows[firstRow + i][attr];
+			double val;
+			if(el[0] == '\0' || (el[0] == '?' && el[1] == '\0'))
+				val = UNKNOWN_REAL_VALUE;
+			else if(!GBits::parseFloat(el, strlen(el), &val))
+			{
+				val = UNKNOWN_REAL_VALUE;
+				if(errs[p]++ == 0)
+					firstBad[p] = firstRow + i;
+				if(stopAtError)
+					break;
+			}
+			outMatrix[i][attr] = val;
+		}
+	});
+	size_t total = 0;
+	for(size_t p = 0; p < pieces; p++)
+	{
+		if(total == 0 && errs[p] > 0)
+			firstErr = rows[firstBad[p]][attr];
+		total += errs[p];
+	}
+	return total;
+}
+
+size_t GCSVParser::convertNominal(const vector< vector<const char*> >& rows, size_t firstRow, size_t attr, GMatrix& outMatrix, bool specified, vector<const char*>& values)
+{
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	size_t n = rows.size() - firstRow;
+	size_t pieces = GCSVParser_rowPieces(pool, n);
+	size_t cap = specified ? INVALID_INDEX : m_maxVals + 1;
+
+	// Number the values in the order they first appear in each piece. (No piece needs more than
+	// cap values, because the column is aborted before the first row that could use another one.)
+	vector< vector<const char*> > pieceValues(pieces);
+	vector< vector<size_t> > pieceFirstRows(pieces);
+	GMatrix_forEachPiece(pool, pieces, [&](size_t p) {
+		GConstStringHashTable ht(31, true);
+		void* pVal;
+		size_t end = n * (p + 1) / pieces;
+		for(size_t i = n * p / pieces; i < end; i++)
+		{
+			const char* el = rows[firstRow + i][attr];
+			double val = UNKNOWN_DISCRETE_VALUE;
+			if(el[0] != '\0' && !(el[0] == '?' && el[1] == '\0'))
+			{
+				if(ht.get(el, &pVal))
+					val = (double)(uintptr_t)pVal;
+				else if(pieceValues[p].size() < cap)
+				{
+					GAssert(el[0] > ' ');
+					GAssert(el[strlen(el) - 1] > ' ');
+					uintptr_t k = pieceValues[p].size();
+					ht.add(el, (const void*)k);
+					pieceValues[p].push_back(el);
+					pieceFirstRows[p].push_back(i);
+					val = (double)k;
+				}
+			}
+			outMatrix[i][attr] = val;
+		}
+	});
+
+	// Merge the dictionaries in order, so the values are numbered in the order they first
+	// appear in the whole column. If it has too many values, find the row where it was aborted.
+	GConstStringHashTable ht(31, true);
+	void* pVal;
+	size_t cutoff = INVALID_INDEX;
+	vector< vector<int> > remap(pieces);
+	values.clear();
+	for(size_t p = 0; p < pieces; p++)
+	{
+		remap[p].resize(pieceValues[p].size());
+		for(size_t k = 0; k < pieceValues[p].size(); k++)
+		{
+			const char* el = pieceValues[p][k];
+			if(ht.get(el, &pVal))
+				remap[p][k] = (int)(uintptr_t)pVal;
+			else if(values.size() < cap)
+			{
+				uintptr_t index = values.size();
+				ht.add(el, (const void*)index);
+				values.push_back(el);
+				remap[p][k] = (int)index;
+				if(values.size() == cap)
+					cutoff = pieceFirstRows[p][k];
+			}
+			else
+				remap[p][k] = UNKNOWN_DISCRETE_VALUE;
+		}
+	}
+
+	// Renumber the elements
+	GMatrix_forEachPiece(pool, pieces, [&](size_t p) {
+		size_t end = n * (p + 1) / pieces;
+		for(size_t i = n * p / pieces; i < end; i++)
+		{
+			double& val = outMatrix[i][attr];
+			if(cutoff != INVALID_INDEX && i > cutoff)
+				val = UNKNOWN_DISCRETE_VALUE;
+			else if(val != UNKNOWN_DISCRETE_VALUE)
+				val = (double)remap[p][(size_t)val];
+		}
+	});
+	return values.size();
+}
+
+void GCSVParser::parseRows(GMatrix& outMatrix, const char* pFile, size_t len, const GRelation& relation)
+{
+	// Extract the elements
+	GHeap heap(2048);
+	vector< vector<const char*> > rows;
+	size_t columnCount = relation.size();
+	tokenize(pFile, len, heap, rows, false, columnCount);
+
+	// Index the nominal values, so each element can be looked up quickly
+	const GArffRelation* pArff = relation.type() == GRelation::ARFF ? (const GArffRelation*)&relation : NULL;
+	vector< std::map<string,size_t> > nominals(columnCount);
+	for(size_t attr = 0; attr < columnCount; attr++)
+	{
+		size_t vals = relation.valueCount(attr);
+		if(vals == 0 || !pArff)
+			continue;
+		for(size_t k = 0; k < vals; k++)
+			nominals[attr].insert(std::pair<string,size_t>(pArff->attrValue(attr, k), k));
+	}
+
+	// Convert the elements to values
+	outMatrix.flush();
+	outMatrix.setRelation(relation.clone());
+	outMatrix.newRows(rows.size());
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	size_t pieces = GCSVParser_rowPieces(pool, rows.size());
+	GMatrix_forEachPiece(pool, pieces, [&](size_t p) {
+		size_t end = rows.size() * (p + 1) / pieces;
+		for(size_t i = rows.size() * p / pieces; i < end; i++)
+		{
+			for(size_t attr = 0; attr < columnCount; attr++)
+			{
+				size_t vals = relation.valueCount(attr);
+				std::map<size_t, string>::const_iterator itFormat = m_formats.find(attr);
+				const char* el = rows[i][attr];
+				double val;
+				if(el[0] == '\0' || strcmp(el, "?") == 0)
+					val = (vals == 0 ? UNKNOWN_REAL_VALUE : UNKNOWN_DISCRETE_VALUE);
+				else if(itFormat != m_formats.end())
+				{
+					if(!GTime::fromString(&val, el, itFormat->second.c_str()))
+						val = UNKNOWN_REAL_VALUE;
+				}
+				else if(vals == 0)
+				{
+					if(!GBits::parseFloat(el, strlen(el), &val))
+						val = UNKNOWN_REAL_VALUE;
+				}
+				else
+				{
+					std::map<string,size_t>::const_iterator it = nominals[attr].find(el);
+					if(it != nominals[attr].end())
+						val = (double)it->second;
+					else
+					{
+						int n = pArff ? pArff->findEnumeratedValue(attr, el) : UNKNOWN_DISCRETE_VALUE;
+						if(n == UNKNOWN_DISCRETE_VALUE && m_specifiedNominal.find(attr) == m_specifiedNominal.end() && vals > m_maxVals)
+							val = UNKNOWN_DISCRETE_VALUE; // This column was aborted because it had too many values
+						else if(n == UNKNOWN_DISCRETE_VALUE)
+							throw Ex("The value \"", el, "\" in column ", to_str(attr), " was not among the values in the rows that were used to determine the types");
+						else
+							val = (double)n;
+					}
+				}
+				outMatrix[i][attr] = val;
+			}
+		}
+	});
+}
+
+// -------------------------------------------------------------------------
+
+// static
+GBatchReader* GBatchReader::open(const char* szFilename)
+{
+	PathData pd;
+	GFile::parsePath(szFilename, &pd);
+	const char* szExt = szFilename + pd.extStart;
+	if(*szExt == '.')
+		szExt++;
+	if(_stricmp(szExt, "csv") == 0)
+	{
+		GCSVParser parser;
+		return new GCSVBatchReader(szFilename, parser);
+	}
+	else if(_stricmp(szExt, "dat") == 0)
+	{
+		GCSVParser parser;
+		parser.setSeparator('\0');
+		return new GCSVBatchReader(szFilename, parser);
+	}
+	else if(*szExt == '\0' || _stricmp(szExt, "arff") == 0)
+		return new GArffBatchReader(szFilename);
+	else
+		throw Ex("Unsupported file format: ", szFilename + pd.extStart);
+}
+
+size_t GBatchReader::next(GMatrix& batch, size_t maxRows)
+{
+	batch.flush();
+	batch.setRelation(relation().clone());
+	return readRows(batch, maxRows);
+}
+
+size_t GBatchReader::next(GMatrix& features, GMatrix& labels, size_t labelDims, size_t maxRows)
+{
+	if(labelDims > relation().size())
+		throw Ex("Expected at most ", to_str(relation().size()), " label dims");
+	GMatrix batch;
+	size_t n = next(batch, maxRows);
+	size_t featureDims = batch.cols() - labelDims;
+	features.flush();
+	features.setRelation(relation().cloneSub(0, featureDims));
+	labels.flush();
+	labels.setRelation(relation().cloneSub(featureDims, labelDims));
+	features.reserve(n);
+	labels.reserve(n);
+	for(size_t i = 0; i < n; i++)
+	{
+		const GVec& r = batch[i];
+		features.newRow().copy(r, 0, featureDims);
+		labels.newRow().copy(r, featureDims, labelDims);
+	}
+	return n;
+}
+
+// -------------------------------------------------------------------------
+
+GArffBatchReader::GArffBatchReader(const char* szFilename)
+: GBatchReader(), m_filename(szFilename), m_pTok(NULL), m_pParseRelation(NULL), m_pRelation(NULL)
+{
+	try
+	{
+		rewind();
+	}
+	catch(...)
+	{
+		delete(m_pTok);
+		throw;
+	}
+	m_pRelation = (GArffRelation*)m_pParseRelation->clone();
+	GMatrix_finishArffRelation(m_pRelation);
+}
+
+// virtual
+GArffBatchReader::~GArffBatchReader()
+{
+	delete(m_pTok);
+	delete(m_pParseRelation);
+	delete(m_pRelation);
+}
+
+// virtual
+const GRelation& GArffBatchReader::relation()
+{
+	return *m_pRelation;
+}
+
+// virtual
+void GArffBatchReader::rewind()
+{
+	delete(m_pTok);
+	m_pTok = NULL;
+	delete(m_pParseRelation);
+	m_pParseRelation = NULL;
+	m_pTok = new GArffTokenizer(m_filename.c_str());
+	m_pParseRelation = GMatrix_parseArffHeader(*m_pTok);
+}
+
+// virtual
+size_t GArffBatchReader::readRows(GMatrix& batch, size_t maxRows)
+{
+	size_t n = 0;
+	while(n < maxRows && GMatrix_parseArffRow(*m_pTok, m_pParseRelation, batch))
+		n++;
+	return n;
+}
+
+// -------------------------------------------------------------------------
+
+GCSVBatchReader::GCSVBatchReader(const char* szFilename, const GCSVParser& parser, size_t sampleRows)
+: GBatchReader(), m_parser(parser), m_pStream(NULL), m_samplePos(0)
+{
+	m_pStream = new std::ifstream();
+	m_pStream->open(szFilename, std::ios::binary);
+	if(m_pStream->fail())
+	{
+		delete(m_pStream);
+		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
+	}
+
+	// Determine the types from a sample of rows
+	m_buf.clear();
+	if(m_parser.namesInFirstRow())
+	{
+		readLines(1);
+		if(m_buf.size() == 0)
+		{
+			delete(m_pStream);
+			throw Ex("Empty file");
+		}
+	}
+	readLines(sampleRows);
+	if(m_buf.size() == 0)
+	{
+		delete(m_pStream);
+		throw Ex("Empty file");
+	}
+	try
+	{
+		m_parser.parse(m_sample, m_buf.data(), m_buf.size());
+	}
+	catch(...)
+	{
+		delete(m_pStream);
+		throw;
+	}
+	m_dataStart = m_pStream->tellg();
+}
+
+// virtual
+GCSVBatchReader::~GCSVBatchReader()
+{
+	delete(m_pStream);
+}
+
+// virtual
+const GRelation& GCSVBatchReader::relation()
+{
+	return m_sample.relation();
+}
+
+// virtual
+void GCSVBatchReader::rewind()
+{
+	m_samplePos = 0;
+	m_pStream->clear();
+	m_pStream->seekg(m_dataStart);
+}
+
+size_t GCSVBatchReader::readLines(size_t maxLines)
+{
+	size_t n = 0;
+	while(n < maxLines && std::getline(*m_pStream, m_line))
+	{
+		size_t len = m_line.size();
+		if(len > 0 && m_line[len - 1] == '\r')
+			len--;
+		size_t i = 0;
+		while(i < len && m_line[i] <= ' ' && m_line[i] != m_parser.separator())
+			i++;
+		if(i >= len)
+			continue; // blank line
+		m_buf.append(m_line, 0, len);
+		m_buf += '\n';
+		n++;
+	}
+	return n;
+}
+
+// virtual
+size_t GCSVBatchReader::readRows(GMatrix& batch, size_t maxRows)
+{
+	// The sample rows come first
+	size_t n = 0;
+	while(n < maxRows && m_samplePos < m_sample.rows())
+	{
+		batch.newRow().copy(m_sample[m_samplePos++]);
+		n++;
+	}
+
+	// Then parse more lines from the file
+	if(n < maxRows)
+	{
+		m_buf.clear();
+		if(readLines(maxRows - n) > 0)
+		{
+			m_parser.parseRows(m_chunk, m_buf.data(), m_buf.size(), m_sample.relation());
+			for(size_t i = 0; i < m_chunk.rows(); i++)
+				batch.newRow().copy(m_chunk[i]);
+			n += m_chunk.rows();
+		}
+	}
+	return n;
+}
+
+#ifndef MIN_PREDICT
+// Reads all of the rows from reader in batches of batchRows, and checks that they match expected
+void GBatchReader_checkAgainst(GBatchReader& reader, const GMatrix& expected, size_t batchRows)
+{
+	if(!reader.relation().isCompatible(expected.relation()))
+		throw Ex("relation mismatch");
+	GMatrix batch;
+	size_t pos = 0;
+	size_t n;
+	while((n = reader.next(batch, batchRows)) > 0)
+	{
+		if(n > batchRows || batch.rows() != n)
+			throw Ex("wrong batch size");
+		for(size_t i = 0; i < n; i++)
+		{
+			if(pos >= expected.rows())
+				throw Ex("too many rows");
+			for(size_t j = 0; j < expected.cols(); j++)
+			{
+				if(batch[i][j] != expected[pos][j])
+					throw Ex("wrong value at row ", to_str(pos), ", col ", to_str(j));
+			}
+			pos++;
+		}
+	}
+	if(pos != expected.rows())
+		throw Ex("too few rows");
+}
+
+void GBatchReader_writeFile(const char* szFilename, const char* szContents)
+{
+	std::ofstream os;
+	os.open(szFilename, std::ios::binary);
+	os << szContents;
+	os.close();
+}
+
+void GBatchReader_testInner(const char* szFilename)
+{
+	// ARFF, with comments, a sparse row, a string, and a missing value
+	const char* szArff =
+		"@RELATION test\n"
+		"@ATTRIBUTE a real\n"
+		"@ATTRIBUTE b {x,y,z}\n"
+		"@ATTRIBUTE s string\n"
+		"@ATTRIBUTE c real\n"
+		"@DATA\n"
+		"1.5,x,hello,2\n"
+		"% a comment\n"
+		"-3,z,world,?\n"
+		"{0 7, 1 y, 3 -1}\n"
+		"\n"
+		"0,y,again,4.25\n"
+		"8,x,last,9\n";
+	GBatchReader_writeFile(szFilename, szArff);
+	GMatrix arff;
+	arff.loadArff(szFilename);
+	GArffBatchReader arffReader(szFilename);
+	for(size_t batchRows = 1; batchRows < 7; batchRows++)
+	{
+		arffReader.rewind();
+		GBatchReader_checkAgainst(arffReader, arff, batchRows);
+	}
+
+	// Split into features and labels
+	arffReader.rewind();
+	GMatrix features, labels;
+	if(arffReader.next(features, labels, 2, 3) != 3 || features.cols() != 2 || labels.cols() != 2)
+		throw Ex("wrong split");
+	if(features[1][1] != 2.0 || labels[2][1] != -1.0 || labels.relation().valueCount(0) != 0)
+		throw Ex("wrong split values");
+
+	// CSV, where later rows are parsed with the types that were determined from a small sample
+	const char* szCsv =
+		"name,size,weight\n"
+		"alpha,1,0.5\n"
+		"beta,2,?\n"
+		"\n"
+		"alpha,3,1.5\r\n"
+		"gamma,4,2.5\n"
+		"beta,5,3.5\n"
+		"gamma,6,\n"
+		"alpha,7,4.5";
+	GBatchReader_writeFile(szFilename, szCsv);
+	GCSVParser parser;
+	parser.columnNamesInFirstRow();
+	parser.setNominalAttr(0);
+	parser.setClearlyNumericalThreshold(1);
+	GMatrix csv;
+	parser.parse(csv, szFilename);
+	GCSVBatchReader csvReader(szFilename, parser, 4);
+	if(csvReader.sample().rows() != 4 || csvReader.relation().valueCount(0) != 3)
+		throw Ex("wrong sample");
+	for(size_t batchRows = 1; batchRows < 9; batchRows++)
+	{
+		csvReader.rewind();
+		GBatchReader_checkAgainst(csvReader, csv, batchRows);
+	}
+
+	// A nominal value that was not in the sample is an error
+	GBatchReader_writeFile(szFilename, "alpha,1\nbeta,2\ndelta,3\n");
+	GCSVParser parser2;
+	parser2.setNominalAttr(0);
+	GCSVBatchReader csvReader2(szFilename, parser2, 2);
+	GMatrix batch;
+	if(csvReader2.next(batch, 2) != 2)
+		throw Ex("wrong batch size");
+	bool threw = false;
+	try
+	{
+		csvReader2.next(batch, 2);
+	}
+	catch(...)
+	{
+		threw = true;
+	}
+	if(!threw)
+		throw Ex("failed to reject a value that was not in the sample");
+}
+
+// static
+void GBatchReader::test()
+{
+	char szFilename[256];
+	GFile::tempFilename(szFilename);
+	try
+	{
+		GBatchReader_testInner(szFilename);
+	}
+	catch(...)
+	{
+		GFile::deleteFile(szFilename);
+		throw;
+	}
+	GFile::deleteFile(szFilename);
+}
+#endif // MIN_PREDICT
+
 
 
 
@@ -5477,6 +7291,160 @@ GDataRowSplitter::~GDataRowSplitter()
 
 
 
+GColumnMatrix::GColumnMatrix(const GMatrix& m)
+: m_rows(m.rows()), m_cols(m.cols())
+{
+	m_stride = (m_rows + 7) & ~(size_t)7;
+	m_pBuf = new double[m_stride * m_cols + 8];
+	m_pData = GMatrixSlab::align(m_pBuf);
+
+	// Transpose a tile at a time, so the reads and writes both stay in cache
+	const size_t tile = 32;
+	for(size_t i0 = 0; i0 < m_rows; i0 += tile)
+	{
+		size_t i1 = std::min(m_rows, i0 + tile);
+		for(size_t j0 = 0; j0 < m_cols; j0 += tile)
+		{
+			size_t j1 = std::min(m_cols, j0 + tile);
+			for(size_t i = i0; i < i1; i++)
+			{
+				const GVec& r = m[i];
+				for(size_t j = j0; j < j1; j++)
+					m_pData[j * m_stride + i] = r[j];
+			}
+		}
+	}
+}
+
+GColumnMatrix::~GColumnMatrix()
+{
+	delete[] m_pBuf;
+}
+
+double GColumnMatrix::columnMean(size_t col) const
+{
+	if(col >= m_cols)
+		throw Ex("attribute index out of range");
+	const double* pCol = column(col);
+	double sum = 0.0;
+	size_t missing = 0;
+	for(size_t i = 0; i < m_rows; i++)
+	{
+		if(pCol[i] == UNKNOWN_REAL_VALUE)
+			missing++;
+		else
+			sum += pCol[i];
+	}
+	size_t count = m_rows - missing;
+	if(count > 0)
+		return sum / count;
+	else
+		return UNKNOWN_REAL_VALUE;
+}
+
+double GColumnMatrix::columnVariance(size_t col, double mean) const
+{
+	const double* pCol = column(col);
+	double sum = 0.0;
+	size_t missing = 0;
+	for(size_t i = 0; i < m_rows; i++)
+	{
+		if(pCol[i] == UNKNOWN_REAL_VALUE)
+		{
+			missing++;
+			continue;
+		}
+		double d = pCol[i] - mean;
+		sum += (d * d);
+	}
+	size_t count = m_rows - missing;
+	if(count > 1)
+		return sum / (count - 1);
+	else
+		return 0;
+}
+
+double GColumnMatrix::covariance(size_t col1, double mean1, size_t col2, double mean2) const
+{
+	const double* pA = column(col1);
+	const double* pB = column(col2);
+	double sum = 0.0;
+	for(size_t i = 0; i < m_rows; i++)
+		sum += (pA[i] - mean1) * (pB[i] - mean2);
+	return sum / (m_rows - 1);
+}
+
+GMatrix* GColumnMatrix::covarianceMatrix() const
+{
+	// Center each column, then the covariances are just dot products of columns
+	GVec means(m_cols);
+	for(size_t j = 0; j < m_cols; j++)
+	{
+		const double* pCol = column(j);
+		double sum = 0.0;
+		for(size_t i = 0; i < m_rows; i++)
+			sum += pCol[i];
+		means[j] = sum / m_rows;
+	}
+	GMatrix centered(m_cols, m_rows);
+	for(size_t j = 0; j < m_cols; j++)
+	{
+		const double* pCol = column(j);
+		GVec& r = centered[j];
+		for(size_t i = 0; i < m_rows; i++)
+			r[i] = pCol[i] - means[j];
+	}
+	GMatrix* pOut = GMatrix::multiply(centered, centered, false, true);
+	pOut->multiply(1.0 / (m_rows - 1));
+	return pOut;
+}
+
+// static
+void GColumnMatrix::test()
+{
+	GRand rand(0);
+	GMatrix m(53, 11);
+	m.fillNormal(rand);
+	for(size_t i = 0; i < m.rows(); i++)
+		m[i][3] += 2.0 * m[i][1];
+	m[7][5] = UNKNOWN_REAL_VALUE;
+	GColumnMatrix cm(m);
+	if(cm.rows() != 53 || cm.cols() != 11)
+		throw Ex("wrong size");
+	for(size_t i = 0; i < m.rows(); i++)
+	{
+		for(size_t j = 0; j < m.cols(); j++)
+		{
+			if(cm.at(i, j) != m[i][j])
+				throw Ex("wrong value");
+		}
+	}
+	for(size_t j = 0; j < m.cols(); j++)
+	{
+		double mean = m.columnMean(j);
+		if(std::abs(cm.columnMean(j) - mean) > 1e-12)
+			throw Ex("wrong mean");
+		if(std::abs(cm.columnVariance(j, mean) - m.columnVariance(j, mean)) > 1e-12)
+			throw Ex("wrong variance");
+	}
+	m[7][5] = 0.0;
+	GColumnMatrix cm2(m);
+	GMatrix* pCov = cm2.covarianceMatrix();
+	std::unique_ptr<GMatrix> hCov(pCov);
+	GMatrix* pExpected = m.covarianceMatrix();
+	std::unique_ptr<GMatrix> hExpected(pExpected);
+	for(size_t i = 0; i < m.cols(); i++)
+	{
+		for(size_t j = 0; j < m.cols(); j++)
+		{
+			if(std::abs((*pCov)[i][j] - (*pExpected)[i][j]) > 1e-10)
+				throw Ex("wrong covariance");
+			if(std::abs(cm2.covariance(i, m.columnMean(i), j, m.columnMean(j)) - (*pExpected)[i][j]) > 1e-10)
+				throw Ex("wrong covariance");
+		}
+	}
+}
+
 GRaggedMatrix::GRaggedMatrix()
 : m_minCols(0), m_maxCols(0)
 {
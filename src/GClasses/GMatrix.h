@@ -45,10 +45,12 @@ class GRand;
 class GDom;
 class GDomNode;
 class GArffTokenizer;
+class GHeap;
 class GDistanceMetric;
 class GSimpleAssignment;
 class GDistanceMetric;
 class GTokenizer;
+class GThreadPool;
 
 
 /// \brief Holds the metadata for a dataset.
@@ -410,6 +412,9 @@ public:
 	/// with the given value
 	int findEnumeratedValue(size_t nAttr, const char* szValue) const;
 
+	/// \brief Returns the name of the specified value of a nominal attribute
+	const char* attrValue(size_t nAttr, size_t nValue) const;
+
 	/// \brief Parses a value
 	double parseValue(size_t attr, const char* val);
 
@@ -421,16 +426,34 @@ public:
 	void dropValue(size_t attr, int val);
 };
 
+class GMatrixSlab;
+
 /// \brief Represents a matrix or a database table.
 ///
 /// Elements can be discrete or continuous.
 ///
 /// References a GRelation object, which stores the meta-information about each column.
+///
+/// By default, each row is a separate heap allocation. If setContiguous is
+/// called, rows are instead carved out of large aligned slabs, which makes
+/// adding rows much cheaper and keeps neighboring rows adjacent in memory.
 class GMatrix
 {
 protected:
 	GRelation* m_pRelation;
 	std::vector<GVec*> m_rows;
+	std::vector<GMatrixSlab*> m_slabs;
+	bool m_contiguous;
+
+	/// Allocates storage for a new row, from a slab if in contiguous mode.
+	GVec* allocRow();
+
+	/// Returns true iff pRow is one of the row objects owned by a slab.
+	bool isSlabRow(const GVec* pRow) const;
+
+	/// Returns a heap-allocated row with the same values as pRow, which the
+	/// caller may delete. (Rows that are already on the heap are returned as is.)
+	GVec* detachRow(GVec* pRow);
 
 public:
 	/// \brief Makes an empty 0x0 matrix.
@@ -607,16 +630,34 @@ public:
 
 
 	/// \brief Loads an ARFF file and replaces the contents of this matrix with it.
-	void loadArff(const char* szFilename, size_t maxRows = (size_t)-1);
+	///
+	/// If all of the rows are loaded and pPool (or GThreadPool::global(), if pPool
+	/// is NULL) has any workers, the whole file is read into memory and parsed
+	/// in parallel. Otherwise, it is streamed.
+	void loadArff(const char* szFilename, size_t maxRows = (size_t)-1, GThreadPool* pPool = NULL);
 
 	/// \brief Loads a raw (binary) file and replaces the contents of this matrix with it.
 	void loadRaw(const char* szFilename);
 
-	/// \brief Loads a file and automatically detects ARFF or raw (binary)
+	/// \brief Loads a file written by saveBinary and replaces the contents of this matrix with it.
+	///
+	/// On platforms that support it, the file is mapped into memory instead of being
+	/// read, and the rows point directly at the mapped data, so nothing is parsed or
+	/// copied, and pages are only read from disk when they are first touched. The mapping
+	/// is private, so changes to the matrix are never written back to the file. (On
+	/// Windows, the file is simply read.)
+	void loadBinary(const char* szFilename);
+
+	/// \brief Loads a file and automatically detects the format (ARFF, raw, or binary)
+	/// by its extension (.arff, .raw, or .gmat)
 	void load(const char* szFilename);
 
 	/// \brief Parses an ARFF file and replaces the contents of this matrix with it.
-	void parseArff(const char* szFile, size_t nLen, size_t maxRows = (size_t)-1);
+	///
+	/// If all of the rows are parsed, the data section of a large file is split at
+	/// line boundaries and the pieces are parsed in parallel with pPool (or with
+	/// GThreadPool::global(), if pPool is NULL). The result is the same either way.
+	void parseArff(const char* szFile, size_t nLen, size_t maxRows = (size_t)-1, GThreadPool* pPool = NULL);
 
 	/// \brief Parses an ARFF file and replaces the contents of this matrix with it.
 	void parseArff(GArffTokenizer& tok, size_t maxRows = (size_t)-1);
@@ -648,13 +689,17 @@ public:
 	void mergeVert(GMatrix* pData, bool ignoreMismatchingName = false);
 
 	/// \brief Computes nCount eigenvectors and the corresponding
-	/// eigenvalues using the power method (which is only accurate if a
-	/// small number of eigenvalues/vectors are needed.)
-	///
-	/// If mostSignificant is true, the largest eigenvalues are
-	/// found. If mostSignificant is false, the smallest eigenvalues are
-	/// found.
-	GMatrix* eigs(size_t nCount, GVec& eigenVals, GRand* pRand, bool mostSignificant);
+	/// eigenvalues.
+	///
+	/// If mostSignificant is true, the eigenvalues with the largest
+	/// magnitude are found. Otherwise the smallest eigenvalues are found.
+	/// They are found one at a time using the power method (which is only
+	/// accurate if a small number of eigenvalues/vectors are needed.)
+	/// If krylovIters is non-zero, mostSignificant is true, and this matrix
+	/// is symmetric, they are instead found together with a block Krylov
+	/// truncated SVD (see GTruncatedSVD) that uses krylovIters power
+	/// iterations. That is much faster for large matrices, but approximate.
+	GMatrix* eigs(size_t nCount, GVec& eigenVals, GRand* pRand, bool mostSignificant, size_t krylovIters = 0);
 
 	/// \brief Multiplies every element in this matrix by a scalar.
 	/// Behavior is undefined for nominal columns.
@@ -684,8 +729,17 @@ public:
 	/// multiplication. (If you want the results to come out transposed,
 	/// you can use the equality (AB)^T=(B^T)(A^T) to figure out how to
 	/// specify the parameters.)
+	///
+	/// The product is computed with a cache-blocked kernel, and large
+	/// products are split across all available hardware threads.
 	static GMatrix* multiply(const GMatrix& a, const GMatrix& b, bool transposeA, bool transposeB);
 
+	/// \brief Matrix multiply into an existing matrix.
+	///
+	/// Like the other overload, except the product is written into out,
+	/// which is resized as needed. out may not be the same object as a or b.
+	static void multiply(const GMatrix& a, const GMatrix& b, GMatrix& out, bool transposeA, bool transposeB);
+
 	/// \brief Computes the Moore-Penrose pseudoinverse of this matrix
 	/// (using the SVD method). You are responsible to delete the
 	/// matrix this returns.
@@ -696,8 +750,29 @@ public:
 	const GRelation& relation() const { return *m_pRelation; }
 
 	/// \brief Allocates space for the specified number of patterns (to
-	/// avoid superfluous resizing)
-	void reserve(size_t n) { m_rows.reserve(n); }
+	/// avoid superfluous resizing). In contiguous mode, this also makes room
+	/// for them in a single slab.
+	void reserve(size_t n);
+
+	/// \brief Switches between contiguous storage and one heap allocation per row.
+	///
+	/// When enabled, all existing rows are packed, in their current order, into
+	/// one slab with a 64-byte aligned, padded row stride, and rows added later
+	/// are carved out of slabs too. Rows are still accessed through row() and
+	/// operator[], but they may not be resized individually. (Use newColumns and
+	/// deleteColumns instead.) Rows obtained from releaseRow or swapRow are
+	/// returned as heap copies that the caller owns, as usual. Call this again
+	/// after sorting or shuffling to restore sequential layout.
+	/// When disabled, every row is moved into its own heap allocation.
+	void setContiguous(bool contiguous = true);
+
+	/// \brief Returns true iff this matrix is in contiguous storage mode.
+	bool isContiguous() const { return m_contiguous; }
+
+	/// \brief Returns a pointer to the first element of row 0 if every row is
+	/// stored sequentially in a single slab, such that row i begins at
+	/// pointer + i * stride. Otherwise, returns nullptr.
+	double* contiguousData(size_t& stride);
 
 	/// \brief Returns the number of rows in this matrix
 	size_t rows() const { return m_rows.size(); }
@@ -708,6 +783,16 @@ public:
 	/// \brief Saves this matrix to a file in raw (binary) format
 	void saveRaw(const char* szFilename);
 
+	/// \brief Saves this matrix and its relation to a file in a binary format that
+	/// loadBinary can map into memory.
+	///
+	/// The file begins with a small header and the relation (in GDom's binary format).
+	/// Then, starting on a 4096-byte boundary, come the rows in native byte order,
+	/// each padded to the same stride as the rows of a contiguous matrix, so
+	/// every row is aligned exactly as if it had been allocated by setContiguous.
+	/// By convention, these files use the .gmat extension.
+	void saveBinary(const char* szFilename);
+
 	/// \brief Performs SVD on A, where A is this m-by-n matrix.
 	///
 	/// You are responsible to delete(*ppU), delete(*ppV), and delete[]
@@ -1222,6 +1307,56 @@ protected:
 };
 
 
+/// \brief A read-only, column-major copy of the values in a GMatrix.
+///
+/// Each column is stored contiguously (with a 64-byte aligned, padded
+/// stride), so statistics that walk down a column stream through memory
+/// instead of touching one cache line per row. The statistics follow the
+/// same conventions as the corresponding methods in GMatrix.
+class GColumnMatrix
+{
+protected:
+	size_t m_rows;
+	size_t m_cols;
+	size_t m_stride;
+	double* m_pBuf;
+	double* m_pData;
+
+public:
+	/// Copies the values in m into column-major storage.
+	GColumnMatrix(const GMatrix& m);
+	~GColumnMatrix();
+
+	/// Returns the number of rows.
+	size_t rows() const { return m_rows; }
+
+	/// Returns the number of columns.
+	size_t cols() const { return m_cols; }
+
+	/// Returns a pointer to the rows() values in the specified column.
+	const double* column(size_t col) const { return m_pData + col * m_stride; }
+
+	/// Returns the element at the specified row and column.
+	double at(size_t row, size_t col) const { return m_pData[col * m_stride + row]; }
+
+	/// Computes the mean of the specified column, ignoring unknown values.
+	/// Returns UNKNOWN_REAL_VALUE if all of the values are unknown.
+	double columnMean(size_t col) const;
+
+	/// Computes the unbiased variance of the specified column about mean, ignoring unknown values.
+	double columnVariance(size_t col, double mean) const;
+
+	/// Computes the covariance between two columns. (Unknown values are not handled.)
+	double covariance(size_t col1, double mean1, size_t col2, double mean2) const;
+
+	/// Computes the covariance matrix of all the columns.
+	GMatrix* covarianceMatrix() const;
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+};
+
+
 
 /// A class for parsing CSV files (or tab-separated files, or whitespace separated files, etc.).
 /// (This class does not support Mac line endings, so you should replace all '\r' with '\n' before using this class if your
@@ -1240,6 +1375,7 @@ protected:
 	std::map<size_t, size_t> m_specifiedReal;
 	std::map<size_t, size_t> m_specifiedNominal;
 	std::map<size_t, size_t> m_stripQuotes;
+	GThreadPool* m_pPool;
 
 public:
 	GCSVParser();
@@ -1274,14 +1410,147 @@ public:
 	/// Indiciate that the specified attribute should have enclosing quotes stripped.
 	void setStripQuotes(size_t attr);
 
+	/// Specifies the pool used to parse. Large buffers are split at line boundaries and the
+	/// pieces are tokenized and converted in parallel. The results (including the order of
+	/// nominal values and which error is reported) are the same regardless of the number of
+	/// threads. If pPool is NULL (the default), GThreadPool::global() is used.
+	void setThreadPool(GThreadPool* pPool) { m_pPool = pPool; }
+
 	/// Load the specified file, and parse it.
 	void parse(GMatrix& outMatrix, const char* szFilename);
 
 	/// Parse the given string.
 	void parse(GMatrix& outMatrix, const char* pString, size_t len);
 
+	/// Parses more rows of a file whose types were already determined, such as by an
+	/// earlier call to parse on the beginning of the file. The rows are converted to
+	/// fit relation, which is cloned into outMatrix. Throws if a nominal value is not
+	/// one of the values in relation (unless the column was aborted for having too many values).
+	void parseRows(GMatrix& outMatrix, const char* pString, size_t len, const GRelation& relation);
+
 	/// Return a string that reports the status of the specified column. (This should only be called after parsing.)
 	std::string& report(size_t column) { return m_report[column]; }
+
+	/// Returns true iff the first row specifies column names.
+	bool namesInFirstRow() const { return m_columnNamesInFirstRow; }
+
+	/// Returns the separating character. ('\0' indicates whitespace.)
+	char separator() const { return m_separator; }
+
+protected:
+	/// Splits pFile into rows of elements, which are copied into heap. If namesInFirstRow is true,
+	/// the first row is not used to count the columns. If columnCount is INVALID_INDEX, it is
+	/// determined from the first row of data. Returns the number of columns.
+	size_t tokenize(const char* pFile, size_t len, GHeap& heap, std::vector< std::vector<const char*> >& rows, bool namesInFirstRow, size_t columnCount);
+
+	/// Tokenizes one piece of a file in the calling thread. firstLine is the line number of
+	/// the first line in the piece, which is used in error messages.
+	size_t tokenizeLines(const char* pFile, size_t len, GHeap& heap, std::vector< std::vector<const char*> >& rows, bool namesInFirstRow, size_t columnCount, size_t firstLine);
+
+	/// Converts the elements of a real-valued column. Returns the number of elements that
+	/// are not valid numbers, and sets firstErr to the first one. If stopAtError is true, it
+	/// stops at the first error.
+	size_t convertReal(const std::vector< std::vector<const char*> >& rows, size_t firstRow, size_t attr, GMatrix& outMatrix, bool stopAtError, std::string& firstErr);
+
+	/// Converts the elements of a nominal column, assigning values in the order in which they
+	/// first appear. Returns the number of values, and puts their names in values.
+	size_t convertNominal(const std::vector< std::vector<const char*> >& rows, size_t firstRow, size_t attr, GMatrix& outMatrix, bool specified, std::vector<const char*>& values);
+};
+
+
+/// Reads a dataset from a file a batch of rows at a time, so that datasets
+/// that are larger than memory can be used for training. Only one batch is
+/// held in memory at a time. The relation is known before the first batch is read.
+class GBatchReader
+{
+public:
+	GBatchReader() {}
+	virtual ~GBatchReader() {}
+
+	/// Performs unit tests for the batch readers. Throws an exception if there is a failure.
+	static void test();
+
+	/// Opens a reader for the specified file, choosing the format by its
+	/// extension (".arff", ".csv", or ".dat"). The caller takes ownership.
+	static GBatchReader* open(const char* szFilename);
+
+	/// Returns the meta-data of the rows that this reader yields.
+	virtual const GRelation& relation() = 0;
+
+	/// Moves back to the first row (to begin another epoch).
+	virtual void rewind() = 0;
+
+	/// Replaces the contents of batch with up to maxRows of the next rows.
+	/// Returns the number of rows that were read, which is 0 at the end of the data.
+	size_t next(GMatrix& batch, size_t maxRows);
+
+	/// Like next, but the last labelDims columns go into labels, and the others go into features.
+	size_t next(GMatrix& features, GMatrix& labels, size_t labelDims, size_t maxRows);
+
+protected:
+	/// Appends up to maxRows of the next rows to batch, which already has the right relation.
+	virtual size_t readRows(GMatrix& batch, size_t maxRows) = 0;
+};
+
+
+/// Reads an ARFF file a batch of rows at a time. (See GMatrix::loadArff to load it all at once.)
+class GArffBatchReader : public GBatchReader
+{
+protected:
+	std::string m_filename;
+	GArffTokenizer* m_pTok;
+	GArffRelation* m_pParseRelation; // string and date attributes have special value counts in this one
+	GArffRelation* m_pRelation;
+
+public:
+	/// Opens the file and parses its meta-data.
+	GArffBatchReader(const char* szFilename);
+	virtual ~GArffBatchReader();
+
+	virtual const GRelation& relation();
+	virtual void rewind();
+
+protected:
+	virtual size_t readRows(GMatrix& batch, size_t maxRows);
+};
+
+
+/// Reads a CSV file (or a whitespace-separated file) a batch of rows at a time.
+/// The types of the columns are determined by parsing a sample of rows from the
+/// start of the file with a GCSVParser, so a nominal value that does not occur
+/// in the sample causes an exception when it is read.
+class GCSVBatchReader : public GBatchReader
+{
+protected:
+	GCSVParser m_parser;
+	std::ifstream* m_pStream;
+	std::streampos m_dataStart;
+	GMatrix m_sample;
+	size_t m_samplePos;
+	std::string m_buf;
+	std::string m_line;
+	GMatrix m_chunk;
+
+public:
+	/// parser specifies how to parse the file. (This object uses a copy of it.)
+	/// sampleRows is the number of rows used to determine the types.
+	GCSVBatchReader(const char* szFilename, const GCSVParser& parser, size_t sampleRows = 10000);
+	virtual ~GCSVBatchReader();
+
+	virtual const GRelation& relation();
+	virtual void rewind();
+
+	/// Returns the parser, whose report method tells what was determined from the sample.
+	GCSVParser& parser() { return m_parser; }
+
+	/// Returns the rows that were used to determine the types. (They are also yielded as the first rows.)
+	const GMatrix& sample() const { return m_sample; }
+
+protected:
+	virtual size_t readRows(GMatrix& batch, size_t maxRows);
+
+	/// Reads up to maxLines non-blank lines into m_buf. Returns the number of lines that were read.
+	size_t readLines(size_t maxLines);
 };
 
 
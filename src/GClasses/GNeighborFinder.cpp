@@ -44,6 +44,9 @@
 #include "GPriorityQueue.h"
 #include <memory>
 #include "GSparseMatrix.h"
+#include "GThread.h"
+#include <algorithm>
+#include <functional>
 
 
 //using std::cerr;
@@ -427,6 +430,76 @@ void GNeighborFinderGeneralizing::sortNeighbors(size_t beg, size_t end)
 	sortNeighbors(beg, initial_end);
 }
 
+// virtual
+size_t GNeighborFinderGeneralizing::findNearestInto(size_t k, const GVec& vec, size_t nExclude, std::vector<size_t>& neighs, std::vector<double>& dists)
+{
+	size_t found = findNearest(nExclude == INVALID_INDEX ? k : k + 1, vec);
+	neighs.clear();
+	dists.clear();
+	for(size_t i = 0; i < found && neighs.size() < k; i++)
+	{
+		if(m_neighs[i] == nExclude)
+			continue;
+		neighs.push_back(m_neighs[i]);
+		dists.push_back(m_dists[i]);
+	}
+	return neighs.size();
+}
+
+void GNeighborFinderGeneralizing::findNearest(size_t k, const GMatrix& queries, GMatrix& outNeighbors, GMatrix& outSquaredDists, GThreadPool* pPool)
+{
+	if(k < 1)
+		throw Ex("Expected k to be at least 1");
+	if(queries.cols() != m_pData->cols())
+		throw Ex("Mismatching number of columns. Expected ", to_str(m_pData->cols()), ", got ", to_str(queries.cols()));
+	size_t n = queries.rows();
+	outNeighbors.resize(n, k);
+	outSquaredDists.resize(n, k);
+
+	// Each block of queries shares one set of scratch buffers
+	const size_t blockSize = 32;
+	size_t blocks = (n + blockSize - 1) / blockSize;
+	auto searchBlock = [&](size_t block) {
+		std::vector<size_t> neighs;
+		std::vector<double> dists;
+		std::vector< std::pair<double, size_t> > sorted;
+		neighs.reserve(k);
+		dists.reserve(k);
+		sorted.reserve(k);
+		size_t end = std::min(n, (block + 1) * blockSize);
+		for(size_t i = block * blockSize; i < end; i++)
+		{
+			size_t found = findNearestInto(k, queries[i], INVALID_INDEX, neighs, dists);
+			sorted.clear();
+			for(size_t j = 0; j < found; j++)
+				sorted.push_back(std::make_pair(dists[j], neighs[j]));
+			std::sort(sorted.begin(), sorted.end());
+			GVec& outN = outNeighbors[i];
+			GVec& outD = outSquaredDists[i];
+			for(size_t j = 0; j < found; j++)
+			{
+				outN[j] = (double)sorted[j].second;
+				outD[j] = sorted[j].first;
+			}
+			for(size_t j = found; j < k; j++)
+			{
+				outN[j] = UNKNOWN_REAL_VALUE;
+				outD[j] = UNKNOWN_REAL_VALUE;
+			}
+		}
+	};
+	if(isReentrant())
+	{
+		GThreadPool& pool = pPool ? *pPool : GThreadPool::global();
+		pool.parallelFor(0, blocks, searchBlock);
+	}
+	else
+	{
+		for(size_t i = 0; i < blocks; i++)
+			searchBlock(i);
+	}
+}
+
 
 
 
@@ -451,11 +524,13 @@ void GBruteForceNeighborFinder::reoptimize()
 size_t GBruteForceNeighborFinder::findNearest(size_t k, const GVec& vec, size_t exclude)
 {
 	GClosestNeighborFindingHelper helper(k, m_neighs, m_dists);
+	m_scratch.resize(m_pData->rows());
+	m_pMetric->squaredDistances(vec, *m_pData, m_scratch.data());
 	for(size_t i = 0; i < m_pData->rows(); i++)
 	{
 		if(i == exclude)
 			continue;
-		helper.TryPoint(i, m_pMetric->squaredDistance(vec, m_pData->row(i)));
+		helper.TryPoint(i, m_scratch[i]);
 	}
 	return m_neighs.size();
 }
@@ -464,11 +539,13 @@ size_t GBruteForceNeighborFinder::findWithinRadius(double squaredRadius, const G
 {
 	m_neighs.clear();
 	m_dists.clear();
+	m_scratch.resize(m_pData->rows());
+	m_pMetric->squaredDistances(vec, *m_pData, m_scratch.data());
 	for(size_t i = 0; i < m_pData->rows(); i++)
 	{
 		if(i == exclude)
 			continue;
-		double d = m_pMetric->squaredDistance(vec, m_pData->row(i));
+		double d = m_scratch[i];
 		if(d <= squaredRadius)
 		{
 			m_neighs.push_back(i);
@@ -507,6 +584,16 @@ size_t GBruteForceNeighborFinder::findWithinRadius(double squaredRadius, size_t
 GSparseNeighborFinder::GSparseNeighborFinder(GSparseMatrix* pData, GMatrix* pBogusData, GSparseSimilarity* pMetric, bool ownMetric)
 : GNeighborFinderGeneralizing(pBogusData, new GRowDistance(), true),
 m_pData(pData),
+m_pCompressed(NULL),
+m_pSparseMetric(pMetric),
+m_ownSparseMetric(ownMetric)
+{
+}
+
+GSparseNeighborFinder::GSparseNeighborFinder(const GCompressedSparseMatrix* pData, GMatrix* pBogusData, GSparseSimilarity* pMetric, bool ownMetric)
+: GNeighborFinderGeneralizing(pBogusData, new GRowDistance(), true),
+m_pData(NULL),
+m_pCompressed(pData),
 m_pSparseMetric(pMetric),
 m_ownSparseMetric(ownMetric)
 {
@@ -529,10 +616,14 @@ size_t GSparseNeighborFinder::findNearest(size_t k, const GVec& vec)
 	m_neighs.clear();
 	m_dists.clear();
 	multimap<double,size_t> priority_queue;
-	for(size_t i = 0; i < m_pData->rows(); i++)
+	size_t rowCount = m_pCompressed ? m_pCompressed->rows() : m_pData->rows();
+	for(size_t i = 0; i < rowCount; i++)
 	{
-		map<size_t,double>& row = m_pData->row(i);
-		double similarity = m_pSparseMetric->similarity(row, vec);
+		double similarity;
+		if(m_pCompressed)
+			similarity = m_pSparseMetric->similarity(m_pCompressed->rowIndexes(i), m_pCompressed->rowValues(i), m_pCompressed->rowNonDefValues(i), vec);
+		else
+			similarity = m_pSparseMetric->similarity(m_pData->row(i), vec);
 		priority_queue.insert(pair<double,size_t>(similarity, i));
 		if(priority_queue.size() > k)
 			priority_queue.erase(priority_queue.begin());
@@ -548,16 +639,22 @@ size_t GSparseNeighborFinder::findNearest(size_t k, const GVec& vec)
 // virtual
 size_t GSparseNeighborFinder::findNearest(size_t k, size_t index)
 {
-	map<size_t,double>& vec = m_pData->row(index);
 	m_neighs.clear();
 	m_dists.clear();
 	multimap<double,size_t> priority_queue;
-	for(size_t i = 0; i < m_pData->rows(); i++)
+	size_t rowCount = m_pCompressed ? m_pCompressed->rows() : m_pData->rows();
+	for(size_t i = 0; i < rowCount; i++)
 	{
 		if(i == index)
 			continue;
-		map<size_t,double>& row = m_pData->row(i);
-		double similarity = m_pSparseMetric->similarity(row, vec);
+		double similarity;
+		if(m_pCompressed)
+		{
+			const GCompressedSparseMatrix& m = *m_pCompressed;
+			similarity = m_pSparseMetric->similarity(m.rowIndexes(i), m.rowValues(i), m.rowNonDefValues(i), m.rowIndexes(index), m.rowValues(index), m.rowNonDefValues(index));
+		}
+		else
+			similarity = m_pSparseMetric->similarity(m_pData->row(i), m_pData->row(index));
 		priority_queue.insert(pair<double,size_t>(similarity, i));
 		if(priority_queue.size() > k)
 			priority_queue.erase(priority_queue.begin());
@@ -1009,50 +1106,99 @@ public:
 
 size_t GKdTree::findNearest(size_t k, const GVec& vec, size_t nExclude)
 {
-	GClosestNeighborFindingHelper helper(k, m_neighs, m_dists);
-	KdTree_Compare_Nodes_Functor comparator;
-	priority_queue< GKdNode*, vector<GKdNode*>, KdTree_Compare_Nodes_Functor > q(comparator);
-	q.push(m_pRoot);
+	return findNearestInto(k, vec, nExclude, m_neighs, m_dists);
+}
+
+/// An entry in the search queue of GKdTree::findNearestInto
+class GKdTree_SearchEntry
+{
+public:
+	double m_minDist;
+	GKdNode* m_pNode;
+	size_t m_offsets; // Where this node's per-attribute offsets begin in the scratch buffer
+
+	GKdTree_SearchEntry(double minDist, GKdNode* pNode, size_t offsets)
+	: m_minDist(minDist), m_pNode(pNode), m_offsets(offsets)
+	{
+	}
+
+	// Reversed, so that std::priority_queue puts the nearest node on top
+	bool operator<(const GKdTree_SearchEntry& other) const
+	{
+		return m_minDist > other.m_minDist;
+	}
+};
+
+// virtual
+size_t GKdTree::findNearestInto(size_t k, const GVec& vec, size_t nExclude, std::vector<size_t>& neighs, std::vector<double>& dists)
+{
+	// This search keeps the per-node bounds in its own scratch buffer (instead of
+	// in the nodes, as findWithinRadius does), so concurrent queries do not collide.
+	// A child that inherits its parent's bounds unchanged shares its parent's slot.
+	GClosestNeighborFindingHelper helper(k, neighs, dists);
+	const GVec& scaleFactors = m_pMetric->scaleFactors();
+	size_t dims = m_pRoot->GetDims();
+	vector<double> offsets(dims, 0.0);
+	vector<double> leafDists; // not m_scratch, which concurrent queries would share
+	priority_queue<GKdTree_SearchEntry> q;
+	q.push(GKdTree_SearchEntry(0.0, m_pRoot, 0));
 	while(q.size() > 0)
 	{
-		GKdNode* pNode = q.top();
+		GKdTree_SearchEntry entry = q.top();
 		q.pop();
-		if(pNode->GetMinDist() >= helper.GetWorstDist())
+		if(entry.m_minDist >= helper.GetWorstDist())
 			break;
-		if(pNode->IsLeaf())
+		if(entry.m_pNode->IsLeaf())
 		{
-			double squaredDist;
-			vector<size_t>* pIndexes = ((GKdLeafNode*)pNode)->GetIndexes();
+			vector<size_t>* pIndexes = ((GKdLeafNode*)entry.m_pNode)->GetIndexes();
 			size_t count = pIndexes->size();
+			leafDists.resize(count);
+			m_pMetric->squaredDistances(vec, *m_pData, pIndexes->data(), count, leafDists.data());
 			for(size_t i = 0; i < count; i++)
 			{
 				size_t index = (*pIndexes)[i];
 				if(index == nExclude)
 					continue;
-				const GVec& pCand = m_pData->row(index);
-				squaredDist = m_pMetric->squaredDistance(vec, pCand);
-				helper.TryPoint(index, squaredDist);
+				helper.TryPoint(index, leafDists[i]);
 			}
 		}
 		else
 		{
 			size_t attr;
 			double pivot;
-			GKdInteriorNode* pParent = (GKdInteriorNode*)pNode;
+			GKdInteriorNode* pParent = (GKdInteriorNode*)entry.m_pNode;
 			pParent->GetDivision(&attr, &pivot);
-			GKdNode* pLess = pParent->GetLess();
-			pLess->CopyOffset(pParent);
-			GKdNode* pGreaterOrEqual = pParent->GetGreaterOrEqual();
-			pGreaterOrEqual->CopyOffset(pParent);
+			GKdNode* pNear;
+			GKdNode* pFar;
+			double offset;
 			if(isGreaterOrEqual(vec.data(), attr, pivot))
-				pLess->AdjustOffset(attr, vec[attr] - pivot, m_pMetric->scaleFactors());
+			{
+				pNear = pParent->GetGreaterOrEqual();
+				pFar = pParent->GetLess();
+				offset = vec[attr] - pivot;
+			}
 			else
-				pGreaterOrEqual->AdjustOffset(attr, pivot - vec[attr], m_pMetric->scaleFactors());
-			q.push(pLess);
-			q.push(pGreaterOrEqual);
+			{
+				pNear = pParent->GetLess();
+				pFar = pParent->GetGreaterOrEqual();
+				offset = pivot - vec[attr];
+			}
+			q.push(GKdTree_SearchEntry(entry.m_minDist, pNear, entry.m_offsets));
+			double prev = offsets[entry.m_offsets + attr];
+			if(offset > prev)
+			{
+				size_t slot = offsets.size();
+				offsets.resize(slot + dims);
+				memcpy(offsets.data() + slot, offsets.data() + entry.m_offsets, sizeof(double) * dims);
+				offsets[slot + attr] = offset;
+				double sf = scaleFactors[attr] * scaleFactors[attr];
+				q.push(GKdTree_SearchEntry(entry.m_minDist + (offset * offset - prev * prev) * sf, pFar, slot));
+			}
+			else
+				q.push(GKdTree_SearchEntry(entry.m_minDist, pFar, entry.m_offsets));
 		}
 	}
-	return m_neighs.size();
+	return neighs.size();
 }
 
 size_t GKdTree::findWithinRadius(double squaredRadius, const GVec& vec, size_t nExclude)
@@ -1070,16 +1216,16 @@ size_t GKdTree::findWithinRadius(double squaredRadius, const GVec& vec, size_t n
 			break;
 		if(pNode->IsLeaf())
 		{
-			double squaredDist;
 			vector<size_t>* pIndexes = ((GKdLeafNode*)pNode)->GetIndexes();
 			size_t count = pIndexes->size();
+			m_scratch.resize(count);
+			m_pMetric->squaredDistances(vec, *m_pData, pIndexes->data(), count, m_scratch.data());
 			for(size_t i = 0; i < count; i++)
 			{
 				size_t index = (*pIndexes)[i];
 				if(index == nExclude)
 					continue;
-				const GVec& pCand = m_pData->row(index);
-				squaredDist = m_pMetric->squaredDistance(vec, pCand);
+				double squaredDist = m_scratch[i];
 				if(squaredDist <= squaredRadius)
 				{
 					m_neighs.push_back(index);
@@ -1304,6 +1450,33 @@ void GKdTree_testThatItDoesntLookFar()
 	}
 }
 
+// Checks that the batch query agrees with one query at a time
+void GNeighborFinderGeneralizing_testBatch(GNeighborFinderGeneralizing& nf, const GMatrix& queries, size_t k)
+{
+	GThreadPool pool(3);
+	GMatrix neighbors;
+	GMatrix dists;
+	nf.findNearest(k, queries, neighbors, dists, &pool);
+	if(neighbors.rows() != queries.rows() || neighbors.cols() != k || dists.rows() != queries.rows() || dists.cols() != k)
+		throw Ex("wrong size");
+	for(size_t i = 0; i < queries.rows(); i++)
+	{
+		size_t found = nf.findNearest(k, queries[i]);
+		nf.sortNeighbors();
+		for(size_t j = 0; j < k; j++)
+		{
+			if(j >= found)
+			{
+				if(neighbors[i][j] != UNKNOWN_REAL_VALUE || dists[i][j] != UNKNOWN_REAL_VALUE)
+					throw Ex("expected padding");
+				continue;
+			}
+			if((size_t)neighbors[i][j] != nf.neighbor(j) || dists[i][j] != nf.distance(j))
+				throw Ex("batch query disagrees with single query");
+		}
+	}
+}
+
 #	define TEST_DIMS 4
 #	define TEST_PATTERNS 1000
 #	define TEST_NEIGHBORS 24
@@ -1379,6 +1552,17 @@ void GKdTree::test()
 				throw Ex("Neighbors out of order");
 		}
 	}
+
+	// Test batch queries
+	GMatrix queries(300, TEST_DIMS);
+	for(size_t i = 0; i < queries.rows(); i++)
+		queries[i].fillNormal(prng);
+	GNeighborFinderGeneralizing_testBatch(kd, queries, TEST_NEIGHBORS);
+	GMatrix small(5, TEST_DIMS);
+	for(size_t i = 0; i < small.rows(); i++)
+		small[i].fillNormal(prng);
+	GKdTree kdSmall(&small);
+	GNeighborFinderGeneralizing_testBatch(kdSmall, queries, 8);
 }
 
 // --------------------------------------------------------------------------------------------------------
@@ -1669,7 +1853,13 @@ GBallNode* GBallTree::buildTree(size_t count, size_t* pIndexes)
 
 size_t GBallTree::findNearest(size_t k, const GVec& vec, size_t nExclude)
 {
-	GClosestNeighborFindingHelper helper(k, m_neighs, m_dists);
+	return findNearestInto(k, vec, nExclude, m_neighs, m_dists);
+}
+
+// virtual
+size_t GBallTree::findNearestInto(size_t k, const GVec& vec, size_t nExclude, std::vector<size_t>& neighs, std::vector<double>& dists)
+{
+	GClosestNeighborFindingHelper helper(k, neighs, dists);
 	GSimplePriorityQueue<GBallNode*> q;
 	q.insert(m_pRoot, m_pRoot->distance(m_pMetric, vec));
 	while(q.size() > 0)
@@ -1696,7 +1886,7 @@ size_t GBallTree::findNearest(size_t k, const GVec& vec, size_t nExclude)
 			q.insert(pInt->m_pRight, pInt->m_pRight->distance(m_pMetric, vec));
 		}
 	}
-	return m_neighs.size();
+	return neighs.size();
 }
 
 size_t GBallTree::findWithinRadius(double squaredRadius, const GVec& vec, size_t nExclude)
@@ -1804,8 +1994,488 @@ void GBallTree::test()
 				throw Ex("distances differ");
 		}
 	}
+
+	// Test batch queries
+	GMatrix m(TEST_BALLTREE_ROWS * 5, TEST_BALLTREE_DIMS);
+	for(size_t j = 0; j < m.rows(); j++)
+		m[j].fillUniform(r);
+	GBallTree ball(&m);
+	GMatrix queries(TEST_BALLTREE_ROWS, TEST_BALLTREE_DIMS);
+	for(size_t j = 0; j < queries.rows(); j++)
+		queries[j].fillUniform(r);
+	GNeighborFinderGeneralizing_testBatch(ball, queries, TEST_BALLTREE_NEIGHBORS);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+// --------------------------------------------------------------------------------------------------------
+
+GHnswNeighborFinder::GHnswNeighborFinder(const GMatrix* pData, size_t M, size_t efConstruction, GDistanceMetric* pMetric, bool ownMetric)
+: GNeighborFinderGeneralizing(pData, pMetric, ownMetric),
+m_M(M),
+m_efConstruction(efConstruction),
+m_efSearch(64),
+m_entry(INVALID_INDEX),
+m_size(0),
+m_rand(0)
+{
+	if(M < 2)
+		throw Ex("Expected M to be at least 2");
+	m_levelMult = 1.0 / log((double)M);
+	reoptimize();
+}
+
+GHnswNeighborFinder::GHnswNeighborFinder(const GDomNode* pNode, const GMatrix* pData, GDistanceMetric* pMetric, bool ownMetric)
+: GNeighborFinderGeneralizing(pData, pMetric, ownMetric),
+m_entry(INVALID_INDEX),
+m_size(0),
+m_rand(0)
+{
+	m_M = (size_t)pNode->getInt("M");
+	m_efConstruction = (size_t)pNode->getInt("efc");
+	m_efSearch = (size_t)pNode->getInt("efs");
+	if(m_M < 2)
+		throw Ex("Expected M to be at least 2");
+	m_levelMult = 1.0 / log((double)m_M);
+	GDomNode* pLinks = pNode->get("links");
+	if(pLinks->size() > pData->rows())
+		throw Ex("This index refers to ", to_str(pLinks->size()), " points, but the data only has ", to_str(pData->rows()), " rows");
+	m_links.resize(pData->rows());
+	GDomListIterator itPoint(pLinks);
+	for(size_t i = 0; itPoint.current(); i++)
+	{
+		GDomListIterator itLayer(itPoint.current());
+		m_links[i].resize(itLayer.remaining());
+		for(size_t layer = 0; itLayer.current(); layer++)
+		{
+			std::vector<size_t>& links = m_links[i][layer];
+			links.resize(itLayer.current()->size());
+			GDomListIterator it(itLayer.current());
+			GIndexVec::deserialize(links.data(), it);
+			itLayer.advance();
+		}
+		if(m_links[i].size() > 0)
+			m_size++;
+		itPoint.advance();
+	}
+
+	// Every link must lead to a point that is in the same layer
+	for(size_t i = 0; i < m_links.size(); i++)
+	{
+		for(size_t layer = 0; layer < m_links[i].size(); layer++)
+		{
+			const std::vector<size_t>& links = m_links[i][layer];
+			for(size_t j = 0; j < links.size(); j++)
+			{
+				if(links[j] >= pLinks->size() || m_links[links[j]].size() <= layer)
+					throw Ex("Invalid link from point ", to_str(i), " to point ", to_str(links[j]), " in layer ", to_str(layer));
+			}
+		}
+	}
+	if(m_size > 0)
+	{
+		m_entry = (size_t)pNode->getInt("entry");
+		if(m_entry >= pLinks->size() || m_links[m_entry].size() == 0)
+			throw Ex("Invalid entry point");
+	}
+}
+
+// virtual
+GHnswNeighborFinder::~GHnswNeighborFinder()
+{
+	for(size_t i = 0; i < m_visitedPool.size(); i++)
+		delete(m_visitedPool[i]);
+}
+
+GDomNode* GHnswNeighborFinder::serialize(GDom* pDoc) const
+{
+	GDomNode* pNode = pDoc->newObj();
+	pNode->add(pDoc, "M", m_M);
+	pNode->add(pDoc, "efc", m_efConstruction);
+	pNode->add(pDoc, "efs", m_efSearch);
+	if(m_size > 0)
+		pNode->add(pDoc, "entry", m_entry);
+	GDomNode* pLinks = pNode->add(pDoc, "links", pDoc->newList());
+	for(size_t i = 0; i < m_links.size(); i++)
+	{
+		GDomNode* pPoint = pLinks->add(pDoc, pDoc->newList());
+		for(size_t layer = 0; layer < m_links[i].size(); layer++)
+			pPoint->add(pDoc, GIndexVec::serialize(pDoc, m_links[i][layer].data(), m_links[i][layer].size()));
+	}
+	return pNode;
+}
+
+// virtual
+void GHnswNeighborFinder::reoptimize()
+{
+	m_links.clear();
+	m_entry = INVALID_INDEX;
+	m_size = 0;
+	for(size_t i = 0; i < m_pData->rows(); i++)
+		insert(i);
+}
+
+size_t GHnswNeighborFinder::randomLayer()
+{
+	return (size_t)floor(-log(1.0 - m_rand.uniform()) * m_levelMult);
+}
+
+void GHnswNeighborFinder::insert(size_t index)
+{
+	if(index >= m_pData->rows())
+		throw Ex("Index out of range. (Add the row to the data before inserting it.)");
+	if(m_links.size() < m_pData->rows())
+		m_links.resize(m_pData->rows());
+	if(m_links[index].size() > 0)
+		throw Ex("Point ", to_str(index), " is already in the graph");
+	size_t level = randomLayer();
+	m_links[index].resize(level + 1);
+	m_size++;
+	if(m_entry == INVALID_INDEX)
+	{
+		m_entry = index;
+		return;
+	}
+
+	// Descend greedily to the top layer of the new point
+	const GVec& vec = m_pData->row(index);
+	size_t topLayer = m_links[m_entry].size() - 1;
+	vector< std::pair<double, size_t> > results;
+	results.push_back(std::make_pair(m_pMetric->squaredDistance(vec, m_pData->row(m_entry)), m_entry));
+	for(size_t layer = topLayer; layer > level; layer--)
+		searchLayer(vec, 1, layer, results, m_visited);
+
+	// Link the new point into each of its layers
+	vector< std::pair<double, size_t> > candidates;
+	vector< std::pair<double, size_t> > backLinks;
+	for(size_t layer = std::min(level, topLayer) + 1; layer-- > 0; )
+	{
+		searchLayer(vec, m_efConstruction, layer, results, m_visited);
+		candidates = results;
+		std::sort(candidates.begin(), candidates.end());
+		selectNeighbors(candidates, m_M);
+		size_t maxLinks = (layer == 0 ? 2 * m_M : m_M);
+		vector<size_t>& links = m_links[index][layer];
+		for(size_t i = 0; i < candidates.size(); i++)
+		{
+			size_t neigh = candidates[i].second;
+			links.push_back(neigh);
+			vector<size_t>& neighLinks = m_links[neigh][layer];
+			neighLinks.push_back(index);
+			if(neighLinks.size() > maxLinks)
+			{
+				// Prune the neighbor's links
+				const GVec& neighVec = m_pData->row(neigh);
+				backLinks.clear();
+				for(size_t j = 0; j < neighLinks.size(); j++)
+					backLinks.push_back(std::make_pair(m_pMetric->squaredDistance(neighVec, m_pData->row(neighLinks[j])), neighLinks[j]));
+				std::sort(backLinks.begin(), backLinks.end());
+				selectNeighbors(backLinks, maxLinks);
+				neighLinks.clear();
+				for(size_t j = 0; j < backLinks.size(); j++)
+					neighLinks.push_back(backLinks[j].second);
+			}
+		}
+	}
+	if(level > topLayer)
+		m_entry = index;
 }
 
+void GHnswVisitedSet::reset(size_t n)
+{
+	if(m_marks.size() < n)
+		m_marks.resize(n, 0);
+	if(++m_epoch == 0)
+	{
+		// The counter wrapped around, so the old marks could be mistaken for new ones
+		std::fill(m_marks.begin(), m_marks.end(), 0);
+		m_epoch = 1;
+	}
+}
+
+GHnswVisitedSet* GHnswNeighborFinder::borrowVisitedSet()
+{
+	GSpinLockHolder lockHolder(&m_visitedLock, "GHnswNeighborFinder::borrowVisitedSet");
+	if(m_visitedPool.size() == 0)
+		return new GHnswVisitedSet();
+	GHnswVisitedSet* pVisited = m_visitedPool.back();
+	m_visitedPool.pop_back();
+	return pVisited;
+}
+
+void GHnswNeighborFinder::returnVisitedSet(GHnswVisitedSet* pVisited)
+{
+	GSpinLockHolder lockHolder(&m_visitedLock, "GHnswNeighborFinder::returnVisitedSet");
+	m_visitedPool.push_back(pVisited);
+}
+
+void GHnswNeighborFinder::searchLayer(const GVec& vec, size_t ef, size_t layer, vector< std::pair<double, size_t> >& results, GHnswVisitedSet& visited) const
+{
+	std::greater< std::pair<double, size_t> > nearestFirst;
+	vector< std::pair<double, size_t> > candidates(results);
+	std::make_heap(candidates.begin(), candidates.end(), nearestFirst);
+	std::make_heap(results.begin(), results.end());
+	visited.reset(m_links.size());
+	for(size_t i = 0; i < results.size(); i++)
+		visited.visit(results[i].second);
+	while(candidates.size() > 0)
+	{
+		std::pair<double, size_t> cand = candidates.front();
+		if(results.size() >= ef && cand.first > results.front().first)
+			break;
+		std::pop_heap(candidates.begin(), candidates.end(), nearestFirst);
+		candidates.pop_back();
+		const vector<size_t>& links = m_links[cand.second][layer];
+		for(size_t i = 0; i < links.size(); i++)
+		{
+			size_t neigh = links[i];
+			if(!visited.visit(neigh))
+				continue;
+			double d = m_pMetric->squaredDistance(vec, m_pData->row(neigh));
+			if(results.size() < ef || d < results.front().first)
+			{
+				candidates.push_back(std::make_pair(d, neigh));
+				std::push_heap(candidates.begin(), candidates.end(), nearestFirst);
+				results.push_back(std::make_pair(d, neigh));
+				std::push_heap(results.begin(), results.end());
+				if(results.size() > ef)
+				{
+					std::pop_heap(results.begin(), results.end());
+					results.pop_back();
+				}
+			}
+		}
+	}
+}
+
+void GHnswNeighborFinder::selectNeighbors(vector< std::pair<double, size_t> >& candidates, size_t maxCount) const
+{
+	size_t selected = 0;
+	for(size_t i = 0; i < candidates.size() && selected < maxCount; i++)
+	{
+		const GVec& cand = m_pData->row(candidates[i].second);
+		bool keep = true;
+		for(size_t j = 0; j < selected; j++)
+		{
+			if(m_pMetric->squaredDistance(cand, m_pData->row(candidates[j].second)) < candidates[i].first)
+			{
+				keep = false;
+				break;
+			}
+		}
+		if(keep)
+			candidates[selected++] = candidates[i];
+	}
+	candidates.resize(selected);
+}
+
+void GHnswNeighborFinder::search(const GVec& vec, size_t ef, vector< std::pair<double, size_t> >& results, GHnswVisitedSet& visited) const
+{
+	results.clear();
+	if(m_entry == INVALID_INDEX)
+		return;
+	results.push_back(std::make_pair(m_pMetric->squaredDistance(vec, m_pData->row(m_entry)), m_entry));
+	for(size_t layer = m_links[m_entry].size() - 1; layer > 0; layer--)
+		searchLayer(vec, 1, layer, results, visited);
+	searchLayer(vec, ef, 0, results, visited);
+	std::sort(results.begin(), results.end());
+}
+
+// virtual
+size_t GHnswNeighborFinder::findNearestInto(size_t k, const GVec& vec, size_t nExclude, vector<size_t>& neighs, vector<double>& dists)
+{
+	neighs.clear();
+	dists.clear();
+	std::unique_ptr<GHnswVisitedSet> hVisited(borrowVisitedSet());
+	vector< std::pair<double, size_t> > results;
+	search(vec, std::max(m_efSearch, nExclude == INVALID_INDEX ? k : k + 1), results, *hVisited);
+	returnVisitedSet(hVisited.release());
+	for(size_t i = 0; i < results.size() && neighs.size() < k; i++)
+	{
+		if(results[i].second == nExclude)
+			continue;
+		neighs.push_back(results[i].second);
+		dists.push_back(results[i].first);
+	}
+	return neighs.size();
+}
+
+// virtual
+size_t GHnswNeighborFinder::findNearest(size_t k, size_t index)
+{
+	return findNearestInto(k, m_pData->row(index), index, m_neighs, m_dists);
+}
+
+// virtual
+size_t GHnswNeighborFinder::findNearest(size_t k, const GVec& vec)
+{
+	return findNearestInto(k, vec, INVALID_INDEX, m_neighs, m_dists);
+}
+
+size_t GHnswNeighborFinder::findWithinRadius(double squaredRadius, const GVec& vec, size_t nExclude)
+{
+	m_neighs.clear();
+	m_dists.clear();
+	std::unique_ptr<GHnswVisitedSet> hVisited(borrowVisitedSet());
+	vector< std::pair<double, size_t> > results;
+	for(size_t ef = std::max(m_efSearch, (size_t)16); true; ef *= 2)
+	{
+		search(vec, ef, results, *hVisited);
+		if(results.size() < ef || results.back().first > squaredRadius)
+			break;
+	}
+	returnVisitedSet(hVisited.release());
+	for(size_t i = 0; i < results.size() && results[i].first <= squaredRadius; i++)
+	{
+		if(results[i].second == nExclude)
+			continue;
+		m_neighs.push_back(results[i].second);
+		m_dists.push_back(results[i].first);
+	}
+	return m_neighs.size();
+}
+
+// virtual
+size_t GHnswNeighborFinder::findWithinRadius(double squaredRadius, size_t index)
+{
+	return findWithinRadius(squaredRadius, m_pData->row(index), index);
+}
+
+// virtual
+size_t GHnswNeighborFinder::findWithinRadius(double squaredRadius, const GVec& vec)
+{
+	return findWithinRadius(squaredRadius, vec, INVALID_INDEX);
+}
+
+// Returns the fraction of the true k nearest neighbors of the queries that nf finds
+double GHnswNeighborFinder_recall(GNeighborFinderGeneralizing& nf, GNeighborFinderGeneralizing& exact, const GMatrix& queries, size_t k)
+{
+	size_t hits = 0;
+	for(size_t i = 0; i < queries.rows(); i++)
+	{
+		size_t found = nf.findNearest(k, queries[i]);
+		exact.findNearest(k, queries[i]);
+		std::set<size_t> truth;
+		for(size_t j = 0; j < k; j++)
+			truth.insert(exact.neighbor(j));
+		for(size_t j = 0; j < found; j++)
+		{
+			if(truth.find(nf.neighbor(j)) != truth.end())
+				hits++;
+		}
+	}
+	return (double)hits / (queries.rows() * k);
+}
+
+// static
+void GHnswNeighborFinder::test()
+{
+	GRand rand(0);
+	GMatrix data(2000, 32);
+	for(size_t i = 0; i < data.rows(); i++)
+		data[i].fillNormal(rand);
+	GMatrix queries(100, 32);
+	for(size_t i = 0; i < queries.rows(); i++)
+		queries[i].fillNormal(rand);
+	GBruteForceNeighborFinder exact(&data);
+
+	// Test recall
+	GHnswNeighborFinder hnsw(&data, 12, 100);
+	if(hnsw.size() != data.rows())
+		throw Ex("wrong size");
+	if(GHnswNeighborFinder_recall(hnsw, exact, queries, 10) < 0.9)
+		throw Ex("poor recall");
+	hnsw.findNearest(10, queries[0]);
+	for(size_t j = 1; j < 10; j++)
+	{
+		if(hnsw.distance(j) < hnsw.distance(j - 1))
+			throw Ex("Neighbors out of order");
+	}
+
+	// Test that a point is excluded from its own neighbors, and that radius queries agree with brute force
+	if(hnsw.findNearest(1, (size_t)7) != 1 || hnsw.neighbor(0) == 7)
+		throw Ex("failed to exclude the point");
+	exact.findNearest(5, queries[1]);
+	double radius = 0.0;
+	for(size_t j = 0; j < 5; j++)
+		radius = std::max(radius, exact.distance(j));
+	size_t radiusCount = hnsw.findWithinRadius(radius, queries[1]);
+	if(radiusCount != exact.findWithinRadius(radius, queries[1]) || radiusCount == 0)
+		throw Ex("wrong number of points within the radius");
+
+	// Test serialization
+	GDom doc;
+	doc.setRoot(hnsw.serialize(&doc));
+	GHnswNeighborFinder loaded(doc.root(), &data);
+	for(size_t i = 0; i < 10; i++)
+	{
+		size_t n1 = hnsw.findNearest(5, queries[i]);
+		size_t n2 = loaded.findNearest(5, queries[i]);
+		if(n1 != n2)
+			throw Ex("loaded index found a different number of neighbors");
+		for(size_t j = 0; j < n1; j++)
+		{
+			if(hnsw.neighbor(j) != loaded.neighbor(j))
+				throw Ex("loaded index disagrees");
+		}
+	}
+
+	// Test incremental inserts
+	GMatrix grow;
+	grow.copy(data, 0, 0, 1000);
+	GHnswNeighborFinder incremental(&grow, 12, 100);
+	for(size_t i = 1000; i < data.rows(); i++)
+	{
+		grow.newRow().copy(data[i]);
+		incremental.insert(i);
+	}
+	if(incremental.size() != data.rows())
+		throw Ex("wrong size");
+	if(GHnswNeighborFinder_recall(incremental, exact, queries, 10) < 0.9)
+		throw Ex("poor recall after incremental inserts");
+
+	// Test batch queries
+	GNeighborFinderGeneralizing_testBatch(hnsw, queries, 10);
+
+	// A link to a point that is not in that layer should be rejected
+	GDom badDoc;
+	GDomNode* pBad = badDoc.newObj();
+	pBad->add(&badDoc, "M", (size_t)4);
+	pBad->add(&badDoc, "efc", (size_t)10);
+	pBad->add(&badDoc, "efs", (size_t)10);
+	pBad->add(&badDoc, "entry", (size_t)0);
+	GDomNode* pBadLinks = pBad->add(&badDoc, "links", badDoc.newList());
+	size_t toOne = 1;
+	size_t toZero = 0;
+	GDomNode* pPoint0 = pBadLinks->add(&badDoc, badDoc.newList());
+	pPoint0->add(&badDoc, GIndexVec::serialize(&badDoc, &toOne, 1));
+	pPoint0->add(&badDoc, GIndexVec::serialize(&badDoc, &toOne, 1));
+	GDomNode* pPoint1 = pBadLinks->add(&badDoc, badDoc.newList());
+	pPoint1->add(&badDoc, GIndexVec::serialize(&badDoc, &toZero, 1));
+	bool rejected = false;
+	try
+	{
+		GHnswNeighborFinder corrupt(pBad, &data);
+	}
+	catch(const std::exception&)
+	{
+		rejected = true;
+	}
+	if(!rejected)
+		throw Ex("Failed to reject a link to a missing layer");
+}
+
+
 
 
 
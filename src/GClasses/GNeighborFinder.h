@@ -21,6 +21,8 @@
 #define __GNEIGHBORFINDER_H__
 
 #include "GMatrix.h"
+#include "GRand.h"
+#include "GThread.h"
 #include <vector>
 #include <map>
 
@@ -36,8 +38,10 @@ class GDistanceMetric;
 class GSupervisedLearner;
 class GRandomIndexIterator;
 class GSparseMatrix;
+class GCompressedSparseMatrix;
 class GSparseSimilarity;
 class GNeighborFinderGeneralizing;
+class GThreadPool;
 
 
 /// Finds the k-nearest neighbors of any vector in a dataset.
@@ -214,6 +218,26 @@ public:
 	/// Uses Quick Sort to sort the neighbors from least to most distant.
 	void sortNeighbors(size_t start = 0, size_t end = INVALID_INDEX);
 
+	/// Finds the k nearest neighbors of every row in queries. The results are written into
+	/// the caller-owned matrices outNeighbors and outSquaredDists, which are resized to
+	/// queries.rows() x k. Row i holds the indexes and squared distances of the neighbors of
+	/// query i, sorted from nearest to farthest. If fewer than k neighbors exist, the
+	/// remaining elements are set to UNKNOWN_REAL_VALUE. If this finder is reentrant (see
+	/// isReentrant), the queries are divided among the threads of pPool (or the global pool
+	/// if pPool is NULL). Otherwise, they are processed serially, and the results that
+	/// "neighbor" and "distance" return are clobbered.
+	void findNearest(size_t k, const GMatrix& queries, GMatrix& outNeighbors, GMatrix& outSquaredDists, GThreadPool* pPool = NULL);
+
+	/// Returns true iff findNearestInto may safely be called from several threads at once.
+	virtual bool isReentrant() { return false; }
+
+	/// Finds the k nearest neighbors of vec, skipping the point with index nExclude, and
+	/// stores them (in no particular order) in the caller-owned vectors neighs and dists.
+	/// Returns the number of neighbors found. The default implementation calls findNearest
+	/// and copies the results out, so it is not reentrant. Classes that override this with
+	/// a search that touches no shared state should also override isReentrant.
+	virtual size_t findNearestInto(size_t k, const GVec& vec, size_t nExclude, std::vector<size_t>& neighs, std::vector<double>& dists);
+
 protected:
 	/// A helper method used by sortNeighbors when the remaining portion to sort is small.
 	void insertionSortNeighbors(size_t start, size_t end);
@@ -224,6 +248,9 @@ protected:
 /// the distance metric does not support the triangle inequality.
 class GBruteForceNeighborFinder : public GNeighborFinderGeneralizing
 {
+protected:
+	GVec m_scratch; // distances to every row, computed with one batch call per query
+
 public:
 	GBruteForceNeighborFinder(GMatrix* pData, GDistanceMetric* pMetric = NULL, bool ownMetric = false);
 	virtual ~GBruteForceNeighborFinder();
@@ -256,6 +283,7 @@ class GSparseNeighborFinder : public GNeighborFinderGeneralizing
 {
 protected:
 	GSparseMatrix* m_pData;
+	const GCompressedSparseMatrix* m_pCompressed;
 	GSparseSimilarity* m_pSparseMetric;
 	bool m_ownSparseMetric;
 
@@ -266,6 +294,10 @@ public:
 	/// pMetric is the similarity metric to use in finding neighbors. Higher similarity indicates closer neighbors.
 	/// ownMetric specifies whether this object should delete pMetric when it is deleted.
 	GSparseNeighborFinder(GSparseMatrix* pData, GMatrix* pBogusData, GSparseSimilarity* pMetric, bool ownMetric = false);
+
+	/// Like the other constructor, except the rows are read from a compressed (CSR) matrix,
+	/// which avoids chasing map nodes on every similarity computation.
+	GSparseNeighborFinder(const GCompressedSparseMatrix* pData, GMatrix* pBogusData, GSparseSimilarity* pMetric, bool ownMetric = false);
 	virtual ~GSparseNeighborFinder();
 
 	/// This is a no-op method in this class.
@@ -296,6 +328,7 @@ protected:
 	size_t m_maxLeafSize;
 	size_t m_size;
 	GKdNode* m_pRoot;
+	std::vector<double> m_scratch; // distances to the rows of a leaf in findWithinRadius, computed with one batch call per leaf
 
 public:
 	GKdTree(const GMatrix* pData, GDistanceMetric* pMetric = NULL, bool ownMetric = false);
@@ -313,6 +346,13 @@ public:
 
 	/// See the comment for GNeighborFinderGeneralizing::neighbors
 	virtual size_t findNearest(size_t k, const GVec& vector);
+	using GNeighborFinderGeneralizing::findNearest;
+
+	/// Returns true. Nearest-neighbor queries do not modify this tree.
+	virtual bool isReentrant() { return true; }
+
+	/// See the comment for GNeighborFinderGeneralizing::findNearestInto
+	virtual size_t findNearestInto(size_t k, const GVec& vec, size_t nExclude, std::vector<size_t>& neighs, std::vector<double>& dists);
 
 	/// See the comment for GNeighborFinder::findWithinRadius
 	size_t findWithinRadius(double squaredRadius, size_t index);
@@ -382,6 +422,13 @@ public:
 
 	/// See the comment for GNeighborFinderGeneralizing::neighbors
 	virtual size_t findNearest(size_t k, const GVec& vec);
+	using GNeighborFinderGeneralizing::findNearest;
+
+	/// Returns true. Nearest-neighbor queries do not modify this tree.
+	virtual bool isReentrant() { return true; }
+
+	/// See the comment for GNeighborFinderGeneralizing::findNearestInto
+	virtual size_t findNearestInto(size_t k, const GVec& vec, size_t nExclude, std::vector<size_t>& neighs, std::vector<double>& dists);
 
 	/// See the comment for GNeighborFinder::findWithinRadius
 	virtual size_t findWithinRadius(double squaredRadius, size_t index);
@@ -422,6 +469,146 @@ protected:
 
 
 
+/// Marks the points that one search of a GHnswNeighborFinder has visited. Starting a
+/// search bumps an epoch counter instead of clearing the marks, so it costs nothing per point.
+class GHnswVisitedSet
+{
+protected:
+	std::vector<unsigned int> m_marks;
+	unsigned int m_epoch;
+
+public:
+	GHnswVisitedSet() : m_epoch(0) {}
+
+	/// Forgets all of the marks, and makes room for at least n points.
+	void reset(size_t n);
+
+	/// Marks point i. Returns false if it was already marked.
+	bool visit(size_t i)
+	{
+		if(m_marks[i] == m_epoch)
+			return false;
+		m_marks[i] = m_epoch;
+		return true;
+	}
+};
+
+
+/// An approximate neighbor finder that uses a hierarchical navigable small-world (HNSW)
+/// graph. (See Malkov and Yashunin, "Efficient and robust approximate nearest neighbor
+/// search using Hierarchical Navigable Small World graphs", 2016.) Every point is linked
+/// to about M of its neighbors in a proximity graph, and a random subset of the points
+/// also forms sparser graphs in higher layers, which serve as express lanes. A query
+/// descends greedily through the upper layers, then explores the bottom layer with a beam
+/// of width efSearch. Unlike GKdTree, it stays fast in high-dimensional spaces, but it may
+/// occasionally miss a true neighbor. Larger values of M, efConstruction, and efSearch
+/// improve recall at the cost of speed. Queries do not modify the graph, so several threads
+/// may query it at once (but not while points are being inserted).
+class GHnswNeighborFinder : public GNeighborFinderGeneralizing
+{
+protected:
+	size_t m_M;
+	size_t m_efConstruction;
+	size_t m_efSearch;
+	double m_levelMult;
+	size_t m_entry;
+	size_t m_size;
+	std::vector< std::vector< std::vector<size_t> > > m_links; // m_links[i][layer] holds the neighbors of point i in that layer
+	GHnswVisitedSet m_visited; // scratch space for insert
+	std::vector<GHnswVisitedSet*> m_visitedPool; // scratch space for queries, which may run concurrently
+	GSpinLock m_visitedLock;
+	GRand m_rand;
+
+public:
+	/// Indexes all of the rows in pData. M is the number of links each point makes in each
+	/// layer (twice that many in the bottom layer), and efConstruction is the width of the
+	/// search used to find those links.
+	GHnswNeighborFinder(const GMatrix* pData, size_t M = 16, size_t efConstruction = 200, GDistanceMetric* pMetric = NULL, bool ownMetric = false);
+
+	/// Loads an index that was produced by serialize. pData and pMetric must be equivalent
+	/// to the ones with which the index was built.
+	GHnswNeighborFinder(const GDomNode* pNode, const GMatrix* pData, GDistanceMetric* pMetric = NULL, bool ownMetric = false);
+
+	virtual ~GHnswNeighborFinder();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Marshals the graph (but not the data or the metric) into a DOM.
+	GDomNode* serialize(GDom* pDoc) const;
+
+	/// Discards the graph and indexes every row in the dataset again.
+	virtual void reoptimize();
+
+	/// Adds the point with the specified index to the graph. This method assumes you have
+	/// already added a new row to the dataset that was used to construct this object.
+	void insert(size_t index);
+
+	/// Returns the number of points in the graph.
+	size_t size() const { return m_size; }
+
+	/// Returns the number of links each point makes in each layer.
+	size_t M() const { return m_M; }
+
+	/// Returns the width of the search used to link new points into the graph.
+	size_t efConstruction() const { return m_efConstruction; }
+
+	/// Returns the width of the search used to answer queries.
+	size_t efSearch() const { return m_efSearch; }
+
+	/// Sets the width of the search used to answer queries. (The default is 64.) If k is
+	/// bigger, k is used instead.
+	void setEfSearch(size_t ef) { m_efSearch = ef; }
+
+	/// See the comment for GNeighborFinder::findNearest
+	virtual size_t findNearest(size_t k, size_t index);
+
+	/// See the comment for GNeighborFinderGeneralizing::neighbors
+	virtual size_t findNearest(size_t k, const GVec& vec);
+	using GNeighborFinderGeneralizing::findNearest;
+
+	/// Returns true. Queries do not modify the graph.
+	virtual bool isReentrant() { return true; }
+
+	/// See the comment for GNeighborFinderGeneralizing::findNearestInto
+	virtual size_t findNearestInto(size_t k, const GVec& vec, size_t nExclude, std::vector<size_t>& neighs, std::vector<double>& dists);
+
+	/// Finds points within the specified radius. The search widens until it finds a point
+	/// outside the radius, so like the other queries, this is approximate.
+	virtual size_t findWithinRadius(double squaredRadius, size_t index);
+
+	/// See the comment for GHnswNeighborFinder::findWithinRadius
+	virtual size_t findWithinRadius(double squaredRadius, const GVec& vec);
+
+protected:
+	/// This is a helper method that finds neighbors within a radius
+	size_t findWithinRadius(double squaredRadius, const GVec& vec, size_t nExclude);
+
+	/// Draws a random layer for a new point
+	size_t randomLayer();
+
+	/// Takes a visited set from the pool, or makes a new one if they are all in use.
+	GHnswVisitedSet* borrowVisitedSet();
+
+	/// Puts a visited set back in the pool.
+	void returnVisitedSet(GHnswVisitedSet* pVisited);
+
+	/// Finds the (approximately) ef nearest points to vec in the graph. Returns them in results,
+	/// sorted from nearest to farthest. visited is scratch space.
+	void search(const GVec& vec, size_t ef, std::vector< std::pair<double, size_t> >& results, GHnswVisitedSet& visited) const;
+
+	/// Performs a best-first search of one layer. On input, results holds the entry points.
+	/// On output, it holds (as a max-heap) the ef nearest points that were found.
+	void searchLayer(const GVec& vec, size_t ef, size_t layer, std::vector< std::pair<double, size_t> >& results, GHnswVisitedSet& visited) const;
+
+	/// Reduces candidates (which must be sorted from nearest to farthest) to at most maxCount
+	/// points, preferring points that are not closer to an already-selected point than
+	/// to the query. This keeps links pointing in diverse directions.
+	void selectNeighbors(std::vector< std::pair<double, size_t> >& candidates, size_t maxCount) const;
+};
+
+
+
 
 
 /// This uses "betweeenness centrality" to find the shortcuts in a table of neighbors and replaces them with INVALID_INDEX.
@@ -189,6 +189,88 @@ double GBlock::computeBlame(const GVec& target)
 	return sse;
 }
 
+/// Temporarily binds a block to individual rows of a minibatch, and restores the original bindings when destroyed.
+class GBlockRowBinder
+{
+protected:
+	GBlock& m_block;
+	const double* m_pInput;
+	size_t m_inputSize;
+	double* m_pOutput;
+	size_t m_outputSize;
+	double* m_pOutBlame;
+	size_t m_outBlameSize;
+	double* m_pInBlame;
+	size_t m_inBlameSize;
+
+public:
+	GBlockRowBinder(GBlock& block)
+	: m_block(block),
+	m_pInput(block.input.data()), m_inputSize(block.input.size()),
+	m_pOutput(block.output.data()), m_outputSize(block.output.size()),
+	m_pOutBlame(block.outBlame.data()), m_outBlameSize(block.outBlame.size()),
+	m_pInBlame(block.inBlame.data()), m_inBlameSize(block.inBlame.size())
+	{
+	}
+
+	~GBlockRowBinder()
+	{
+		m_block.input.setData(m_pInput, m_inputSize);
+		m_block.output.setData(m_pOutput, m_outputSize);
+		m_block.outBlame.setData(m_pOutBlame, m_outBlameSize);
+		m_block.inBlame.setData(m_pInBlame, m_inBlameSize);
+	}
+};
+
+void GBlock::forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize)
+{
+	GBlockRowBinder binder(*this);
+	for(size_t r = 0; r < batchSize; r++)
+	{
+		input.setData(in.data() + r * inStride, inputs());
+		output.setData(out.data() + r * outStride, outputs());
+		forwardProp();
+	}
+}
+
+double GBlock::computeBlameBatch(const GVec& target, const GVec& out, GVec& outBl, size_t outStride, size_t batchSize)
+{
+	GBlockRowBinder binder(*this);
+	double sse = 0.0;
+	for(size_t r = 0; r < batchSize; r++)
+	{
+		GConstVecWrapper t(target.data() + r * outStride, outputs());
+		output.setData((double*)out.data() + r * outStride, outputs());
+		outBlame.setData(outBl.data() + r * outStride, outputs());
+		sse += computeBlame(t);
+	}
+	return sse;
+}
+
+void GBlock::backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	GBlockRowBinder binder(*this);
+	for(size_t r = 0; r < batchSize; r++)
+	{
+		input.setData(in.data() + r * inStride, inputs());
+		inBlame.setData(inBl.data() + r * inStride, inputs());
+		output.setData((double*)out.data() + r * outStride, outputs());
+		outBlame.setData((double*)outBl.data() + r * outStride, outputs());
+		backProp();
+	}
+}
+
+void GBlock::updateGradientBatch(const GVec& in, size_t inStride, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	GBlockRowBinder binder(*this);
+	for(size_t r = 0; r < batchSize; r++)
+	{
+		input.setData(in.data() + r * inStride, inputs());
+		outBlame.setData((double*)outBl.data() + r * outStride, outputs());
+		updateGradient();
+	}
+}
+
 std::string GBlock::to_str(bool includeWeights, bool includeActivations) const
 {
 	std::ostringstream os;
@@ -428,6 +510,36 @@ void GBlockActivation::backProp()
 		inBlame[i] += outBlame[i] * derivative(input[i], output[i]);
 }
 
+void GBlockActivation::forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize)
+{
+	const double* pIn = in.data();
+	double* pOut = out.data();
+	for(size_t r = 0; r < batchSize; r++)
+	{
+		for(size_t i = 0; i < inputCount; i++)
+			pOut[i] = eval(pIn[i]);
+		pIn += inStride;
+		pOut += outStride;
+	}
+}
+
+void GBlockActivation::backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	const double* pIn = in.data();
+	double* pInBl = inBl.data();
+	const double* pOut = out.data();
+	const double* pOutBl = outBl.data();
+	for(size_t r = 0; r < batchSize; r++)
+	{
+		for(size_t i = 0; i < inputCount; i++)
+			pInBl[i] += pOutBl[i] * derivative(pIn[i], pOut[i]);
+		pIn += inStride;
+		pInBl += inStride;
+		pOut += outStride;
+		pOutBl += outStride;
+	}
+}
+
 void GBlockActivation::inverseProp(const GVec& output, GVec& input)
 {
 	for(size_t i = 0; i < outputCount; i++)
@@ -737,6 +849,108 @@ void GBlockLinear::updateGradientNormalized()
 	}
 }
 
+void GBlockLinear::forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize)
+{
+	// Out = In * W + bias, computed four rows at a time so each row of W is loaded once per four rows
+	const double* pBias = weights.data();
+	const double* pW = pBias + outputCount;
+	size_t r = 0;
+	for( ; r + 4 <= batchSize; r += 4)
+	{
+		const double* pIn0 = in.data() + r * inStride;
+		const double* pIn1 = pIn0 + inStride;
+		const double* pIn2 = pIn1 + inStride;
+		const double* pIn3 = pIn2 + inStride;
+		double* pOut0 = out.data() + r * outStride;
+		double* pOut1 = pOut0 + outStride;
+		double* pOut2 = pOut1 + outStride;
+		double* pOut3 = pOut2 + outStride;
+		for(size_t j = 0; j < outputCount; j++)
+		{
+			pOut0[j] = pBias[j];
+			pOut1[j] = pBias[j];
+			pOut2[j] = pBias[j];
+			pOut3[j] = pBias[j];
+		}
+		const double* pRow = pW;
+		for(size_t i = 0; i < inputCount; i++)
+		{
+			double a0 = pIn0[i];
+			double a1 = pIn1[i];
+			double a2 = pIn2[i];
+			double a3 = pIn3[i];
+			for(size_t j = 0; j < outputCount; j++)
+			{
+				double w = pRow[j];
+				pOut0[j] += a0 * w;
+				pOut1[j] += a1 * w;
+				pOut2[j] += a2 * w;
+				pOut3[j] += a3 * w;
+			}
+			pRow += outputCount;
+		}
+	}
+	for( ; r < batchSize; r++)
+	{
+		const double* pIn = in.data() + r * inStride;
+		double* pOut = out.data() + r * outStride;
+		for(size_t j = 0; j < outputCount; j++)
+			pOut[j] = pBias[j];
+		const double* pRow = pW;
+		for(size_t i = 0; i < inputCount; i++)
+		{
+			double a = pIn[i];
+			for(size_t j = 0; j < outputCount; j++)
+				pOut[j] += a * pRow[j];
+			pRow += outputCount;
+		}
+	}
+}
+
+void GBlockLinear::backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	// InBlame += OutBlame * W^T
+	const double* pW = weights.data() + outputCount; // skip the bias weights
+	for(size_t r = 0; r < batchSize; r++)
+	{
+		const double* pOutBl = outBl.data() + r * outStride;
+		double* pInBl = inBl.data() + r * inStride;
+		const double* pRow = pW;
+		for(size_t i = 0; i < inputCount; i++)
+		{
+			double d = 0.0;
+			for(size_t j = 0; j < outputCount; j++)
+				d += pOutBl[j] * pRow[j];
+			pInBl[i] += d;
+			pRow += outputCount;
+		}
+	}
+}
+
+void GBlockLinear::updateGradientBatch(const GVec& in, size_t inStride, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	// Gradient += [1, In]^T * OutBlame
+	double* pBiasGrad = gradient.data();
+	for(size_t r = 0; r < batchSize; r++)
+	{
+		const double* pOutBl = outBl.data() + r * outStride;
+		for(size_t j = 0; j < outputCount; j++)
+			pBiasGrad[j] += pOutBl[j];
+	}
+	double* pRow = pBiasGrad + outputCount;
+	for(size_t i = 0; i < inputCount; i++)
+	{
+		for(size_t r = 0; r < batchSize; r++)
+		{
+			double act = in[r * inStride + i];
+			const double* pOutBl = outBl.data() + r * outStride;
+			for(size_t j = 0; j < outputCount; j++)
+				pRow[j] += pOutBl[j] * act;
+		}
+		pRow += outputCount;
+	}
+}
+
 size_t GBlockLinear::weightCount() const
 {
 	return (inputCount + 1) * outputCount;
@@ -1584,6 +1798,69 @@ void GBlockConv::updateGradient()
 	GAssert(gradPos == weights.size());
 }
 
+void GBlockConv::forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize)
+{
+	size_t weightsPos = 0;
+	size_t outPos = 0;
+	for(size_t i = 0; i < filterCount; i++)
+	{
+		double bias = weights[weightsPos++];
+		tensorFilter.setData(*(GVec*)&weights, weightsPos, filterSize);
+		for(size_t r = 0; r < batchSize; r++)
+		{
+			tensorInput.setData((double*)in.data() + r * inStride, inputCount);
+			tensorOutput.setData(out.data() + r * outStride + outPos, outputsPerFilter);
+			tensorOutput.fill(bias);
+			GTensor::convolve(tensorInput, tensorFilter, tensorOutput, false, 1);
+		}
+		weightsPos += filterSize;
+		outPos += outputsPerFilter;
+	}
+	if(weightsPos != weights.size())
+		throw Ex("Expected ", GClasses::to_str(weightsPos), " weights. Got ", GClasses::to_str(weights.size()));
+}
+
+void GBlockConv::backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	size_t weightsPos = 0;
+	size_t outPos = 0;
+	for(size_t i = 0; i < filterCount; i++)
+	{
+		weightsPos++; // skip the bias
+		tensorFilter.setData(*(GVec*)&weights, weightsPos, filterSize);
+		for(size_t r = 0; r < batchSize; r++)
+		{
+			tensorInput.setData(inBl.data() + r * inStride, inputCount);
+			tensorOutput.setData((double*)outBl.data() + r * outStride + outPos, outputsPerFilter);
+			GTensor::convolve(tensorFilter, tensorOutput, tensorInput, true, 1);
+		}
+		weightsPos += filterSize;
+		outPos += outputsPerFilter;
+	}
+	GAssert(weightsPos == weights.size());
+}
+
+void GBlockConv::updateGradientBatch(const GVec& in, size_t inStride, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	size_t gradPos = 0;
+	size_t outPos = 0;
+	for(size_t i = 0; i < filterCount; i++)
+	{
+		size_t biasPos = gradPos++;
+		tensorFilter.setData(gradient, gradPos, filterSize);
+		for(size_t r = 0; r < batchSize; r++)
+		{
+			tensorInput.setData((double*)in.data() + r * inStride, inputCount);
+			tensorOutput.setData((double*)outBl.data() + r * outStride + outPos, outputsPerFilter);
+			gradient[biasPos] += tensorOutput.sum();
+			GTensor::convolve(tensorInput, tensorOutput, tensorFilter, false, 1);
+		}
+		gradPos += filterSize;
+		outPos += outputsPerFilter;
+	}
+	GAssert(gradPos == weights.size());
+}
+
 size_t GBlockConv::weightCount() const
 {
 	return filterCount * (filterSize + 1);
@@ -3386,6 +3663,92 @@ void GLayer::updateGradientNormalized()
 		m_blocks[i]->updateGradientNormalized();
 }
 
+bool GLayer::supportsBatch() const
+{
+	for(size_t i = 0; i < m_blocks.size(); i++)
+	{
+		if(!m_blocks[i]->supportsBatch())
+			return false;
+	}
+	return true;
+}
+
+void GLayer::reserveBatch(size_t batchSize)
+{
+	size_t n = batchSize * outputs();
+	if(outputBatch.size() < n)
+	{
+		outputBatch.resize(n);
+		outBlameBatch.resize(n);
+	}
+}
+
+// Returns the number of elements spanned by batchSize rows of width elements each
+size_t GLayer_batchSpan(size_t batchSize, size_t stride, size_t width)
+{
+	return batchSize > 0 ? (batchSize - 1) * stride + width : 0;
+}
+
+void GLayer::forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize)
+{
+	size_t posOutput = 0;
+	for(size_t i = 0; i < blockCount(); i++)
+	{
+		GBlock& b = *m_blocks[i];
+		GConstVecWrapper vwIn(in.data() + b.inPos(), GLayer_batchSpan(batchSize, inStride, b.inputs()));
+		GVecWrapper vwOut(out.data() + posOutput, GLayer_batchSpan(batchSize, outStride, b.outputs()));
+		b.forwardPropBatch(vwIn, inStride, vwOut, outStride, batchSize);
+		posOutput += b.outputs();
+	}
+}
+
+double GLayer::computeBlameBatch(const GVec& target, const GVec& out, GVec& outBl, size_t outStride, size_t batchSize)
+{
+	double sse = 0.0;
+	size_t pos = 0;
+	for(size_t i = 0; i < blockCount(); i++)
+	{
+		GBlock& b = *m_blocks[i];
+		size_t span = GLayer_batchSpan(batchSize, outStride, b.outputs());
+		GConstVecWrapper vwTarget(target.data() + pos, span);
+		GConstVecWrapper vwOut(out.data() + pos, span);
+		GVecWrapper vwOutBl(outBl.data() + pos, span);
+		sse += b.computeBlameBatch(vwTarget, vwOut, vwOutBl, outStride, batchSize);
+		pos += b.outputs();
+	}
+	return sse;
+}
+
+void GLayer::backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	size_t posOutput = outputs();
+	for(size_t i = blockCount() - 1; i < blockCount(); i--)
+	{
+		GBlock& b = *m_blocks[i];
+		posOutput -= b.outputs();
+		size_t inSpan = GLayer_batchSpan(batchSize, inStride, b.inputs());
+		size_t outSpan = GLayer_batchSpan(batchSize, outStride, b.outputs());
+		GConstVecWrapper vwIn(in.data() + b.inPos(), inSpan);
+		GVecWrapper vwInBl(inBl.data() + b.inPos(), inSpan);
+		GConstVecWrapper vwOut(out.data() + posOutput, outSpan);
+		GConstVecWrapper vwOutBl(outBl.data() + posOutput, outSpan);
+		b.backPropBatch(vwIn, vwInBl, inStride, vwOut, vwOutBl, outStride, batchSize);
+	}
+}
+
+void GLayer::updateGradientBatch(const GVec& in, size_t inStride, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	size_t posOutput = 0;
+	for(size_t i = 0; i < blockCount(); i++)
+	{
+		GBlock& b = *m_blocks[i];
+		GConstVecWrapper vwIn(in.data() + b.inPos(), GLayer_batchSpan(batchSize, inStride, b.inputs()));
+		GConstVecWrapper vwOutBl(outBl.data() + posOutput, GLayer_batchSpan(batchSize, outStride, b.outputs()));
+		b.updateGradientBatch(vwIn, inStride, vwOutBl, outStride, batchSize);
+		posOutput += b.outputs();
+	}
+}
+
 void GLayer::step(double learningRate, double momentum)
 {
 	for(size_t i = 0; i < blockCount(); i++)
@@ -3946,6 +4309,126 @@ void GNeuralNet::updateGradientNormalized()
 		m_layers[i]->updateGradientNormalized();
 }
 
+bool GNeuralNet::supportsBatch() const
+{
+	for(size_t i = 0; i < m_layers.size(); i++)
+	{
+		if(!m_layers[i]->supportsBatch())
+			return false;
+	}
+	return true;
+}
+
+void GNeuralNet::forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize)
+{
+	const GVec* pIn = &in;
+	size_t stride = inStride;
+	for(size_t i = 0; i + 1 < m_layers.size(); i++)
+	{
+		GLayer& lay = *m_layers[i];
+		lay.reserveBatch(batchSize);
+		lay.forwardPropBatch(*pIn, stride, lay.outputBatch, lay.outputs(), batchSize);
+		pIn = &lay.outputBatch;
+		stride = lay.outputs();
+	}
+	outputLayer().forwardPropBatch(*pIn, stride, out, outStride, batchSize);
+}
+
+GVec& GNeuralNet::forwardPropBatch(const GVec& in, size_t batchSize)
+{
+	GAssert(in.size() >= batchSize * inputs());
+	GLayer& outLay = outputLayer();
+	outLay.reserveBatch(batchSize);
+	m_inputBatch.setData(in);
+	forwardPropBatch(in, inputs(), outLay.outputBatch, outLay.outputs(), batchSize);
+	return outLay.outputBatch;
+}
+
+double GNeuralNet::computeBlameBatch(const GVec& target, const GVec& out, GVec& outBl, size_t outStride, size_t batchSize)
+{
+	return outputLayer().computeBlameBatch(target, out, outBl, outStride, batchSize);
+}
+
+double GNeuralNet::computeBlameBatch(const GVec& targets, size_t batchSize)
+{
+	GAssert(targets.size() >= batchSize * outputs());
+	GLayer& outLay = outputLayer();
+	return outLay.computeBlameBatch(targets, outLay.outputBatch, outLay.outBlameBatch, outLay.outputs(), batchSize);
+}
+
+void GNeuralNet::backPropBatchInner(const GVec& in, GVec* pInBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	// Compute the minimum blame magnitude for each row (in the same manner as backProp)
+	GVec minBlameSqMag(batchSize);
+	for(size_t r = 0; r < batchSize; r++)
+	{
+		const GConstVecWrapper row(outBl.data() + r * outStride, outputs());
+		minBlameSqMag[r] = row.squaredMagnitude() * 0.0001;
+	}
+
+	for(size_t i = m_layers.size() - 1; i > 0; i--)
+	{
+		GLayer& layPrev = *m_layers[i - 1];
+		size_t prevStride = layPrev.outputs();
+		layPrev.outBlameBatch.fill(0.0, 0, batchSize * prevStride);
+		GLayer& lay = *m_layers[i];
+		if(i + 1 == m_layers.size())
+			lay.backPropBatch(layPrev.outputBatch, layPrev.outBlameBatch, prevStride, out, outBl, outStride, batchSize);
+		else
+			lay.backPropBatch(layPrev.outputBatch, layPrev.outBlameBatch, prevStride, lay.outputBatch, lay.outBlameBatch, lay.outputs(), batchSize);
+
+		// Ensure that the blame has not diminished into oblivion
+		for(size_t r = 0; r < batchSize; r++)
+		{
+			GVecWrapper row(layPrev.outBlameBatch.data() + r * prevStride, prevStride);
+			double sqMag = row.squaredMagnitude();
+			if(sqMag > 0.0 && sqMag < minBlameSqMag[r])
+				row *= minBlameSqMag[r] / sqMag;
+		}
+	}
+	if(pInBl)
+	{
+		GLayer& lay = *m_layers[0];
+		if(m_layers.size() == 1)
+			lay.backPropBatch(in, *pInBl, inStride, out, outBl, outStride, batchSize);
+		else
+			lay.backPropBatch(in, *pInBl, inStride, lay.outputBatch, lay.outBlameBatch, lay.outputs(), batchSize);
+	}
+}
+
+void GNeuralNet::backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	backPropBatchInner(in, &inBl, inStride, out, outBl, outStride, batchSize);
+}
+
+void GNeuralNet::backpropagateBatch(size_t batchSize, GVec* inputBlame)
+{
+	GLayer& outLay = outputLayer();
+	if(inputBlame)
+		inputBlame->fill(0.0, 0, batchSize * inputs());
+	backPropBatchInner(m_inputBatch, inputBlame, inputs(), outLay.outputBatch, outLay.outBlameBatch, outLay.outputs(), batchSize);
+}
+
+void GNeuralNet::updateGradientBatch(const GVec& in, size_t inStride, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	const GVec* pIn = &in;
+	size_t stride = inStride;
+	for(size_t i = 0; i + 1 < m_layers.size(); i++)
+	{
+		GLayer& lay = *m_layers[i];
+		lay.updateGradientBatch(*pIn, stride, lay.outBlameBatch, lay.outputs(), batchSize);
+		pIn = &lay.outputBatch;
+		stride = lay.outputs();
+	}
+	outputLayer().updateGradientBatch(*pIn, stride, outBl, outStride, batchSize);
+}
+
+void GNeuralNet::updateGradientBatch(size_t batchSize)
+{
+	GLayer& outLay = outputLayer();
+	updateGradientBatch(m_inputBatch, inputs(), outLay.outBlameBatch, outLay.outputs(), batchSize);
+}
+
 void GNeuralNet::step(double learningRate, double momentum)
 {
 	for(size_t i = 0; i < m_layers.size(); i++)
@@ -4305,6 +4788,83 @@ void GNeuralNet_testConvolutional3()
 	GNeuralNet_finiteDifferencingTest(nn, x);
 }
 
+void GNeuralNet_testBatchMatchesIncremental(GNeuralNet& nn)
+{
+	GRand rand(0);
+	GVec weights(nn.weightCount());
+	nn.init(weights);
+	weights.fillNormal(rand, 0.5);
+	size_t batchSize = 7;
+	size_t inDims = nn.inputs();
+	size_t outDims = nn.outputs();
+	GVec feat(batchSize * inDims);
+	feat.fillNormal(rand);
+	GVec lab(batchSize * outDims);
+	lab.fillNormal(rand);
+
+	// Process one sample at a time
+	GVec pred(batchSize * outDims);
+	GVec inBl(batchSize * inDims);
+	GVec inBlRow(inDims);
+	nn.gradient.fill(0.0);
+	double sse = 0.0;
+	for(size_t i = 0; i < batchSize; i++)
+	{
+		GConstVecWrapper f(feat.data() + i * inDims, inDims);
+		GConstVecWrapper l(lab.data() + i * outDims, outDims);
+		pred.copy(i * outDims, nn.forwardProp(f));
+		sse += nn.computeBlame(l);
+		nn.backpropagate(&inBlRow);
+		nn.updateGradient();
+		inBl.copy(i * inDims, inBlRow);
+	}
+	GVec grad;
+	grad.copy(nn.gradient);
+
+	// Process the whole minibatch at once
+	nn.gradient.fill(0.0);
+	GVec& predBatch = nn.forwardPropBatch(feat, batchSize);
+	for(size_t i = 0; i < batchSize * outDims; i++)
+	{
+		if(std::abs(predBatch[i] - pred[i]) > 1e-9)
+			throw Ex("forwardPropBatch disagrees with forwardProp");
+	}
+	double sseBatch = nn.computeBlameBatch(lab, batchSize);
+	if(std::abs(sseBatch - sse) > 1e-9)
+		throw Ex("computeBlameBatch disagrees with computeBlame");
+	GVec inBlBatch(batchSize * inDims);
+	nn.backpropagateBatch(batchSize, &inBlBatch);
+	nn.updateGradientBatch(batchSize);
+	for(size_t i = 0; i < batchSize * inDims; i++)
+	{
+		if(std::abs(inBlBatch[i] - inBl[i]) > 1e-9)
+			throw Ex("backpropagateBatch disagrees with backpropagate");
+	}
+	for(size_t i = 0; i < grad.size(); i++)
+	{
+		if(std::abs(nn.gradient[i] - grad[i]) > 1e-9)
+			throw Ex("updateGradientBatch disagrees with updateGradient");
+	}
+}
+
+void GNeuralNet_testBatch()
+{
+	GNeuralNet nn;
+	nn.add(new GBlockLinear(3, 6));
+	nn.add(new GBlockTanh(3));
+	nn.concat(new GBlockLogistic(3), 3);
+	nn.add(new GBlockLinear(6, 2));
+	if(!nn.supportsBatch())
+		throw Ex("expected batch support");
+	GNeuralNet_testBatchMatchesIncremental(nn);
+
+	GNeuralNet nnConv;
+	nnConv.add(new GBlockConv({4}, {3, 2}, {4, 2}));
+	nnConv.add(new GBlockTanh(8));
+	nnConv.add(new GBlockLinear(8, 3));
+	GNeuralNet_testBatchMatchesIncremental(nnConv);
+}
+
 void GNeuralNet_testSerializationRoundTrip()
 {
 	// Make a random neural net
@@ -4513,6 +5073,7 @@ void GNeuralNet::test()
 	GNeuralNet_testConvolutional1();
 	GNeuralNet_testConvolutional3();
 	GNeuralNet_testSerializationRoundTrip();
+	GNeuralNet_testBatch();
 /*
 	GNeuralNet_test_drop();
 	GNeuralNet_test_insert();
@@ -4901,6 +5462,40 @@ void GBlockResidual::backProp()
 	}
 }
 
+void GBlockResidual::forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize)
+{
+	GNeuralNet::forwardPropBatch(in, inStride, out, outStride, batchSize);
+	for(size_t r = 0; r < batchSize; r++)
+	{
+		const double* pIn = in.data() + r * inStride;
+		double* pOut = out.data() + r * outStride;
+		size_t j = 0;
+		for(size_t i = 0; i < outputs(); i++)
+		{
+			pOut[i] += pIn[j++];
+			if(j >= inputs())
+				j = 0;
+		}
+	}
+}
+
+void GBlockResidual::backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize)
+{
+	GNeuralNet::backPropBatch(in, inBl, inStride, out, outBl, outStride, batchSize);
+	for(size_t r = 0; r < batchSize; r++)
+	{
+		double* pInBl = inBl.data() + r * inStride;
+		const double* pOutBl = outBl.data() + r * outStride;
+		size_t j = 0;
+		for(size_t i = 0; i < outputs(); i++)
+		{
+			pInBl[j++] += pOutBl[i];
+			if(j >= inputs())
+				j = 0;
+		}
+	}
+}
+
 
 
 
@@ -4910,6 +5505,90 @@ void GBlockResidual::backProp()
 
 
 
+GContextLayer::GContextLayer(const GLayer& layer)
+: m_layer(layer), output(layer.outputs())
+{
+	GVecWrapper vwOutput;
+	size_t posOutput = 0;
+	for(size_t i = 0; i < layer.blockCount(); i++)
+	{
+		// Make a copy of the block that shares its weights but has its own output.
+		// (The weights are never written through this copy, and the gradient is only
+		// bound so that nested networks see a buffer of the size they expect.)
+		GBlock& b = (GBlock&)layer.block(i);
+		if(b.weights.size() != b.weightCount())
+			throw Ex("The neural network must be bound to its weights before a context can be made");
+		GBlock* pCopy = b.clone();
+		m_blocks.push_back(pCopy);
+		vwOutput.setData(output, posOutput, b.outputs());
+		pCopy->bind(nullptr, &vwOutput, nullptr, nullptr, &b.weights, &b.gradient);
+		posOutput += b.outputs();
+	}
+}
+
+GContextLayer::~GContextLayer()
+{
+	for(size_t i = 0; i < m_blocks.size(); i++)
+		delete(m_blocks[i]);
+}
+
+void GContextLayer::bindInput(const GVec& in)
+{
+	GAssert(in.size() == m_layer.inputs());
+	for(size_t i = 0; i < m_blocks.size(); i++)
+	{
+		GBlock& b = *m_blocks[i];
+		b.input.setData(in, b.inPos(), b.inputs());
+		if(b.type() == GBlock::block_neuralnet)
+			((GNeuralNet&)b).layer(0).bindInput(b.input);
+	}
+}
+
+void GContextLayer::forwardProp()
+{
+	for(size_t i = 0; i < m_blocks.size(); i++)
+		m_blocks[i]->forwardProp();
+}
+
+
+
+GContextNeuralNet::GContextNeuralNet(const GNeuralNet& nn)
+: m_nn(nn), m_pWeights(nn.weights.data()), m_weightCount(nn.weights.size())
+{
+	if(nn.layerCount() == 0)
+		throw Ex("The neural network has no layers");
+	for(size_t i = 0; i < nn.layerCount(); i++)
+	{
+		m_layers.push_back(new GContextLayer(nn.layer(i)));
+		if(i > 0)
+			m_layers[i]->bindInput(m_layers[i - 1]->output);
+	}
+}
+
+GContextNeuralNet::~GContextNeuralNet()
+{
+	for(size_t i = 0; i < m_layers.size(); i++)
+		delete(m_layers[i]);
+}
+
+bool GContextNeuralNet::isStale() const
+{
+	return m_nn.weights.data() != m_pWeights || m_nn.weights.size() != m_weightCount || m_nn.layerCount() != m_layers.size();
+}
+
+const GVec& GContextNeuralNet::forwardProp(const GVec& in)
+{
+	m_layers[0]->bindInput(in);
+	for(size_t i = 0; i < m_layers.size(); i++)
+		m_layers[i]->forwardProp();
+	return m_layers[m_layers.size() - 1]->output;
+}
+
+
+
+
+
+
 GNeuralNetLearner::GNeuralNetLearner()
 : GIncrementalLearner(), m_pOptimizer(nullptr)
 {}
@@ -4923,9 +5602,18 @@ m_pOptimizer(nullptr)
 */
 GNeuralNetLearner::~GNeuralNetLearner()
 {
+	flushContexts();
 	delete(m_pOptimizer);
 }
 
+void GNeuralNetLearner::flushContexts()
+{
+	GSpinLockHolder lockHolder(&m_contextLock, "GNeuralNetLearner::flushContexts");
+	for(size_t i = 0; i < m_contexts.size(); i++)
+		delete(m_contexts[i]);
+	m_contexts.clear();
+}
+
 GNeuralNetOptimizer& GNeuralNetLearner::optimizer()
 {
 	if(!m_pOptimizer)
@@ -4997,7 +5685,27 @@ void GNeuralNetLearner::predictDistribution(const GVec& in, GPrediction* pOut)
 // virtual
 void GNeuralNetLearner::predict(const GVec& in, GVec& out)
 {
-	out.copy(m_nn.forwardProp(in));
+	// Borrow a context from the pool, or make a new one if they are all in use
+	GContextNeuralNet* pCtx = nullptr;
+	{
+		GSpinLockHolder lockHolder(&m_contextLock, "GNeuralNetLearner::predict");
+		while(!pCtx && m_contexts.size() > 0)
+		{
+			pCtx = m_contexts.back();
+			m_contexts.pop_back();
+			if(pCtx->isStale())
+			{
+				delete(pCtx);
+				pCtx = nullptr;
+			}
+		}
+	}
+	std::unique_ptr<GContextNeuralNet> hCtx(pCtx ? pCtx : new GContextNeuralNet(m_nn));
+	out.copy(hCtx->forwardProp(in));
+
+	// Return it to the pool
+	GSpinLockHolder lockHolder(&m_contextLock, "GNeuralNetLearner::predict");
+	m_contexts.push_back(hCtx.release());
 }
 
 // virtual
@@ -5012,6 +5720,7 @@ void GNeuralNetLearner::beginIncrementalLearningInner(const GRelation& featureRe
 	delete(m_pOptimizer);
 	m_pOptimizer = nullptr;
 	optimizer();
+	flushContexts();
 }
 
 
@@ -5097,9 +5806,67 @@ void GNeuralNet_testMath()
 
 
 // static
+class GNeuralNet_testPredictWorker : public GWorkerThread
+{
+protected:
+	GNeuralNetLearner& m_learner;
+	const GMatrix& m_features;
+	GMatrix& m_predictions;
+
+public:
+	GNeuralNet_testPredictWorker(GMasterThread& master, GNeuralNetLearner& learner, const GMatrix& features, GMatrix& predictions)
+	: GWorkerThread(master), m_learner(learner), m_features(features), m_predictions(predictions)
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_learner.predict(m_features[jobId], m_predictions[jobId]);
+	}
+};
+
+void GNeuralNet_testConcurrentPredict()
+{
+	GRand rand(0);
+	GNeuralNetLearner learner;
+	learner.nn().add(new GBlockLinear(4, 6), new GBlockTanh(6));
+	learner.nn().concat(new GBlockLogistic(2), 4);
+	learner.nn().add(new GBlockLinear(8, 3));
+	GMatrix features(200, 4);
+	features.fillNormal(rand);
+	GMatrix labels(200, 3);
+	labels.fillNormal(rand);
+	learner.beginIncrementalLearning(features.relation(), labels.relation());
+	learner.nn().initWeights(rand);
+
+	// Several threads share one network. They should all get the same answers as serial evaluation.
+	GThreadPool pool(3);
+	for(size_t pass = 0; pass < 2; pass++)
+	{
+		GMatrix predictions(features.rows(), 3);
+		GMasterThread master(&pool);
+		for(size_t i = 0; i < 4; i++)
+			master.addWorker(new GNeuralNet_testPredictWorker(master, learner, features, predictions));
+		master.doJobs(features.rows());
+		for(size_t i = 0; i < features.rows(); i++)
+		{
+			GVec& expected = learner.nn().forwardProp(features[i]);
+			for(size_t j = 0; j < 3; j++)
+			{
+				if(predictions[i][j] != expected[j])
+					throw Ex("concurrent prediction differs from serial prediction");
+			}
+		}
+
+		// The contexts share the weights, so they should see training
+		learner.optimizer().optimizeBatch(features, labels, 0, 20);
+	}
+}
+
 void GNeuralNetLearner::test()
 {
 	GNeuralNet_testMath();
+	GNeuralNet_testConcurrentPredict();
 }
 
 
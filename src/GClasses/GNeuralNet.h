@@ -24,6 +24,7 @@
 #include "GVec.h"
 #include <vector>
 #include "GDom.h"
+#include "GThread.h"
 #include <cmath>
 
 namespace GClasses {
@@ -189,6 +190,28 @@ public:
 	/// update the gradient using only the sign of the input, ignoring the magnitude of the input.
 	virtual void updateGradientNormalized() { updateGradient(); }
 
+	/// Returns true iff this block can process a whole minibatch at once. Blocks that retain
+	/// per-sample state between forwardProp and backProp (such as recurrent blocks) return false.
+	virtual bool supportsBatch() const { return !isRecurrent(); }
+
+	/// Evaluates a minibatch of batchSize rows. Row r of the input begins at in[r * inStride],
+	/// and row r of the output begins at out[r * outStride].
+	/// The default implementation binds this block to each row in turn and calls forwardProp.
+	virtual void forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize);
+
+	/// Computes the blame on a minibatch of output rows. (target, out, and outBl all use outStride.)
+	/// Returns the SSE summed over the whole minibatch.
+	virtual double computeBlameBatch(const GVec& target, const GVec& out, GVec& outBl, size_t outStride, size_t batchSize);
+
+	/// Evaluates a minibatch of outBlame rows, and adds to the corresponding inBlame rows.
+	/// (in and inBl use inStride. out and outBl use outStride.)
+	/// (Assumes forwardPropBatch has already been called.)
+	virtual void backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize);
+
+	/// Accumulates the gradient of the weights over a whole minibatch.
+	/// (Assumes backPropBatch has already been called.)
+	virtual void updateGradientBatch(const GVec& in, size_t inStride, const GVec& outBl, size_t outStride, size_t batchSize);
+
 	/// Adds the gradient scaled by the learning rate to the weights.
 	/// (Assumes updateGradient has already been called.)
 	virtual void step(double learningRate, double momentum);
@@ -260,6 +283,7 @@ public:
 	virtual size_t weightCount() const override { return 0; }
 	virtual void initWeights(GRand& rand) override {}
 	virtual void updateGradient() override {}
+	virtual void updateGradientBatch(const GVec& in, size_t inStride, const GVec& outBl, size_t outStride, size_t batchSize) override {}
 	virtual void step(double learningRate, double momentum) override {}
 };
 
@@ -281,6 +305,12 @@ public:
 	/// (Note that it "adds to" the inBlame because multiple blocks may fork from a common source.)
 	virtual void backProp() override;
 
+	/// Evaluates a minibatch of inputs.
+	virtual void forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize) override;
+
+	/// Evaluates a minibatch of outBlame rows, and adds to inBlame.
+	virtual void backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize) override;
+
 	/// Computes the input that would produce the specified output.
 	/// (May throw an exception if this activation function is not invertible.)
 	void inverseProp(const GVec& output, GVec& input);
@@ -806,6 +836,15 @@ public:
 	/// Updates the gradient using only the sign of the input, ignoring the magnitude of the input.
 	virtual void updateGradientNormalized() override;
 
+	/// Evaluates a minibatch of inputs as a single matrix-matrix product.
+	virtual void forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize) override;
+
+	/// Evaluates a minibatch of outBlame rows, and adds to inBlame.
+	virtual void backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize) override;
+
+	/// Accumulates the gradient over a whole minibatch.
+	virtual void updateGradientBatch(const GVec& in, size_t inStride, const GVec& outBl, size_t outStride, size_t batchSize) override;
+
 	/// Returns the number of double-precision elements necessary to serialize the weights of this block into a vector.
 	virtual size_t weightCount() const override;
 
@@ -935,6 +974,9 @@ public:
 	/// Returns a copy of this block
 	virtual GBlockRunningNormalizer* clone() const override { return new GBlockRunningNormalizer(*this); }
 
+	/// Returns false because step uses the most recent input to update the running statistics.
+	virtual bool supportsBatch() const override { return false; }
+
 	/// Evaluate the input, set the output.
 	virtual void forwardProp() override;
 
@@ -1043,6 +1085,9 @@ public:
 	/// Returns a copy of this block
 	virtual GBlockTemperedLinear* clone() const override { return new GBlockTemperedLinear(*this); }
 
+	/// Returns false because updateGradient adjusts the weights after each sample.
+	virtual bool supportsBatch() const override { return false; }
+
 	/// Evaluate the input, set the output.
 	virtual void forwardProp() override;
 
@@ -1113,6 +1158,15 @@ public:
 	/// (Assumes backProp has already been called.)
 	virtual void updateGradient() override;
 
+	/// Evaluates a minibatch of inputs, one filter at a time.
+	virtual void forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize) override;
+
+	/// Evaluates a minibatch of outBlame rows, and adds to inBlame.
+	virtual void backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize) override;
+
+	/// Accumulates the gradient over a whole minibatch.
+	virtual void updateGradientBatch(const GVec& in, size_t inStride, const GVec& outBl, size_t outStride, size_t batchSize) override;
+
 	/// Returns the number of double-precision elements necessary to serialize the weights of this block into a vector.
 	virtual size_t weightCount() const override;
 
@@ -1604,6 +1658,9 @@ public:
 	/// Returns a copy of this block
 	virtual GBlockPAL* clone() const override { return new GBlockPAL(*this); }
 
+	/// Returns false because the activation probabilities are retained between forwardProp and updateGradient.
+	virtual bool supportsBatch() const override { return false; }
+
 	/// Evaluate the input, set the output.
 	virtual void forwardProp() override;
 
@@ -1949,6 +2006,8 @@ public:
 	GVec outBlameBuf;
 	GVecWrapper output;
 	GVecWrapper outBlame;
+	GVec outputBatch; // Row-major output activations for the most recent minibatch
+	GVec outBlameBatch; // Row-major output blame for the most recent minibatch
 
 	GLayer();
 	GLayer(const GLayer& that, GLayer* pPrevLayer);
@@ -2018,6 +2077,24 @@ public:
 	/// Updates the gradient using only the sign of the inputs.
 	void updateGradientNormalized();
 
+	/// Returns true iff every block in this layer supports minibatch processing.
+	bool supportsBatch() const;
+
+	/// Ensures that outputBatch and outBlameBatch are big enough to hold batchSize rows.
+	void reserveBatch(size_t batchSize);
+
+	/// Evaluates a minibatch. (See GBlock::forwardPropBatch.)
+	void forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize);
+
+	/// Computes the out blame for a minibatch. (See GBlock::computeBlameBatch.)
+	double computeBlameBatch(const GVec& target, const GVec& out, GVec& outBl, size_t outStride, size_t batchSize);
+
+	/// Evaluates a minibatch of outBlame rows, and adds to inBlame. (See GBlock::backPropBatch.)
+	void backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize);
+
+	/// Accumulates the gradient over a minibatch. (See GBlock::updateGradientBatch.)
+	void updateGradientBatch(const GVec& in, size_t inStride, const GVec& outBl, size_t outStride, size_t batchSize);
+
 	/// Adds the gradient scaled by the learningRate to the weights.
 	void step(double learningRate, double momentum);
 
@@ -2216,6 +2293,36 @@ public:
 	/// Update the gradient using only the sign of the input, ignoring the magnitude of the input.
 	virtual void updateGradientNormalized() override;
 
+	/// Evaluates a minibatch of batchSize input rows stored contiguously (row-major) in in.
+	/// Returns a reference to a row-major buffer of the corresponding output rows.
+	GVec& forwardPropBatch(const GVec& in, size_t batchSize);
+
+	/// Computes blame on the outputs of the most recent call to forwardPropBatch.
+	/// targets holds batchSize rows stored contiguously. Returns the SSE summed over the minibatch.
+	double computeBlameBatch(const GVec& targets, size_t batchSize);
+
+	/// Backpropagates the error for the most recent minibatch.
+	/// If inputBlame is non-null, the blame for the input rows will also be computed.
+	void backpropagateBatch(size_t batchSize, GVec* inputBlame = nullptr);
+
+	/// Accumulates the gradient over the most recent minibatch.
+	void updateGradientBatch(size_t batchSize);
+
+	/// Returns true iff every block in this neural network supports minibatch processing.
+	virtual bool supportsBatch() const override;
+
+	/// Evaluates a minibatch, passing it through every layer in turn.
+	virtual void forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize) override;
+
+	/// Computes blame on the outputs of a minibatch.
+	virtual double computeBlameBatch(const GVec& target, const GVec& out, GVec& outBl, size_t outStride, size_t batchSize) override;
+
+	/// Backpropagates a minibatch through every layer in turn.
+	virtual void backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize) override;
+
+	/// Accumulates the gradient over a minibatch.
+	virtual void updateGradientBatch(const GVec& in, size_t inStride, const GVec& outBl, size_t outStride, size_t batchSize) override;
+
 	/// Adds the gradient scaled by the learning rate to the weights
 	virtual void step(double learningRate, double momentum) override;
 
@@ -2245,6 +2352,12 @@ protected:
 
 	/// Like backProp, but it doesn't compute blame on the inputs.
 	void backPropFast();
+
+	/// Internal method to backpropagate a minibatch. If pInBl is nullptr, the first layer is skipped.
+	void backPropBatchInner(const GVec& in, GVec* pInBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize);
+
+	/// The input rows of the most recent call to forwardPropBatch
+	GConstVecWrapper m_inputBatch;
 };
 
 
@@ -2258,21 +2371,89 @@ class GBlockResidual : public GNeuralNet
 	virtual void forwardProp() override;
 
 	virtual void backProp() override;
+
+	virtual void forwardPropBatch(const GVec& in, size_t inStride, GVec& out, size_t outStride, size_t batchSize) override;
+
+	virtual void backPropBatch(const GVec& in, GVec& inBl, size_t inStride, const GVec& out, const GVec& outBl, size_t outStride, size_t batchSize) override;
+};
+
+
+
+
+
+
+
+
+/// Holds the activations that one caller needs in order to evaluate a GLayer.
+/// The blocks in a context are copies of the layer's blocks that are bound to the
+/// layer's weights and to this context's own output buffer, so any number of
+/// contexts can evaluate the same layer at once without copying any weights.
+class GContextLayer
+{
+protected:
+	const GLayer& m_layer;
+	std::vector<GBlock*> m_blocks;
+
+public:
+	GVec output;
+
+	/// Makes a context for evaluating layer, which must already be bound to its weights.
+	GContextLayer(const GLayer& layer);
+	~GContextLayer();
+
+	/// Returns the layer this context evaluates.
+	const GLayer& layer() const { return m_layer; }
+
+	/// Binds to the specified input buffer.
+	void bindInput(const GVec& in);
+
+	/// Evaluates the input, sets the output.
+	void forwardProp();
 };
 
 
+/// Holds the activations that one caller needs in order to evaluate a GNeuralNet.
+/// The weights of the neural network are shared, not copied, so one thread can
+/// use one context to evaluate a network while other threads evaluate the same
+/// network with their own contexts. The weights must not change while a context
+/// is in use, and a context becomes stale if the network is re-bound to a
+/// different weights buffer (which can be checked with isStale).
+/// Recurrent blocks keep their state in the context.
+class GContextNeuralNet
+{
+protected:
+	const GNeuralNet& m_nn;
+	std::vector<GContextLayer*> m_layers;
+	const double* m_pWeights;
+	size_t m_weightCount;
 
+public:
+	/// Makes a context for evaluating nn, which must already be bound to its weights.
+	GContextNeuralNet(const GNeuralNet& nn);
+	~GContextNeuralNet();
 
+	/// Returns the neural network this context evaluates.
+	const GNeuralNet& nn() const { return m_nn; }
 
+	/// Returns true iff the neural network has been re-bound since this context was made.
+	bool isStale() const;
 
+	/// Evaluates the neural network. Returns a reference to the output, which
+	/// is owned by this context.
+	const GVec& forwardProp(const GVec& in);
+};
 
 
 /// A thin wrapper around a GNeuralNet that implements the GIncrementalLearner interface.
+/// Once trained, predict may be called from several threads at once. (Each call
+/// borrows a GContextNeuralNet from a pool, so the weights are never duplicated.)
 class GNeuralNetLearner : public GIncrementalLearner
 {
 protected:
 	GNeuralNet m_nn;
 	GNeuralNetOptimizer* m_pOptimizer;
+	std::vector<GContextNeuralNet*> m_contexts;
+	GSpinLock m_contextLock;
 
 public:
 	GNeuralNetLearner();
@@ -2324,6 +2505,9 @@ protected:
 
 	/// See the comment for GIncrementalLearner::beginIncrementalLearningInner
 	virtual void beginIncrementalLearningInner(const GRelation& featureRel, const GRelation& labelRel) override;
+
+	/// Deletes all of the pooled contexts.
+	void flushContexts();
 };
 
 
@@ -23,6 +23,7 @@
 #include "GRand.h"
 #include <string.h>
 #include <math.h>
+#include <memory>
 
 namespace GClasses {
 
@@ -115,11 +116,31 @@ void GNeuralNetOptimizer::optimizeEpoch()
 #endif // GCUDA
 }
 
+void GNeuralNetOptimizer::computeGradientBatch(const GVec &feat, const GVec &lab, size_t batchSize)
+{
+	size_t featDims = m_model.inputs();
+	size_t labDims = m_model.outputs();
+	for(size_t i = 0; i < batchSize; ++i)
+	{
+		GConstVecWrapper f(feat.data() + i * featDims, featDims);
+		GConstVecWrapper l(lab.data() + i * labDims, labDims);
+		computeGradient(f, l);
+	}
+}
+
 void GNeuralNetOptimizer::optimizeBatch(const GMatrix &features, const GMatrix &labels, size_t start, size_t batchSize)
 {
 	GAssert(features.cols() == m_model.layer(0).inputs() && labels.cols() == m_model.outputLayer().outputs(), "Features/labels size mismatch!");
+	size_t featDims = features.cols();
+	size_t labDims = labels.cols();
+	m_batchFeatures.resize(batchSize * featDims);
+	m_batchLabels.resize(batchSize * labDims);
 	for(size_t i = 0; i < batchSize; ++i)
-		computeGradient(features[start + i], labels[start + i]);
+	{
+		m_batchFeatures.copy(i * featDims, features[start + i]);
+		m_batchLabels.copy(i * labDims, labels[start + i]);
+	}
+	computeGradientBatch(m_batchFeatures, m_batchLabels, batchSize);
 	descendGradient(m_learningRate / batchSize);
 }
 
@@ -131,12 +152,18 @@ void GNeuralNetOptimizer::optimizeBatch(const GMatrix &features, const GMatrix &
 void GNeuralNetOptimizer::optimizeBatch(const GMatrix &features, const GMatrix &labels, GRandomIndexIterator &ii, size_t batchSize)
 {
 	GAssert(features.cols() == m_model.layer(0).inputs() && labels.cols() == m_model.outputLayer().outputs(), "Features/labels size mismatch!");
+	size_t featDims = features.cols();
+	size_t labDims = labels.cols();
+	m_batchFeatures.resize(batchSize * featDims);
+	m_batchLabels.resize(batchSize * labDims);
 	size_t j;
 	for(size_t i = 0; i < batchSize; ++i)
 	{
 		if(!ii.next(j)) ii.reset(), ii.next(j);
-		computeGradient(features[j], labels[j]);
+		m_batchFeatures.copy(i * featDims, features[j]);
+		m_batchLabels.copy(i * labDims, labels[j]);
 	}
+	computeGradientBatch(m_batchFeatures, m_batchLabels, batchSize);
 	descendGradient(m_learningRate / batchSize);
 }
 
@@ -159,6 +186,38 @@ void GNeuralNetOptimizer::optimize(const GMatrix &features, const GMatrix &label
 			optimizeBatch(features, labels, ii, m_batchSize);
 }
 
+void GNeuralNetOptimizer::optimize(GBatchReader &reader, size_t labelDims, size_t chunkRows)
+{
+	GMatrix features, labels;
+	std::unique_ptr<GRandomIndexIterator> hIt;
+	size_t left = 0; // the rows of the current chunk that have not been visited yet
+	reader.rewind();
+	for(size_t i = 0; i < m_epochs; ++i)
+	{
+		for(size_t j = 0; j < m_batchesPerEpoch; ++j)
+		{
+			if(left == 0)
+			{
+				if(reader.next(features, labels, labelDims, chunkRows) == 0)
+				{
+					// The data ran out, so this epoch is over, and the next one starts from the top
+					reader.rewind();
+					if(j > 0)
+						break;
+					if(reader.next(features, labels, labelDims, chunkRows) == 0)
+						throw Ex("Expected at least one row");
+				}
+				hIt.reset(new GRandomIndexIterator(features.rows(), m_rand));
+				hIt->reset();
+				left = features.rows();
+			}
+			size_t n = std::min(m_batchSize, left);
+			optimizeBatch(features, labels, *hIt, n);
+			left -= n;
+		}
+	}
+}
+
 void GNeuralNetOptimizer::optimizeWithValidation(const GMatrix &features, const GMatrix &labels, const GMatrix &validationFeat, const GMatrix &validationLab)
 {
 	size_t batchesPerEpoch = m_batchesPerEpoch;
@@ -242,6 +301,19 @@ void GSGDOptimizer::computeGradient(const GVec& feat, const GVec& lab)
 	m_model.updateGradient();
 }
 
+void GSGDOptimizer::computeGradientBatch(const GVec& feat, const GVec& lab, size_t batchSize)
+{
+	if(!m_model.supportsBatch())
+	{
+		GNeuralNetOptimizer::computeGradientBatch(feat, lab, batchSize);
+		return;
+	}
+	m_model.forwardPropBatch(feat, batchSize);
+	m_model.computeBlameBatch(lab, batchSize);
+	m_model.backpropagateBatch(batchSize);
+	m_model.updateGradientBatch(batchSize);
+}
+
 void GSGDOptimizer::descendGradient(double learningRate)
 {
 	m_model.step(learningRate, m_momentum);
@@ -360,6 +432,19 @@ void GRMSPropOptimizer::computeGradient(const GVec& feat, const GVec& lab)
 	m_model.updateGradient();
 }
 
+void GRMSPropOptimizer::computeGradientBatch(const GVec& feat, const GVec& lab, size_t batchSize)
+{
+	if(!m_model.supportsBatch())
+	{
+		GNeuralNetOptimizer::computeGradientBatch(feat, lab, batchSize);
+		return;
+	}
+	m_model.forwardPropBatch(feat, batchSize);
+	m_model.computeBlameBatch(lab, batchSize);
+	m_model.backpropagateBatch(batchSize);
+	m_model.updateGradientBatch(batchSize);
+}
+
 void GRMSPropOptimizer::descendGradient(double learningRate)
 {
 	for(size_t i = 0; i < m_meanSquare.size(); ++i)
@@ -56,6 +56,7 @@ protected:
 	double m_minImprovement;
 	double m_learningRate;
 	GRandomIndexIterator* m_pII;
+	GVec m_batchFeatures, m_batchLabels;
 
 public:
 	GNeuralNetOptimizer(GNeuralNet& model, GRand& rand, const GMatrix* pTrainingFeatures = nullptr, const GMatrix* pTrainingLabels = nullptr);
@@ -67,6 +68,11 @@ public:
 	/// Evaluate feat and lab, and update the model's gradient.
 	virtual void computeGradient(const GVec &feat, const GVec &lab) = 0;
 
+	/// Evaluate a minibatch of batchSize rows, with the features and labels each stored
+	/// contiguously (row-major) in a single vector, and update the model's gradient.
+	/// The default implementation calls computeGradient for each row.
+	virtual void computeGradientBatch(const GVec &feat, const GVec &lab, size_t batchSize);
+
 	/// Step the model's parameters in the direction of the calculated gradient scaled by learningRate.
 	virtual void descendGradient(double learningRate) = 0;
 
@@ -96,6 +102,14 @@ public:
 	// convenience training methods
 	
 	void optimize(const GMatrix &features, const GMatrix &labels);
+
+	/// Trains on data that is streamed from reader, so it never has to fit in memory.
+	/// Each epoch is batchesPerEpoch() mini-batches, or the rest of the pass over the
+	/// data if that ends first. The next epoch continues where the last one stopped, and
+	/// the reader is rewound whenever the data runs out. (So by default, each epoch is one
+	/// full pass.) Rows are read chunkRows at a time, and the mini-batches are drawn in
+	/// a random order within each chunk. The last labelDims columns are the labels.
+	void optimize(GBatchReader &reader, size_t labelDims, size_t chunkRows = 10000);
 	void optimizeWithValidation(const GMatrix &features, const GMatrix &labels, const GMatrix &validationFeat, const GMatrix &validationLab);
 	void optimizeWithValidation(const GMatrix &features, const GMatrix &labels, double validationPortion = 0.35);
 	
@@ -139,6 +153,9 @@ public:
 	
 	/// Evaluate feat and lab, and update the model's gradient.
 	virtual void computeGradient(const GVec &feat, const GVec &lab) override;
+
+	/// Evaluate a minibatch with the model's batched forward and backward propagation.
+	virtual void computeGradientBatch(const GVec &feat, const GVec &lab, size_t batchSize) override;
 	
 	/// Step the model's parameters in the direction of the calculated gradient scaled by learningRate.
 	virtual void descendGradient(double learningRate) override;
@@ -207,6 +224,9 @@ public:
 	
 	/// Evaluate feat and lab, and update the model's gradient.
 	virtual void computeGradient(const GVec &feat, const GVec &lab) override;
+
+	/// Evaluate a minibatch with the model's batched forward and backward propagation.
+	virtual void computeGradientBatch(const GVec &feat, const GVec &lab, size_t batchSize) override;
 	
 	/// Step the model's parameters in the direction of the calculated gradient scaled by learningRate.
 	virtual void descendGradient(double learningRate) override;
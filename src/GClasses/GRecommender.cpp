@@ -36,8 +36,13 @@
 #include "GApp.h"
 #include "GLearner.h"
 #include "GLearnerLib.h"
+#include "GThread.h"
 #include "usage.h"
 #include <memory>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <errno.h>
 
 using std::map;
 using std::multimap;
@@ -65,6 +70,249 @@ void GCollaborativeFilter_dims(GMatrix& data, size_t* pOutUsers, size_t* pOutIte
 		throw Ex("col 1 (item) indexes out of range");
 }
 
+GRatings::GRatings()
+: m_userCount(0), m_itemCount(0)
+{
+}
+
+GRatings::GRatings(const GMatrix& data)
+: m_userCount(0), m_itemCount(0)
+{
+	if(data.cols() != 3)
+		throw Ex("Expected 3 cols");
+	reserve(data.rows());
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		const GVec& vec = data[i];
+		if(vec[0] < 0)
+			throw Ex("col 0 (user) indexes out of range");
+		if(vec[1] < 0)
+			throw Ex("col 1 (item) indexes out of range");
+		add((size_t)vec[0], (size_t)vec[1], vec[2]);
+	}
+}
+
+GRatings::~GRatings()
+{
+}
+
+void GRatings::reserve(size_t n)
+{
+	m_users.reserve(n);
+	m_items.reserve(n);
+	m_ratings.reserve(n);
+}
+
+void GRatings::add(size_t user, size_t item, double rating)
+{
+	if(user >= 0xffffffff || item >= 0xffffffff)
+		throw Ex("User and item ids must fit in 32 bits");
+	if(m_ratings.size() >= 0xffffffff)
+		throw Ex("Too many ratings");
+	m_users.push_back((uint32_t)user);
+	m_items.push_back((uint32_t)item);
+	m_ratings.push_back((float)rating);
+	m_userCount = std::max(m_userCount, user + 1);
+	m_itemCount = std::max(m_itemCount, item + 1);
+	m_userStarts.clear();
+	m_itemStarts.clear();
+}
+
+void GRatings::clear()
+{
+	m_users.clear();
+	m_items.clear();
+	m_ratings.clear();
+	m_userCount = 0;
+	m_itemCount = 0;
+	m_byUser.clear();
+	m_userStarts.clear();
+	m_byItem.clear();
+	m_itemStarts.clear();
+}
+
+void GRatings_countingSort(const std::vector<uint32_t>& keys, size_t keyCount, std::vector<uint32_t>& order, std::vector<size_t>& starts)
+{
+	starts.assign(keyCount + 1, 0);
+	for(size_t i = 0; i < keys.size(); i++)
+		starts[keys[i] + 1]++;
+	for(size_t i = 0; i < keyCount; i++)
+		starts[i + 1] += starts[i];
+	order.resize(keys.size());
+	std::vector<size_t> pos(starts.begin(), starts.end() - 1);
+	for(size_t i = 0; i < keys.size(); i++)
+		order[pos[keys[i]]++] = (uint32_t)i;
+}
+
+void GRatings::buildIndexes()
+{
+	GRatings_countingSort(m_users, m_userCount, m_byUser, m_userStarts);
+	GRatings_countingSort(m_items, m_itemCount, m_byItem, m_itemStarts);
+}
+
+const uint32_t* GRatings::userRatings(size_t user, size_t* pOutCount) const
+{
+	if(!hasIndexes())
+		throw Ex("buildIndexes must be called first");
+	if(user >= m_userCount)
+	{
+		*pOutCount = 0;
+		return NULL;
+	}
+	*pOutCount = m_userStarts[user + 1] - m_userStarts[user];
+	return m_byUser.data() + m_userStarts[user];
+}
+
+const uint32_t* GRatings::itemRatings(size_t item, size_t* pOutCount) const
+{
+	if(!hasIndexes())
+		throw Ex("buildIndexes must be called first");
+	if(item >= m_itemCount)
+	{
+		*pOutCount = 0;
+		return NULL;
+	}
+	*pOutCount = m_itemStarts[item + 1] - m_itemStarts[item];
+	return m_byItem.data() + m_itemStarts[item];
+}
+
+GMatrix* GRatings::toMatrix() const
+{
+	GMatrix* pData = new GMatrix(size(), 3);
+	for(size_t i = 0; i < size(); i++)
+	{
+		GVec& vec = pData->row(i);
+		vec[0] = (double)m_users[i];
+		vec[1] = (double)m_items[i];
+		vec[2] = (double)m_ratings[i];
+	}
+	return pData;
+}
+
+const char* GRatings_skipSeparators(const char* sz)
+{
+	while(*sz == ' ' || *sz == '\t' || *sz == ',' || *sz == '\r')
+		sz++;
+	return sz;
+}
+
+void GRatings::loadText(std::istream& stream)
+{
+	std::string line;
+	size_t lineNum = 0;
+	while(std::getline(stream, line))
+	{
+		lineNum++;
+		const char* sz = GRatings_skipSeparators(line.c_str());
+		if(*sz == '\0' || *sz == '%' || *sz == '#')
+			continue;
+		char* pEnd;
+		unsigned long long user = strtoull(sz, &pEnd, 10);
+		if(pEnd == sz)
+			throw Ex("Expected a user id on line ", to_str(lineNum));
+		sz = GRatings_skipSeparators(pEnd);
+		unsigned long long item = strtoull(sz, &pEnd, 10);
+		if(pEnd == sz)
+			throw Ex("Expected an item id on line ", to_str(lineNum));
+		sz = GRatings_skipSeparators(pEnd);
+		double rating = strtod(sz, &pEnd);
+		if(pEnd == sz)
+			throw Ex("Expected a rating on line ", to_str(lineNum));
+		add((size_t)user, (size_t)item, rating);
+	}
+}
+
+void GRatings::loadText(const char* szFilename)
+{
+	std::ifstream s;
+	s.open(szFilename, std::ios::binary);
+	if(!s)
+		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
+	loadText(s);
+}
+
+// static
+void GRatings::test()
+{
+	// Parse some text
+	std::istringstream ss("% user item rating\n2 0 4.5\n0,1,3\n\n1\t1\t-2\n2 3 1\n0 3 0.25\n");
+	GRatings r;
+	r.loadText(ss);
+	if(r.size() != 5 || r.userCount() != 3 || r.itemCount() != 4)
+		throw Ex("wrong size");
+	if(r.user(1) != 0 || r.item(1) != 1 || r.rating(1) != 3.0 || r.rating(2) != -2.0 || r.rating(4) != 0.25)
+		throw Ex("parse error");
+
+	// Check the indexes
+	r.buildIndexes();
+	size_t n;
+	const uint32_t* pPos = r.userRatings(0, &n);
+	if(n != 2 || pPos[0] != 1 || pPos[1] != 4)
+		throw Ex("wrong user index");
+	pPos = r.userRatings(2, &n);
+	if(n != 2 || pPos[0] != 0 || pPos[1] != 3)
+		throw Ex("wrong user index");
+	pPos = r.itemRatings(3, &n);
+	if(n != 2 || pPos[0] != 3 || pPos[1] != 4)
+		throw Ex("wrong item index");
+	r.itemRatings(2, &n);
+	if(n != 0)
+		throw Ex("expected no ratings");
+
+	// Round-trip through a matrix
+	std::unique_ptr<GMatrix> hM(r.toMatrix());
+	GRatings r2(*hM);
+	for(size_t i = 0; i < r.size(); i++)
+	{
+		if(r2.user(i) != r.user(i) || r2.item(i) != r.item(i) || r2.rating(i) != r.rating(i))
+			throw Ex("round-trip failed");
+	}
+	if(r2.hasIndexes())
+		throw Ex("indexes should not be built yet");
+
+	// Training from ratings should match training from the equivalent matrix
+	GBaselineRecommender b1, b2;
+	b1.train(*hM);
+	b2.trainRatings(r);
+	for(size_t i = 0; i < r.itemCount(); i++)
+	{
+		if(std::abs(b1.predict(0, i) - b2.predict(0, i)) > 1e-9)
+			throw Ex("baseline mismatch");
+	}
+
+	// Matrix factorization should recover ratings made from known user and item biases,
+	// whether it trains from a matrix (at double precision) or from GRatings (at float precision)
+	GMatrix additive(0, 3);
+	GRatings additiveRatings;
+	for(size_t user = 0; user < 10; user++)
+	{
+		for(size_t item = 0; item < 10; item++)
+		{
+			GVec& row = additive.newRow();
+			row[0] = (double)user;
+			row[1] = (double)item;
+			row[2] = 1.0 + 0.1 * user + 0.2 * item;
+			additiveRatings.add(user, item, row[2]);
+		}
+	}
+	GMatrixFactorization m1(2);
+	GMatrixFactorization m2(2);
+	m1.train(additive);
+	m2.trainRatings(additiveRatings);
+	double worst1 = 0.0;
+	double worst2 = 0.0;
+	for(size_t i = 0; i < additive.rows(); i++)
+	{
+		const GVec& row = additive[i];
+		worst1 = std::max(worst1, std::abs(m1.predict((size_t)row[0], (size_t)row[1]) - row[2]));
+		worst2 = std::max(worst2, std::abs(m2.predict((size_t)row[0], (size_t)row[1]) - row[2]));
+	}
+	if(worst1 > 0.05 || worst2 > 0.05)
+		throw Ex("matrix factorization did not fit the ratings. Worst errors: ", to_str(worst1), ", ", to_str(worst2));
+}
+
+// -----------------------------------------------------------------------------
+
 GCollaborativeFilter::GCollaborativeFilter()
 : m_rand(0)
 {
@@ -168,6 +416,223 @@ double GCollaborativeFilter::crossValidate(GMatrix& data, size_t folds, double*
 	return ssse / folds;
 }
 
+// virtual
+void GCollaborativeFilter::trainRatings(const GRatings& ratings)
+{
+	std::unique_ptr<GMatrix> hData(ratings.toMatrix());
+	train(*hData);
+}
+
+double GCollaborativeFilter::trainAndTest(const GRatings& dataTrain, const GRatings& dataTest, double* pOutMAE)
+{
+	trainRatings(dataTrain);
+	double sse = 0.0;
+	double se = 0.0;
+	for(size_t j = 0; j < dataTest.size(); j++)
+	{
+		double prediction = predict(dataTest.user(j), dataTest.item(j));
+		if (prediction < -1e100 || prediction > 1e100)
+		{
+			throw Ex("Unreasonable prediction");
+		}
+		double err = dataTest.rating(j) - prediction;
+		se += std::abs(err);
+		sse += (err * err);
+	}
+	if(pOutMAE)
+		*pOutMAE = se / dataTest.size();
+	return sse / dataTest.size();
+}
+
+// virtual
+size_t GCollaborativeFilter::itemCount() const
+{
+	throw Ex("This recommender does not report its number of items, so it cannot make top-N recommendations");
+	return 0;
+}
+
+/// A bounded heap that keeps the n best (score, item) pairs added to it
+class GTopNHeap
+{
+protected:
+	size_t m_n;
+	std::vector<std::pair<double,size_t> > m_heap;
+
+	static bool better(const std::pair<double,size_t>& a, const std::pair<double,size_t>& b)
+	{
+		return a.first > b.first || (a.first == b.first && a.second < b.second);
+	}
+
+public:
+	GTopNHeap(size_t n) : m_n(n)
+	{
+		m_heap.reserve(n);
+	}
+
+	/// Returns true when n pairs are held, so the worst one is a meaningful threshold
+	bool full() const { return m_n > 0 && m_heap.size() >= m_n; }
+
+	/// Returns the worst score in the heap. (Only call this when full.)
+	double worst() const { return m_heap.front().first; }
+
+	void add(double score, size_t item)
+	{
+		std::pair<double,size_t> p(score, item);
+		if(m_heap.size() < m_n)
+		{
+			m_heap.push_back(p);
+			std::push_heap(m_heap.begin(), m_heap.end(), better);
+		}
+		else if(m_n > 0 && better(p, m_heap.front()))
+		{
+			std::pop_heap(m_heap.begin(), m_heap.end(), better);
+			m_heap.back() = p;
+			std::push_heap(m_heap.begin(), m_heap.end(), better);
+		}
+	}
+
+	/// Writes the pairs best-first, and pads the remaining slots
+	void write(size_t* pOutItems, double* pOutScores)
+	{
+		std::sort_heap(m_heap.begin(), m_heap.end(), better);
+		for(size_t i = 0; i < m_n; i++)
+		{
+			if(i < m_heap.size())
+			{
+				pOutItems[i] = m_heap[i].second;
+				pOutScores[i] = m_heap[i].first;
+			}
+			else
+			{
+				pOutItems[i] = INVALID_INDEX;
+				pOutScores[i] = -1e308;
+			}
+		}
+	}
+};
+
+// virtual
+void GCollaborativeFilter::recommendTopNInner(size_t user, size_t n, const unsigned char* pExcluded, size_t* pOutItems, double* pOutScores)
+{
+	GTopNHeap heap(n);
+	size_t items = itemCount();
+	for(size_t i = 0; i < items; i++)
+	{
+		if(!pExcluded[i])
+			heap.add(predict(user, i), i);
+	}
+	heap.write(pOutItems, pOutScores);
+}
+
+void GCollaborativeFilter::recommendTopN(size_t user, size_t n, std::vector<size_t>& outItems, std::vector<double>& outScores, const std::set<size_t>* pExclude)
+{
+	size_t items = itemCount();
+	prepareTopN();
+	std::vector<unsigned char> excluded(items, 0);
+	if(pExclude)
+	{
+		for(std::set<size_t>::const_iterator it = pExclude->begin(); it != pExclude->end() && *it < items; it++)
+			excluded[*it] = 1;
+	}
+	outItems.resize(n);
+	outScores.resize(n);
+	recommendTopNInner(user, n, excluded.data(), outItems.data(), outScores.data());
+	size_t found = 0;
+	while(found < n && outItems[found] != INVALID_INDEX)
+		found++;
+	outItems.resize(found);
+	outScores.resize(found);
+}
+
+void GCollaborativeFilter::recommendTopN(const std::vector<size_t>& users, size_t n, std::vector<size_t>& outItems, std::vector<double>& outScores, const GRatings* pExclude, GThreadPool* pPool)
+{
+	if(pExclude && !pExclude->hasIndexes())
+		throw Ex("buildIndexes must be called on the excluded ratings first");
+	size_t items = itemCount();
+	prepareTopN();
+	outItems.resize(users.size() * n);
+	outScores.resize(users.size() * n);
+
+	// Each chunk of users shares one array of exclusion flags, which is cleared after each user
+	GThreadPool serial(0);
+	GThreadPool& pool = parallelTopN() ? (pPool ? *pPool : GThreadPool::global()) : serial;
+	size_t chunks = std::min(users.size(), 4 * (pool.workers() + 1));
+	pool.parallelFor(0, chunks, [&](size_t c) {
+		std::vector<unsigned char> excluded(items, 0);
+		size_t end = users.size() * (c + 1) / chunks;
+		for(size_t i = users.size() * c / chunks; i < end; i++)
+		{
+			size_t count = 0;
+			const uint32_t* pPos = pExclude ? pExclude->userRatings(users[i], &count) : NULL;
+			for(size_t j = 0; j < count; j++)
+			{
+				size_t item = pExclude->item(pPos[j]);
+				if(item < items)
+					excluded[item] = 1;
+			}
+			recommendTopNInner(users[i], n, excluded.data(), outItems.data() + i * n, outScores.data() + i * n);
+			for(size_t j = 0; j < count; j++)
+			{
+				size_t item = pExclude->item(pPos[j]);
+				if(item < items)
+					excluded[item] = 0;
+			}
+		}
+	});
+}
+
+void GCollaborativeFilter_testTopN(GCollaborativeFilter& rec, const GMatrix& data)
+{
+	GRatings rated(data);
+	rated.buildIndexes();
+	size_t items = rec.itemCount();
+	std::vector<size_t> users;
+	for(size_t i = 0; i < rated.userCount() && i < 40; i++)
+		users.push_back(i);
+	users.push_back(rated.userCount() + 3); // an unknown user
+	size_t n = 7;
+
+	// The batch results should not depend on the number of threads
+	GThreadPool serial(0);
+	GThreadPool pool(3);
+	std::vector<size_t> items1, items2;
+	std::vector<double> scores1, scores2;
+	rec.recommendTopN(users, n, items1, scores1, &rated, &serial);
+	rec.recommendTopN(users, n, items2, scores2, &rated, &pool);
+	if(items1 != items2 || scores1 != scores2)
+		throw Ex("Top-N results depend on the number of threads");
+
+	// Compare with a brute-force ranking, and with the single-user version
+	for(size_t i = 0; i < users.size(); i++)
+	{
+		std::set<size_t> exclude;
+		size_t count;
+		const uint32_t* pPos = rated.userRatings(users[i], &count);
+		for(size_t j = 0; j < count; j++)
+			exclude.insert(rated.item(pPos[j]));
+		std::vector<std::pair<double,size_t> > all;
+		for(size_t j = 0; j < items; j++)
+		{
+			if(exclude.find(j) == exclude.end())
+				all.push_back(std::make_pair(-rec.predict(users[i], j), j));
+		}
+		std::sort(all.begin(), all.end());
+		std::vector<size_t> single;
+		std::vector<double> singleScores;
+		rec.recommendTopN(users[i], n, single, singleScores, &exclude);
+		if(single.size() != std::min(n, all.size()))
+			throw Ex("wrong number of recommendations");
+		for(size_t j = 0; j < n; j++)
+		{
+			size_t expected = j < all.size() ? all[j].second : INVALID_INDEX;
+			if(items1[i * n + j] != expected)
+				throw Ex("Top-N mismatch");
+			if(j < single.size() && (single[j] != expected || singleScores[j] != -all[j].first))
+				throw Ex("Top-N mismatch");
+		}
+	}
+}
+
 double GCollaborativeFilter::trainAndTest(GMatrix& dataTrain, GMatrix& dataTest, double* pOutMAE)
 {
 	train(dataTrain);
@@ -374,6 +839,7 @@ GBaselineRecommender::GBaselineRecommender(const GDomNode* pNode, GLearnerLoader
 : GCollaborativeFilter(pNode, ll)
 {
 	m_ratings.deserialize(pNode->get("ratings"));
+	m_items = m_ratings.size();
 }
 
 // virtual
@@ -392,6 +858,7 @@ void GBaselineRecommender::train(GMatrix& data)
 	m_items = size_t(ceil(r)) + 1;
 	if(data.rows() * 8 < m_items)
 		throw Ex("column 1 (item) indexes out of range");
+	m_topNOrder.clear();
 
 	// Allocate space
 	m_ratings.resize(m_items);
@@ -414,6 +881,30 @@ void GBaselineRecommender::train(GMatrix& data)
 	}
 }
 
+// virtual
+void GBaselineRecommender::trainRatings(const GRatings& ratings)
+{
+	m_items = ratings.itemCount();
+	if(ratings.size() * 8 < m_items)
+		throw Ex("column 1 (item) indexes out of range");
+	m_topNOrder.clear();
+	m_ratings.resize(m_items);
+	m_ratings.fill(0.0);
+	std::vector<size_t> counts(m_items, 0);
+	const uint32_t* pItems = ratings.items();
+	const float* pRatings = ratings.ratings();
+	for(size_t i = 0; i < ratings.size(); i++)
+	{
+		m_ratings[pItems[i]] += pRatings[i];
+		counts[pItems[i]]++;
+	}
+	for(size_t i = 0; i < m_items; i++)
+	{
+		if(counts[i] > 0)
+			m_ratings[i] /= counts[i];
+	}
+}
+
 // virtual
 double GBaselineRecommender::predict(size_t user, size_t item)
 {
@@ -447,11 +938,48 @@ GDomNode* GBaselineRecommender::serialize(GDom* pDoc) const
 	return pNode;
 }
 
+// virtual
+void GBaselineRecommender::prepareTopN()
+{
+	if(m_topNOrder.size() == m_items)
+		return;
+	m_topNOrder.resize(m_items);
+	for(size_t i = 0; i < m_items; i++)
+		m_topNOrder[i] = i;
+	const GVec& r = m_ratings;
+	std::stable_sort(m_topNOrder.begin(), m_topNOrder.end(), [&r](size_t a, size_t b) { return r[a] > r[b]; });
+}
+
+// virtual
+void GBaselineRecommender::recommendTopNInner(size_t user, size_t n, const unsigned char* pExcluded, size_t* pOutItems, double* pOutScores)
+{
+	size_t found = 0;
+	for(size_t i = 0; i < m_items && found < n; i++)
+	{
+		size_t item = m_topNOrder[i];
+		if(pExcluded[item])
+			continue;
+		pOutItems[found] = item;
+		pOutScores[found] = m_ratings[item];
+		found++;
+	}
+	for( ; found < n; found++)
+	{
+		pOutItems[found] = INVALID_INDEX;
+		pOutScores[found] = -1e308;
+	}
+}
+
 // static
 void GBaselineRecommender::test()
 {
 	GBaselineRecommender rec;
 	rec.basicTest(1.16);
+	GRand rnd(0);
+	GMatrix m(0, 3);
+	GCF_basicTest_makeData(m, rnd);
+	rec.train(m);
+	GCollaborativeFilter_testTopN(rec, m);
 }
 
 
@@ -517,6 +1045,12 @@ void GInstanceRecommender::train(GMatrix& data)
 	}
 }
 
+// virtual
+size_t GInstanceRecommender::itemCount() const
+{
+	return m_pData ? m_pData->cols() : 0;
+}
+
 // virtual
 double GInstanceRecommender::predict(size_t user, size_t item)
 {
@@ -910,12 +1444,12 @@ void GDenseClusterRecommender::test()
 
 
 GMatrixFactorization::GMatrixFactorization(size_t intrinsicDims)
-: GCollaborativeFilter(), m_intrinsicDims(intrinsicDims), m_regularizer(0.01), m_pP(NULL), m_pQ(NULL), m_pPMask(NULL), m_pQMask(NULL), m_pPWeights(NULL), m_pQWeights(NULL), m_nonNeg(false), m_minIters(1), m_decayRate(0.97)
+: GCollaborativeFilter(), m_intrinsicDims(intrinsicDims), m_regularizer(0.01), m_pP(NULL), m_pQ(NULL), m_pPMask(NULL), m_pQMask(NULL), m_pPWeights(NULL), m_pQWeights(NULL), m_nonNeg(false), m_minIters(1), m_decayRate(0.97), m_eSchedule(SERIAL), m_blocks(0), m_pPool(NULL), m_topNPruning(true)
 {
 }
 
 GMatrixFactorization::GMatrixFactorization(const GDomNode* pNode, GLearnerLoader& ll)
-: GCollaborativeFilter(pNode, ll)
+: GCollaborativeFilter(pNode, ll), m_eSchedule(SERIAL), m_blocks(0), m_pPool(NULL), m_topNPruning(true)
 {
 	m_regularizer = pNode->getDouble("reg");
 	m_minIters = (size_t)pNode->getInt("mi");
@@ -1089,11 +1623,164 @@ void GMatrixFactorization_absValues(double* pVec, size_t dims)
 	}
 }
 
+/// A rating packed for streaming through memory during training. Ratings from a GMatrix
+/// are packed as doubles, and ratings from a GRatings stay floats.
+template<typename R>
+struct GMatrixFactorization_rating
+{
+	uint32_t user;
+	uint32_t item;
+	R rating;
+};
+
 // virtual
 void GMatrixFactorization::train(GMatrix& data)
 {
 	size_t users, items;
 	GCollaborativeFilter_dims(data, &users, &items);
+	if(users > 0xffffffff || items > 0xffffffff)
+		throw Ex("User and item ids must fit in 32 bits");
+
+	// Pack the ratings at double precision. (GRatings would round them to floats.)
+	std::vector< GMatrixFactorization_rating<double> > work(data.rows());
+	for(size_t i = 0; i < work.size(); i++)
+	{
+		const GVec& row = data[i];
+		work[i].user = (uint32_t)row[0];
+		work[i].item = (uint32_t)row[1];
+		work[i].rating = row[2];
+	}
+	trainPacked(work, users, items);
+}
+
+void GMatrixFactorization::sgdStep(size_t user, size_t item, double rating, double learningRate, GVec& pT)
+{
+	if(m_pPMask && user < m_pPMask->rows())
+		clampP(user);
+	if(m_pQMask && item < m_pQMask->rows())
+		clampQ(item);
+
+	// Compute the error for this rating
+	GVec& p = m_pP->row(user);
+	GVec& q = m_pQ->row(item);
+	double pred = q[0] + p[0];
+	for(size_t i = 1; i <= m_intrinsicDims; i++)
+		pred += p[i] * q[i];
+	double err = rating - pred;
+
+	// Update Q
+	q[0] += learningRate * (err - m_regularizer * (q[0]));
+	for(size_t i = 1; i <= m_intrinsicDims; i++)
+	{
+		pT[i] = q[i];
+		q[i] += learningRate * (err * p[i] - m_regularizer * q[i]);
+		if(m_nonNeg)
+			q[i] = std::max(0.0, q[i]);
+	}
+	if(m_pQMask && item < m_pQMask->rows())
+	{
+		// Update the bias and weights for clamped values
+		GVec& mask = m_pQMask->row(item);
+		GVec& bb = m_pQWeights->row(0);
+		GVec& w = m_pQWeights->row(1);
+		for(size_t i = 0; i < m_intrinsicDims; i++)
+		{
+			if(mask[i] != UNKNOWN_REAL_VALUE)
+			{
+				bb[i] += 0.1 * learningRate * err * p[i + 1];
+				w[i] += 0.1 * learningRate * err * p[i + 1] * mask[i];
+			}
+		}
+	}
+
+	// Update P
+	p[0] += learningRate * (err - m_regularizer * p[0]);
+	for(size_t i = 1; i <= m_intrinsicDims; i++)
+	{
+		p[i] += learningRate * (err * pT[i] - m_regularizer * p[i]);
+		if(m_nonNeg)
+			p[i] = std::max(0.0, p[i]);
+	}
+	if(m_pPMask && user < m_pPMask->rows())
+	{
+		// Update the bias and weights for clamped values
+		GVec& mask = m_pPMask->row(user);
+		GVec& bb = m_pPWeights->row(0);
+		GVec& w = m_pPWeights->row(1);
+		for(size_t i = 0; i < m_intrinsicDims; i++)
+		{
+			if(mask[i] != UNKNOWN_REAL_VALUE)
+			{
+				bb[i] += 0.1 * learningRate * err * pT[i + 1];
+				w[i] += 0.1 * learningRate * err * pT[i + 1] * mask[i];
+			}
+		}
+	}
+}
+
+/// Randomly assigns users and items to blocks, then sorts the ratings by cell (user block * blocks + item block)
+template<typename R>
+void GMatrixFactorization_blockRatings(std::vector< GMatrixFactorization_rating<R> >& work, size_t users, size_t items, size_t blocks, GRand& rand, std::vector<size_t>& cellStarts)
+{
+	std::vector<size_t> userBlock(users);
+	for(size_t i = 0; i < users; i++)
+		userBlock[i] = i % blocks;
+	for(size_t n = users; n > 0; n--)
+		std::swap(userBlock[(size_t)rand.next(n)], userBlock[n - 1]);
+	std::vector<size_t> itemBlock(items);
+	for(size_t i = 0; i < items; i++)
+		itemBlock[i] = i % blocks;
+	for(size_t n = items; n > 0; n--)
+		std::swap(itemBlock[(size_t)rand.next(n)], itemBlock[n - 1]);
+	cellStarts.assign(blocks * blocks + 1, 0);
+	for(size_t i = 0; i < work.size(); i++)
+		cellStarts[userBlock[work[i].user] * blocks + itemBlock[work[i].item] + 1]++;
+	for(size_t i = 0; i < blocks * blocks; i++)
+		cellStarts[i + 1] += cellStarts[i];
+	std::vector<size_t> pos(cellStarts.begin(), cellStarts.end() - 1);
+	std::vector< GMatrixFactorization_rating<R> > sorted(work.size());
+	for(size_t i = 0; i < work.size(); i++)
+		sorted[pos[userBlock[work[i].user] * blocks + itemBlock[work[i].item]]++] = work[i];
+	work.swap(sorted);
+}
+
+// virtual
+void GMatrixFactorization::trainRatings(const GRatings& ratings)
+{
+	std::vector< GMatrixFactorization_rating<float> > work(ratings.size());
+	const uint32_t* pUsers = ratings.users();
+	const uint32_t* pItems = ratings.items();
+	const float* pRatings = ratings.ratings();
+	for(size_t i = 0; i < work.size(); i++)
+	{
+		work[i].user = pUsers[i];
+		work[i].item = pItems[i];
+		work[i].rating = pRatings[i];
+	}
+	trainPacked(work, ratings.userCount(), ratings.itemCount());
+}
+
+template<typename R>
+double GMatrixFactorization::validate(const std::vector< GMatrixFactorization_rating<R> >& work)
+{
+	double sse = 0;
+	for(size_t i = 0; i < work.size(); i++)
+	{
+		GVec& pref = m_pP->row(work[i].user);
+		GVec& weights = m_pQ->row(work[i].item);
+		double pred = weights[0] + pref[0];
+		for(size_t j = 1; j <= m_intrinsicDims; j++)
+			pred += pref[j] * weights[j];
+		double err = work[i].rating - pred;
+		sse += (err * err);
+	}
+	return sse;
+}
+
+template<typename R>
+void GMatrixFactorization::trainPacked(std::vector< GMatrixFactorization_rating<R> >& work, size_t users, size_t items)
+{
+	m_topNItems.clear();
 
 	// Initialize P and Q with small random values
 	delete(m_pP);
@@ -1116,11 +1803,18 @@ void GMatrixFactorization::train(GMatrix& data)
 			GMatrixFactorization_absValues(m_pQ->row(i).data() + 1, m_intrinsicDims);
 	}
 
-	// Make a shallow copy of the data (so we can shuffle it)
-	GMatrix dataCopy(data.relation().clone());
-	GReleaseDataHolder hDataCopy(&dataCopy);
-	for(size_t i = 0; i < data.rows(); i++)
-		dataCopy.takeRow(&data[i]);
+	// Prepare the schedule. Clamped elements share weights across all ratings, so they force serial training.
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	bool serial = m_eSchedule == SERIAL || m_pPMask || m_pQMask;
+	size_t blocks = 0;
+	std::vector<size_t> cellStarts;
+	if(!serial && m_eSchedule == BLOCKED)
+	{
+		blocks = m_blocks > 0 ? m_blocks : pool.workers() + 1;
+		GMatrixFactorization_blockRatings(work, users, items, blocks, m_rand, cellStarts);
+	}
+	std::vector<size_t> strata(blocks);
+	std::vector<uint64_t> cellSeeds(blocks * blocks);
 
 	// Train
 	double prevErr = 1e10;
@@ -1133,82 +1827,60 @@ void GMatrixFactorization::train(GMatrix& data)
 		GMatrix backupQ(*m_pQ);
 		for(size_t iter = 0; iter < m_minIters; iter++)
 		{
-			// Shuffle the ratings
-			dataCopy.shuffle(m_rand);
-
-			// Do an epoch of training
-			for(size_t j = 0; j < dataCopy.rows(); j++)
+			if(blocks > 0)
 			{
-				GVec& vec = dataCopy[j];
-				size_t user = (size_t)vec[0];
-				size_t item = (size_t)vec[1];
-				if(m_pPMask && user < m_pPMask->rows())
-					clampP(user);
-				if(m_pQMask && item < m_pQMask->rows())
-					clampQ(item);
-
-				// Compute the error for this rating
-				GVec& p = m_pP->row(user);
-				GVec& q = m_pQ->row(item);
-				double pred = q[0] + p[0];
-				for(size_t i = 1; i <= m_intrinsicDims; i++)
-					pred += p[i] * q[i];
-				double err = vec[2] - pred;
-
-				// Update Q
-				q[0] += learningRate * (err - m_regularizer * (q[0]));
-				for(size_t i = 1; i <= m_intrinsicDims; i++)
-				{
-					pT[i] = q[i];
-					q[i] += learningRate * (err * p[i] - m_regularizer * q[i]);
-					if(m_nonNeg)
-						q[i] = std::max(0.0, q[i]);
-				}
-				if(m_pQMask && item < m_pQMask->rows())
+				// Visit the strata in a random order. Each cell shuffles its own ratings.
+				for(size_t i = 0; i < blocks; i++)
+					strata[i] = i;
+				for(size_t n = blocks; n > 0; n--)
+					std::swap(strata[(size_t)m_rand.next(n)], strata[n - 1]);
+				for(size_t i = 0; i < cellSeeds.size(); i++)
+					cellSeeds[i] = m_rand.next();
+				for(size_t s = 0; s < blocks; s++)
 				{
-					// Update the bias and weights for clamped values
-					GVec& mask = m_pQMask->row(item);
-					GVec& bb = m_pQWeights->row(0);
-					GVec& w = m_pQWeights->row(1);
-					for(size_t i = 0; i < m_intrinsicDims; i++)
-					{
-						if(mask[i] != UNKNOWN_REAL_VALUE)
-						{
-							bb[i] += 0.1 * learningRate * err * p[i + 1];
-							w[i] += 0.1 * learningRate * err * p[i + 1] * mask[i];
-						}
-					}
+					size_t shift = strata[s];
+					pool.parallelFor(0, blocks, [&](size_t b) {
+						size_t cell = b * blocks + (b + shift) % blocks;
+						GMatrixFactorization_rating<R>* pCell = work.data() + cellStarts[cell];
+						size_t n = cellStarts[cell + 1] - cellStarts[cell];
+						GRand rand(cellSeeds[cell]);
+						for(size_t k = n; k > 0; k--)
+							std::swap(pCell[(size_t)rand.next(k)], pCell[k - 1]);
+						GVec scratch(m_intrinsicDims + 1);
+						for(size_t j = 0; j < n; j++)
+							sgdStep(pCell[j].user, pCell[j].item, pCell[j].rating, learningRate, scratch);
+					});
 				}
+			}
+			else
+			{
+				// Shuffle the ratings
+				for(size_t n = work.size(); n > 0; n--)
+					std::swap(work[(size_t)m_rand.next(n)], work[n - 1]);
 
-				// Update P
-				p[0] += learningRate * (err - m_regularizer * p[0]);
-				for(size_t i = 1; i <= m_intrinsicDims; i++)
+				// Do an epoch of training
+				if(serial)
 				{
-					p[i] += learningRate * (err * pT[i] - m_regularizer * p[i]);
-					if(m_nonNeg)
-						p[i] = std::max(0.0, p[i]);
+					for(size_t j = 0; j < work.size(); j++)
+						sgdStep(work[j].user, work[j].item, work[j].rating, learningRate, pT);
 				}
-				if(m_pPMask && user < m_pPMask->rows())
+				else
 				{
-					// Update the bias and weights for clamped values
-					GVec& mask = m_pPMask->row(user);
-					GVec& bb = m_pPWeights->row(0);
-					GVec& w = m_pPWeights->row(1);
-					for(size_t i = 0; i < m_intrinsicDims; i++)
-					{
-						if(mask[i] != UNKNOWN_REAL_VALUE)
-						{
-							bb[i] += 0.1 * learningRate * err * pT[i + 1];
-							w[i] += 0.1 * learningRate * err * pT[i + 1] * mask[i];
-						}
-					}
+					// Hogwild: contiguous chunks of the shuffled ratings train concurrently without locks
+					size_t chunks = 4 * (pool.workers() + 1);
+					pool.parallelFor(0, chunks, [&](size_t c) {
+						GVec scratch(m_intrinsicDims + 1);
+						size_t end = work.size() * (c + 1) / chunks;
+						for(size_t j = work.size() * c / chunks; j < end; j++)
+							sgdStep(work[j].user, work[j].item, work[j].rating, learningRate, scratch);
+					});
 				}
 			}
 			epochs++;
 		}
 
 		// Stopping criteria
-		double rsse = sqrt(validate(data));
+		double rsse = sqrt(validate(work));
 		if(rsse >= 1e-12 && 1.0 - (rsse / prevErr) >= 0.001) {} else // This awkward if/else structure causes "nan" to be handled in a useful way
 		{
 			if(rsse <= prevErr) {} else // This awkward if/else structure causes "nan" to be handled in a useful way
@@ -1238,6 +1910,88 @@ double GMatrixFactorization::predict(size_t user, size_t item)
 	return pred;
 }
 
+// virtual
+void GMatrixFactorization::prepareTopN()
+{
+	if(!m_pQ)
+		throw Ex("Not trained yet");
+	size_t items = m_pQ->rows();
+	if(m_topNItems.size() == items)
+		return;
+
+	// Sort the items by the magnitude of their profiles
+	std::vector<double> norms(items);
+	for(size_t i = 0; i < items; i++)
+	{
+		const GVec& q = m_pQ->row(i);
+		double sq = 0.0;
+		for(size_t j = 1; j <= m_intrinsicDims; j++)
+			sq += q[j] * q[j];
+		norms[i] = sqrt(sq);
+	}
+	std::vector<size_t> order(items);
+	for(size_t i = 0; i < items; i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&norms](size_t a, size_t b) { return norms[a] > norms[b]; });
+
+	// Pack them contiguously in that order
+	size_t stride = m_intrinsicDims + 1;
+	m_topNQ.resize(items * stride);
+	m_topNNorms.resize(items);
+	m_topNMaxBias.resize(items);
+	for(size_t i = 0; i < items; i++)
+	{
+		const GVec& q = m_pQ->row(order[i]);
+		std::copy(q.data(), q.data() + stride, m_topNQ.data() + i * stride);
+		m_topNNorms[i] = norms[order[i]];
+	}
+	for(size_t i = items; i > 0; i--)
+	{
+		double bias = m_topNQ[(i - 1) * stride];
+		m_topNMaxBias[i - 1] = (i < items ? std::max(bias, m_topNMaxBias[i]) : bias);
+	}
+	m_topNItems.swap(order);
+}
+
+// virtual
+void GMatrixFactorization::recommendTopNInner(size_t user, size_t n, const unsigned char* pExcluded, size_t* pOutItems, double* pOutScores)
+{
+	GTopNHeap heap(n);
+	size_t items = m_topNItems.size();
+	if(user >= m_pP->rows())
+	{
+		// predict scores unknown users as 0
+		for(size_t i = 0; i < items; i++)
+		{
+			if(!pExcluded[i])
+				heap.add(0.0, i);
+		}
+		heap.write(pOutItems, pOutScores);
+		return;
+	}
+	const GVec& p = m_pP->row(user);
+	double sq = 0.0;
+	for(size_t j = 1; j <= m_intrinsicDims; j++)
+		sq += p[j] * p[j];
+	double pNorm = sqrt(sq);
+	size_t stride = m_intrinsicDims + 1;
+	const double* pQ = m_topNQ.data();
+	for(size_t i = 0; i < items; i++, pQ += stride)
+	{
+		// No later item can score more than this bound
+		if(m_topNPruning && heap.full() && p[0] + m_topNMaxBias[i] + pNorm * m_topNNorms[i] + 1e-9 < heap.worst())
+			break;
+		size_t item = m_topNItems[i];
+		if(pExcluded[item])
+			continue;
+		double pred = p[0] + pQ[0];
+		for(size_t j = 1; j <= m_intrinsicDims; j++)
+			pred += p[j] * pQ[j];
+		heap.add(pred, item);
+	}
+	heap.write(pOutItems, pOutScores);
+}
+
 void GMatrixFactorization_vectorToRatings(const GVec& vec, size_t dims, GMatrix& data)
 {
 	for(size_t i = 0; i < dims; i++)
@@ -1323,12 +2077,89 @@ void GMatrixFactorization::impute(GVec& vec, size_t dims)
 	}
 }
 
+void GMatrixFactorization_testParallel()
+{
+	GThreadPool serial(0);
+	GThreadPool pool(3);
+	GRand rnd(0);
+	GMatrix m(0, 3);
+	GCF_basicTest_makeData(m, rnd);
+
+	// The blocked schedule gives the same model for any number of threads
+	GMatrixFactorization a(3);
+	GMatrixFactorization b(3);
+	a.setRegularizer(0.002);
+	b.setRegularizer(0.002);
+	a.useBlockedSchedule(4);
+	b.useBlockedSchedule(4);
+	a.setThreadPool(&serial);
+	b.setThreadPool(&pool);
+	a.train(m);
+	b.train(m);
+	for(size_t i = 0; i < m.rows(); i++)
+	{
+		size_t user = (size_t)m[i][0];
+		size_t item = (size_t)m[i][1];
+		if(a.predict(user, item) != b.predict(user, item))
+			throw Ex("The blocked schedule depends on the number of threads");
+	}
+
+	// Both parallel schedules should still fit the data
+	GMatrixFactorization c(3);
+	c.setRegularizer(0.002);
+	c.useBlockedSchedule(4);
+	c.setThreadPool(&pool);
+	c.basicTest(0.17);
+
+	// Hogwild's racing updates make a threaded run depend on timing. Without workers it
+	// is deterministic, so that run must fit the data, and a threaded run must then
+	// reach nearly the same training error from the same seed.
+	GMatrixFactorization d(3);
+	d.setRegularizer(0.002);
+	d.useHogwild();
+	d.setThreadPool(&serial);
+	d.basicTest(0.17);
+	GMatrixFactorization e(3);
+	GMatrixFactorization f(3);
+	e.setRegularizer(0.002);
+	f.setRegularizer(0.002);
+	e.useHogwild();
+	f.useHogwild();
+	e.setThreadPool(&serial);
+	f.setThreadPool(&pool);
+	e.train(m);
+	f.train(m);
+	double serialErr = 0.0;
+	double threadedErr = 0.0;
+	for(size_t i = 0; i < m.rows(); i++)
+	{
+		size_t user = (size_t)m[i][0];
+		size_t item = (size_t)m[i][1];
+		double d1 = m[i][2] - e.predict(user, item);
+		double d2 = m[i][2] - f.predict(user, item);
+		serialErr += d1 * d1;
+		threadedErr += d2 * d2;
+	}
+	if(std::abs(threadedErr - serialErr) > 0.1 * serialErr)
+		throw Ex("Threaded Hogwild strayed from the serial fit");
+}
+
 // static
 void GMatrixFactorization::test()
 {
 	GMatrixFactorization rec(3);
 	rec.setRegularizer(0.002);
 	rec.basicTest(0.17);
+	GMatrixFactorization_testParallel();
+
+	// Top-N recommendations, with and without pruning
+	GRand rnd(0);
+	GMatrix m(0, 3);
+	GCF_basicTest_makeData(m, rnd);
+	rec.train(m);
+	GCollaborativeFilter_testTopN(rec, m);
+	rec.setTopNPruning(false);
+	GCollaborativeFilter_testTopN(rec, m);
 }
 
 
@@ -28,6 +28,9 @@
 #include "GVec.h"
 #include <vector>
 #include <map>
+#include <set>
+#include <cstdint>
+#include <iosfwd>
 
 namespace GClasses {
 
@@ -42,12 +45,106 @@ class GClusterer;
 class GDom;
 class GDomNode;
 class GLearnerLoader;
+class GThreadPool;
+template<typename R> struct GMatrixFactorization_rating;
 
 using std::multimap;
 
 struct ArrayWrapper { size_t values[2]; };
 
 
+/// A compact, column-oriented store of (user, item, rating) triples. Each rating
+/// costs 12 bytes (plus 8 more if the user and item indexes are built), instead of
+/// a heap-allocated three-element GVec per rating as in the GMatrix form.
+class GRatings
+{
+protected:
+	std::vector<uint32_t> m_users;
+	std::vector<uint32_t> m_items;
+	std::vector<float> m_ratings;
+	size_t m_userCount;
+	size_t m_itemCount;
+	std::vector<uint32_t> m_byUser; // rating positions sorted by user
+	std::vector<size_t> m_userStarts;
+	std::vector<uint32_t> m_byItem; // rating positions sorted by item
+	std::vector<size_t> m_itemStarts;
+
+public:
+	/// Makes an empty set of ratings
+	GRatings();
+
+	/// Copies from a 3-column matrix of (user, item, rating) triples, as
+	/// expected by GCollaborativeFilter::train.
+	GRatings(const GMatrix& data);
+
+	~GRatings();
+
+	/// Reserves space for n ratings
+	void reserve(size_t n);
+
+	/// Adds a rating. (This invalidates the user and item indexes.)
+	void add(size_t user, size_t item, double rating);
+
+	/// Removes all ratings
+	void clear();
+
+	/// Returns the number of ratings
+	size_t size() const { return m_ratings.size(); }
+
+	/// Returns one more than the largest user id
+	size_t userCount() const { return m_userCount; }
+
+	/// Returns one more than the largest item id
+	size_t itemCount() const { return m_itemCount; }
+
+	/// Returns the user of the i'th rating
+	size_t user(size_t i) const { return m_users[i]; }
+
+	/// Returns the item of the i'th rating
+	size_t item(size_t i) const { return m_items[i]; }
+
+	/// Returns the value of the i'th rating
+	double rating(size_t i) const { return m_ratings[i]; }
+
+	/// Returns the array of user ids, one per rating
+	const uint32_t* users() const { return m_users.data(); }
+
+	/// Returns the array of item ids, one per rating
+	const uint32_t* items() const { return m_items.data(); }
+
+	/// Returns the array of rating values
+	const float* ratings() const { return m_ratings.data(); }
+
+	/// Builds the user- and item-sorted index arrays with a counting sort.
+	/// Call this after all ratings are added and before calling userRatings or itemRatings.
+	void buildIndexes();
+
+	/// Returns true iff buildIndexes was called after the last rating was added
+	bool hasIndexes() const { return m_userStarts.size() == m_userCount + 1 && m_byUser.size() == size(); }
+
+	/// Returns the positions of all ratings by the specified user, in the order they were added.
+	/// The number of positions is stored in *pOutCount.
+	const uint32_t* userRatings(size_t user, size_t* pOutCount) const;
+
+	/// Returns the positions of all ratings of the specified item, in the order they were added.
+	/// The number of positions is stored in *pOutCount.
+	const uint32_t* itemRatings(size_t item, size_t* pOutCount) const;
+
+	/// Returns the ratings as a 3-column matrix of (user, item, rating) triples
+	GMatrix* toMatrix() const;
+
+	/// Reads ratings from text with one "user item rating" triple per line. Values may be
+	/// separated by whitespace or commas. Blank lines and lines starting with '%' or '#' are skipped.
+	void loadText(std::istream& stream);
+
+	/// Reads ratings from a text file. (See the other overload.)
+	void loadText(const char* szFilename);
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+};
+
+
 /// The base class for collaborative filtering recommender systems.
 class GCollaborativeFilter
 {
@@ -68,6 +165,11 @@ public:
 	/// attributes in pData should be continuous.
 	virtual void train(GMatrix& data) = 0;
 
+	/// Trains this recommender system from a compact set of ratings. The default
+	/// implementation converts to a GMatrix and calls train, so classes that
+	/// can consume GRatings directly should override it.
+	virtual void trainRatings(const GRatings& ratings);
+
 	/// Train from an m-by-n dense matrix, where m is the number of users
 	/// and n is the number of items. All attributes must be
 	/// continuous. Missing values are indicated with UNKNOWN_REAL_VALUE.
@@ -91,6 +193,29 @@ public:
 	/// data.)
 	virtual void impute(GVec& vec, size_t dims) = 0;
 
+	/// Returns the number of items this recommender can score, which is one more than
+	/// the largest item id it was trained with. The default implementation throws an
+	/// exception, so recommenders that support top-N recommendations must override it.
+	virtual size_t itemCount() const;
+
+	/// Finds the n items with the highest predicted ratings for the specified user.
+	/// The items are returned in outItems in order of decreasing score (ties go to the
+	/// lower item id), with their scores in outScores. Items in pExclude (for example,
+	/// those the user already rated) are skipped. Fewer than n items are returned if
+	/// there are not enough candidates. This is not thread-safe, because the first call
+	/// after training builds caches in the recommender (see prepareTopN). To serve many
+	/// users concurrently, use the batch overload instead.
+	void recommendTopN(size_t user, size_t n, std::vector<size_t>& outItems, std::vector<double>& outScores, const std::set<size_t>* pExclude = NULL);
+
+	/// Finds the top n items for each user in users. Row i of the results occupies
+	/// elements i * n through i * n + n - 1 of outItems and outScores. Unused slots
+	/// hold INVALID_INDEX with a score of -1e308. If pExclude is non-NULL, each user's
+	/// own ratings in it are excluded, and its indexes must already be built. Recommenders
+	/// with thread-safe scoring spread the users across pPool (or GThreadPool::global()
+	/// if pPool is NULL). The others score the users serially. Like the single-user
+	/// overload, this must not be called from several threads at once on the same recommender.
+	void recommendTopN(const std::vector<size_t>& users, size_t n, std::vector<size_t>& outItems, std::vector<double>& outScores, const GRatings* pExclude = NULL, GThreadPool* pPool = NULL);
+
 	/// Marshal this object into a DOM that can be converted to a variety
 	/// of formats. (Implementations of this method should use baseDomNode.)
 	virtual GDomNode* serialize(GDom* pDoc) const = 0;
@@ -107,6 +232,9 @@ public:
 	/// Returns the mean-squared difference between actual and target predictions.
 	double trainAndTest(GMatrix& train, GMatrix& test, double* pOutMAE = NULL);
 
+	/// Like the other trainAndTest, except it trains with trainRatings.
+	double trainAndTest(const GRatings& train, const GRatings& test, double* pOutMAE = NULL);
+
 	/// This divides the data into two equal-size parts. It trains on one part, and
 	/// then measures the precision/recall using the other part. It returns a
 	/// three-column data set with recall scores in column 0 and corresponding
@@ -133,6 +261,22 @@ public:
 protected:
 	/// Child classes should use this in their implementation of serialize
 	GDomNode* baseDomNode(GDom* pDoc, const char* szClassName) const;
+
+	/// Called before top-N recommendations are made. Classes may build any structures
+	/// they need to answer recommendTopNInner quickly here. This is called without
+	/// synchronization, from the calling thread, before any scoring tasks start, so it may
+	/// freely modify member caches. (That is why recommendTopN is not thread-safe.)
+	virtual void prepareTopN() {}
+
+	/// Returns true if recommendTopNInner may be called from several threads at once
+	/// (after prepareTopN). The default is false.
+	virtual bool parallelTopN() const { return false; }
+
+	/// Writes the top n items and their scores for user to pOutItems and pOutScores,
+	/// padding unused slots with INVALID_INDEX and -1e308. pExcluded holds one flag per
+	/// item, and items with a non-zero flag are skipped. The default implementation
+	/// calls predict for every item.
+	virtual void recommendTopNInner(size_t user, size_t n, const unsigned char* pExcluded, size_t* pOutItems, double* pOutScores);
 };
 
 
@@ -144,6 +288,7 @@ class GBaselineRecommender : public GCollaborativeFilter
 protected:
 	GVec m_ratings;
 	size_t m_items;
+	std::vector<size_t> m_topNOrder; // items sorted by decreasing rating
 
 public:
 	/// General-purpose constructor
@@ -158,17 +303,33 @@ public:
 	/// See the comment for GCollaborativeFilter::train
 	virtual void train(GMatrix& data);
 
+	/// See the comment for GCollaborativeFilter::trainRatings
+	virtual void trainRatings(const GRatings& ratings);
+
 	/// See the comment for GCollaborativeFilter::predict
 	virtual double predict(size_t user, size_t item);
 
 	/// See the comment for GCollaborativeFilter::impute
 	virtual void impute(GVec& vec, size_t dims);
 
+	/// See the comment for GCollaborativeFilter::itemCount
+	virtual size_t itemCount() const { return m_items; }
+
 	/// See the comment for GCollaborativeFilter::serialize
 	virtual GDomNode* serialize(GDom* pDoc) const;
 
 	/// Performs unit tests. Throws if a failure occurs. Returns if successful.
 	static void test();
+
+protected:
+	/// Sorts the items by rating
+	virtual void prepareTopN();
+
+	/// Returns true
+	virtual bool parallelTopN() const { return true; }
+
+	/// Walks the items in order of decreasing rating
+	virtual void recommendTopNInner(size_t user, size_t n, const unsigned char* pExcluded, size_t* pOutItems, double* pOutScores);
 };
 
 
@@ -208,6 +369,9 @@ public:
 	/// See the comment for GCollaborativeFilter::impute
 	virtual void impute(GVec& vec, size_t dims);
 
+	/// See the comment for GCollaborativeFilter::itemCount
+	virtual size_t itemCount() const;
+
 	/// See the comment for GCollaborativeFilter::serialize
 	virtual GDomNode* serialize(GDom* pDoc) const;
 
@@ -266,6 +430,9 @@ public:
 	/// See the comment for GCollaborativeFilter::impute
 	virtual void impute(GVec& vec, size_t dims);
 
+	/// See the comment for GCollaborativeFilter::itemCount
+	virtual size_t itemCount() const { return m_items; }
+
 	/// See the comment for GCollaborativeFilter::serialize
 	virtual GDomNode* serialize(GDom* pDoc) const;
 
@@ -305,6 +472,9 @@ public:
 	/// See the comment for GCollaborativeFilter::impute
 	virtual void impute(GVec& vec, size_t dims);
 
+	/// See the comment for GCollaborativeFilter::itemCount
+	virtual size_t itemCount() const { return m_items; }
+
 	/// See the comment for GCollaborativeFilter::serialize
 	virtual GDomNode* serialize(GDom* pDoc) const;
 
@@ -330,6 +500,14 @@ public:
 /// decay and a different stopping criteria.
 class GMatrixFactorization : public GCollaborativeFilter
 {
+public:
+	enum Schedule
+	{
+		SERIAL,
+		HOGWILD,
+		BLOCKED,
+	};
+
 protected:
 	size_t m_intrinsicDims;
 	double m_regularizer;
@@ -342,6 +520,14 @@ protected:
 	bool m_nonNeg;
 	size_t m_minIters;
 	double m_decayRate;
+	Schedule m_eSchedule;
+	size_t m_blocks;
+	GThreadPool* m_pPool;
+	bool m_topNPruning;
+	std::vector<double> m_topNQ; // item profiles packed contiguously in order of decreasing magnitude
+	std::vector<size_t> m_topNItems; // the item id of each packed profile
+	std::vector<double> m_topNNorms; // the magnitude of each packed profile, excluding the bias
+	std::vector<double> m_topNMaxBias; // the largest bias among this and all later packed profiles
 
 public:
 	/// General-purpose constructor
@@ -375,15 +561,53 @@ public:
 	/// Constrain all non-bias weights to be non-negative during training.
 	void nonNegative() { m_nonNeg = true; }
 
-	/// See the comment for GCollaborativeFilter::train
+	/// Train each epoch with Hogwild-style lock-free updates. The shuffled ratings are
+	/// split into contiguous chunks that are processed concurrently, and threads update
+	/// the shared user and item profiles without synchronization. Collisions are rare
+	/// when the ratings are sparse, and they only perturb the stochastic gradient.
+	/// Results may vary from run to run when more than one thread is used.
+	void useHogwild() { m_eSchedule = HOGWILD; }
+
+	/// Train each epoch with a stratified, block-partitioned schedule (as in DSGD and
+	/// FPSGD). Users and items are randomly assigned to one of blocks groups, splitting
+	/// the ratings into blocks*blocks cells. Each epoch visits blocks strata in a random
+	/// order. The cells in one stratum share no users and no items, so they train
+	/// concurrently without conflicts, and the result does not depend on the number of
+	/// threads. If blocks is 0, one block per thread in the pool is used.
+	void useBlockedSchedule(size_t blocks = 0) { m_eSchedule = BLOCKED; m_blocks = blocks; }
+
+	/// Go back to training each epoch with a single sequential loop (the default).
+	void useSerialSchedule() { m_eSchedule = SERIAL; }
+
+	/// Specifies the pool used by useHogwild and useBlockedSchedule. If pPool is
+	/// NULL (the default), GThreadPool::global() is used. Clamped profile elements
+	/// share weights across all ratings, so training always runs serially when any
+	/// users or items are clamped.
+	void setThreadPool(GThreadPool* pPool) { m_pPool = pPool; }
+
+	/// See the comment for GCollaborativeFilter::train. The ratings keep their double precision.
+	/// Throws if a user or item id does not fit in 32 bits.
 	virtual void train(GMatrix& data);
 
+	/// See the comment for GCollaborativeFilter::trainRatings
+	virtual void trainRatings(const GRatings& ratings);
+
 	/// See the comment for GCollaborativeFilter::predict
 	virtual double predict(size_t user, size_t item);
 
 	/// See the comment for GCollaborativeFilter::impute
 	virtual void impute(GVec& vec, size_t dims);
 
+	/// See the comment for GCollaborativeFilter::itemCount
+	virtual size_t itemCount() const { return m_pQ ? m_pQ->rows() : 0; }
+
+	/// Specifies whether top-N recommendations use maximum-inner-product pruning
+	/// (the default is true). The item profiles are scanned in order of decreasing
+	/// magnitude, and the scan stops as soon as the Cauchy-Schwarz bound on the
+	/// remaining scores cannot beat the n'th best score found so far. The results
+	/// are exact either way.
+	void setTopNPruning(bool b) { m_topNPruning = b; }
+
 	/// Returns the matrix of user preference vectors
 	GMatrix* getP() { return m_pP; }
 
@@ -412,6 +636,28 @@ protected:
 	/// Returns the sum-squared error for the specified set of ratings
 	double validate(GMatrix& data);
 
+	/// Returns the sum-squared error for the specified set of packed ratings
+	template<typename R>
+	double validate(const std::vector< GMatrixFactorization_rating<R> >& work);
+
+	/// Trains on packed ratings, whose values are of type R. (train packs doubles,
+	/// and trainRatings packs the floats that GRatings stores.)
+	template<typename R>
+	void trainPacked(std::vector< GMatrixFactorization_rating<R> >& work, size_t users, size_t items);
+
+	/// Performs one stochastic gradient descent update with a single rating.
+	/// pT is scratch space with 1 + m_intrinsicDims elements.
+	void sgdStep(size_t user, size_t item, double rating, double learningRate, GVec& pT);
+
+	/// Packs the item profiles for fast top-N scans
+	virtual void prepareTopN();
+
+	/// Returns true
+	virtual bool parallelTopN() const { return true; }
+
+	/// Streams through the packed item profiles, stopping early if pruning is enabled
+	virtual void recommendTopNInner(size_t user, size_t n, const unsigned char* pExcluded, size_t* pOutItems, double* pOutScores);
+
 	void clampP(size_t i);
 	void clampQ(size_t i);
 };
@@ -488,6 +734,9 @@ public:
 	/// See the comment for GCollaborativeFilter::impute
 	virtual void impute(GVec& vec, size_t dims);
 
+	/// See the comment for GCollaborativeFilter::itemCount
+	virtual size_t itemCount() const { return m_items; }
+
 	/// See the comment for GCollaborativeFilter::serialize
 	virtual GDomNode* serialize(GDom* pDoc) const;
 
@@ -593,6 +842,9 @@ public:
 	/// See the comment for GCollaborativeFilter::impute
 	virtual void impute(GVec& vec, size_t dims);
 
+	/// See the comment for GCollaborativeFilter::itemCount
+	virtual size_t itemCount() const { return m_itemCount; }
+
 	/// Delete all of the filters
 	void clear();
 
@@ -633,6 +885,9 @@ public:
 	/// See the comment for GCollaborativeFilter::impute
 	virtual void impute(GVec& vec, size_t dims);
 
+	/// See the comment for GCollaborativeFilter::itemCount
+	virtual size_t itemCount() const { return m_items; }
+
 	/// Delete all of the learners
 	void clear();
 
@@ -670,6 +925,9 @@ public:
 
 	virtual void impute(GVec& vec, size_t dims);
 
+	/// See the comment for GCollaborativeFilter::itemCount
+	virtual size_t itemCount() const { return m_cf->itemCount(); }
+
 	/// See the comment for GCollaborativeFilter::serialize
 	virtual GDomNode* serialize(GDom* pDoc) const { return NULL; };
 
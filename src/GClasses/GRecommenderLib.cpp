@@ -124,7 +124,7 @@ void GRecommenderLib::loadData(GMatrix& data, const char* szFilename)
 	if(_stricmp(szFilename + pd.extStart, ".sparse") == 0)
 	{
 		GDom doc;
-		doc.loadJson(szFilename);
+		doc.load(szFilename);
 		GSparseMatrix sm(doc.root());
 		data.resize(0, 3);
 		for(size_t i = 0; i < sm.rows(); i++)
@@ -145,6 +145,34 @@ void GRecommenderLib::loadData(GMatrix& data, const char* szFilename)
 		throw Ex("Unsupported file format: ", szFilename + pd.extStart);
 }
 
+void GRecommenderLib::loadRatings(GRatings& ratings, const char* szFilename)
+{
+	ratings.clear();
+	PathData pd;
+	GFile::parsePath(szFilename, &pd);
+	if(_stricmp(szFilename + pd.extStart, ".sparse") == 0)
+	{
+		GDom doc;
+		doc.load(szFilename);
+		GSparseMatrix sm(doc.root());
+		for(size_t i = 0; i < sm.rows(); i++)
+		{
+			GSparseMatrix::Iter rowEnd = sm.rowEnd(i);
+			for(GSparseMatrix::Iter it = sm.rowBegin(i); it != rowEnd; it++)
+				ratings.add(i, it->first, it->second);
+		}
+	}
+	else if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
+	{
+		GMatrix data;
+		data.loadArff(szFilename);
+		GRatings tmp(data);
+		std::swap(ratings, tmp);
+	}
+	else
+		ratings.loadText(szFilename);
+}
+
 GSparseMatrix* GRecommenderLib::loadSparseData(const char* szFilename)
 {
 	// Load the dataset by extension
@@ -177,7 +205,7 @@ GSparseMatrix* GRecommenderLib::loadSparseData(const char* szFilename)
 	else if(_stricmp(szFilename + pd.extStart, ".sparse") == 0)
 	{
 		GDom doc;
-		doc.loadJson(szFilename);
+		doc.load(szFilename);
 		return new GSparseMatrix(doc.root());
 	}
 	throw Ex("Unsupported file format: ", szFilename + pd.extStart);
@@ -320,6 +348,10 @@ GMatrixFactorization* GRecommenderLib::InstantiateMatrixFactorization(GArgReader
 			pModel->setDecayRate(args.pop_double());
 		else if(args.if_pop("-nonneg"))
 			pModel->nonNegative();
+		else if(args.if_pop("-hogwild"))
+			pModel->useHogwild();
+		else if(args.if_pop("-blocked"))
+			pModel->useBlockedSchedule(args.pop_uint());
 		else if(args.if_pop("-clampusers"))
 		{
 			GMatrix tmp;
@@ -654,12 +686,12 @@ void GRecommenderLib::transacc(GArgReader& args)
 	// Load the data
 	if(args.size() < 1)
 		throw Ex("No training set specified.");
-	GMatrix train;
-	loadData(train, args.pop_string());
+	GRatings train;
+	loadRatings(train, args.pop_string());
 	if(args.size() < 1)
 		throw Ex("No test set specified.");
-	GMatrix test;
-	loadData(test, args.pop_string());
+	GRatings test;
+	loadRatings(test, args.pop_string());
 
 	// Instantiate the recommender
 	GCollaborativeFilter* pModel = InstantiateAlgorithm(args);
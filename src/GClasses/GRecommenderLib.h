@@ -62,6 +62,8 @@ public:
 	static void loadData(GMatrix& data, const char* szFilename);
 	
 	static GSparseMatrix* loadSparseData(const char* szFilename);
+
+	static void loadRatings(GRatings& ratings, const char* szFilename);
 	
 	static GBaselineRecommender* InstantiateBaselineRecommender(GArgReader& args);
 	
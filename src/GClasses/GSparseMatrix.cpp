@@ -30,6 +30,7 @@
 #include <cmath>
 #include <set>
 #include <memory>
+#include <algorithm>
 
 using std::cout;
 
@@ -128,41 +129,37 @@ void GSparseMatrix::multiply(double scalar)
 
 GMatrix* GSparseMatrix::multiply(GMatrix* pThat, bool transposeThat)
 {
-	// Transpose pThat if necessary
-	GMatrix* pOther = pThat;
-	std::unique_ptr<GMatrix> hOther;
-	if(!transposeThat)
-	{
-		pOther = pThat->transpose();
-		hOther.reset(pOther);
-	}
-	if(pOther->cols() != cols())
+	// The row maps are walked in place, so no second copy of this matrix is made
+	if((transposeThat ? pThat->cols() : pThat->rows()) != m_cols)
 		throw Ex("Matrices have incompatible sizes");
+	if(transposeThat)
+		return project(*pThat);
 
-	// Do the multiplying
-	GMatrix* pResult = new GMatrix(rows(), pOther->rows());
+	// Each result row is a sum of scaled dense rows
+	GMatrix* pResult = new GMatrix(rows(), pThat->cols());
+	pResult->fill(0.0);
 	for(size_t r = 0; r < rows(); r++)
 	{
-		SparseVec& a = row(r);
 		GVec& out = pResult->row(r);
-		for(size_t c = 0; c < pOther->rows(); c++)
-		{
-			GVec& b = pOther->row(c);
-			out[c] = GSparseVec::dotProduct(a, b);
-		}
+		Iter end = rowEnd(r);
+		for(Iter it = rowBegin(r); it != end; it++)
+			out.addScaled(it->second, pThat->row(it->first));
 	}
 	return pResult;
 }
 
 GMatrix* GSparseMatrix::project(GMatrix& components)
 {
+	if(components.cols() != cols())
+		throw Ex("Matrices have incompatible sizes");
+
+	// Each result element is a sparse row dotted with a dense row
 	GMatrix* pOut = new GMatrix(rows(), components.rows());
 	for(size_t i = 0; i < rows(); i++)
 	{
+		GVec& out = pOut->row(i);
 		for(size_t j = 0; j < components.rows(); j++)
-		{
-			(*pOut)[i][j] = GSparseVec::dotProduct(row(i), components.row(j));
-		}
+			out[j] = GSparseVec::dotProduct(row(i), components.row(j));
 	}
 	return pOut;
 }
@@ -904,6 +901,418 @@ void GSparseMatrix::test()
 
 
 
+// ----------------------------------------------------------------------
+
+GCompressedSparseMatrix::GCompressedSparseMatrix(size_t cols, double defaultValue)
+: m_cols(cols), m_defaultValue(defaultValue), m_rowStarts(1, 0)
+{
+	if((uint64_t)cols > (uint64_t)0xffffffff)
+		throw Ex("GCompressedSparseMatrix supports at most 2^32 columns");
+}
+
+GCompressedSparseMatrix::GCompressedSparseMatrix(const GSparseMatrix& that)
+: m_cols(that.cols()), m_defaultValue(((GSparseMatrix&)that).defaultValue())
+{
+	if((uint64_t)m_cols > (uint64_t)0xffffffff)
+		throw Ex("GCompressedSparseMatrix supports at most 2^32 columns");
+	size_t count = 0;
+	for(size_t i = 0; i < that.rows(); i++)
+		count += ((GSparseMatrix&)that).rowNonDefValues(i);
+	m_rowStarts.reserve(that.rows() + 1);
+	m_indexes.reserve(count);
+	m_values.reserve(count);
+	m_rowStarts.push_back(0);
+	for(size_t i = 0; i < that.rows(); i++)
+	{
+		GSparseMatrix::Iter end = that.rowEnd(i);
+		for(GSparseMatrix::Iter it = that.rowBegin(i); it != end; it++)
+		{
+			m_indexes.push_back((uint32_t)it->first);
+			m_values.push_back(it->second);
+		}
+		m_rowStarts.push_back(m_values.size());
+	}
+}
+
+GCompressedSparseMatrix::GCompressedSparseMatrix(const GDomNode* pNode)
+{
+	GCompressedSparseMatrixBuilder builder((size_t)pNode->getInt("cols"), pNode->getDouble("def"));
+	GDomNode* pRows = pNode->get("rows");
+	GDomListIterator it1(pRows);
+	builder.reserve(it1.remaining(), 0);
+	while(it1.current())
+	{
+		for(GDomListIterator it2(it1.current()); it2.current(); it2.advance())
+		{
+			size_t col = (size_t)it2.currentInt();
+			it2.advance();
+			if(!it2.current())
+				throw Ex("Expected an even number of items in the list");
+			builder.add(col, it2.currentDouble());
+		}
+		builder.endRow();
+		it1.advance();
+	}
+	std::unique_ptr<GCompressedSparseMatrix> hBuilt(builder.build());
+	m_cols = hBuilt->m_cols;
+	m_defaultValue = hBuilt->m_defaultValue;
+	m_rowStarts.swap(hBuilt->m_rowStarts);
+	m_indexes.swap(hBuilt->m_indexes);
+	m_values.swap(hBuilt->m_values);
+}
+
+GCompressedSparseMatrix::~GCompressedSparseMatrix()
+{
+}
+
+GDomNode* GCompressedSparseMatrix::serialize(GDom* pDoc) const
+{
+	GDomNode* pNode = pDoc->newObj();
+	pNode->add(pDoc, "def", m_defaultValue);
+	pNode->add(pDoc, "cols", m_cols);
+	GDomNode* pRows = pNode->add(pDoc, "rows", pDoc->newList());
+	for(size_t i = 0; i < rows(); i++)
+	{
+		GDomNode* pElements = pRows->add(pDoc, pDoc->newList());
+		for(size_t j = m_rowStarts[i]; j < m_rowStarts[i + 1]; j++)
+		{
+			pElements->add(pDoc, (size_t)m_indexes[j]);
+			pElements->add(pDoc, m_values[j]);
+		}
+	}
+	return pNode;
+}
+
+double GCompressedSparseMatrix::get(size_t row, size_t col) const
+{
+	GAssert(row < rows() && col < m_cols); // out of range
+	const uint32_t* pBegin = rowIndexes(row);
+	const uint32_t* pEnd = pBegin + rowNonDefValues(row);
+	const uint32_t* pIt = std::lower_bound(pBegin, pEnd, (uint32_t)col);
+	if(pIt == pEnd || *pIt != col)
+		return m_defaultValue;
+	return rowValues(row)[pIt - pBegin];
+}
+
+void GCompressedSparseMatrix::fullRow(GVec& outFullRow, size_t row) const
+{
+	outFullRow.resize(m_cols);
+	outFullRow.fill(m_defaultValue);
+	const uint32_t* pIndexes = rowIndexes(row);
+	const double* pValues = rowValues(row);
+	for(size_t j = 0; j < rowNonDefValues(row); j++)
+		outFullRow[pIndexes[j]] = pValues[j];
+}
+
+GSparseMatrix* GCompressedSparseMatrix::toSparseMatrix() const
+{
+	GSparseMatrix* pOut = new GSparseMatrix(rows(), m_cols, m_defaultValue);
+	for(size_t i = 0; i < rows(); i++)
+	{
+		SparseVec& r = pOut->row(i);
+		for(size_t j = m_rowStarts[i]; j < m_rowStarts[i + 1]; j++)
+			r.insert(r.end(), std::make_pair((size_t)m_indexes[j], m_values[j]));
+	}
+	return pOut;
+}
+
+GMatrix* GCompressedSparseMatrix::toFullMatrix() const
+{
+	GMatrix* pOut = new GMatrix(rows(), m_cols);
+	for(size_t i = 0; i < rows(); i++)
+		fullRow(pOut->row(i), i);
+	return pOut;
+}
+
+GCompressedSparseMatrix* GCompressedSparseMatrix::transpose() const
+{
+	// Count the elements in each column
+	GCompressedSparseMatrix* pOut = new GCompressedSparseMatrix(rows(), m_defaultValue);
+	std::unique_ptr<GCompressedSparseMatrix> hOut(pOut);
+	pOut->m_cols = rows();
+	pOut->m_rowStarts.assign(m_cols + 1, 0);
+	for(size_t j = 0; j < m_indexes.size(); j++)
+		pOut->m_rowStarts[m_indexes[j] + 1]++;
+	for(size_t c = 0; c < m_cols; c++)
+		pOut->m_rowStarts[c + 1] += pOut->m_rowStarts[c];
+
+	// Scatter the elements. Visiting the rows in order keeps each column sorted.
+	pOut->m_indexes.resize(m_indexes.size());
+	pOut->m_values.resize(m_values.size());
+	std::vector<size_t> pos(pOut->m_rowStarts.begin(), pOut->m_rowStarts.end() - 1);
+	for(size_t i = 0; i < rows(); i++)
+	{
+		for(size_t j = m_rowStarts[i]; j < m_rowStarts[i + 1]; j++)
+		{
+			size_t dest = pos[m_indexes[j]]++;
+			pOut->m_indexes[dest] = (uint32_t)i;
+			pOut->m_values[dest] = m_values[j];
+		}
+	}
+	return hOut.release();
+}
+
+void GCompressedSparseMatrix::multiply(const GVec& x, GVec& y) const
+{
+	if(x.size() != m_cols)
+		throw Ex("Expected a vector of size ", to_str(m_cols), ". Got ", to_str(x.size()));
+	y.resize(rows());
+	for(size_t i = 0; i < rows(); i++)
+		y[i] = GSparseVec::dotProduct(rowIndexes(i), rowValues(i), rowNonDefValues(i), x.data());
+}
+
+void GCompressedSparseMatrix::multiplyTranspose(const GVec& x, GVec& y) const
+{
+	if(x.size() != rows())
+		throw Ex("Expected a vector of size ", to_str(rows()), ". Got ", to_str(x.size()));
+	y.resize(m_cols);
+	y.fill(0.0);
+	for(size_t i = 0; i < rows(); i++)
+		GSparseVec::addScaled(x[i], rowIndexes(i), rowValues(i), rowNonDefValues(i), y.data());
+}
+
+GMatrix* GCompressedSparseMatrix::multiply(const GMatrix& that, bool transposeThat) const
+{
+	if((transposeThat ? that.cols() : that.rows()) != m_cols)
+		throw Ex("Matrices have incompatible sizes");
+	if(transposeThat)
+	{
+		// Each result element is a sparse row dotted with a dense row
+		GMatrix* pResult = new GMatrix(rows(), that.rows());
+		for(size_t i = 0; i < rows(); i++)
+		{
+			GVec& out = pResult->row(i);
+			for(size_t c = 0; c < that.rows(); c++)
+				out[c] = GSparseVec::dotProduct(rowIndexes(i), rowValues(i), rowNonDefValues(i), that[c].data());
+		}
+		return pResult;
+	}
+	else
+	{
+		// Each result row is a sum of scaled dense rows
+		GMatrix* pResult = new GMatrix(rows(), that.cols());
+		pResult->fill(0.0);
+		for(size_t i = 0; i < rows(); i++)
+		{
+			GVec& out = pResult->row(i);
+			const uint32_t* pIndexes = rowIndexes(i);
+			const double* pValues = rowValues(i);
+			for(size_t j = 0; j < rowNonDefValues(i); j++)
+				out.addScaled(pValues[j], that[pIndexes[j]]);
+		}
+		return pResult;
+	}
+}
+
+// static
+void GCompressedSparseMatrix::test()
+{
+	GRand rand(0);
+	GSparseMatrix sm(30, 40);
+	for(size_t i = 0; i < 150; i++)
+		sm.set((size_t)rand.next(30), (size_t)rand.next(40), rand.normal());
+	GCompressedSparseMatrix cm(sm);
+	GMatrix* pFull = sm.toFullMatrix();
+	std::unique_ptr<GMatrix> hFull(pFull);
+
+	// Element access
+	size_t count = 0;
+	for(size_t i = 0; i < sm.rows(); i++)
+	{
+		count += sm.rowNonDefValues(i);
+		for(size_t j = 0; j < sm.cols(); j++)
+		{
+			if(cm.get(i, j) != sm.get(i, j))
+				throw Ex("wrong value");
+		}
+	}
+	if(cm.nonDefValues() != count)
+		throw Ex("wrong count");
+
+	// Builder, with elements in arbitrary order
+	GCompressedSparseMatrixBuilder builder(sm.cols());
+	for(size_t i = 0; i < sm.rows(); i++)
+	{
+		for(size_t j = sm.cols(); j > 0; j--)
+			builder.add(j - 1, sm.get(i, j - 1));
+		builder.endRow();
+	}
+	GCompressedSparseMatrix* pBuilt = builder.build();
+	std::unique_ptr<GCompressedSparseMatrix> hBuilt(pBuilt);
+	GMatrix* pBuiltFull = pBuilt->toFullMatrix();
+	std::unique_ptr<GMatrix> hBuiltFull(pBuiltFull);
+	if(pBuilt->nonDefValues() != count || pBuiltFull->sumSquaredDifference(*pFull) != 0.0)
+		throw Ex("builder failed");
+	builder.add(3, 1.0);
+	builder.add(3, 2.0);
+	bool threw = false;
+	try
+	{
+		builder.endRow();
+	}
+	catch(const std::exception&)
+	{
+		threw = true;
+	}
+	if(!threw)
+		throw Ex("Expected duplicate columns to be rejected");
+
+	// Transpose
+	GCompressedSparseMatrix* pT = cm.transpose();
+	std::unique_ptr<GCompressedSparseMatrix> hT(pT);
+	for(size_t i = 0; i < sm.rows(); i++)
+	{
+		for(size_t j = 0; j < sm.cols(); j++)
+		{
+			if(pT->get(j, i) != sm.get(i, j))
+				throw Ex("transpose failed");
+		}
+	}
+
+	// Multiplication
+	GVec x(sm.cols());
+	x.fillNormal(rand);
+	GVec y, yExpected(sm.rows());
+	cm.multiply(x, y);
+	pFull->multiply(x, yExpected);
+	if(y.squaredDistance(yExpected) > 1e-20)
+		throw Ex("multiply failed");
+	GVec z(sm.rows());
+	z.fillNormal(rand);
+	GVec w, wExpected(sm.cols());
+	cm.multiplyTranspose(z, w);
+	pFull->multiply(z, wExpected, true);
+	if(w.squaredDistance(wExpected) > 1e-20)
+		throw Ex("multiplyTranspose failed");
+	GMatrix b(sm.cols(), 7);
+	for(size_t i = 0; i < b.rows(); i++)
+		b[i].fillNormal(rand);
+	GMatrix* pProd = cm.multiply(b, false);
+	std::unique_ptr<GMatrix> hProd(pProd);
+	GMatrix* pProdExpected = GMatrix::multiply(*pFull, b, false, false);
+	std::unique_ptr<GMatrix> hProdExpected(pProdExpected);
+	if(pProd->sumSquaredDifference(*pProdExpected) > 1e-20)
+		throw Ex("matrix multiply failed");
+	GMatrix* bT = b.transpose();
+	std::unique_ptr<GMatrix> hBT(bT);
+	GMatrix* pProd2 = cm.multiply(*bT, true);
+	std::unique_ptr<GMatrix> hProd2(pProd2);
+	if(pProd2->sumSquaredDifference(*pProdExpected) > 1e-20)
+		throw Ex("matrix multiply by transpose failed");
+	GMatrix* pProd3 = sm.multiply(&b, false);
+	std::unique_ptr<GMatrix> hProd3(pProd3);
+	GMatrix* pProd4 = sm.multiply(bT, true);
+	std::unique_ptr<GMatrix> hProd4(pProd4);
+	if(pProd3->sumSquaredDifference(*pProdExpected) > 1e-20 || pProd4->sumSquaredDifference(*pProdExpected) > 1e-20)
+		throw Ex("GSparseMatrix multiply failed");
+
+	// Serialization is compatible with GSparseMatrix
+	GDom doc;
+	doc.setRoot(cm.serialize(&doc));
+	GSparseMatrix sm2(doc.root());
+	GDom doc2;
+	doc2.setRoot(sm.serialize(&doc2));
+	GCompressedSparseMatrix cm2(doc2.root());
+	for(size_t i = 0; i < sm.rows(); i++)
+	{
+		for(size_t j = 0; j < sm.cols(); j++)
+		{
+			if(sm2.get(i, j) != sm.get(i, j) || cm2.get(i, j) != sm.get(i, j))
+				throw Ex("serialization failed");
+		}
+	}
+
+	// Sparse-sparse kernels
+	for(size_t i = 0; i < sm.rows(); i++)
+	{
+		for(size_t k = 0; k < sm.rows(); k++)
+		{
+			double expected = pFull->row(i).dotProduct(pFull->row(k));
+			double actual = GSparseVec::dotProduct(cm.rowIndexes(i), cm.rowValues(i), cm.rowNonDefValues(i), cm.rowIndexes(k), cm.rowValues(k), cm.rowNonDefValues(k));
+			if(std::abs(actual - expected) > 1e-12)
+				throw Ex("sparse dot product failed");
+		}
+	}
+}
+
+// ----------------------------------------------------------------------
+
+GCompressedSparseMatrixBuilder::GCompressedSparseMatrixBuilder(size_t cols, double defaultValue)
+: m_pMatrix(new GCompressedSparseMatrix(cols, defaultValue))
+{
+}
+
+GCompressedSparseMatrixBuilder::~GCompressedSparseMatrixBuilder()
+{
+	delete(m_pMatrix);
+}
+
+void GCompressedSparseMatrixBuilder::reserve(size_t rows, size_t nonDefValues)
+{
+	m_pMatrix->m_rowStarts.reserve(rows + 1);
+	m_pMatrix->m_indexes.reserve(nonDefValues);
+	m_pMatrix->m_values.reserve(nonDefValues);
+}
+
+void GCompressedSparseMatrixBuilder::add(size_t col, double val)
+{
+	if(col >= m_pMatrix->m_cols)
+		throw Ex("Column ", to_str(col), " is out of range. There are ", to_str(m_pMatrix->m_cols), " columns");
+	if(val == m_pMatrix->m_defaultValue)
+		return;
+	m_pMatrix->m_indexes.push_back((uint32_t)col);
+	m_pMatrix->m_values.push_back(val);
+}
+
+void GCompressedSparseMatrixBuilder::endRow()
+{
+	std::vector<uint32_t>& indexes = m_pMatrix->m_indexes;
+	std::vector<double>& values = m_pMatrix->m_values;
+	size_t start = m_pMatrix->m_rowStarts.back();
+	size_t end = values.size();
+
+	// Sort the row, unless it was added in order
+	bool sorted = true;
+	for(size_t j = start + 1; j < end && sorted; j++)
+		sorted = (indexes[j - 1] < indexes[j]);
+	if(!sorted)
+	{
+		m_sortBuf.clear();
+		for(size_t j = start; j < end; j++)
+			m_sortBuf.push_back(std::make_pair(indexes[j], values[j]));
+		std::sort(m_sortBuf.begin(), m_sortBuf.end());
+		for(size_t j = start; j < end; j++)
+		{
+			indexes[j] = m_sortBuf[j - start].first;
+			values[j] = m_sortBuf[j - start].second;
+		}
+		for(size_t j = start + 1; j < end; j++)
+		{
+			if(indexes[j - 1] == indexes[j])
+			{
+				// Discard the row so the builder remains usable
+				uint32_t col = indexes[j];
+				indexes.resize(start);
+				values.resize(start);
+				throw Ex("Column ", to_str(col), " was added more than once to row ", to_str(m_pMatrix->rows()));
+			}
+		}
+	}
+	m_pMatrix->m_rowStarts.push_back(end);
+}
+
+GCompressedSparseMatrix* GCompressedSparseMatrixBuilder::build()
+{
+	if(m_pMatrix->m_values.size() > m_pMatrix->m_rowStarts.back())
+		endRow();
+	GCompressedSparseMatrix* pOut = m_pMatrix;
+	m_pMatrix = new GCompressedSparseMatrix(pOut->m_cols, pOut->m_defaultValue);
+	pOut->m_rowStarts.shrink_to_fit();
+	pOut->m_indexes.shrink_to_fit();
+	pOut->m_values.shrink_to_fit();
+	return pOut;
+}
+
 // static
 size_t GSparseVec::indexOfMaxMagnitude(SparseVec& sparse)
 {
@@ -959,6 +1368,8 @@ double GSparseVec::dotProduct(SparseVec& a, SparseVec& b)
 			d += itA->second * itB->second;
 			itA++;
 			itB++;
+			if(itA == a.end() || itB == b.end())
+				break;
 		}
 	}
 	return d;
@@ -986,6 +1397,95 @@ size_t GSparseVec::count_matching_elements(SparseVec& a, SparseVec& b)
 	return count;
 }
 
+// static
+double GSparseVec::dotProduct(const uint32_t* pIndexes, const double* pValues, size_t n, const double* pDense)
+{
+	// Independent accumulators let the gathers and multiplies overlap
+	double d0 = 0.0;
+	double d1 = 0.0;
+	double d2 = 0.0;
+	double d3 = 0.0;
+	size_t i = 0;
+	for( ; i + 4 <= n; i += 4)
+	{
+		d0 += pValues[i] * pDense[pIndexes[i]];
+		d1 += pValues[i + 1] * pDense[pIndexes[i + 1]];
+		d2 += pValues[i + 2] * pDense[pIndexes[i + 2]];
+		d3 += pValues[i + 3] * pDense[pIndexes[i + 3]];
+	}
+	for( ; i < n; i++)
+		d0 += pValues[i] * pDense[pIndexes[i]];
+	return (d0 + d1) + (d2 + d3);
+}
+
+// static
+double GSparseVec::dotProduct(const uint32_t* pIndexesA, const double* pValuesA, size_t nA, const uint32_t* pIndexesB, const double* pValuesB, size_t nB)
+{
+	if(nA > nB)
+	{
+		std::swap(pIndexesA, pIndexesB);
+		std::swap(pValuesA, pValuesB);
+		std::swap(nA, nB);
+	}
+	double d = 0.0;
+	if(nA * 16 < nB)
+	{
+		// A is much shorter, so binary-search for each of its elements in the rest of B
+		const uint32_t* pB = pIndexesB;
+		const uint32_t* pEndB = pIndexesB + nB;
+		for(size_t i = 0; i < nA && pB != pEndB; i++)
+		{
+			pB = std::lower_bound(pB, pEndB, pIndexesA[i]);
+			if(pB != pEndB && *pB == pIndexesA[i])
+				d += pValuesA[i] * pValuesB[pB - pIndexesB];
+		}
+		return d;
+	}
+	size_t i = 0;
+	size_t j = 0;
+	while(i < nA && j < nB)
+	{
+		if(pIndexesA[i] < pIndexesB[j])
+			i++;
+		else if(pIndexesB[j] < pIndexesA[i])
+			j++;
+		else
+			d += pValuesA[i++] * pValuesB[j++];
+	}
+	return d;
+}
+
+// static
+void GSparseVec::addScaled(double scalar, const uint32_t* pIndexes, const double* pValues, size_t n, double* pDense)
+{
+	size_t i = 0;
+	for( ; i + 4 <= n; i += 4)
+	{
+		pDense[pIndexes[i]] += scalar * pValues[i];
+		pDense[pIndexes[i + 1]] += scalar * pValues[i + 1];
+		pDense[pIndexes[i + 2]] += scalar * pValues[i + 2];
+		pDense[pIndexes[i + 3]] += scalar * pValues[i + 3];
+	}
+	for( ; i < n; i++)
+		pDense[pIndexes[i]] += scalar * pValues[i];
+}
+
+// static
+double GSparseVec::squaredMagnitude(const double* pValues, size_t n)
+{
+	double d0 = 0.0;
+	double d1 = 0.0;
+	size_t i = 0;
+	for( ; i + 2 <= n; i += 2)
+	{
+		d0 += pValues[i] * pValues[i];
+		d1 += pValues[i + 1] * pValues[i + 1];
+	}
+	if(i < n)
+		d0 += pValues[i] * pValues[i];
+	return d0 + d1;
+}
+
 
 
 } // namespace GClasses
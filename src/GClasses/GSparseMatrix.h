@@ -23,6 +23,7 @@
 #include <map>
 #include <vector>
 #include <iostream>
+#include <cstdint>
 
 namespace GClasses {
 
@@ -173,6 +174,125 @@ protected:
 	void singularValueDecompositionHelper(GSparseMatrix** ppU, double** ppDiag, GSparseMatrix** ppV, bool throwIfNoConverge, size_t maxIters);
 };
 
+/// An immutable sparse matrix in compressed-sparse-row form. The sorted column
+/// indexes of all the rows are stored in one contiguous array, and the values in
+/// another, so each stored element costs 12 bytes, and scanning a row does not
+/// chase any pointers. (Each element of a GSparseMatrix is a node in a tree.)
+/// The compressed-sparse-column form of a matrix is the compressed-sparse-row form of
+/// its transpose, which transpose() computes in linear time.
+/// Use GCompressedSparseMatrixBuilder to make one row by row.
+class GCompressedSparseMatrix
+{
+friend class GCompressedSparseMatrixBuilder;
+protected:
+	size_t m_cols;
+	double m_defaultValue;
+	std::vector<size_t> m_rowStarts; // rows() + 1 offsets into m_indexes and m_values
+	std::vector<uint32_t> m_indexes;
+	std::vector<double> m_values;
+
+public:
+	/// Compresses a GSparseMatrix.
+	GCompressedSparseMatrix(const GSparseMatrix& that);
+
+	/// Deserializes a matrix that was serialized by this class or by GSparseMatrix.
+	/// (They use the same format, and no GSparseMatrix is built in between.)
+	GCompressedSparseMatrix(const GDomNode* pNode);
+
+	~GCompressedSparseMatrix();
+
+	static void test();
+
+	/// Serializes this object in the same format as GSparseMatrix::serialize.
+	GDomNode* serialize(GDom* pDoc) const;
+
+	/// Returns the default value--the common value that is not stored.
+	double defaultValue() const { return m_defaultValue; }
+
+	/// Returns the number of rows (as if this matrix were dense)
+	size_t rows() const { return m_rowStarts.size() - 1; }
+
+	/// Returns the number of columns (as if this matrix were dense)
+	size_t cols() const { return m_cols; }
+
+	/// Returns the total number of non-default-valued elements.
+	size_t nonDefValues() const { return m_values.size(); }
+
+	/// Returns the number of non-default-valued elements in the specified row.
+	size_t rowNonDefValues(size_t i) const { return m_rowStarts[i + 1] - m_rowStarts[i]; }
+
+	/// Returns the sorted column indexes of the elements stored in the specified row.
+	const uint32_t* rowIndexes(size_t i) const { return m_indexes.data() + m_rowStarts[i]; }
+
+	/// Returns the values of the elements stored in the specified row, in the same order as rowIndexes.
+	const double* rowValues(size_t i) const { return m_values.data() + m_rowStarts[i]; }
+
+	/// Returns the value at the specified position in the matrix. Returns the
+	/// default value if no element is stored at that position.
+	double get(size_t row, size_t col) const;
+
+	/// Copies a row into a non-sparse vector
+	void fullRow(GVec& outFullRow, size_t row) const;
+
+	/// Converts to a GSparseMatrix
+	GSparseMatrix* toSparseMatrix() const;
+
+	/// Converts to a full matrix
+	GMatrix* toFullMatrix() const;
+
+	/// Returns the transpose of this matrix
+	GCompressedSparseMatrix* transpose() const;
+
+	/// Computes y = Ax, treating elements that are not stored as zeros.
+	void multiply(const GVec& x, GVec& y) const;
+
+	/// Computes y = A^T x, treating elements that are not stored as zeros.
+	void multiplyTranspose(const GVec& x, GVec& y) const;
+
+	/// Multiplies this matrix by that dense matrix, and returns the resulting dense matrix.
+	/// If transposeThat is true, then it multiplies by the transpose of that. Elements
+	/// that are not stored are treated as zeros.
+	GMatrix* multiply(const GMatrix& that, bool transposeThat) const;
+
+protected:
+	/// Makes an empty matrix. Used by GCompressedSparseMatrixBuilder.
+	GCompressedSparseMatrix(size_t cols, double defaultValue);
+};
+
+
+/// Builds a GCompressedSparseMatrix one row at a time.
+class GCompressedSparseMatrixBuilder
+{
+protected:
+	GCompressedSparseMatrix* m_pMatrix;
+	std::vector< std::pair<uint32_t,double> > m_sortBuf;
+
+public:
+	/// cols is the number of columns in the matrix. defaultValue specifies the common
+	/// value that is not stored.
+	GCompressedSparseMatrixBuilder(size_t cols, double defaultValue = 0.0);
+	~GCompressedSparseMatrixBuilder();
+
+	/// Reserves space for the specified number of rows and non-default-valued elements.
+	void reserve(size_t rows, size_t nonDefValues);
+
+	/// Adds an element to the current row. The elements of a row may be added in
+	/// any order, but each column may be added at most once per row. Elements with
+	/// the default value are not stored.
+	void add(size_t col, double val);
+
+	/// Finishes the current row. Subsequent calls to add will go in the next row.
+	void endRow();
+
+	/// Returns the number of rows that have been finished.
+	size_t rows() const { return m_pMatrix->rows(); }
+
+	/// Finishes the current row, if any elements have been added to it, and returns
+	/// the matrix. The caller takes ownership of it. The builder is empty afterward.
+	GCompressedSparseMatrix* build();
+};
+
+
 /// Provides static methods for operating on sparse vectors
 class GSparseVec
 {
@@ -188,6 +308,19 @@ public:
 
 	/// Returns the number of elements that the two vectors both specify in common
 	static size_t count_matching_elements(SparseVec& a, SparseVec& b);
+
+	/// Computes the dot product of a compressed sparse vector (n sorted indexes
+	/// and their values, as in a row of a GCompressedSparseMatrix) with a dense vector.
+	static double dotProduct(const uint32_t* pIndexes, const double* pValues, size_t n, const double* pDense);
+
+	/// Computes the dot product of two compressed sparse vectors
+	static double dotProduct(const uint32_t* pIndexesA, const double* pValuesA, size_t nA, const uint32_t* pIndexesB, const double* pValuesB, size_t nB);
+
+	/// Adds scalar times a compressed sparse vector to a dense vector
+	static void addScaled(double scalar, const uint32_t* pIndexes, const double* pValues, size_t n, double* pDense);
+
+	/// Returns the sum of the squares of the values of a compressed sparse vector
+	static double squaredMagnitude(const double* pValues, size_t n);
 };
 
 
@@ -270,124 +270,222 @@ void GSpinLock::test()
 
 
 
-void GWorkerThread::pump()
+class GThreadPoolQueue
 {
-	while(m_keepAlive)
-	{
-		size_t jobId = m_master.nextJob(this);
-		if(jobId == INVALID_INDEX)
-			GThread::sleep(m_boredom & (~3)); // The "&(~3)" makes it so values < 4 will evaluate to 0, which just yields
-		else
-		{
-#ifdef _DEBUG
-			m_working = true;
-#endif
-			doJob(jobId);
-#ifdef _DEBUG
-			m_working = false;
-#endif
-		}
-	}
-	delete(this);
-}
-
-
-
-
+public:
+	std::mutex m_mutex;
+	std::deque< std::function<void()> > m_tasks;
+};
 
+namespace
+{
+	// The pool and queue index of the calling thread, if it is a pool worker
+	thread_local GThreadPool* t_pPool = nullptr;
+	thread_local size_t t_queue = 0;
+}
 
-GMasterThread::GMasterThread()
-: m_job(0), m_jobCount(0), m_pMasterLock(NULL)
+GThreadPool::GThreadPool(size_t workers)
+: m_pending(0), m_stop(false)
 {
+	for(size_t i = 0; i <= workers; i++)
+		m_queues.push_back(new GThreadPoolQueue());
+	for(size_t i = 0; i < workers; i++)
+		m_threads.push_back(std::thread(&GThreadPool::workerMain, this, i));
 }
 
-GMasterThread::~GMasterThread()
+GThreadPool::~GThreadPool()
 {
-	for(vector<GWorkerThread*>::iterator it = m_workers.begin(); it != m_workers.end(); it++)
 	{
-		if(m_pMasterLock)
-		{
-			GAssert(!(*it)->m_working); // A worker is still working on a job!
-			(*it)->m_keepAlive = false; // The worker thread will delete the worker object
-		}
-		else
-			delete(*it);
+		std::lock_guard<std::mutex> lock(m_parkMutex);
+		m_stop = true;
 	}
-	delete(m_pMasterLock);
+	m_parkCond.notify_all();
+	for(size_t i = 0; i < m_threads.size(); i++)
+		m_threads[i].join();
+	while(runPendingTask())
+	{
+	}
+	for(size_t i = 0; i < m_queues.size(); i++)
+		delete(m_queues[i]);
 }
 
-void GMasterThread::addWorker(GWorkerThread* pWorker)
+// static
+GThreadPool& GThreadPool::global()
 {
-	if(m_pMasterLock)
-		throw Ex("Sorry, workers may not be added after jobs have already been performed.");
-	m_workers.push_back(pWorker);
+	static GThreadPool pool(std::max((unsigned int)1, std::thread::hardware_concurrency()) - 1);
+	return pool;
 }
 
-void GMasterThread::doJobs(size_t jobCount)
+void GThreadPool::enqueue(std::function<void()> task)
 {
-	// Update the number of available jobs
+	// Count the task before it becomes visible, so m_pending never drops below
+	// zero. (Taking the park lock ensures that a worker cannot miss this task
+	// between checking m_pending and going to sleep.)
 	{
-		GSpinLockHolder lockHolder(m_pMasterLock, "GMasterThread::reset");
-		m_job = 0;
-		m_jobCount = jobCount;
-		m_activeWorkers = m_workers.size();
-		for(vector<GWorkerThread*>::iterator it = m_workers.begin(); it != m_workers.end(); it++)
-			(*it)->m_boredom = 0;
+		std::lock_guard<std::mutex> lock(m_parkMutex);
+		m_pending++;
 	}
 
-	// Make sure there are workers to perform the jobs
-	if(!m_pMasterLock)
+	// Workers push to their own queue. Everyone else uses the shared one at the end.
+	size_t q = (t_pPool == this ? t_queue : m_queues.size() - 1);
 	{
-		if(m_workers.size() < 2)
+		std::lock_guard<std::mutex> lock(m_queues[q]->m_mutex);
+		m_queues[q]->m_tasks.push_back(std::move(task));
+	}
+	m_parkCond.notify_one();
+}
+
+bool GThreadPool::takeTask(std::function<void()>& task)
+{
+	size_t queueCount = m_queues.size();
+	size_t self = (t_pPool == this ? t_queue : queueCount - 1);
+
+	// Newest task from our own queue first, since its data is likely still in cache
+	{
+		GThreadPoolQueue& q = *m_queues[self];
+		std::lock_guard<std::mutex> lock(q.m_mutex);
+		if(q.m_tasks.size() > 0)
 		{
-			// Just do the jobs now
-			if(m_workers.size() == 0)
-				throw Ex("There are no worker threads. addWorker must be called at least once before you call doJobs.");
-			GWorkerThread* pWorker = m_workers[0];
-			while(m_job < m_jobCount)
-				pWorker->doJob(m_job++);
-			m_activeWorkers = 0;
+			task = std::move(q.m_tasks.back());
+			q.m_tasks.pop_back();
+			return true;
 		}
-		else
+	}
+
+	// Then steal the oldest task from somebody else
+	for(size_t i = 1; i < queueCount; i++)
+	{
+		GThreadPoolQueue& q = *m_queues[(self + i) % queueCount];
+		std::lock_guard<std::mutex> lock(q.m_mutex);
+		if(q.m_tasks.size() > 0)
 		{
-			// Spawn a thread for each worker
-			m_pMasterLock = new GSpinLock();
-			for(vector<GWorkerThread*>::iterator it = m_workers.begin(); it != m_workers.end(); it++)
-				GThread::spawnThread(spawnWorker, *it);
+			task = std::move(q.m_tasks.front());
+			q.m_tasks.pop_front();
+			return true;
 		}
 	}
+	return false;
+}
 
-	// Sleep until all jobs are done
-	while(m_activeWorkers > 0)
+bool GThreadPool::runPendingTask()
+{
+	if(m_pending.load() == 0)
+		return false;
+	std::function<void()> task;
+	if(!takeTask(task))
+		return false;
+	m_pending--;
+	task();
+	return true;
+}
+
+void GThreadPool::workerMain(size_t index)
+{
+	t_pPool = this;
+	t_queue = index;
+	while(true)
 	{
-		if(m_jobCount > 20)
-			GThread::sleep(0); // todo: maybe sleep a little longer if there are a lot of jobs
+		if(runPendingTask())
+			continue;
+		std::unique_lock<std::mutex> lock(m_parkMutex);
+		m_parkCond.wait(lock, [this]() { return m_stop || m_pending.load() > 0; });
+		if(m_stop && m_pending.load() == 0)
+			break;
 	}
-	GAssert(m_job >= m_jobCount);
 }
 
-size_t GMasterThread::nextJob(GWorkerThread* pWorker)
+// static
+void GThreadPool::test()
 {
-	GSpinLockHolder lockHolder(m_pMasterLock, "GMasterThread::nextJob");
-	if(m_job < m_jobCount)
+	GThreadPool pool(3);
+
+	// parallelFor should visit every index exactly once
+	std::vector<size_t> visits(1000, 0);
+	pool.parallelFor(0, visits.size(), [&visits](size_t i) { visits[i]++; });
+	for(size_t i = 0; i < visits.size(); i++)
 	{
-		pWorker->m_boredom = 0;
-		return m_job++;
+		if(visits[i] != 1)
+			throw Ex("parallelFor missed or repeated an index");
 	}
-	else
+
+	// Nested loops and futures should not deadlock, even when every worker is waiting
+	std::atomic<size_t> sum(0);
+	pool.parallelFor(0, 16, [&pool, &sum](size_t i) {
+		pool.parallelFor(0, 100, [&sum, i](size_t j) { sum += i * j; });
+		std::future<size_t> fut = pool.submit([i]() { return i; });
+		sum += pool.get(fut);
+	});
+	if(sum.load() != 4950 * 120 + 120)
+		throw Ex("wrong sum");
+
+	// Exceptions should propagate to the caller
+	bool caught = false;
+	try
 	{
-		if(pWorker->m_boredom == 0 && m_activeWorkers > 0)
-			m_activeWorkers--;
-		pWorker->m_boredom = std::min((size_t)100, (pWorker->m_boredom + 1) * 3 / 2);
-		return INVALID_INDEX;
+		pool.parallelFor(0, 100, [](size_t i) { if(i == 37) throw Ex("expected"); });
 	}
+	catch(const std::exception&)
+	{
+		caught = true;
+	}
+	if(!caught)
+		throw Ex("exception was lost");
+
+	// A pool with no workers runs everything in the caller
+	GThreadPool serial(0);
+	std::future<int> fut = serial.submit([]() { return 7; });
+	if(serial.get(fut) != 7)
+		throw Ex("wrong result");
 }
 
-// static
-unsigned int GMasterThread::spawnWorker(void* pWorkerObject)
+
+
+GMasterThread::GMasterThread(GThreadPool* pPool)
+: m_pMasterLock(NULL), m_pPool(pPool ? pPool : &GThreadPool::global())
 {
-	((GWorkerThread*)pWorkerObject)->pump();
-	return 0;
+}
+
+GMasterThread::~GMasterThread()
+{
+	for(vector<GWorkerThread*>::iterator it = m_workers.begin(); it != m_workers.end(); it++)
+		delete(*it);
+	delete(m_pMasterLock);
+}
+
+void GMasterThread::addWorker(GWorkerThread* pWorker)
+{
+	m_workers.push_back(pWorker);
+}
+
+void GMasterThread::doJobs(size_t jobCount)
+{
+	if(m_workers.size() == 0)
+		throw Ex("There are no worker threads. addWorker must be called at least once before you call doJobs.");
+	if(m_workers.size() < 2)
+	{
+		// Just do the jobs now
+		GWorkerThread* pWorker = m_workers[0];
+		for(size_t i = 0; i < jobCount; i++)
+			pWorker->doJob(i);
+		return;
+	}
+	if(!m_pMasterLock)
+		m_pMasterLock = new GSpinLock();
+
+	// Each worker pulls jobs from a shared counter until they run out, so a
+	// worker object is only ever used by one thread at a time
+	std::atomic<size_t> nextJob(0);
+	std::vector<GWorkerThread*>& workers = m_workers;
+	m_pPool->parallelFor(0, m_workers.size(), [&workers, &nextJob, jobCount](size_t w) {
+		GWorkerThread* pWorker = workers[w];
+		while(true)
+		{
+			size_t job = nextJob++;
+			if(job >= jobCount)
+				break;
+			pWorker->doJob(job);
+		}
+	});
 }
 
 
@@ -21,6 +21,16 @@
 #define __GTHREAD_H__
 
 #include "GError.h"
+#include <vector>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <exception>
 #ifndef WINDOWS
 #	include <pthread.h>
 #	include <unistd.h>
@@ -132,6 +142,188 @@ public:
 
 
 
+class GThreadPoolQueue;
+
+/// A work-stealing pool of threads.
+///
+/// Each worker thread owns a deque of tasks. A worker pushes and pops tasks
+/// at the back of its own deque, and when that is empty, it steals from the
+/// front of the other deques (including one for tasks submitted by threads
+/// outside the pool). Idle workers park on a condition variable, so they
+/// cost nothing while there is no work, and wake as soon as a task arrives.
+///
+/// Threads that wait on the pool (in parallelFor or get) run pending tasks
+/// while they wait, so parallel loops and futures may be nested freely
+/// without starving the pool.
+class GThreadPool
+{
+protected:
+	std::vector<GThreadPoolQueue*> m_queues; // one per worker, plus one for outside submissions
+	std::vector<std::thread> m_threads;
+	std::mutex m_parkMutex;
+	std::condition_variable m_parkCond;
+	std::atomic<size_t> m_pending;
+	bool m_stop;
+
+public:
+	/// Makes a pool with the specified number of worker threads. (The thread that
+	/// waits for work also helps, so a pool with zero workers simply runs
+	/// everything in the calling thread.)
+	GThreadPool(size_t workers);
+
+	/// Finishes all pending tasks, then joins the worker threads.
+	~GThreadPool();
+
+	/// Returns a process-wide pool with one worker fewer than the number of
+	/// hardware threads. (The calling thread makes up the difference.)
+	static GThreadPool& global();
+
+	/// Returns the number of worker threads in this pool.
+	size_t workers() const { return m_threads.size(); }
+
+	/// Queues a task to be run by some thread in this pool.
+	void enqueue(std::function<void()> task);
+
+	/// Runs one pending task in the calling thread, if there are any.
+	/// Returns true iff a task was run.
+	bool runPendingTask();
+
+	/// Queues a task and returns a future for its result.
+	template<typename F>
+	std::future<typename std::result_of<F()>::type> submit(F f)
+	{
+		typedef typename std::result_of<F()>::type R;
+		std::shared_ptr< std::packaged_task<R()> > pTask(new std::packaged_task<R()>(f));
+		std::future<R> fut = pTask->get_future();
+		enqueue([pTask]() { (*pTask)(); });
+		return fut;
+	}
+
+	/// Waits for a future obtained from submit, running other pending tasks in
+	/// the meantime, and returns its result. (Use this instead of future::get
+	/// inside a task, or the pool may run out of threads to do the work.)
+	template<typename T>
+	T get(std::future<T>& fut)
+	{
+		while(fut.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			if(!runPendingTask())
+				fut.wait(); // The task it waits for is already running somewhere
+		}
+		return fut.get();
+	}
+
+	/// Calls f(i) for every i in [begin, end), spreading the calls across this pool.
+	/// Indexes are claimed in chunks of at least grain, so cheap bodies should use a
+	/// larger grain. Returns when all of the calls are done. If any call throws, one
+	/// of the exceptions is rethrown here after the others are done.
+	template<typename F>
+	void parallelFor(size_t begin, size_t end, F f, size_t grain = 1)
+	{
+		if(end <= begin)
+			return;
+		size_t n = end - begin;
+		size_t chunk = std::max(grain, n / (4 * (workers() + 1)));
+		size_t chunks = (n + chunk - 1) / chunk;
+		if(workers() == 0 || chunks < 2)
+		{
+			for(size_t i = begin; i < end; i++)
+				f(i);
+			return;
+		}
+		std::shared_ptr<GParallelForState> pState(new GParallelForState(begin, end, chunk));
+		size_t helpers = std::min(workers(), chunks - 1);
+		pState->m_helpers = helpers;
+		for(size_t i = 0; i < helpers; i++)
+		{
+			enqueue([pState, f]() {
+				pState->run(f);
+				pState->finishHelper();
+			});
+		}
+		pState->run(f);
+		while(!pState->isDone())
+		{
+			if(!runPendingTask())
+				pState->waitForHelpers(); // All the helpers have already started
+		}
+		if(pState->m_error)
+			std::rethrow_exception(pState->m_error);
+	}
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+protected:
+	/// The main loop of each worker thread
+	void workerMain(size_t index);
+
+	/// Pops a task from the queue that belongs to the calling thread, or steals one.
+	bool takeTask(std::function<void()>& task);
+
+	/// The shared state of one call to parallelFor
+	class GParallelForState
+	{
+	public:
+		std::atomic<size_t> m_next;
+		size_t m_end;
+		size_t m_chunk;
+		size_t m_helpers;
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::exception_ptr m_error;
+
+		GParallelForState(size_t begin, size_t end, size_t chunk)
+		: m_next(begin), m_end(end), m_chunk(chunk), m_helpers(0)
+		{
+		}
+
+		template<typename F>
+		void run(F& f)
+		{
+			while(true)
+			{
+				size_t start = m_next.fetch_add(m_chunk);
+				if(start >= m_end)
+					break;
+				size_t stop = std::min(m_end, start + m_chunk);
+				try
+				{
+					for(size_t i = start; i < stop; i++)
+						f(i);
+				}
+				catch(...)
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					if(!m_error)
+						m_error = std::current_exception();
+					m_next = m_end; // Skip the rest
+				}
+			}
+		}
+
+		void finishHelper()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_helpers--;
+			m_cond.notify_all();
+		}
+
+		bool isDone()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_helpers == 0;
+		}
+
+		void waitForHelpers()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait(lock, [this]() { return m_helpers == 0; });
+		}
+	};
+};
+
+
 class GMasterThread;
 
 /// An abstract class for performing jobs.
@@ -140,27 +332,16 @@ class GMasterThread;
 /// The class you write, that inherits from this one, will typically
 /// have additional constructor parameters that pass in any values or data
 /// necessary to define the jobs.
+/// Each worker object is used by at most one thread at a time, so it may keep
+/// scratch buffers without taking any locks.
 class GWorkerThread
 {
 public:
-	volatile bool m_keepAlive;
-	size_t m_boredom; // don't change this value without taking the master lock
 	GMasterThread& m_master;
-#ifdef _DEBUG
-	volatile bool m_working; // this exists only to support a debug assert
-#endif
 
-	GWorkerThread(GMasterThread& master) : m_keepAlive(true), m_boredom(0), m_master(master) {}
+	GWorkerThread(GMasterThread& master) : m_master(master) {}
 	virtual ~GWorkerThread() {}
 
-	/// This method is called by the master thread. Users should not need to call it. It pulls jobs
-	/// from the master thread (by calling nextJob()) and does them as long as m_keepAlive is true.
-	/// If the master returns INVALID_INDEX for the job id, it goes to sleep for a short time.
-	/// (Each time it receives INVALID_INDEX, it becomes more bored, and so sleeps a little longer,
-	/// up to a maximum nap of 100ms. When it receives a job, the boredom counter resets to 0.)
-	/// When m_keepAlive is set to false, this method will delete this object and exit.
-	void pump();
-
 	/// This method should be implemented to perform the job indicated
 	/// by the specified id. (The job ids range from 0 to jobCount-1.)
 	/// The implementing class should be designed such that jobId is sufficient
@@ -169,27 +350,26 @@ public:
 	/// thread-safe manner. Here is an example of how to take a lock in order to do
 	/// something critical:
 	/// GSpinLockHolder lockHolder(m_master.getLock(), "MyWorkerThread::doJob");
-	/// (Note that this assumes the master will never be deleted while a worker is doing a job.)
 	virtual void doJob(size_t jobId) = 0;
 };
 
 
-/// Manages a pool of GWorkerThread objects. To use this class,
+/// Manages a set of GWorkerThread objects. To use this class,
 /// first call addWorker one or more times. Then, call doJobs.
+/// The jobs are run on a GThreadPool, so no threads are spawned per call,
+/// and nobody spins or naps while waiting for work.
 class GMasterThread
 {
 protected:
-	size_t m_job;
-	size_t m_jobCount;
 	std::vector<GWorkerThread*> m_workers;
 	GSpinLock* m_pMasterLock;
-	volatile size_t m_activeWorkers;
+	GThreadPool* m_pPool;
 
 public:
-	GMasterThread();
+	/// If pPool is nullptr, the global pool is used.
+	GMasterThread(GThreadPool* pPool = nullptr);
 
-	/// Note that all worker threads reference the master, so it is not okay to delete the
-	/// master while a worker is still doing a job.
+	/// Deletes all the workers.
 	~GMasterThread();
 
 	/// Adds a worker to the pool. Takes ownership of the worker object.
@@ -198,27 +378,16 @@ public:
 	/// Perform some jobs. The job ids will range from 0 to jobCount-1.
 	/// If no workers have been added, throws an exception.
 	/// If only one worker has been added, that worker performs all of the
-	/// jobs in the same thread as the master (so no new threads are spawned).
-	/// If two or more workers have been added to the pool, the jobs will be
-	/// performed by those workers in separate threads.
+	/// jobs in the same thread as the master.
+	/// If two or more workers have been added, each worker pulls jobs from a
+	/// shared counter on a thread from the pool. (The calling thread helps.)
 	/// This method does not return until all the jobs are done.
 	void doJobs(size_t jobCount);
 
-	/// This method is called by worker threads to obtain the next available job.
-	/// Calling it is a contract to complete the job. Returns INVALID_INDEX if
-	/// there are no more jobs to do. In that case, the worker thread should terminate.
-	/// (This method is already synchronized, so you do not need to take a lock
-	/// before calling it.)
-	size_t nextJob(GWorkerThread* pWorkerWhoWantsAJob);
-
 	/// Returns a pointer to the master lock. (If there is only one worker, then there
 	/// are no worker threads, and this method will return NULL. Note that GSpinLockHolder
 	/// checks for NULL, so it provides a good way to take the lock.)
 	GSpinLock* getLock() { return m_pMasterLock; }
-
-protected:
-	/// This is a helper function that spawns a worker thread
-	static unsigned int spawnWorker(void* pWorkerObject);
 };
 
 
@@ -28,6 +28,8 @@
 #include "GNeuralNet.h"
 #include "GRecommender.h"
 #include "GHolders.h"
+#include "GTruncatedSVD.h"
+#include "GFile.h"
 #include <stdlib.h>
 #include <vector>
 #include <algorithm>
@@ -114,6 +116,43 @@ void GIncrementalTransform::train(const GRelation& relation)
 	setAfter(trainInner(relation));
 }
 
+void GIncrementalTransform::trainStream(GBatchReader& reader, size_t sampleRows, size_t batchRows)
+{
+	if(sampleRows == 0 || batchRows == 0)
+		throw Ex("Expected at least one row per sample and per batch");
+	setBefore(reader.relation().clone());
+	setAfter(trainStreamInner(reader, sampleRows, batchRows));
+}
+
+// virtual
+GRelation* GIncrementalTransform::trainStreamInner(GBatchReader& reader, size_t sampleRows, size_t batchRows)
+{
+	// Draw a uniform sample in one pass (reservoir sampling)
+	GMatrix sample(before().clone());
+	GMatrix batch;
+	GRand rand(0);
+	size_t seen = 0;
+	reader.rewind();
+	while(reader.next(batch, batchRows) > 0)
+	{
+		for(size_t i = 0; i < batch.rows(); i++)
+		{
+			if(sample.rows() < sampleRows)
+				sample.newRow().copy(batch[i]);
+			else
+			{
+				size_t j = (size_t)rand.next(seen + 1);
+				if(j < sampleRows)
+					sample[j].copy(batch[i]);
+			}
+			seen++;
+		}
+	}
+	if(sample.rows() == 0)
+		throw Ex("Expected at least one row");
+	return trainInner(sample);
+}
+
 // virtual
 GMatrix* GIncrementalTransform::reduce(const GMatrix& in)
 {
@@ -157,6 +196,45 @@ std::unique_ptr<GMatrix> GIncrementalTransform::untransformBatch(const GMatrix&
 }
 
 //static
+void GIncrementalTransform_testStream(const char* szFilename)
+{
+	GRand rand(0);
+	GMatrix m(0, 3);
+	for(size_t i = 0; i < 100; i++)
+	{
+		GVec& row = m.newRow();
+		row[0] = rand.normal() * 3.0 + 1.0;
+		row[1] = rand.uniform();
+		row[2] = row[0] - row[1];
+	}
+	m.saveArff(szFilename);
+	GArffBatchReader reader(szFilename);
+
+	// Normalization sees every row, even when the sample is tiny
+	GNormalize n1;
+	n1.train(m);
+	GNormalize n2;
+	n2.trainStream(reader, 5, 7);
+	std::unique_ptr<GMatrix> hN1(n1.transformBatch(m));
+	std::unique_ptr<GMatrix> hN2(n2.transformBatch(m));
+	if(hN1->sumSquaredDifference(*hN2) > 1e-12)
+		throw Ex("Streamed normalization differs");
+
+	// Other transforms train on a sample, which is all of the data if it fits
+	GPCA p1(2);
+	p1.train(m);
+	GPCA p2(2);
+	p2.trainStream(reader, 1000, 7);
+	std::unique_ptr<GMatrix> hP1(p1.transformBatch(m));
+	std::unique_ptr<GMatrix> hP2(p2.transformBatch(m));
+	if(hP1->sumSquaredDifference(*hP2) > 1e-12)
+		throw Ex("Streamed PCA differs");
+	GPCA p3(2);
+	p3.trainStream(reader, 50, 7);
+	if(p3.after().size() != 2)
+		throw Ex("Sampled PCA has the wrong number of dims");
+}
+
 void GIncrementalTransform::test()
 {
 	// Make an input matrix
@@ -211,6 +289,20 @@ void GIncrementalTransform::test()
 		throw Ex("Expected:\n", to_str(m), "\nGot:\n", to_str(*pD));
 	if(!pD->relation().isCompatible(m.relation()) || !m.relation().isCompatible(pD->relation()))
 		throw Ex("failed");
+
+	// Train from a stream
+	char szFilename[256];
+	GFile::tempFilename(szFilename);
+	try
+	{
+		GIncrementalTransform_testStream(szFilename);
+	}
+	catch(...)
+	{
+		GFile::deleteFile(szFilename);
+		throw;
+	}
+	GFile::deleteFile(szFilename);
 }
 
 
@@ -435,13 +527,43 @@ void GIncrementalTransformChainer::untransformToDistribution(const GVec& in, GPr
 
 // ---------------------------------------------------------------
 
+GTransformBatchReader::GTransformBatchReader(GBatchReader& reader, GIncrementalTransform& transform)
+: GBatchReader(), m_reader(reader), m_transform(transform)
+{
+}
+
+// virtual
+const GRelation& GTransformBatchReader::relation()
+{
+	return m_transform.after();
+}
+
+// virtual
+void GTransformBatchReader::rewind()
+{
+	m_reader.rewind();
+}
+
+// virtual
+size_t GTransformBatchReader::readRows(GMatrix& batch, size_t maxRows)
+{
+	size_t n = m_reader.next(m_raw, maxRows);
+	if(n > 0 && m_raw.cols() != m_transform.before().size())
+		throw Ex("Expected a transform trained on data with ", to_str(m_raw.cols()), " columns");
+	for(size_t i = 0; i < n; i++)
+		m_transform.transform(m_raw[i], batch.newRow());
+	return n;
+}
+
+// ---------------------------------------------------------------
+
 GPCA::GPCA(size_t target_Dims)
-: GIncrementalTransform(), m_targetDims(target_Dims), m_pBasisVectors(NULL), m_aboutOrigin(false), m_rand(0)
+: GIncrementalTransform(), m_targetDims(target_Dims), m_pBasisVectors(NULL), m_aboutOrigin(false), m_randomized(false), m_blockKrylov(false), m_rand(0)
 {
 }
 
 GPCA::GPCA(const GDomNode* pNode)
-: GIncrementalTransform(pNode), m_rand(0)
+: GIncrementalTransform(pNode), m_randomized(false), m_blockKrylov(false), m_rand(0)
 {
 	m_pBasisVectors = new GMatrix(pNode->get("basis"));
 	m_targetDims = m_pBasisVectors->rows();
@@ -483,6 +605,28 @@ GRelation* GPCA::trainInner(const GMatrix& data)
 	else
 		data.centroid(mean);
 
+	// Find all of the components at once in a few passes over the data
+	if(m_randomized && data.rows() > 1 && !data.doesHaveAnyMissingValues())
+	{
+		GMatrixOperator op(data);
+		if(m_aboutOrigin)
+			trainRandomized(op);
+		else
+		{
+			GCenteredOperator centered(op, mean);
+			trainRandomized(centered);
+		}
+		return new GUniformRelation(m_targetDims, 0);
+	}
+
+	// When many components are wanted, one pass to build the scatter matrix
+	// is cheaper than many power iterations over the data
+	if(data.rows() > 1 && before().size() <= 40 * m_targetDims && !data.doesHaveAnyMissingValues())
+	{
+		trainFromScatter(data, mean);
+		return new GUniformRelation(m_targetDims, 0);
+	}
+
 	// Make a copy of the data
 	GMatrix tmpData(data.relation().cloneMinimal());
 	tmpData.copy(data);
@@ -507,6 +651,93 @@ GRelation* GPCA::trainInner(const GMatrix& data)
 	return new GUniformRelation(m_targetDims, 0);
 }
 
+void GPCA::trainFromScatter(const GMatrix& data, const GVec& mean)
+{
+	// Compute the scatter matrix, S = (X - mean)^T (X - mean)
+	size_t dims = before().size();
+	GMatrix centered(data.rows(), dims);
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		GVec& r = centered[i];
+		r.copy(data[i]);
+		r -= mean;
+	}
+	GMatrix scatter;
+	GMatrix::multiply(centered, centered, scatter, true, false);
+
+	// Find each component by power iteration, then deflate it out of S. (This is
+	// the same as removing the component from the data, but costs O(dims^2).)
+	GVec accumulator(dims);
+	for(size_t i = 0; i < m_targetDims; i++)
+	{
+		GVec& vec = m_pBasisVectors->row(i + 1);
+		vec.fillSphericalShell(m_rand);
+		double mag = 0;
+		for(size_t iters = 0; iters < 200; iters++)
+		{
+			scatter.multiply(vec, accumulator);
+			vec.copy(accumulator);
+			vec.normalize();
+			double d = accumulator.squaredMagnitude();
+			if(iters < 6 || d - mag > 1e-8)
+				mag = d;
+			else
+				break;
+		}
+		scatter.multiply(vec, accumulator);
+		double lambda = vec.dotProduct(accumulator);
+		if(m_eigVals.size() > 0)
+			m_eigVals[i] = lambda / (data.rows() - 1);
+		for(size_t j = 0; j < dims; j++)
+		{
+			GVec& r = scatter[j];
+			double v = vec[j];
+			double u = accumulator[j];
+			for(size_t k = 0; k < dims; k++)
+				r[k] += lambda * v * vec[k] - v * accumulator[k] - u * vec[k];
+		}
+	}
+}
+
+void GPCA::trainOperator(GLinearOperator& op)
+{
+	if(op.rows() < 2)
+		throw Ex("Expected at least 2 rows");
+	setBefore(new GUniformRelation(op.cols(), 0));
+	delete(m_pBasisVectors);
+	m_pBasisVectors = new GMatrix(1 + m_targetDims, op.cols());
+	GVec& mean = m_pBasisVectors->row(0);
+	if(m_aboutOrigin)
+	{
+		mean.fill(0.0);
+		trainRandomized(op);
+	}
+	else
+	{
+		op.columnMeans(mean);
+		GCenteredOperator centered(op, mean);
+		trainRandomized(centered);
+	}
+	setAfter(new GUniformRelation(m_targetDims, 0));
+}
+
+void GPCA::trainRandomized(GLinearOperator& op)
+{
+	// The right singular vectors of the centered data are the eigenvectors
+	// of its scatter matrix, and the eigenvalues are the squared singular values.
+	GTruncatedSVD svd(m_rand);
+	svd.useBlockKrylov(m_blockKrylov);
+	GVec sv;
+	GMatrix v;
+	svd.compute(op, m_targetDims, sv, v);
+	for(size_t i = 0; i < m_targetDims; i++)
+	{
+		m_pBasisVectors->row(i + 1).copy(v[i]);
+		if(m_eigVals.size() > 0)
+			m_eigVals[i] = sv[i] * sv[i] / (op.rows() - 1);
+	}
+}
+
 // virtual
 GRelation* GPCA::trainInner(const GRelation& relation)
 {
@@ -1175,8 +1406,7 @@ void GNormalize::setMinsAndRanges(const GRelation& rel, const GVec& mins, const
 	m_ranges.copy(ranges);
 }
 
-// virtual
-GRelation* GNormalize::trainInner(const GMatrix& data)
+void GNormalize::setRanges(const GVec& mins, const GVec& maxs)
 {
 	size_t nAttrCount = before().size();
 	m_mins.resize(nAttrCount);
@@ -1185,7 +1415,7 @@ GRelation* GNormalize::trainInner(const GMatrix& data)
 	{
 		if(before().valueCount(i) == 0)
 		{
-			m_mins[i] = data.columnMin(i);
+			m_mins[i] = mins[i];
 			if(m_mins[i] >= 1e300)
 			{
 				m_mins[i] = 0.0;
@@ -1193,7 +1423,7 @@ GRelation* GNormalize::trainInner(const GMatrix& data)
 			}
 			else
 			{
-				m_ranges[i] = data.columnMax(i) - m_mins[i];
+				m_ranges[i] = maxs[i] - m_mins[i];
 				if(m_ranges[i] < 1e-12)
 					m_ranges[i] = 1.0;
 			}
@@ -1204,9 +1434,55 @@ GRelation* GNormalize::trainInner(const GMatrix& data)
 			m_ranges[i] = 0;
 		}
 	}
+}
+
+// virtual
+GRelation* GNormalize::trainInner(const GMatrix& data)
+{
+	size_t nAttrCount = before().size();
+	GVec mins(nAttrCount);
+	GVec maxs(nAttrCount);
+	for(size_t i = 0; i < nAttrCount; i++)
+	{
+		if(before().valueCount(i) == 0)
+		{
+			mins[i] = data.columnMin(i);
+			maxs[i] = data.columnMax(i);
+		}
+	}
+	setRanges(mins, maxs);
 	return data.relation().clone();
 }
 
+// virtual
+GRelation* GNormalize::trainStreamInner(GBatchReader& reader, size_t sampleRows, size_t batchRows)
+{
+	size_t nAttrCount = before().size();
+	GVec mins(nAttrCount);
+	GVec maxs(nAttrCount);
+	mins.fill(1e308);
+	maxs.fill(-1e308);
+	GMatrix batch;
+	reader.rewind();
+	while(reader.next(batch, batchRows) > 0)
+	{
+		for(size_t j = 0; j < batch.rows(); j++)
+		{
+			const GVec& row = batch[j];
+			for(size_t i = 0; i < nAttrCount; i++)
+			{
+				if(before().valueCount(i) == 0 && row[i] != UNKNOWN_REAL_VALUE)
+				{
+					mins[i] = std::min(mins[i], row[i]);
+					maxs[i] = std::max(maxs[i], row[i]);
+				}
+			}
+		}
+	}
+	setRanges(mins, maxs);
+	return before().clone();
+}
+
 // virtual
 GRelation* GNormalize::trainInner(const GRelation& relation)
 {
@@ -24,6 +24,8 @@
 
 namespace GClasses {
 
+class GLinearOperator;
+
 /// This is the base class of algorithms that transform data without supervision
 class GTransform
 {
@@ -75,6 +77,13 @@ public:
 	/// data may throw an exception in this method.
 	void train(const GRelation& pRelation);
 
+	/// Trains the transform on data streamed from reader, so the data never has to fit
+	/// in memory. Rows are read batchRows at a time. By default, one pass over the data
+	/// draws a uniform random sample of up to sampleRows rows, and the transform is trained
+	/// on that sample. Transforms that only need running statistics (such as GNormalize)
+	/// use every row instead.
+	void trainStream(GBatchReader& reader, size_t sampleRows = 100000, size_t batchRows = 10000);
+
 	/// Sets the before relation. Takes ownership of pRel.
 	void setBefore(GRelation* pRel);
 
@@ -144,6 +153,10 @@ protected:
 	/// This method returns a smart-pointer to a relation the represents
 	/// the form that the data will take after it is transformed.
 	virtual GRelation* trainInner(const GRelation& relation) = 0;
+
+	/// This method implements the functionality called by trainStream. The
+	/// default implementation calls trainInner with a reservoir sample of the rows.
+	virtual GRelation* trainStreamInner(GBatchReader& reader, size_t sampleRows, size_t batchRows);
 };
 
 
@@ -182,6 +195,33 @@ public:
 
 
 
+/// A GBatchReader that transforms the rows of another reader as they are read,
+/// so a transform can be applied to data that does not fit in memory. (The
+/// transform is typically trained on a sample, such as the first batch.)
+class GTransformBatchReader : public GBatchReader
+{
+protected:
+	GBatchReader& m_reader;
+	GIncrementalTransform& m_transform;
+	GMatrix m_raw;
+
+public:
+	/// reader and transform must remain valid for the life of this object, and
+	/// transform must already be trained on data with the same relation as reader.
+	GTransformBatchReader(GBatchReader& reader, GIncrementalTransform& transform);
+	virtual ~GTransformBatchReader() {}
+
+	/// Returns the relation of the transformed data.
+	virtual const GRelation& relation();
+	virtual void rewind();
+
+protected:
+	virtual size_t readRows(GMatrix& batch, size_t maxRows);
+};
+
+
+
+
 /// This wraps two two-way-incremental-transforms to form a single combination transform
 class GIncrementalTransformChainer : public GIncrementalTransform
 {
@@ -235,6 +275,8 @@ protected:
 	GMatrix* m_pBasisVectors;
 	GVec m_eigVals;
 	bool m_aboutOrigin;
+	bool m_randomized;
+	bool m_blockKrylov;
 	GRand m_rand;
 
 public:
@@ -256,6 +298,19 @@ public:
 	/// of computing them about the mean).
 	void aboutOrigin() { m_aboutOrigin = true; }
 
+	/// Specify to find all of the components at once with a randomized truncated
+	/// SVD (see GTruncatedSVD), which takes only a few passes over the data
+	/// instead of several per component. If blockKrylov is true, it solves in the
+	/// span of every power iteration, which is more accurate when the eigenvalues
+	/// decay slowly. This method must be called before train is called.
+	void useRandomizedSVD(bool blockKrylov = false) { m_randomized = true; m_blockKrylov = blockKrylov; }
+
+	/// Trains with a randomized truncated SVD of the matrix that op represents.
+	/// This works with data that is not a dense GMatrix in memory, such as a
+	/// GCompressedSparseOperator or a GRawFileOperator. (Unless aboutOrigin was
+	/// called, the data is centered implicitly, so sparse data stays sparse.)
+	void trainOperator(GLinearOperator& op);
+
 	/// Returns the eigenvalues. Returns NULL if computeEigVals was not called.
 	GVec& eigVals() { return m_eigVals; }
 
@@ -289,6 +344,16 @@ protected:
 
 	/// Throws an exception (because this transform cannot be trained without data)
 	virtual GRelation* trainInner(const GRelation& relation);
+
+	/// Finds the principal components by power iteration on the scatter
+	/// matrix of the centered data, which is formed with one matrix multiply.
+	/// This is much faster than iterating over the data when many components
+	/// are requested, but it requires that data has no missing values.
+	void trainFromScatter(const GMatrix& data, const GVec& mean);
+
+	/// Finds the principal components of op (which must already be centered) with
+	/// a randomized truncated SVD.
+	void trainRandomized(GLinearOperator& op);
 };
 
 
@@ -568,6 +633,12 @@ protected:
 
 	/// Throws an exception (because this transform cannot be trained without data)
 	virtual GRelation* trainInner(const GRelation& relation);
+
+	/// Finds the min and max of every column in one pass over all of the rows
+	virtual GRelation* trainStreamInner(GBatchReader& reader, size_t sampleRows, size_t batchRows);
+
+	/// Sets m_mins and m_ranges from the min and max of each continuous column
+	void setRanges(const GVec& mins, const GVec& maxs);
 };
 
 
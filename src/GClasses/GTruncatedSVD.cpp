@@ -0,0 +1,681 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#include "GTruncatedSVD.h"
+#include "GError.h"
+#include "GRand.h"
+#include "GVec.h"
+#include "GThread.h"
+#include "GSparseMatrix.h"
+#include "GTransform.h"
+#include "GHolders.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <errno.h>
+#include <memory>
+#include <vector>
+
+namespace GClasses {
+
+using std::vector;
+
+void GLinearOperator::columnMeans(GVec& outMeans)
+{
+	if(rows() == 0)
+		throw Ex("Expected at least one row");
+	GMatrix ones(1, rows());
+	ones.fill(1.0 / rows());
+	GMatrix means;
+	multiplyTranspose(ones, means);
+	outMeans.copy(means[0]);
+}
+
+// -------------------------------------------------------------------------
+
+GMatrixOperator::GMatrixOperator(const GMatrix& m, GThreadPool* pPool)
+: GLinearOperator(), m_m(m), m_pPool(pPool)
+{
+}
+
+// virtual
+void GMatrixOperator::multiply(const GMatrix& in, GMatrix& out)
+{
+	if(in.cols() != m_m.cols())
+		throw Ex("Expected ", to_str(m_m.cols()), " columns. Got ", to_str(in.cols()));
+	size_t l = in.rows();
+	out.resize(l, m_m.rows());
+	auto body = [&](size_t i)
+	{
+		const GVec& row = m_m[i];
+		for(size_t j = 0; j < l; j++)
+			out[j][i] = row.dotProduct(in[j]);
+	};
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	pool.parallelFor(0, m_m.rows(), body, 64);
+}
+
+// virtual
+void GMatrixOperator::multiplyTranspose(const GMatrix& in, GMatrix& out)
+{
+	if(in.cols() != m_m.rows())
+		throw Ex("Expected ", to_str(m_m.rows()), " columns. Got ", to_str(in.cols()));
+	size_t l = in.rows();
+	size_t m = m_m.rows();
+	out.resize(l, m_m.cols());
+	out.fill(0.0);
+
+	// The rows are summed in a fixed number of chunks that does not depend on the
+	// number of threads, and the chunks are added together in order, so the result
+	// is the same no matter how many threads do the work.
+	size_t chunkSize = std::max((size_t)1024, (m + 15) / 16);
+	size_t chunks = (m + chunkSize - 1) / chunkSize;
+	vector< std::unique_ptr<GMatrix> > partials(chunks);
+	auto body = [&](size_t c)
+	{
+		GMatrix* pAcc = &out;
+		if(c > 0)
+		{
+			partials[c].reset(new GMatrix(l, m_m.cols()));
+			pAcc = partials[c].get();
+			pAcc->fill(0.0);
+		}
+		size_t end = std::min(m, (c + 1) * chunkSize);
+		for(size_t i = c * chunkSize; i < end; i++)
+		{
+			const GVec& row = m_m[i];
+			for(size_t j = 0; j < l; j++)
+			{
+				double y = in[j][i];
+				if(y != 0.0)
+					(*pAcc)[j].addScaled(y, row);
+			}
+		}
+	};
+	GThreadPool& pool = m_pPool ? *m_pPool : GThreadPool::global();
+	pool.parallelFor(0, chunks, body);
+	for(size_t c = 1; c < chunks; c++)
+	{
+		for(size_t j = 0; j < l; j++)
+			out[j] += (*partials[c])[j];
+	}
+}
+
+// -------------------------------------------------------------------------
+
+GCompressedSparseOperator::GCompressedSparseOperator(const GCompressedSparseMatrix& m)
+: GLinearOperator(), m_m(m)
+{
+}
+
+// virtual
+size_t GCompressedSparseOperator::rows() const
+{
+	return m_m.rows();
+}
+
+// virtual
+size_t GCompressedSparseOperator::cols() const
+{
+	return m_m.cols();
+}
+
+// virtual
+void GCompressedSparseOperator::multiply(const GMatrix& in, GMatrix& out)
+{
+	if(in.cols() != m_m.cols())
+		throw Ex("Expected ", to_str(m_m.cols()), " columns. Got ", to_str(in.cols()));
+	size_t l = in.rows();
+	out.resize(l, m_m.rows());
+	for(size_t i = 0; i < m_m.rows(); i++)
+	{
+		const uint32_t* pIndexes = m_m.rowIndexes(i);
+		const double* pValues = m_m.rowValues(i);
+		size_t n = m_m.rowNonDefValues(i);
+		for(size_t j = 0; j < l; j++)
+			out[j][i] = GSparseVec::dotProduct(pIndexes, pValues, n, in[j].data());
+	}
+}
+
+// virtual
+void GCompressedSparseOperator::multiplyTranspose(const GMatrix& in, GMatrix& out)
+{
+	if(in.cols() != m_m.rows())
+		throw Ex("Expected ", to_str(m_m.rows()), " columns. Got ", to_str(in.cols()));
+	size_t l = in.rows();
+	out.resize(l, m_m.cols());
+	out.fill(0.0);
+	for(size_t i = 0; i < m_m.rows(); i++)
+	{
+		const uint32_t* pIndexes = m_m.rowIndexes(i);
+		const double* pValues = m_m.rowValues(i);
+		size_t n = m_m.rowNonDefValues(i);
+		for(size_t j = 0; j < l; j++)
+		{
+			double y = in[j][i];
+			if(y != 0.0)
+				GSparseVec::addScaled(y, pIndexes, pValues, n, out[j].data());
+		}
+	}
+}
+
+// -------------------------------------------------------------------------
+
+GRawFileOperator::GRawFileOperator(const char* szFilename)
+: GLinearOperator(), m_filename(szFilename)
+{
+	std::ifstream s;
+	s.open(szFilename, std::ios::in | std::ios::binary);
+	if(s.fail())
+		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
+	s.read((char*)&m_rows, sizeof(size_t));
+	s.read((char*)&m_cols, sizeof(size_t));
+	if(s.fail())
+		throw Ex("The file, ", szFilename, ", is too short to be a raw matrix");
+}
+
+void GRawFileOperator::open(std::ifstream& s)
+{
+	s.open(m_filename.c_str(), std::ios::in | std::ios::binary);
+	if(s.fail())
+		throw Ex("Error while trying to open the file, ", m_filename, ". ", strerror(errno));
+	s.seekg(2 * sizeof(size_t));
+}
+
+// virtual
+void GRawFileOperator::multiply(const GMatrix& in, GMatrix& out)
+{
+	if(in.cols() != m_cols)
+		throw Ex("Expected ", to_str(m_cols), " columns. Got ", to_str(in.cols()));
+	size_t l = in.rows();
+	out.resize(l, m_rows);
+	std::ifstream s;
+	open(s);
+	GVec row(m_cols);
+	for(size_t i = 0; i < m_rows; i++)
+	{
+		s.read((char*)row.data(), sizeof(double) * m_cols);
+		if(s.fail())
+			throw Ex("Unexpected end of file in ", m_filename);
+		for(size_t j = 0; j < l; j++)
+			out[j][i] = row.dotProduct(in[j]);
+	}
+}
+
+// virtual
+void GRawFileOperator::multiplyTranspose(const GMatrix& in, GMatrix& out)
+{
+	if(in.cols() != m_rows)
+		throw Ex("Expected ", to_str(m_rows), " columns. Got ", to_str(in.cols()));
+	size_t l = in.rows();
+	out.resize(l, m_cols);
+	out.fill(0.0);
+	std::ifstream s;
+	open(s);
+	GVec row(m_cols);
+	for(size_t i = 0; i < m_rows; i++)
+	{
+		s.read((char*)row.data(), sizeof(double) * m_cols);
+		if(s.fail())
+			throw Ex("Unexpected end of file in ", m_filename);
+		for(size_t j = 0; j < l; j++)
+		{
+			double y = in[j][i];
+			if(y != 0.0)
+				out[j].addScaled(y, row);
+		}
+	}
+}
+
+// -------------------------------------------------------------------------
+
+GCenteredOperator::GCenteredOperator(GLinearOperator& op, const GVec& center)
+: GLinearOperator(), m_op(op), m_center(center)
+{
+	if(center.size() != op.cols())
+		throw Ex("Expected the center to have ", to_str(op.cols()), " elements");
+}
+
+// virtual
+void GCenteredOperator::multiply(const GMatrix& in, GMatrix& out)
+{
+	// (A - 1c^T)x = Ax - (c.x)1
+	m_op.multiply(in, out);
+	for(size_t j = 0; j < in.rows(); j++)
+	{
+		double d = m_center.dotProduct(in[j]);
+		GVec& o = out[j];
+		for(size_t i = 0; i < o.size(); i++)
+			o[i] -= d;
+	}
+}
+
+// virtual
+void GCenteredOperator::multiplyTranspose(const GMatrix& in, GMatrix& out)
+{
+	// (A - 1c^T)^T y = A^T y - (1.y)c
+	m_op.multiplyTranspose(in, out);
+	for(size_t j = 0; j < in.rows(); j++)
+		out[j].addScaled(-in[j].sum(), m_center);
+}
+
+// -------------------------------------------------------------------------
+
+GTruncatedSVD::GTruncatedSVD(GRand& rand)
+: m_rand(rand), m_oversampling(10), m_powerIters(2), m_blockKrylov(false)
+{
+}
+
+GTruncatedSVD::~GTruncatedSVD()
+{
+}
+
+// static
+void GTruncatedSVD::orthonormalizeRows(GMatrix& m)
+{
+	size_t i = 0;
+	while(i < m.rows())
+	{
+		GVec& r = m[i];
+		double before = r.squaredMagnitude();
+		for(size_t pass = 0; pass < 2; pass++)
+		{
+			for(size_t j = 0; j < i; j++)
+				r.addScaled(-r.dotProduct(m[j]), m[j]);
+		}
+		double after = r.squaredMagnitude();
+		if(after <= 1e-20 * before || after == 0.0)
+			m.deleteRowPreserveOrder(i);
+		else
+		{
+			r *= (1.0 / std::sqrt(after));
+			i++;
+		}
+	}
+}
+
+// Sets row j of m to a random unit vector that is orthogonal to the rows before it
+void GTruncatedSVD_completeRow(GMatrix& m, size_t j, GRand& rand)
+{
+	GVec& r = m[j];
+	for(size_t attempts = 0; attempts < 100; attempts++)
+	{
+		r.fillNormal(rand);
+		for(size_t pass = 0; pass < 2; pass++)
+		{
+			for(size_t i = 0; i < j; i++)
+				r.addScaled(-r.dotProduct(m[i]), m[i]);
+		}
+		double mag = r.squaredMagnitude();
+		if(mag > 1e-12)
+		{
+			r *= (1.0 / std::sqrt(mag));
+			return;
+		}
+	}
+	throw Ex("Failed to find an orthogonal direction");
+}
+
+// static
+void GTruncatedSVD::symmetricEigs(GMatrix& m, GVec& outVals, GMatrix& outVecs)
+{
+	size_t n = m.rows();
+	if(m.cols() != n)
+		throw Ex("Expected a square matrix");
+	GMatrix vecs(n, n);
+	vecs.makeIdentity();
+	for(size_t sweep = 0; sweep < 100; sweep++)
+	{
+		double off = 0.0;
+		double diag = 0.0;
+		for(size_t p = 0; p < n; p++)
+		{
+			diag += m[p][p] * m[p][p];
+			for(size_t q = p + 1; q < n; q++)
+				off += m[p][q] * m[p][q];
+		}
+		if(off <= 1e-30 * diag || off == 0.0)
+			break;
+		for(size_t p = 0; p < n; p++)
+		{
+			for(size_t q = p + 1; q < n; q++)
+			{
+				double apq = m[p][q];
+				if(apq == 0.0)
+					continue;
+
+				// Pick the rotation that zeros m[p][q]
+				double theta = (m[q][q] - m[p][p]) / (2.0 * apq);
+				double t = 1.0 / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+				if(theta < 0.0)
+					t = -t;
+				double c = 1.0 / std::sqrt(t * t + 1.0);
+				double s = t * c;
+
+				// m = J^T m J
+				for(size_t k = 0; k < n; k++)
+				{
+					double a = m[k][p];
+					double b = m[k][q];
+					m[k][p] = c * a - s * b;
+					m[k][q] = s * a + c * b;
+				}
+				for(size_t k = 0; k < n; k++)
+				{
+					double a = m[p][k];
+					double b = m[q][k];
+					m[p][k] = c * a - s * b;
+					m[q][k] = s * a + c * b;
+				}
+
+				// Accumulate the rotation into the eigenvectors (stored as rows)
+				GVec& vp = vecs[p];
+				GVec& vq = vecs[q];
+				for(size_t k = 0; k < n; k++)
+				{
+					double a = vp[k];
+					double b = vq[k];
+					vp[k] = c * a - s * b;
+					vq[k] = s * a + c * b;
+				}
+			}
+		}
+	}
+
+	// Sort by descending eigenvalue
+	vector<size_t> order(n);
+	for(size_t i = 0; i < n; i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&m](size_t a, size_t b) { return m[a][a] > m[b][b]; });
+	outVals.resize(n);
+	outVecs.resize(n, n);
+	for(size_t i = 0; i < n; i++)
+	{
+		outVals[i] = m[order[i]][order[i]];
+		outVecs[i].copy(vecs[order[i]]);
+	}
+}
+
+void GTruncatedSVD::compute(GLinearOperator& A, size_t k, GVec& outSingularValues, GMatrix& outV, GMatrix* pOutU)
+{
+	size_t m = A.rows();
+	size_t n = A.cols();
+	size_t minDim = std::min(m, n);
+	if(k > minDim)
+		throw Ex("Cannot find more than ", to_str(minDim), " singular values of a ", to_str(m), "x", to_str(n), " matrix");
+	size_t l = std::min(k + m_oversampling, minDim);
+
+	// Find an orthonormal basis, Q, that approximately spans the dominant range of A
+	GMatrix omega(l, n);
+	omega.fillNormal(m_rand);
+	GMatrix y;
+	A.multiply(omega, y);
+	orthonormalizeRows(y);
+	GMatrix z;
+	GMatrix q;
+	if(m_blockKrylov)
+	{
+		// Keep every block, and orthonormalize their union
+		vector<GMatrix*> blocks;
+		VectorOfPointersHolder<GMatrix> hBlocks(blocks);
+		size_t total = y.rows();
+		for(size_t i = 0; i < m_powerIters; i++)
+		{
+			GMatrix* pPrev = blocks.size() > 0 ? blocks.back() : &y;
+			A.multiplyTranspose(*pPrev, z);
+			orthonormalizeRows(z);
+			GMatrix* pNext = new GMatrix();
+			blocks.push_back(pNext);
+			A.multiply(z, *pNext);
+			orthonormalizeRows(*pNext);
+			total += pNext->rows();
+		}
+		q.resize(std::min(total, m), m);
+		size_t pos = 0;
+		for(size_t i = 0; i < y.rows() && pos < q.rows(); i++)
+			q[pos++].copy(y[i]);
+		for(size_t b = 0; b < blocks.size(); b++)
+		{
+			for(size_t i = 0; i < blocks[b]->rows() && pos < q.rows(); i++)
+				q[pos++].copy((*blocks[b])[i]);
+		}
+		orthonormalizeRows(q);
+	}
+	else
+	{
+		// Subspace iteration
+		for(size_t i = 0; i < m_powerIters; i++)
+		{
+			A.multiplyTranspose(y, z);
+			orthonormalizeRows(z);
+			A.multiply(z, y);
+			orthonormalizeRows(y);
+		}
+		q.copy(y);
+	}
+
+	// B = Q^T A is small. (Each row of bt is a row of B.) Its singular vectors
+	// come from the eigenvectors of B B^T.
+	GMatrix bt;
+	A.multiplyTranspose(q, bt);
+	size_t r = q.rows();
+	GMatrix bbt(r, r);
+	for(size_t i = 0; i < r; i++)
+	{
+		for(size_t j = 0; j <= i; j++)
+		{
+			double d = bt[i].dotProduct(bt[j]);
+			bbt[i][j] = d;
+			bbt[j][i] = d;
+		}
+	}
+	GVec vals;
+	GMatrix w;
+	symmetricEigs(bbt, vals, w);
+
+	// V = B^T W S^-1 and U = Q W
+	outSingularValues.resize(k);
+	outV.resize(k, n);
+	if(pOutU)
+		pOutU->resize(k, m);
+	double tiny = r > 0 ? 1e-12 * std::sqrt(std::max(0.0, vals[0])) : 0.0;
+	for(size_t j = 0; j < k; j++)
+	{
+		double sigma = j < r ? std::sqrt(std::max(0.0, vals[j])) : 0.0;
+		if(sigma <= tiny)
+		{
+			// A has rank < k, so any orthogonal directions will do
+			outSingularValues[j] = 0.0;
+			GTruncatedSVD_completeRow(outV, j, m_rand);
+			if(pOutU)
+				GTruncatedSVD_completeRow(*pOutU, j, m_rand);
+			continue;
+		}
+		outSingularValues[j] = sigma;
+		GVec& v = outV[j];
+		v.fill(0.0);
+		for(size_t i = 0; i < r; i++)
+			v.addScaled(w[j][i], bt[i]);
+		v *= (1.0 / sigma);
+		if(pOutU)
+		{
+			GVec& u = (*pOutU)[j];
+			u.fill(0.0);
+			for(size_t i = 0; i < r; i++)
+				u.addScaled(w[j][i], q[i]);
+		}
+	}
+}
+
+#ifndef MIN_PREDICT
+// Makes an m-by-n matrix with the specified singular values and random singular vectors
+void GTruncatedSVD_makeMatrix(GRand& rand, size_t m, size_t n, const GVec& sv, GMatrix& outA, GMatrix& outU, GMatrix& outV)
+{
+	size_t k = sv.size();
+	outU.resize(k, m);
+	outV.resize(k, n);
+	for(size_t i = 0; i < k; i++)
+	{
+		GTruncatedSVD_completeRow(outU, i, rand);
+		GTruncatedSVD_completeRow(outV, i, rand);
+	}
+	outA.resize(m, n);
+	outA.fill(0.0);
+	for(size_t i = 0; i < m; i++)
+	{
+		for(size_t j = 0; j < k; j++)
+			outA[i].addScaled(sv[j] * outU[j][i], outV[j]);
+	}
+}
+
+void GTruncatedSVD_checkAgainst(const GVec& sv, const GMatrix& v, const GVec& svTrue, const GMatrix& vTrue, double tol)
+{
+	for(size_t i = 0; i < sv.size(); i++)
+	{
+		if(std::abs(sv[i] - svTrue[i]) > tol * svTrue[i])
+			throw Ex("wrong singular value ", to_str(i), ". Expected ", to_str(svTrue[i]), ". Got ", to_str(sv[i]));
+		if(std::abs(std::abs(v[i].dotProduct(vTrue[i])) - 1.0) > tol)
+			throw Ex("wrong singular vector ", to_str(i));
+	}
+}
+
+// static
+void GTruncatedSVD::test()
+{
+	GRand rand(0);
+
+	// A matrix of rank 6 is recovered exactly, since the oversampled block spans its range
+	GVec svTrue({50.0, 20.0, 10.0, 5.0, 2.0, 1.0});
+	GMatrix a, uTrue, vTrue;
+	GTruncatedSVD_makeMatrix(rand, 200, 30, svTrue, a, uTrue, vTrue);
+	GMatrixOperator op(a);
+	for(size_t krylov = 0; krylov < 2; krylov++)
+	{
+		GTruncatedSVD svd(rand);
+		svd.useBlockKrylov(krylov == 1);
+		GVec sv;
+		GMatrix v, u;
+		svd.compute(op, 4, sv, v, &u);
+		GTruncatedSVD_checkAgainst(sv, v, svTrue, vTrue, 1e-8);
+		for(size_t i = 0; i < 4; i++)
+		{
+			if(std::abs(std::abs(u[i].dotProduct(uTrue[i])) - 1.0) > 1e-8)
+				throw Ex("wrong left singular vector");
+		}
+
+		// Asking for more than the rank fills in orthogonal directions
+		svd.compute(op, 8, sv, v);
+		if(sv[6] != 0.0 || sv[7] != 0.0 || std::abs(sv[5] - 1.0) > 1e-8)
+			throw Ex("wrong singular values for a rank-deficient matrix");
+		for(size_t i = 0; i < 8; i++)
+		{
+			for(size_t j = 0; j <= i; j++)
+			{
+				if(std::abs(v[i].dotProduct(v[j]) - (i == j ? 1.0 : 0.0)) > 1e-8)
+					throw Ex("singular vectors are not orthonormal");
+			}
+		}
+	}
+
+	// With slowly decaying singular values, a few power iterations still find the top ones
+	GVec svSlow(30);
+	for(size_t i = 0; i < svSlow.size(); i++)
+		svSlow[i] = 10.0 * std::pow(0.8, (double)i);
+	GTruncatedSVD_makeMatrix(rand, 300, 40, svSlow, a, uTrue, vTrue);
+	for(size_t krylov = 0; krylov < 2; krylov++)
+	{
+		GTruncatedSVD svd(rand);
+		svd.setOversampling(5);
+		svd.setPowerIterations(4);
+		svd.useBlockKrylov(krylov == 1);
+		GVec sv;
+		GMatrix v;
+		svd.compute(op, 3, sv, v);
+		GTruncatedSVD_checkAgainst(sv, v, svSlow, vTrue, 1e-3);
+	}
+
+	// The sparse operator and the threaded dense operator agree with the serial one
+	GMatrix b(5000, 12);
+	b.fill(0.0);
+	for(size_t i = 0; i < b.rows(); i++)
+	{
+		for(size_t j = 0; j < 3; j++)
+		{
+			size_t c = (size_t)rand.next(b.cols());
+			b[i][c] = rand.normal() * (c + 1);
+		}
+	}
+	GSparseMatrix sp(b.rows(), b.cols());
+	for(size_t i = 0; i < b.rows(); i++)
+	{
+		for(size_t j = 0; j < b.cols(); j++)
+		{
+			if(b[i][j] != 0.0)
+				sp.set(i, j, b[i][j]);
+		}
+	}
+	GCompressedSparseMatrix csr(sp);
+	GCompressedSparseOperator spOp(csr);
+	GThreadPool serialPool(0);
+	GMatrixOperator serialOp(b, &serialPool);
+	GThreadPool pool(3);
+	GMatrixOperator parallelOp(b, &pool);
+	GMatrix x(3, b.cols());
+	x.fillNormal(rand);
+	GMatrix y(3, b.rows());
+	y.fillNormal(rand);
+	GMatrix o1, o2, o3;
+	serialOp.multiply(x, o1);
+	parallelOp.multiply(x, o2);
+	spOp.multiply(x, o3);
+	for(size_t j = 0; j < o1.rows(); j++)
+	{
+		for(size_t i = 0; i < o1.cols(); i++)
+		{
+			if(o1[j][i] != o2[j][i] || std::abs(o1[j][i] - o3[j][i]) > 1e-12)
+				throw Ex("operators disagree");
+		}
+	}
+	serialOp.multiplyTranspose(y, o1);
+	parallelOp.multiplyTranspose(y, o2);
+	spOp.multiplyTranspose(y, o3);
+	for(size_t j = 0; j < o1.rows(); j++)
+	{
+		for(size_t i = 0; i < o1.cols(); i++)
+		{
+			if(o1[j][i] != o2[j][i] || std::abs(o1[j][i] - o3[j][i]) > 1e-9)
+				throw Ex("transposed operators disagree");
+		}
+	}
+
+	// Randomized PCA on a sparse matrix agrees with ordinary PCA on the dense one
+	GPCA pca(3);
+	pca.train(b);
+	GPCA rpca(3);
+	rpca.useRandomizedSVD(true);
+	rpca.trainOperator(spOp);
+	for(size_t i = 0; i <= 3; i++)
+	{
+		double d = pca.components()->row(i).dotProduct(rpca.components()->row(i));
+		if(i == 0 ? std::abs(d - pca.centroid().squaredMagnitude()) > 1e-9 : std::abs(std::abs(d) - 1.0) > 1e-4)
+			throw Ex("randomized PCA disagrees with PCA");
+	}
+}
+#endif // MIN_PREDICT
+
+} // namespace GClasses
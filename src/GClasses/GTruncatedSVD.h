@@ -0,0 +1,210 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#ifndef __GTRUNCATEDSVD_H__
+#define __GTRUNCATEDSVD_H__
+
+#include "GMatrix.h"
+#include <string>
+#include <fstream>
+
+namespace GClasses {
+
+class GRand;
+class GThreadPool;
+class GCompressedSparseMatrix;
+
+
+/// An abstract m-by-n matrix that can only be multiplied by blocks of vectors.
+/// This is all that GTruncatedSVD needs, so the matrix does not have to be
+/// held in memory in dense form. Blocks of vectors are stored one vector per row,
+/// so a block of l vectors with n elements each is an l-by-n GMatrix.
+class GLinearOperator
+{
+public:
+	GLinearOperator() {}
+	virtual ~GLinearOperator() {}
+
+	/// Returns the number of rows in this matrix.
+	virtual size_t rows() const = 0;
+
+	/// Returns the number of columns in this matrix.
+	virtual size_t cols() const = 0;
+
+	/// Computes out[j] = A in[j] for each row j of in. in has cols() columns.
+	/// out is resized to in.rows()-by-rows().
+	virtual void multiply(const GMatrix& in, GMatrix& out) = 0;
+
+	/// Computes out[j] = A^T in[j] for each row j of in. in has rows() columns.
+	/// out is resized to in.rows()-by-cols().
+	virtual void multiplyTranspose(const GMatrix& in, GMatrix& out) = 0;
+
+	/// Computes the mean of each column with one transposed multiply.
+	void columnMeans(GVec& outMeans);
+};
+
+
+/// Wraps a dense GMatrix as a GLinearOperator. Both multiplies are
+/// spread across a thread pool, and give the same results with any
+/// number of threads.
+class GMatrixOperator : public GLinearOperator
+{
+protected:
+	const GMatrix& m_m;
+	GThreadPool* m_pPool;
+
+public:
+	/// m must remain valid for the life of this object. If pPool is NULL,
+	/// GThreadPool::global() is used.
+	GMatrixOperator(const GMatrix& m, GThreadPool* pPool = NULL);
+	virtual ~GMatrixOperator() {}
+
+	virtual size_t rows() const { return m_m.rows(); }
+	virtual size_t cols() const { return m_m.cols(); }
+	virtual void multiply(const GMatrix& in, GMatrix& out);
+	virtual void multiplyTranspose(const GMatrix& in, GMatrix& out);
+};
+
+
+/// Wraps a GCompressedSparseMatrix as a GLinearOperator. Elements that are
+/// not stored are treated as zeros.
+class GCompressedSparseOperator : public GLinearOperator
+{
+protected:
+	const GCompressedSparseMatrix& m_m;
+
+public:
+	/// m must remain valid for the life of this object.
+	GCompressedSparseOperator(const GCompressedSparseMatrix& m);
+	virtual ~GCompressedSparseOperator() {}
+
+	virtual size_t rows() const;
+	virtual size_t cols() const;
+	virtual void multiply(const GMatrix& in, GMatrix& out);
+	virtual void multiplyTranspose(const GMatrix& in, GMatrix& out);
+};
+
+
+/// A GLinearOperator that streams its rows from a file written by
+/// GMatrix::saveRaw each time it is multiplied, so only one row
+/// of the matrix is ever in memory.
+class GRawFileOperator : public GLinearOperator
+{
+protected:
+	std::string m_filename;
+	size_t m_rows;
+	size_t m_cols;
+
+public:
+	/// Reads the dimensions from the header of the specified file.
+	GRawFileOperator(const char* szFilename);
+	virtual ~GRawFileOperator() {}
+
+	virtual size_t rows() const { return m_rows; }
+	virtual size_t cols() const { return m_cols; }
+	virtual void multiply(const GMatrix& in, GMatrix& out);
+	virtual void multiplyTranspose(const GMatrix& in, GMatrix& out);
+
+protected:
+	/// Opens the file and skips past the header.
+	void open(std::ifstream& s);
+};
+
+
+/// Represents A - 1 c^T, where A is another operator and c is a vector with
+/// A.cols() elements, without ever forming it. (With c set to the column means,
+/// this is the centered data that PCA works with, and A stays sparse.)
+class GCenteredOperator : public GLinearOperator
+{
+protected:
+	GLinearOperator& m_op;
+	const GVec& m_center;
+
+public:
+	/// op and center must remain valid for the life of this object.
+	GCenteredOperator(GLinearOperator& op, const GVec& center);
+	virtual ~GCenteredOperator() {}
+
+	virtual size_t rows() const { return m_op.rows(); }
+	virtual size_t cols() const { return m_op.cols(); }
+	virtual void multiply(const GMatrix& in, GMatrix& out);
+	virtual void multiplyTranspose(const GMatrix& in, GMatrix& out);
+};
+
+
+/// Computes the k largest singular values of a matrix and the corresponding
+/// singular vectors with a randomized range finder (Halko, Martinsson, and Tropp,
+/// 2011). It multiplies a block of k+oversampling random vectors through the
+/// matrix, refines their span with a few power iterations, and then solves a small
+/// (k+oversampling)-sized problem. Each power iteration costs two passes over
+/// the matrix, so the whole thing takes only a few passes, whereas extracting the
+/// components one at a time by power iteration and deflation takes many.
+///
+/// With useBlockKrylov, it keeps every block that the power iterations produce
+/// and solves in their combined span (block Lanczos). That costs more memory and
+/// a bigger small problem, but it converges in fewer passes when the singular
+/// values decay slowly.
+class GTruncatedSVD
+{
+protected:
+	GRand& m_rand;
+	size_t m_oversampling;
+	size_t m_powerIters;
+	bool m_blockKrylov;
+
+public:
+	GTruncatedSVD(GRand& rand);
+	~GTruncatedSVD();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Sets the number of extra random vectors to use beyond the number of singular
+	/// values that are requested. The default is 10.
+	void setOversampling(size_t n) { m_oversampling = n; }
+
+	/// Sets the number of power iterations (each one is two passes over the matrix).
+	/// The default is 2.
+	void setPowerIterations(size_t n) { m_powerIters = n; }
+
+	/// Specifies whether to keep every block of the power iterations and solve in
+	/// their combined span (block Krylov), instead of in the span of the last block only.
+	void useBlockKrylov(bool b = true) { m_blockKrylov = b; }
+
+	/// Computes the k largest singular values of A, in descending order, and the
+	/// corresponding right singular vectors (as the rows of outV, which is k-by-A.cols()).
+	/// If pOutU is non-NULL, it is set to the left singular vectors, also one per row,
+	/// so it is k-by-A.rows().
+	void compute(GLinearOperator& A, size_t k, GVec& outSingularValues, GMatrix& outV, GMatrix* pOutU = NULL);
+
+	/// Computes the eigenvalues and eigenvectors of a small symmetric matrix by
+	/// cyclic Jacobi rotations. m is destroyed. The eigenvectors are returned
+	/// as the rows of outVecs, in order of descending eigenvalue.
+	static void symmetricEigs(GMatrix& m, GVec& outVals, GMatrix& outVecs);
+
+protected:
+	/// Orthonormalizes the rows of m by modified Gram-Schmidt, applied twice for
+	/// stability. Rows that are (numerically) in the span of the rows before them
+	/// are removed, so m may have fewer rows afterward.
+	static void orthonormalizeRows(GMatrix& m);
+};
+
+
+} // namespace GClasses
+
+#endif // __GTRUNCATEDSVD_H__
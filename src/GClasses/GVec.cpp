@@ -435,7 +435,7 @@ void GVec::deserialize(const GDomNode* pNode)
 {
 	GDomListIterator it(pNode);
 	resize_implicit(it.remaining());
-	for(size_t i = 0; it.current(); i++)
+	for(size_t i = 0; i < m_size; i++)
 	{
 		(*this)[i] = it.currentDouble();
 		it.advance();
@@ -962,7 +962,7 @@ GDomNode* GIndexVec::serialize(GDom* pDoc, const size_t* pVec, size_t dims)
 // static
 void GIndexVec::deserialize(size_t* pVec, GDomListIterator& it)
 {
-	while(it.current())
+	while(it.remaining() > 0)
 	{
 		*(pVec++) = size_t(it.currentInt());
 		it.advance();
@@ -65,12 +65,13 @@ public:
 	/// Returns the size of this vector.
 	size_t size() const { return m_size; }
 
-	/// Resizes this vector
-	void resize(size_t n);
+	/// Resizes this vector. (This is virtual so that views into memory owned by
+	/// something else, such as the rows of a contiguous GMatrix, can refuse.)
+	virtual void resize(size_t n);
 
 	/// Resizes this vector while preserving any elements that overlap with the new size.
 	/// Any new elements will contain garbage.
-	void resizePreserve(size_t n);
+	virtual void resizePreserve(size_t n);
 
 	/// Sets all the elements in this vector to val.
 	void fill(const double val, size_t startPos = 0, size_t elements = (size_t)-1);
@@ -268,7 +269,7 @@ public:
 	void fromImage(GImage* pImage, int width, int height, int channels, double range);
 
 	/// Swaps the contents of this vector with that vector.
-	void swapContents(GVec& that);
+	virtual void swapContents(GVec& that);
 
 
 
@@ -229,6 +229,7 @@ UsageNode* makeAlgorithmUsageTree()
 		pOpts->add("-random [draws]=1", "Use random divisions (instead of divisions that reduce entropy). Random divisions make the algorithm train faster, and also increase model variance, so it is better suited for ensembles, "
 			"but random divisions also make the decision tree more vulnerable to problems with irrelevant features. [draws] is typically 1, but if you specify a larger value, it will pick the best out of the specified number of random draws.");
 		pOpts->add("-binary", "Use binary divisions. For nominal attributes with more than 2 categorical values, one specific value will be separated from all others at each division.");
+		pOpts->add("-histogram [bins]=256", "Find divisions with histograms. Each continuous feature is quantized into at most [bins] bins (at most 256) before training, and only the bin boundaries are considered as pivots. This is much faster with large data sets. It implies -binary.");
 		pOpts->add("-leafthresh [n]=1", "When building the tree, if the number of samples is <= this value, it will stop trying to divide the data and will create a leaf node. The default value is 1. For noisy data, larger values may be advantageous.");
 		pOpts->add("-maxlevels [n]=5", "When building the tree, if the depth (the length of the path from the root to the node currently being formed, including the root and the currently forming node) is [n], it will stop trying to divide the data and will create a "
 			"leaf node.  This means that there will be at most [n]-1 splits before a decision is made.  This crudely limits overfitting, and so can be helpful on small data sets.  It can also make the resulting trees easier to interpret.  If set to 0, then there is no maximum (which is the default).");
@@ -239,6 +240,7 @@ UsageNode* makeAlgorithmUsageTree()
 		pOpts->add("-noise [var]=1.0", "The variance of the noise parameter.");
 		pOpts->add("-prior [var]=1024.0", "The prior variance for the weights. (This value will be multiplied by an identity matrix to form the prior covariance for the weights.");
 		pOpts->add("-maxsamples [n]=350", "The maximum number of samples to train with. (If the training data contains more than [n] rows, then it will automatically randomly sub-sample the training data in order to limit computational complexity.)");
+		pOpts->add("-inducingpoints [m]=0", "Train a sparse approximation that uses [m] randomly chosen training rows as inducing points. This uses all of the training data, costs time proportional to the number of rows times [m] squared, and ignores -maxsamples. The noise variance must be positive. If [m] is 0, the exact model is trained.");
 		UsageNode* pKern = pOpts->add("-kernel [k]", "Specify the kernel to use");
 		pKern->add("identity", "This simple kernel causes it to learn a linear model. If no kernel is specified, this is the default.");
 		pKern->add("chisquared", "A Chi Squared kernel.");
@@ -275,6 +277,10 @@ UsageNode* makeAlgorithmUsageTree()
 		pOpts->add("-scalefeatures", "Use a hill-climbing algorithm on the training set to scale the feature dimensions in order to give more accurate results. This increases training time, but also improves accuracy and robustness to irrelevant features.");
 		pOpts->add("-pearson", "Use Pearson's correlation coefficient to evaluate the similarity between sparse vectors. (Only compatible with sparse training.)");
 		pOpts->add("-cosine", "Use the cosine method to evaluate the similarity between sparse vectors. (Only compatible with sparse training.)");
+		UsageNode* pHnsw = pOpts->add("-hnsw [m] [efconstruction] [efsearch]", "Find approximate neighbors with a hierarchical navigable small-world graph instead of a kd-tree. This is much faster when there are many high-dimensional features, but it may occasionally miss a true neighbor. The arguments are optional, but they must be given in order.");
+		pHnsw->add("[m]=16", "The number of links each point makes in each layer of the graph.");
+		pHnsw->add("[efconstruction]=200", "The width of the search used to link each point into the graph. Bigger values make a better graph, but take longer to train.");
+		pHnsw->add("[efsearch]=64", "The width of the search used to find neighbors. Bigger values improve recall, but make predictions slower.");
 	}
 	{
 		pRoot->add("linear", "A linear regression model");
@@ -342,6 +348,7 @@ UsageNode* makeAlgorithmUsageTree()
 		pRF->add("[trees]=50", "Specify the number of trees in the random forest");
 		UsageNode* pOpts = pRF->add("<options>");
 		pOpts->add("-samples [n]=1", "Specify the number of randomly-drawn attributes to evaluate. The one that maximizes information gain will be chosen for the decision boundary. If [n] is 1, then the divisions are completely random. Larger values will decrease the randomness.");
+		pOpts->add("-histogram [bins]=256", "Find divisions with histograms. Each continuous feature is quantized into at most [bins] bins (at most 256) once, and the bin boundaries are shared by all of the trees. This is much faster with large data sets.");
 	}
 	{
 		pRoot->add("usage", "Print usage information.");
@@ -458,6 +465,7 @@ UsageNode* makeClusterUsageTree()
 		UsageNode* pOpts = pKM->add("<options>");
 		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator.");
 		pOpts->add("-reps [n]=1", "Cluster the data [n] times, and return the clustering that minimizes the sum-squared-distance between each row and its corresponding centroid.");
+		pOpts->add("-minibatch [size] [iters]", "Train the centroids with [iters] mini-batches of [size] randomly drawn rows instead of full passes over the data. This is much faster on very large datasets. All attributes must be continuous.");
 	}
 	{
 		pRoot->add("kmedoids [dataset] [clusters]", "Performs k-medoids clustering. Outputs the cluster id for each row.");
@@ -513,6 +521,8 @@ UsageNode* makeCollaborativeFilterUsageTree()
 		pOpts->add("-miniters [value]=1", "Specify a the minimum number of iterations to train the model before checking its validation error. This ensures that model does at least a certain amount of training before converging.");
 		pOpts->add("-decayrate [value]=0.97", "Specify a decay rate in the range of (0-1) for the learning rate parameter. Value closer to 1 will cause the rate the decay slower while rate closer to 0 cause the a faster decay.");
 		pOpts->add("-nonneg", "Constrain all non-bias weights to be non-negative");
+		pOpts->add("-hogwild", "Train each epoch on all available threads with lock-free (Hogwild-style) updates. Results may vary from run to run.");
+		pOpts->add("-blocked [blocks]=0", "Train each epoch on all available threads with a stratified block-partitioned schedule, so no two threads ever update the same user or item. Users and items are split into [blocks] groups. If [blocks] is 0, one group per thread is used. For a fixed number of blocks, the results do not depend on the number of threads.");
 	}
 	{
 		UsageNode* pNLPCA = pRoot->add("nlpca [intrinsic] <options>", "A non-linear PCA collaborative-filtering algorithm. This algorithm was published in Scholz, M. Kaplan, F. Guy, C. L. Kopka, J. Selbig, J., Non-linear PCA: a missing data approach, In Bioinformatics,"
@@ -638,6 +648,7 @@ UsageNode* makeDimRedUsageTree()
 		UsageNode* pOpts = pIsomap->add("<options>");
 		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator.");
 		pOpts->add("-tolerant", "If there are points that are disconnected from the rest of the graph, just drop them from the data. (This may cause the results to contain fewer rows than the input.)");
+		pOpts->add("-landmarks [m]=0", "Use Landmark Isomap with [m] randomly chosen landmarks. Geodesic distances are only computed from the landmarks, and the other points are embedded by triangulation, so this needs far less time and memory on large datasets. If [m] is 0, distances between all pairs of points are used.");
 		pIsomap->add("[dataset]=in.arff", "The filename of the high-dimensional data to reduce.");
 		pIsomap->add("[neighbor-count]=12", "The number of neighbors to use.");
 		pIsomap->add("[target_dims]=2", "The number of dimensions to reduce the data into.");
@@ -738,6 +749,8 @@ UsageNode* makeDimRedUsageTree()
 		pOpts->add("-eigenvalues [filename]=eigenvalues.arff", "Save the eigenvalues to the specified file.");
 		pOpts->add("-components [filename]=eigenvectors.arff", "Save the centroid and principal component vectors (in order of decreasing corresponding eigenvalue) to the specified file.");
 		pOpts->add("-aboutorigin", "Compute the principal components about the origin. (The default is to compute them relative to the centroid.)");
+		pOpts->add("-randomized", "Find all of the components at once with a randomized truncated SVD, which takes only a few passes over the data. This is much faster for large datasets.");
+		pOpts->add("-krylov", "Like -randomized, but solve in the span of every power iteration (block Krylov). This is more accurate when the eigenvalues decay slowly.");
 		pOpts->add("-modelin [filename]=in.json", "Load the PCA model from a json file.");
 		pOpts->add("-modelout [filename]=out.json", "Save the trained PCA model to a json file.");
 		pPCA->add("[dataset]=in.arff", "The filename of the high-dimensional data to reduce.");
@@ -1013,6 +1026,9 @@ UsageNode* makeLearnUsageTree()
 		UsageNode* pOpts = pTrain->add("<options>");
 		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator. (Use this option to ensure that your results are reproduceable.)");
 		pOpts->add("-embed", "Escape the output model such that it can easily be embedded in C or C++ code.");
+		pOpts->add("-binary", "Output the model in a compact binary format instead of JSON. Binary models are smaller and load much faster. (The predict and test commands detect the format automatically.)");
+		pOpts->add("-stream [rows]=10000", "Read the dataset [rows] rows at a time instead of loading all of it, so datasets that are larger than memory can be used. Only incremental learners (such as naivebayes) support this. The algorithm is configured with the first batch of rows. For CSV files, the types of the columns are determined from the first 10000 rows.");
+		pOpts->add("-epochs [n]=1", "When used with -stream, specifies the number of passes to make over the data.");
 		pTrain->add("[dataset]=train.arff", "The filename of a dataset.");
 		UsageNode* pDO = pTrain->add("<data_opts>");
 		pDO->add("-labels [attr_list]=0", "Specify which attributes to use as labels. (If not specified, the default is to use the last attribute for the label.) [attr_list] is a comma-separated list of zero-indexed columns. A hypen may be used to specify a range of"
@@ -1190,6 +1206,16 @@ UsageNode* makeNeighborUsageTree()
 		pCC->add("[thresh]=10", "The threshold cycle-length for bad cycles.");
 		pKD->add("[k]=12", "The number of neighbors.");
 	}
+	{
+		UsageNode* pHnsw = pRoot->add("hnsw <options> [k]", "An approximate way to find the nearest Euclidean-distance neighbors. It uses a hierarchical navigable small-world graph, which stays fast with high-dimensional data, but may occasionally miss a true neighbor.");
+		UsageNode* pOpts = pHnsw->add("<options>");
+		UsageNode* pCC = pOpts->add("-cyclecut [thresh]", "Use CycleCut to break shortcuts and cycles.");
+		pCC->add("[thresh]=10", "The threshold cycle-length for bad cycles.");
+		pOpts->add("-m [value]=16", "The number of links each point makes in each layer of the graph.");
+		pOpts->add("-efconstruction [value]=200", "The width of the search used to link each point into the graph.");
+		pOpts->add("-efsearch [value]=64", "The width of the search used to find neighbors.");
+		pHnsw->add("[k]=12", "The number of neighbors.");
+	}
 	return pRoot;
 }
 
@@ -1416,8 +1442,8 @@ UsageNode* makeRecommendUsageTree()
 		UsageNode* pTransacc = pRoot->add("transacc <options> [train] [test] [collab-filter]", "Train using [train], then test using [test]. Prints MSE and MAE to stdout.");
 		UsageNode* pOpts = pTransacc->add("<options>");
 		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator.");
-		pTransacc->add("[train]=train.arff", "The filename of 3-column (user, item, rating) dataset with one row for each rating. Column 0 contains a user ID. Column 1 contains an item ID. Column 2 contains the known rating for that user-item pair.");
-		pTransacc->add("[test]=test.arff", "The filename of 3-column (user, item, rating) dataset with one row for each rating. Column 0 contains a user ID. Column 1 contains an item ID. Column 2 contains the known rating for that user-item pair.");
+		pTransacc->add("[train]=train.arff", "The filename of 3-column (user, item, rating) dataset with one row for each rating. Column 0 contains a user ID. Column 1 contains an item ID. Column 2 contains the known rating for that user-item pair. Files ending in .arff or .sparse are loaded as datasets. Any other file is read as plain text with one \"user item rating\" triple per line, separated by whitespace or commas, which is streamed directly into a compact rating store. Either way, the ratings are stored in single precision (about 7 significant digits), so algorithms that train on a full matrix see them rounded to float.");
+		pTransacc->add("[test]=test.arff", "The filename of 3-column (user, item, rating) dataset with one row for each rating, in any of the formats supported for [train].");
 	}
 	{
 		pRoot->add("usage", "Print usage information.");
@@ -1874,6 +1900,11 @@ UsageNode* makeTransformUsageTree()
 		pThresh->add("[column]=0", "The zero-indexed column number to threshold.");
 		pThresh->add("[threshold]=0.5", "The threshold value.");
 	}
+	{
+		UsageNode* pTB = pRoot->add("tobinary [dataset] [filename]", "Saves the dataset (including its meta-data) in a binary format that can be mapped into memory, so it loads almost instantly. Datasets with the .gmat extension are loaded this way by all of the tools. (Use export or any other command with a .gmat dataset to get text back out.)");
+		pTB->add("[dataset]=in.arff", "The filename of a dataset.");
+		pTB->add("[filename]=out.gmat", "The name of the binary file to write.");
+	}
 	{
 		pRoot->add("transpose [dataset]=m.arff", "Transpose the data such that columns become rows and rows become columns.");
 	}
@@ -69,6 +69,8 @@ void loadData(GMatrix& m, const char* szFilename)
 	GFile::parsePath(szFilename, &pd);
 	if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
 		m.loadArff(szFilename);
+	else if(_stricmp(szFilename + pd.extStart, ".gmat") == 0)
+		m.loadBinary(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".csv") == 0)
 	{
 		GCSVParser parser;
@@ -147,12 +149,19 @@ void kmeans(GArgReader& args)
 	// Parse Options
 	unsigned int nSeed = getpid() * (unsigned int)time(NULL);
 	size_t reps = 1;
+	size_t batchSize = 0;
+	size_t batchIters = 0;
 	while(args.size() > 0)
 	{
 		if(args.if_pop("-seed"))
 			nSeed = args.pop_uint();
 		else if(args.if_pop("-reps"))
 			reps = args.pop_uint();
+		else if(args.if_pop("-minibatch"))
+		{
+			batchSize = args.pop_uint();
+			batchIters = args.pop_uint();
+		}
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
@@ -161,6 +170,7 @@ void kmeans(GArgReader& args)
 	GRand prng(nSeed);
 	GKMeans clusterer(clusters, &prng);
 	clusterer.setReps(reps);
+	clusterer.setMiniBatch(batchSize, batchIters);
 	GMatrix* pOut = clusterer.reduce(data);
 	std::unique_ptr<GMatrix> hOut(pOut);
 	pOut->print(cout);
@@ -182,6 +182,8 @@ void loadDataWithSwitches(GMatrix& data, GArgReader& args, size_t& pLabelDims,
 	GFile::parsePath(szFilename, &pd);
 	if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
 		data.loadArff(szFilename);
+	else if(_stricmp(szFilename + pd.extStart, ".gmat") == 0)
+		data.loadBinary(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".csv") == 0)
 	{
 		GCSVParser parser;
@@ -271,6 +273,8 @@ GMatrix* loadData(const char* szFilename)
 	GFile::parsePath(szFilename, &pd);
 	if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
 		m.loadArff(szFilename);
+	else if(_stricmp(szFilename + pd.extStart, ".gmat") == 0)
+		m.loadBinary(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".csv") == 0)
 	{
 		GCSVParser parser;
@@ -336,10 +340,19 @@ GNeighborFinder* instantiateNeighborFinder(GMatrix* pData, size_t neighborCount,
 	{
 		// Parse the options
 		int cutCycleLen = 0;
+		size_t hnswM = 16;
+		size_t efConstruction = 200;
+		size_t efSearch = 64;
 		while(args.next_is_flag())
 		{
 			if(args.if_pop("-cyclecut"))
 				cutCycleLen = args.pop_uint();
+			else if(args.if_pop("-m"))
+				hnswM = args.pop_uint();
+			else if(args.if_pop("-efconstruction"))
+				efConstruction = args.pop_uint();
+			else if(args.if_pop("-efsearch"))
+				efSearch = args.pop_uint();
 			else
 				throw Ex("Invalid neighbor finder option: ", args.peek());
 		}
@@ -353,6 +366,12 @@ GNeighborFinder* instantiateNeighborFinder(GMatrix* pData, size_t neighborCount,
 		{
 			pNF = new GKdTree(pData, NULL, true);
 		}
+		else if(_stricmp(alg, "hnsw") == 0)
+		{
+			GHnswNeighborFinder* pHnsw = new GHnswNeighborFinder(pData, hnswM, efConstruction, NULL, true);
+			pHnsw->setEfSearch(efSearch);
+			pNF = pHnsw;
+		}
 		else
 			throw Ex("Unrecognized neighbor finding algorithm: ", alg);
 
@@ -513,12 +532,15 @@ void isomap(GArgReader& args)
 
 	// Parse Options
 	bool tolerant = false;
+	size_t landmarks = 0;
 	while(args.size() > 0)
 	{
 		if(args.if_pop("-seed"))
 			prng.setSeed(args.pop_uint());
 		else if(args.if_pop("-tolerant"))
 			tolerant = true;
+		else if(args.if_pop("-landmarks"))
+			landmarks = args.pop_uint();
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
@@ -526,6 +548,7 @@ void isomap(GArgReader& args)
 	// Transform the data
 	GIsomap transform(neighborCount, targetDims, &prng);
 	transform.setNeighborFinder(pNF);
+	transform.setLandmarks(landmarks);
 	if(tolerant)
 		transform.dropDisconnectedPoints();
 	GMatrix* pDataAfter = transform.reduce(*pData);
@@ -649,10 +672,16 @@ void principalComponentAnalysis(GArgReader& args)
 	string modelIn;
 	string modelOut;
 	bool aboutOrigin = false;
+	bool randomized = false;
+	bool krylov = false;
 	while(args.next_is_flag())
 	{
 		if(args.if_pop("-seed"))
 			seed = args.pop_uint();
+		else if(args.if_pop("-randomized"))
+			randomized = true;
+		else if(args.if_pop("-krylov"))
+			randomized = krylov = true;
 		else if(args.if_pop("-roundtrip"))
 			roundTrip = args.pop_string();
 		else if(args.if_pop("-eigenvalues"))
@@ -674,20 +703,22 @@ void principalComponentAnalysis(GArgReader& args)
 	if(modelIn.length() > 0)
 	{
 		GDom doc;
-		doc.loadJson(modelIn.c_str());
+		doc.load(modelIn.c_str());
 		pTransform = new GPCA(doc.root());
 	}
 	else
 	{
 		pTransform = new GPCA(nTargetDims);
+		pTransform->rand().setSeed(seed);
 		if(aboutOrigin)
 			pTransform->aboutOrigin();
+		if(randomized)
+			pTransform->useRandomizedSVD(krylov);
 		if(eigenvalues.length() > 0)
 			pTransform->computeEigVals();
 		pTransform->train(*pData);
 	}
 	Holder<GPCA> hTransform(pTransform);
-	pTransform->rand().setSeed(seed);
 
 	GMatrix* pDataAfter = pTransform->transformBatch(*pData);
 	Holder<GMatrix> hDataAfter(pDataAfter);
@@ -886,7 +917,7 @@ void selfOrganizingMap(GArgReader& args){
   }else{
     //Create map from file
     GDom source;
-    source.loadJson(loadFrom.c_str());
+    source.load(loadFrom.c_str());
     som.reset(new GSelfOrganizingMap(source.root()));
     //Transform using the loaded network
     out.reset(som->transformBatch(*pData));
@@ -988,7 +1019,7 @@ void unsupervisedBackProp(GArgReader& args)
 		else if(args.if_pop("-modelin"))
 		{
 			GDom doc;
-			doc.loadJson(args.pop_string());
+			doc.load(args.pop_string());
 			pUBP = new GUnsupervisedBackProp(doc.root());
 			hUBP.reset(pUBP);
 		}
@@ -1154,7 +1154,7 @@ void semanticMap(GArgReader& args){
   }
   // Load the self organizing map
   GDom doc;
-  doc.loadJson(somFile.c_str());
+  doc.load(somFile.c_str());
   GSelfOrganizingMap som(doc.root());
   // Parse the options
   string outFilename="semantic_map.svg";
@@ -1713,7 +1713,7 @@ void printDecisionTree(GArgReader& args)
 	GDom doc;
 	if(args.size() < 1)
 		throw Ex("Model not specified.");
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	GLearnerLoader ll(true);
 	GSupervisedLearner* pModeler = ll.loadLearner(doc.root());
 	std::unique_ptr<GSupervisedLearner> hModeler(pModeler);
@@ -1745,7 +1745,7 @@ void printRandomForest(GArgReader& args)
 	GDom doc;
 	if(args.size() < 1)
 		throw Ex("Model not specified.");
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	GLearnerLoader ll(true);
 	GSupervisedLearner* pModeler = ll.loadLearner(doc.root());
 	std::unique_ptr<GSupervisedLearner> hModeler(pModeler);
@@ -218,12 +218,12 @@ void multiplyDense(GArgReader& args)
 	// Load the sparse matrix
 	if(args.size() < 1)
 		throw Ex("No dataset specified.");
-	GSparseMatrix* pA;
-	std::unique_ptr<GSparseMatrix> hA(nullptr);
+	GCompressedSparseMatrix* pA;
+	std::unique_ptr<GCompressedSparseMatrix> hA(nullptr);
 	{
 		GDom doc;
-		doc.loadJson(args.pop_string());
-		pA = new GSparseMatrix(doc.root());
+		doc.load(args.pop_string());
+		pA = new GCompressedSparseMatrix(doc.root());
 		hA.reset(pA);
 	}
 
@@ -241,7 +241,7 @@ void multiplyDense(GArgReader& args)
 			throw Ex("Invalid option: ", args.peek());
 	}
 
-	GMatrix* pResult = pA->multiply(&b, transpose);
+	GMatrix* pResult = pA->multiply(b, transpose);
 	std::unique_ptr<GMatrix> hResult(pResult);
 	pResult->print(cout);
 }
@@ -265,7 +265,7 @@ void train(GArgReader& args)
 	std::unique_ptr<GSparseMatrix> hSparseFeatures(nullptr);
 	{
 		GDom doc;
-		doc.loadJson(args.pop_string());
+		doc.load(args.pop_string());
 		pSparseFeatures = new GSparseMatrix(doc.root());
 		hSparseFeatures.reset(pSparseFeatures);
 	}
@@ -310,7 +310,7 @@ void predict(GArgReader& args)
 	GDom doc;
 	if(args.size() < 1)
 		throw Ex("Model not specified.");
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	GLearnerLoader ll(true);
 	GSupervisedLearner* pModeler = ll.loadLearner(doc.root());
 	std::unique_ptr<GSupervisedLearner> hModeler(pModeler);
@@ -323,7 +323,7 @@ void predict(GArgReader& args)
 	std::unique_ptr<GSparseMatrix> hData(nullptr);
 	{
 		GDom doc2;
-		doc2.loadJson(args.pop_string());
+		doc2.load(args.pop_string());
 		pData = new GSparseMatrix(doc2.root());
 		hData.reset(pData);
 	}
@@ -355,7 +355,7 @@ void test(GArgReader& args)
 	GDom doc;
 	if(args.size() < 1)
 		throw Ex("Model not specified.");
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	GLearnerLoader ll(true);
 	GSupervisedLearner* pModeler = ll.loadLearner(doc.root());
 	std::unique_ptr<GSupervisedLearner> hModeler(pModeler);
@@ -368,7 +368,7 @@ void test(GArgReader& args)
 	std::unique_ptr<GSparseMatrix> hData(nullptr);
 	{
 		GDom doc2;
-		doc2.loadJson(args.pop_string());
+		doc2.load(args.pop_string());
 		pData = new GSparseMatrix(doc2.root());
 		hData.reset(pData);
 	}
@@ -414,18 +414,18 @@ void transpose(GArgReader& args)
 	// Load the sparse matrix
 	if(args.size() < 1)
 		throw Ex("No dataset specified.");
-	GSparseMatrix* pA;
-	std::unique_ptr<GSparseMatrix> hA(nullptr);
+	GCompressedSparseMatrix* pA;
+	std::unique_ptr<GCompressedSparseMatrix> hA(nullptr);
 	{
 		GDom doc;
-		doc.loadJson(args.pop_string());
-		pA = new GSparseMatrix(doc.root());
+		doc.load(args.pop_string());
+		pA = new GCompressedSparseMatrix(doc.root());
 		hA.reset(pA);
 	}
 
 	// Transpose it
-	GSparseMatrix* pB = pA->transpose();
-	std::unique_ptr<GSparseMatrix> hB(pB);
+	GCompressedSparseMatrix* pB = pA->transpose();
+	std::unique_ptr<GCompressedSparseMatrix> hB(pB);
 
 	// Print it
 	{
@@ -589,9 +589,10 @@ void shuffle(GArgReader& args)
 {
 	// Load
 	GDom doc;
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	GSparseMatrix* pData = new GSparseMatrix(doc.root());
 	std::unique_ptr<GSparseMatrix> hData(pData);
+	doc.clear(); // the matrix holds its own copy, so free the parsed tree now
 
 	// Parse options
 	unsigned int nSeed = getpid() * (unsigned int)time(NULL);
@@ -632,9 +633,10 @@ void split(GArgReader& args)
 {
 	// Load
 	GDom doc;
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	GSparseMatrix* pData = new GSparseMatrix(doc.root());
 	std::unique_ptr<GSparseMatrix> hData(pData);
+	doc.clear(); // the matrix holds its own copy, so free the parsed tree now
 	size_t pats1 = args.pop_uint();
 	size_t pats2 = pData->rows() - pats1;
 	if(pats2 >= pData->rows())
@@ -657,9 +659,10 @@ void splitFold(GArgReader& args)
 {
 	// Load
 	GDom doc;
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	GSparseMatrix* pData = new GSparseMatrix(doc.root());
 	std::unique_ptr<GSparseMatrix> hData(pData);
+	doc.clear(); // the matrix holds its own copy, so free the parsed tree now
 	size_t fold = args.pop_uint();
 	size_t folds = args.pop_uint();
 	if(fold >= folds)
@@ -52,6 +52,7 @@
 #include "../GClasses/GHiddenMarkovModel.h"
 #include "../GClasses/GHillClimber.h"
 #include "../GClasses/GHtml.h"
+#include "../GClasses/GImage.h"
 #include "../GClasses/GKeyPair.h"
 #include "../GClasses/GKNN.h"
 #include "../GClasses/GLinear.h"
@@ -78,6 +79,7 @@
 #include "../GClasses/GTime.h"
 #include "../GClasses/GTransform.h"
 #include "../GClasses/GTree.h"
+#include "../GClasses/GTruncatedSVD.h"
 #include "../GClasses/GVec.h"
 #include "../GClasses/GReverseBits.h"
 
@@ -895,6 +897,7 @@ public:
 		runTest("GBallTree", GBallTree::test);
 		runTest("GBaselineLearner", GBaselineLearner::test);
 		runTest("GBaselineRecommender", GBaselineRecommender::test);
+		runTest("GBatchReader", GBatchReader::test);
 		runTest("GBayesianModelAveraging", GBayesianModelAveraging::test);
 		runTest("GBayesianModelCombination", GBayesianModelCombination::test);
 		runTest("GBayesNet", GBayesNet::test);
@@ -907,6 +910,9 @@ public:
 		runTest("GBrandesBetweenness", GBrandesBetweennessCentrality::test);
 		runTest("GBucket", GBucket::test);
 		runTest("GCategoricalSamplerBatch", GCategoricalSamplerBatch::test);
+		runTest("GColumnMatrix", GColumnMatrix::test);
+		runTest("GCompiledTrees", GCompiledTrees::test);
+		runTest("GCompressedSparseMatrix", GCompressedSparseMatrix::test);
 		runTest("GCompressor", GCompressor::test);
 		runTest("GCoordVectorIterator", GCoordVectorIterator::test);
 		runTest("GCrypto", GCrypto::test);
@@ -919,15 +925,20 @@ public:
 		runTest("GFloydWarshall", GFloydWarshall::test);
 		runTest("GFourier", GFourier::test);
 		runTest("GGaussianProcess", GGaussianProcess::test);
+		runTest("GGradBoost", GGradBoost::test);
 		runTest("GGraphCut", GGraphCut::test);
 		runTest("GHashTable", GHashTable::test);
 		runTest("GHiddenMarkovModel", GHiddenMarkovModel::test);
 		runTest("GHillClimber", GHillClimber::test);
+		runTest("GHnswNeighborFinder", GHnswNeighborFinder::test);
 		runTest("GHtmlDoc", GHtmlDoc::test);
+		runTest("GImage", GImage::test);
 		runTest("GIncrementalTransform", GIncrementalTransform::test);
 		runTest("GInstanceRecommender", GInstanceRecommender::test);
+		runTest("GIsomap", GIsomap::test);
 		runTest("GKdTree", GKdTree::test);
 		runTest("GKeyPair", GKeyPair::test);
+		runTest("GKMeans", GKMeans::test);
 		runTest("GKNN", GKNN::test);
 		runTest("GLinearDistribution", GLinearDistribution::test);
 		runTest("GLinearProgramming", GLinearProgramming::test);
@@ -952,6 +963,7 @@ public:
 		runTest("GRandomDirectionBinarySearch", GRandomDirectionBinarySearch::test);
 		runTest("GRandMersenneTwister", GRandMersenneTwister::test);
 		runTest("GRandomForest", GRandomForest::test);
+		runTest("GRatings", GRatings::test);
 		runTest("GRelation", GRelation::test);
 		runTest("GRelationalTable", GRelationalTable_test);
 		runTest("GResamplingAdaBoost", GResamplingAdaBoost::test);
@@ -966,6 +978,8 @@ public:
 		runTest("GSubImageFinder2", GSubImageFinder2::test);
 		runTest("GSupervisedLearner", GSupervisedLearner::test);
 		runTest("GTensor", GTensor::test);
+		runTest("GThreadPool", GThreadPool::test);
+		runTest("GTruncatedSVD", GTruncatedSVD::test);
 		runTest("GVec", GVec::test);
 
 		// Test whether we can find and execute the command-line tools
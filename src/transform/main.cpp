@@ -160,6 +160,8 @@ GMatrix* loadData(const char* szFilename)
 	Holder<GMatrix> hData(pData);
 	if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
 		pData->loadArff(szFilename);
+	else if(_stricmp(szFilename + pd.extStart, ".gmat") == 0)
+		pData->loadBinary(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".raw") == 0)
 		pData->loadRaw(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".csv") == 0)
@@ -1257,7 +1259,7 @@ void powerColumns(GArgReader& args)
 void prettify(GArgReader& args)
 {
 	GDom doc;
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	doc.writeJsonPretty(cout);
 }
 
@@ -2270,7 +2272,7 @@ void transition(GArgReader& args)
 void uglify(GArgReader& args)
 {
 	GDom doc;
-	doc.loadJson(args.pop_string());
+	doc.load(args.pop_string());
 	doc.writeJson(cout);
 }
 
@@ -2324,6 +2326,13 @@ void toraw(GArgReader& args)
 	pData->saveRaw(args.pop_string());
 }
 
+void toBinary(GArgReader& args)
+{
+	GMatrix* pData = loadData(args.pop_string());
+	Holder<GMatrix> hData(pData);
+	pData->saveBinary(args.pop_string());
+}
+
 void ShowUsage(const char* appName)
 {
 	cout << "Full Usage Information\n";
@@ -2457,6 +2466,7 @@ int main(int argc, char *argv[])
 		else if(args.if_pop("squaredDistance")) squaredDistance(args);
 		else if(args.if_pop("swapcolumns")) SwapAttributes(args);
 		else if(args.if_pop("threshold")) threshold(args);
+		else if(args.if_pop("tobinary")) toBinary(args);
 		else if(args.if_pop("toraw")) toraw(args);
 		else if(args.if_pop("transition")) transition(args);
 		else if(args.if_pop("transpose")) Transpose(args);